@@ -16,6 +16,8 @@ import h5py
 import numpy as np
 import pandas as pd
 import io
+import mmap
+import struct
 import sys
 import shutil
 import sched
@@ -249,6 +251,11 @@ def get_geant4_env(sim_params=None):
             env['G4PHYSICSLIST'] = str(sim_params['physics_list'])
         if 'optical_physics' in sim_params:
             env['G4OPTICALPHYSICS'] = 'true' if sim_params['optical_physics'] else 'false'
+        # airpet-sim caches built physics tables (~/.cache/airpet/physics by default)
+        if sim_params.get('physics_cache') is False:
+            env['AIRPET_PHYSICS_CACHE'] = 'off'
+        elif sim_params.get('physics_cache'):
+            env['AIRPET_PHYSICS_CACHE'] = str(sim_params['physics_cache'])
 
     # Also ensure the binary directory is in PATH
     bin_dir = os.path.join(conda_prefix, "bin")
@@ -263,6 +270,87 @@ def get_geant4_env(sim_params=None):
 GEANT4_APP_DIR = os.path.join(os.getcwd(), "geant4")
 GEANT4_BUILD_DIR = os.path.join(GEANT4_APP_DIR, "build")
 GEANT4_EXECUTABLE = os.path.join(GEANT4_BUILD_DIR, "airpet-sim")
+# Native listmode OSEM reconstruction; the Python MLEM is used without it.
+RECON_EXECUTABLE = os.path.join(GEANT4_BUILD_DIR, "airpet-recon")
+
+# Optional warm simulation server ("airpet-sim --serve <socket>"). When the
+# socket exists, jobs are sent to it instead of starting a new process.
+SIM_SERVER_SOCKET = os.environ.get("AIRPET_SIM_SOCKET", "")
+
+class SimServerJob:
+    """
+    A job running on the airpet-sim server. Mimics the parts of
+    subprocess.Popen used here (poll/terminate/wait), so stop_simulation and
+    cleanup_processes treat it like a process. messages() must be consumed
+    by another thread for wait() to return.
+    """
+    def __init__(self, socket_path, job_id, run_dir, sim_params=None, macro="run.mac"):
+        import socket
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(socket_path)
+        self.returncode = None
+        self.rejected = None  # the server's reason, if it cannot run the job
+        self.finished = threading.Event()
+        request_lines = [f"job {job_id}", f"dir {os.path.abspath(run_dir)}"]
+        request_lines += self.physics_lines(sim_params or {})
+        request_lines += [f"macro {macro}", "end", ""]
+        self.sock.sendall("\n".join(request_lines).encode())
+        self.reader = self.sock.makefile('r')
+
+    @staticmethod
+    def physics_lines(sim_params):
+        """
+        The settings get_geant4_env() passes to a new process. The server
+        rejects a job whose physics list or optical setting differ from its
+        own; the physics table cache is applied for the job.
+        """
+        lines = []
+        if 'physics_list' in sim_params:
+            lines.append(f"physics {sim_params['physics_list']}")
+        if 'optical_physics' in sim_params:
+            lines.append(f"optical {'true' if sim_params['optical_physics'] else 'false'}")
+        if sim_params.get('physics_cache') is False:
+            lines.append("physics_cache off")
+        elif sim_params.get('physics_cache'):
+            lines.append(f"physics_cache {sim_params['physics_cache']}")
+        return lines
+
+    def messages(self):
+        """Yields the server's JSON messages until the job has finished."""
+        try:
+            for line in self.reader:
+                try:
+                    message = json.loads(line)
+                except ValueError:
+                    continue
+                if message.get("type") == "finished":
+                    self.returncode = 0 if message.get("status") == "ok" else 1
+                    if message.get("status") == "rejected":
+                        self.rejected = message.get("message", "rejected")
+                    self.finished.set()
+                    yield message
+                    break
+                yield message
+        finally:
+            if self.returncode is None:
+                self.returncode = 1  # connection lost
+            self.sock.close()
+            self.finished.set()
+
+    def poll(self):
+        return self.returncode
+
+    def wait(self, timeout=None):
+        """Blocks until the server reports the job finished or aborted."""
+        if not self.finished.wait(timeout):
+            raise subprocess.TimeoutExpired("airpet-sim server job", timeout)
+        return self.returncode
+
+    def terminate(self):
+        try:
+            self.sock.sendall(b"abort\n")
+        except OSError:
+            pass
 
 # A dictionary to track running simulation processes
 SIMULATION_PROCESSES = {}
@@ -276,12 +364,21 @@ LOR_PROCESSING_LOCK = threading.Lock()
 
 # Ensure we terminate any running simulations when the Flask app exits
 def cleanup_processes():
+    # Waited for without the lock: the monitor threads take it to record the
+    # last messages of their jobs.
     with SIMULATION_LOCK:
-        for job_id, process in SIMULATION_PROCESSES.items():
-            if process.poll() is None: # Check if the process is still running
-                print(f"Terminating running simulation job {job_id}...")
-                process.terminate()
-                process.wait()
+        running = list(SIMULATION_PROCESSES.items())
+    for job_id, process in running:
+        if process.poll() is None: # Check if the process is still running
+            print(f"Terminating running simulation job {job_id}...")
+            process.terminate()
+            try:
+                process.wait(timeout=60)
+            except subprocess.TimeoutExpired:
+                print(f"Simulation job {job_id} did not stop within 60 s.")
+                if hasattr(process, 'kill'):
+                    process.kill()
+                    process.wait()
 
 atexit.register(cleanup_processes)
 
@@ -346,286 +443,110 @@ def run_simulation():
                     "stderr": []
                 }
 
-            try:
-                # --- SINGLE PROCESS MODE ---
-                if num_threads <= 1:
-                    command = [executable_path, "run.mac"]
-                    process = subprocess.Popen(
-                        command, cwd=run_dir,
-                        stdout=subprocess.PIPE, stderr=subprocess.PIPE,
-                        text=True, bufsize=1,
-                        env=get_geant4_env(sim_params)
-                    )
+            if SIM_SERVER_SOCKET and os.path.exists(SIM_SERVER_SOCKET):
+                # Warm server: no process startup, structured progress messages.
+                # A server with other physics rejects the job, which then runs
+                # in its own process below.
+                rejected = None
+                try:
+                    job = SimServerJob(SIM_SERVER_SOCKET, job_id, run_dir, sim_params)
                     with SIMULATION_LOCK:
-                         SIMULATION_PROCESSES[job_id] = process
-                    
-                    # Monitor
-                    if process.stdout:
-                        for line in iter(process.stdout.readline, ''):
-                            line = line.strip()
-                            if line:
-                                with SIMULATION_LOCK:
-                                    SIMULATION_STATUS[job_id]['stdout'].append(line)
-                                    if ">>> Event" in line and "starts" in line:
-                                        try:
-                                            # Using regex might be safer but split is okay
-                                            parts = line.split()
-                                            # format: ">>> Event N starts..."
-                                            if len(parts) > 2 and parts[2].isdigit():
-                                                SIMULATION_STATUS[job_id]['progress'] = int(parts[2]) + 1
-                                        except: pass
-                    
-                    stdout_remainder, stderr_output = process.communicate()
-                    if stderr_output:
-                         with SIMULATION_LOCK:
-                             SIMULATION_STATUS[job_id]['stderr'].append(stderr_output)
-                             
-                    final_return_code = process.returncode
-
-                # --- MULTI-PROCESS MODE ---
-                else:
-                    msg = f"Starting {num_threads} parallel processes for {total_events} events..."
+                        SIMULATION_PROCESSES[job_id] = job
+                        SIMULATION_STATUS[job_id]['stdout'].append(f"Job sent to simulation server {SIM_SERVER_SOCKET}.")
+                    for message in job.messages():
+                        if message.get("type") == "progress":
+                            with SIMULATION_LOCK:
+                                progress = min(int(message.get("events", 0)), total_events)
+                                if progress > SIMULATION_STATUS[job_id]['progress']:
+                                    SIMULATION_STATUS[job_id]['progress'] = progress
+                        elif message.get("type") in ("finished", "error"):
+                            with SIMULATION_LOCK:
+                                SIMULATION_STATUS[job_id]['stdout'].append(json.dumps(message))
+                    rejected = job.rejected
                     with SIMULATION_LOCK:
-                        SIMULATION_STATUS[job_id]['stdout'].append(msg)
-                    
-                    # 1. Prepare Macros
-                    base_macro_path = os.path.join(run_dir, "run.mac")
-                    with open(base_macro_path, 'r') as f:
-                        base_lines = f.readlines()
-                    
-                    # Filter out commands we will override
-                    filtered_lines = []
-                    for line in base_lines:
-                        s = line.strip()
-                        if s.startswith("/run/beamOn"): continue
-                        if s.startswith("/random/setSeeds"): continue
-                        if s.startswith("/analysis/setFileName"): continue
-                        if s.startswith("/run/numberOfThreads"): continue 
-                        if s.startswith("/g4pet/run/saveHits"): continue # We force true usually, but read params
-                        filtered_lines.append(line)
-                    
-                    # Base seeds
-                    seed1 = int(sim_params.get('seed1', 12345))
-                    seed2 = int(sim_params.get('seed2', 67890))
-                    
-                    events_per_thread = total_events // num_threads
-                    remainder = total_events % num_threads
-                    
-                    procs = []
-                    
-                    for i in range(num_threads):
-                        n_events = events_per_thread + (1 if i < remainder else 0)
-                        if n_events <= 0: continue
-                        
-                        macro_name = f"run_t{i}.mac"
-                        out_name = f"output_t{i}.hdf5"
-                        
-                        # Unique seeds
-                        s1 = seed1 + i*1000
-                        s2 = seed2 + i*1000
-                        
-                        # Write specific macro
-                        with open(os.path.join(run_dir, macro_name), 'w') as f:
-                            f.writelines(filtered_lines)
-                            f.write(f"\n/random/setSeeds {s1} {s2}")
-                            f.write(f"\n/analysis/setFileName {out_name}")
-                            f.write(f"\n/run/beamOn {n_events}\n")
-                        
-                        cmd = [executable_path, macro_name]
-                        p = subprocess.Popen(
-                            cmd, cwd=run_dir,
-                            stdout=subprocess.PIPE, stderr=subprocess.PIPE,
-                            text=True, bufsize=1,
-                            env=get_geant4_env(sim_params)
-                        )
-                        procs.append(p)
-                    
+                        if rejected:
+                            SIMULATION_STATUS[job_id]['stdout'].append(
+                                f"Simulation server cannot run this job ({rejected}); starting airpet-sim instead.")
+                        elif job.returncode == 0:
+                            SIMULATION_STATUS[job_id]['progress'] = total_events
+                            SIMULATION_STATUS[job_id]['status'] = 'Completed'
+                            LATEST_COMPLETED_JOB_ID = job_id
+                        else:
+                            SIMULATION_STATUS[job_id]['status'] = 'Error'
+                        SIMULATION_PROCESSES.pop(job_id, None)
+                except Exception as e:
+                    traceback.print_exc()
                     with SIMULATION_LOCK:
-                        SIMULATION_PROCESSES[job_id] = procs # Store list for parallel stop handling
+                        SIMULATION_STATUS[job_id]['status'] = 'Error'
+                        SIMULATION_STATUS[job_id]['stderr'].append(str(e))
+                        SIMULATION_PROCESSES.pop(job_id, None)
+                if not rejected:
+                    return
 
-                    # 2. Monitor Loop
-                    # We launch threads to continuously drain stdout/stderr of all processes
-                    # to prevent deadlocks and update progress.
-                    monitor_threads = []
-                    
-                    def stdout_reader(proc, idx):
-                        for line in iter(proc.stdout.readline, ''):
-                            line = line.strip()
-                            if not line: continue
-                            
-                            # Filter spammy lines
-                            if "Checking overlaps for volume" in line: continue
-                            
-                            # Log T0 fully, others only on error/warning
-                            is_interesting = (idx == 0) or ("error" in line.lower()) or ("warning" in line.lower()) or ("exception" in line.lower())
-                            
-                            if is_interesting:
-                                prefix = f"[T{idx}] "
-                                with SIMULATION_LOCK:
-                                    SIMULATION_STATUS[job_id]['stdout'].append(prefix + line)
-                                    
-                                    # Parse progress (T0 only) to avoid jitter
-                                    if idx == 0 and ">>> Event" in line and "starts" in line:
-                                        try:
-                                            # Example: ">>> Event 123 starts..."
-                                            parts = line.split()
-                                            if len(parts) > 2 and parts[2].isdigit():
-                                                local_ev = int(parts[2])
-                                                SIMULATION_STATUS[job_id]['progress'] = (local_ev + 1) * num_threads
-                                        except: pass
-                        proc.stdout.close()
-
-                    def stderr_reader(proc, idx):
-                        for line in iter(proc.stderr.readline, ''):
-                            line = line.strip()
-                            if line:
-                                with SIMULATION_LOCK:
-                                    SIMULATION_STATUS[job_id]['stderr'].append(f"[T{idx}] {line}")
-                        proc.stderr.close()
-
-                    for i, p in enumerate(procs):
-                        # Start stdout reader
-                        t_out = threading.Thread(target=stdout_reader, args=(p, i))
-                        t_out.start()
-                        monitor_threads.append(t_out)
-                        
-                        # Start stderr reader
-                        t_err = threading.Thread(target=stderr_reader, args=(p, i))
-                        t_err.start()
-                        monitor_threads.append(t_err)
-                    
-                    # Wait for all streaming to finish
-                    for t in monitor_threads:
-                        t.join()
-                    
-                    # Ensure all processes have exited and set return code
-                    final_return_code = 0
-                    for p in procs:
-                        p.wait()
-                        if p.returncode != 0:
-                            final_return_code = p.returncode
-                    
-                    # (The following code expects final_return_code and cleanup)
+            try:
+                # A single airpet-sim process is launched. For more than one
+                # thread it runs with the tasking run manager, so geometry and
+                # physics are built once and shared by all worker threads.
+                command = [executable_path]
+                if num_threads > 1:
+                    command += ["--run-manager", "tasking", "--threads", str(num_threads)]
+                    with SIMULATION_LOCK:
+                        SIMULATION_STATUS[job_id]['stdout'].append(
+                            f"Starting {num_threads} worker threads for {total_events} events...")
+                command.append("run.mac")
+
+                process = subprocess.Popen(
+                    command, cwd=run_dir,
+                    stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                    text=True, bufsize=1,
+                    env=get_geant4_env(sim_params)
+                )
+                with SIMULATION_LOCK:
+                     SIMULATION_PROCESSES[job_id] = process
+
+                # Drain stderr in a separate thread so a chatty stderr cannot
+                # block the process while we are reading stdout.
+                def stderr_reader(proc):
+                    for line in iter(proc.stderr.readline, ''):
+                        line = line.strip()
+                        if line:
+                            with SIMULATION_LOCK:
+                                SIMULATION_STATUS[job_id]['stderr'].append(line)
+                    proc.stderr.close()
+
+                t_err = threading.Thread(target=stderr_reader, args=(process,))
+                t_err.start()
+
+                # Monitor
+                if process.stdout:
+                    for line in iter(process.stdout.readline, ''):
+                        line = line.strip()
+                        if not line: continue
+
+                        # Filter spammy lines
+                        if "Checking overlaps for volume" in line: continue
 
-                    if final_return_code == 0:
-                         with SIMULATION_LOCK:
-                            SIMULATION_STATUS[job_id]['stdout'].append("Parallel tasks completed. Merging...")
-
-                # --- MERGE LOGIC ---
-                if final_return_code == 0:
-                    import glob
-                    import shutil
-                    print(f"[Merge] Searching for output files in {run_dir}...")
-                    # Look for separate files and sort humerically to ensure correct EventID order
-                    t_files = glob.glob(os.path.join(run_dir, "output_t*.hdf5"))
-                    if not t_files or len(t_files) == 0:
-                         t_files = glob.glob(os.path.join(run_dir, "run_t*.hdf5"))
-
-                    if t_files:
-                        print(f"[Merge] Found {len(t_files)} fragments. Starting merge...")
-                        try:
-                            t_files.sort(key=lambda x: int(os.path.basename(x).split('_t')[1].split('.')[0]))
-                        except:
-                            t_files.sort()
-                        
-                        target_path = os.path.join(run_dir, "output.hdf5")
-                        shutil.copyfile(t_files[0], target_path)
-                        print(f"[Merge] Initialized target file from {t_files[0]}")
-
-                        # Robust Iterative Merge Logic (Matches repair_full_merge.py)
-                        # 1. Clean T0 (Base)
-                        try:
-                            with h5py.File(target_path, 'r+') as f:
-                                if 'default_ntuples/Hits' in f:
-                                    hits = f['default_ntuples/Hits']
-                                    
-                                    # Detect limit
-                                    lim_t0 = 0
-                                    if 'EventID' in hits and 'pages' in hits['EventID']:
-                                        ev = hits['EventID']['pages'][:]
-                                        nz = np.nonzero(ev)[0]
-                                        lim_t0 = nz[-1] + 1 if len(nz) > 0 else 0
-                                    
-                                    # Clean T0 Columns
-                                    for c in hits:
-                                        if isinstance(hits[c], h5py.Group) and 'pages' in hits[c]:
-                                            dset = hits[c]['pages']
-                                            data = dset[:lim_t0]
-                                            attrs = dict(dset.attrs)
-                                            del hits[c]['pages']
-                                            # Create Chunked + Compressed
-                                            dn = hits[c].create_dataset('pages', data=data, maxshape=(None,)+data.shape[1:], chunks=True, compression="gzip")
-                                            for k,v in attrs.items(): dn.attrs[k] = v
-                                    print(f"T0 Initialized: {lim_t0} rows (Compressed)")
-                        except Exception as e:
-                            print(f"T0 Clean Error: {e}")
-
-                        # 2. Append T1..TN
-                        evt_per_thread = total_events // num_threads
-                        
-                        try:
-                            with h5py.File(target_path, 'r+') as f_dst:
-                                if 'default_ntuples/Hits' in f_dst:
-                                    grp_dst_hits = f_dst['default_ntuples/Hits']
-                                    
-                                    for src_path in t_files[1:]:
-                                        fname = os.path.basename(src_path)
-                                        current_offset = 0
-                                        try:
-                                            t_idx = int(fname.split('_t')[1].split('.')[0])
-                                            current_offset = t_idx * evt_per_thread
-                                        except: pass
-                                        
-                                        with h5py.File(src_path, 'r') as f_src:
-                                            if 'default_ntuples/Hits' not in f_src: continue
-                                            grp_src_hits = f_src['default_ntuples/Hits']
-                                            
-                                            # Detect Source Limit
-                                            lim_src = 0
-                                            if 'EventID' in grp_src_hits:
-                                                 ev = grp_src_hits['EventID']['pages'][:]
-                                                 nz = np.nonzero(ev)[0]
-                                                 if len(nz)>0: lim_src = nz[-1]+1
-                                            
-                                            print(f"Merging {fname}: Limit={lim_src} Offset={current_offset}")
-
-                                            # Merge Columns Iteratively
-                                            for col in grp_dst_hits:
-                                                if col not in grp_src_hits: continue
-                                                
-                                                dst_node = grp_dst_hits[col]
-                                                src_node = grp_src_hits[col]
-                                                
-                                                # Handle Pages (Data)
-                                                if isinstance(dst_node, h5py.Group) and 'pages' in dst_node:
-                                                    dst_d = dst_node['pages']
-                                                    src_d = src_node['pages']
-                                                    
-                                                    # Read valid data
-                                                    data = src_d[:lim_src]
-                                                    
-                                                    # Apply Offset to EventID
-                                                    if col == "EventID":
-                                                        data = data.astype(np.int64)
-                                                        if current_offset > 0: data += current_offset
-                                                    
-                                                    # Write
-                                                    old_len = dst_d.shape[0]
-                                                    add_len = len(data)
-                                                    dst_d.resize((old_len+add_len,) + dst_d.shape[1:])
-                                                    dst_d[old_len:old_len+add_len] = data
-                                                
-                                                # Handle Metadata (entries)
-                                                elif isinstance(dst_node, h5py.Dataset) and col=='entries':
-                                                    dst_node[...] += src_node[...]
-                        except Exception as e:
-                             print(f"Merge Loop Error: {e}")
-                                                
                         with SIMULATION_LOCK:
-                            SIMULATION_STATUS[job_id]['stdout'].append("Merge finished.")
-                            # Cleanup (DISABLE FOR DEBUGGING)
-                            for f in t_files: os.remove(f)
+                            SIMULATION_STATUS[job_id]['stdout'].append(line)
+                            # Worker output is prefixed (e.g. "G4WT3 > >>> Event 12 starts"),
+                            # so locate the number after "Event" rather than a fixed column.
+                            # Workers run slightly out of order, so only move progress forward.
+                            if ">>> Event" in line and "starts" in line:
+                                try:
+                                    parts = line.split()
+                                    ev_idx = parts.index("Event") + 1
+                                    if ev_idx < len(parts) and parts[ev_idx].isdigit():
+                                        progress = min(int(parts[ev_idx]) + 1, total_events)
+                                        if progress > SIMULATION_STATUS[job_id]['progress']:
+                                            SIMULATION_STATUS[job_id]['progress'] = progress
+                                except: pass
+
+                process.wait()
+                t_err.join()
+                final_return_code = process.returncode
 
+                # In MT mode all worker threads append to the single output.hdf5
+                # written by airpet-sim, so there is nothing to merge here.
                 with SIMULATION_LOCK:
                     if final_return_code == 0:
                         SIMULATION_STATUS[job_id]['progress'] = total_events
@@ -703,6 +624,137 @@ def get_simulation_metadata(version_id, job_id):
     except Exception as e:
         return jsonify({"success": False, "error": str(e)}), 500
 
+# Layout of the live stream file written by airpet-sim (see AirPetLiveStream.hh)
+LIVE_STREAM_MAGIC = b'AIRPLIV1'
+LIVE_HEADER = struct.Struct('<8s8Id2q3QQqqqQQQ')
+LIVE_HEADER_FIELDS = (
+    'magic', 'version', 'header_size', 'state', 'num_channels', 'spectrum_bins',
+    'lor_capacity', 'lor_record_size', 'lor_every', 'spectrum_max_mev', 'run_id',
+    'total_events', 'channels_offset', 'spectrum_offset', 'lor_offset', 'sequence',
+    'events_done', 'hits', 'lors', 'update_time_ns', 'lor_claimed', 'lor_committed')
+LIVE_SEQUENCE_OFFSET = struct.calcsize('<8s8Id2q3Q')
+LIVE_COUNTERS = struct.Struct('<qqqQ')  # events_done, hits, lors, update_time_ns
+LIVE_LOR_DTYPE = np.dtype([
+    ('EventID', '<i4'), ('StartX', '<f4'), ('StartY', '<f4'), ('StartZ', '<f4'),
+    ('EndX', '<f4'), ('EndY', '<f4'), ('EndZ', '<f4'), ('Energy1', '<f4'),
+    ('Energy2', '<f4'), ('TOF', '<f4'), ('Weight', '<f4'), ('reserved', '<i4')])
+LIVE_STATES = {1: 'running', 2: 'finished'}
+
+def read_live_stream(path, since_lor=0, max_lors=5000):
+    """
+    Reads a consistent snapshot of a live stream file while airpet-sim may be
+    writing it. Nothing is locked: the histograms are retried while their
+    sequence number is odd or changes during the copy, and LORs the writer
+    may have overwritten meanwhile are dropped.
+
+    Returns the header fields, the hit counts per channel, the hit energy
+    spectrum and the newest sampled LORs (at most max_lors) from ring index
+    since_lor on; 'next_lor' is the since_lor of the next call.
+    """
+    with open(path, 'rb') as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as mm:
+        header = dict(zip(LIVE_HEADER_FIELDS, LIVE_HEADER.unpack_from(mm, 0)))
+        if header['magic'] != LIVE_STREAM_MAGIC or header['version'] != 1:
+            raise ValueError("Not an airpet-sim live stream file.")
+        if header['lor_record_size'] != LIVE_LOR_DTYPE.itemsize:
+            raise ValueError("Unsupported live stream LOR record size.")
+
+        for _ in range(100):
+            sequence = struct.unpack_from('<Q', mm, LIVE_SEQUENCE_OFFSET)[0]
+            if sequence & 1:
+                time.sleep(0.001)
+                continue
+            channels = np.frombuffer(mm, '<u8', header['num_channels'], header['channels_offset']).copy()
+            spectrum = np.frombuffer(mm, '<u8', header['spectrum_bins'], header['spectrum_offset']).copy()
+            counters = LIVE_COUNTERS.unpack_from(mm, LIVE_SEQUENCE_OFFSET + 8)
+            if struct.unpack_from('<Q', mm, LIVE_SEQUENCE_OFFSET)[0] == sequence:
+                break
+        else:
+            raise RuntimeError("Live stream is being updated; try again.")
+        header['events_done'], header['hits'], header['lors'], header['update_time_ns'] = counters
+
+        capacity = header['lor_capacity']
+        committed = struct.unpack_from('<Q', mm, LIVE_HEADER.size - 8)[0]
+        first = max(since_lor, committed - capacity, committed - max_lors, 0)
+        indices = np.arange(first, committed, dtype=np.int64)
+        ring = np.frombuffer(mm, LIVE_LOR_DTYPE, capacity, header['lor_offset'])
+        lors = ring[indices % capacity]  # a copy
+        del ring  # the mapping cannot close while a view exists
+        claimed = struct.unpack_from('<Q', mm, LIVE_HEADER.size - 16)[0]
+        lors = lors[indices + capacity >= claimed]
+        header['state'] = struct.unpack_from('<I', mm, 16)[0]
+
+    header.pop('magic')
+    header['state'] = LIVE_STATES.get(header['state'], 'unknown')
+    return {
+        "header": header,
+        "channel_hits": channels,
+        "spectrum": spectrum,
+        "lors": lors,
+        "next_lor": int(committed),
+    }
+
+@app.route('/api/simulation/live/<version_id>/<job_id>', methods=['GET'])
+def get_simulation_live(version_id, job_id):
+    """Live hit counts, energy spectrum and sampled LORs of a running job."""
+    pm = get_project_manager_for_session()
+    version_dir = pm._get_version_dir(version_id)
+    live_path = os.path.join(version_dir, "sim_runs", job_id, "live.bin")
+
+    if not os.path.exists(live_path):
+        return jsonify({"success": False, "error": "No live stream for this simulation run."}), 404
+
+    try:
+        since = request.args.get('since', 0, type=int)
+        max_lors = request.args.get('max_lors', 5000, type=int)
+        live = read_live_stream(live_path, since, max_lors)
+        header = live['header']
+
+        bin_width_kev = header['spectrum_max_mev'] * 1000.0 / max(header['spectrum_bins'], 1)
+        lors = live['lors']
+        return jsonify({"success": True, "live": {
+            "state": header['state'],
+            "run_id": header['run_id'],
+            "events_done": header['events_done'],
+            "total_events": header['total_events'],
+            "hits": header['hits'],
+            "lors": header['lors'],
+            "lor_every": header['lor_every'],
+            "update_time": header['update_time_ns'] / 1e9,
+            "channel_hits": live['channel_hits'].tolist(),
+            "spectrum": {
+                "bin_edges_kev": (np.arange(header['spectrum_bins'] + 1) * bin_width_kev).tolist(),
+                "counts": live['spectrum'].tolist(),
+            },
+            "sampled_lors": {name: lors[name].tolist() for name in LIVE_LOR_DTYPE.names if name != 'reserved'},
+            "next_lor": live['next_lor'],
+        }})
+    except Exception as e:
+        traceback.print_exc()
+        return jsonify({"success": False, "error": str(e)}), 500
+
+# Table numbers of the "Names" ntuple written by airpet-sim (see AirPetNameTable)
+NAME_TABLE_PARTICLE = 0
+NAME_TABLE_LOGICAL_VOLUME = 1
+NAME_TABLE_PHYSICAL_VOLUME = 2
+
+def read_name_table(h5file, table):
+    """Returns {id: name} for one table of the default_ntuples/Names ntuple."""
+    if 'default_ntuples/Names' not in h5file:
+        return {}
+    group = h5file['default_ntuples/Names']
+    n = None
+    if 'entries' in group:
+        ent = group['entries']
+        n = int(ent[()]) if ent.shape == () else int(ent[0])
+    tables = group['Table']['pages'][:n]
+    ids = group['ID']['pages'][:n]
+    names = group['Name']['pages'][:n]
+    result = {}
+    for t, i, name in zip(tables, ids, names):
+        if int(t) == table:
+            result[int(i)] = name.decode('utf-8') if isinstance(name, bytes) else str(name)
+    return result
+
 @app.route('/api/simulation/analysis/<version_id>/<job_id>', methods=['GET'])
 def get_simulation_analysis(version_id, job_id):
     pm = get_project_manager_for_session()
@@ -711,10 +763,6 @@ def get_simulation_analysis(version_id, job_id):
     output_path = os.path.join(run_dir, "output.hdf5")
 
     if not os.path.exists(output_path):
-        import glob
-        fragments = glob.glob(os.path.join(run_dir, "output_t*.hdf5"))
-        if fragments:
-             return jsonify({"success": False, "error": f"Found {len(fragments)} output fragments but the final merged file is missing. The simulation might still be merging or the merge failed."}), 404
         return jsonify({"success": False, "error": "Simulation output not found. This usually means the simulation completed but no hits were recorded. Ensure you have marked a volume as 'Sensitive' and that particles are actually hitting it."}), 404
 
     try:
@@ -725,12 +773,15 @@ def get_simulation_analysis(version_id, job_id):
         analysis_data = {}
 
         with h5py.File(output_path, 'r') as f:
-            # Check for Hits ntuple
-            if 'default_ntuples/Hits' not in f:
+            # Check for Hits ntuple (or the per-crystal sums written with
+            # /g4pet/run/hitsFormat summed, which have no positions or particles)
+            if 'default_ntuples/Hits' in f:
+                hits_group = f['default_ntuples/Hits']
+            elif 'default_ntuples/CrystalEdep' in f:
+                hits_group = f['default_ntuples/CrystalEdep']
+            else:
                  return jsonify({"success": False, "error": "Hits data not found in output file."}), 404
             
-            hits_group = f['default_ntuples/Hits']
-            
             # Determine number of valid entries
             num_entries = None
             if 'entries' in hits_group:
@@ -768,6 +819,12 @@ def get_simulation_analysis(version_id, job_id):
             pos_z = get_col('PosZ')
             copy_no = get_col('CopyNo')
             particle_name_ds = get_col('ParticleName')
+            if len(particle_name_ds) == 0:
+                # Newer outputs store an integer ParticleID plus a Names lookup table
+                particle_ids = get_col('ParticleID')
+                if len(particle_ids) > 0:
+                    particle_names = read_name_table(f, NAME_TABLE_PARTICLE)
+                    particle_name_ds = [particle_names.get(int(i), f"id{int(i)}") for i in particle_ids]
             
             # 1. Energy Spectrum
             if len(edep) > 0:
@@ -856,10 +913,6 @@ def download_simulation_data(version_id, job_id):
     try:
         # Return the file as an attachment
         if not os.path.exists(output_path):
-             import glob
-             fragments = glob.glob(os.path.join(run_dir, "output_t*.hdf5"))
-             if fragments:
-                  return jsonify({"success": False, "error": f"Found {len(fragments)} output fragments but the final merged file is missing."}), 404
              return jsonify({"success": False, "error": f"Simulation output file not found. Did the simulation produce any hits? (Check the 'Analysis' tab to see if hit count is zero)"}), 404
         
         filename = f"sim_{job_id[:8]}_output.hdf5"
@@ -867,6 +920,44 @@ def download_simulation_data(version_id, job_id):
     except Exception as e:
         return jsonify({"success": False, "error": str(e)}), 500
 
+# Binary track files written by airpet-sim (see geant4/include/AirPetTrackFile.hh)
+TRACK_DATA_FILE = "tracks.bin"
+TRACK_INDEX_FILE = "tracks.idx"
+TRACK_INDEX_DTYPE = np.dtype([('event_id', '<i8'), ('offset', '<u8'), ('size', '<u8')])
+
+def read_binary_tracks(tracks_dir, event_ids=None):
+    """
+    Returns the tracks of the given events (all if None) in the text format of
+    the old per-event track files. Events are located through the index, so
+    only the requested blocks are read.
+    """
+    index = np.fromfile(os.path.join(tracks_dir, TRACK_INDEX_FILE), dtype=TRACK_INDEX_DTYPE)
+    if event_ids is not None:
+        index = index[np.isin(index['event_id'], np.asarray(list(event_ids), dtype=np.int64))]
+    index = np.sort(index, order='event_id')
+    if len(index) == 0:
+        return ""
+
+    data = np.memmap(os.path.join(tracks_dir, TRACK_DATA_FILE), dtype=np.uint8, mode='r')
+    lines = []
+    for entry in index:
+        block = data[int(entry['offset']):int(entry['offset']) + int(entry['size'])]
+        event_id, n_tracks = np.frombuffer(block, dtype='<i4', count=2)
+        pos = 8
+        lines.append("# EventID ParticleName TrackID ParentID PDGCode")
+        for _ in range(n_tracks):
+            track_id, parent_id, pdg, name_len = np.frombuffer(block, dtype='<i4', count=4, offset=pos)
+            pos += 16
+            name = bytes(block[pos:pos + name_len]).decode('utf-8')
+            pos += name_len
+            n_points = int(np.frombuffer(block, dtype='<i4', count=1, offset=pos)[0])
+            pos += 4
+            points = np.frombuffer(block, dtype='<f4', count=3 * n_points, offset=pos).reshape(-1, 3)
+            pos += 12 * n_points
+            lines.append(f"T {event_id} {name} {track_id} {parent_id} {pdg}")
+            lines.extend(f"{x:g} {y:g} {z:g}" for x, y, z in points)
+    return "\n".join(lines) + "\n"
+
 @app.route('/api/simulation/tracks/<version_id>/<job_id>/<event_spec>', methods=['GET'])
 def get_simulation_tracks(version_id, job_id, event_spec):
     pm = get_project_manager_for_session()
@@ -877,31 +968,39 @@ def get_simulation_tracks(version_id, job_id, event_spec):
     if not os.path.isdir(tracks_dir):
         return jsonify({"success": False, "error": "Tracks directory not found for this run."}), 404
 
-    # --- Handle multiple event files ---
+    # --- Parse the event specification ---
+    event_ids = None  # None means all events
+    if event_spec.lower() != 'all':
+        if '-' in event_spec:
+            try:
+                start_str, end_str = event_spec.split('-', 1)
+                start = int(start_str)
+                end = int(end_str)
+
+                if start > end: # A small sanity check to allow users to enter ranges backwards
+                    start, end = end, start
+                event_ids = range(start, end + 1)
+            except ValueError:
+                return jsonify({"success": False, "error": "Invalid event range format. Use 'start-end' (e.g., '0-99')."}), 400
+        else:
+            try:
+                event_ids = [int(event_spec)]
+            except ValueError:
+                return jsonify({"success": False, "error": "Invalid event specification. Use a single number, a range 'start-end', or 'all'."}), 400
+
+    # --- Binary track file written by airpet-sim ---
+    if os.path.exists(os.path.join(tracks_dir, TRACK_INDEX_FILE)):
+        all_tracks_content = read_binary_tracks(tracks_dir, event_ids)
+        if not all_tracks_content:
+            return jsonify({"success": False, "error": "No tracks found for the specified events."}), 404
+        return Response(all_tracks_content, mimetype='text/plain')
+
+    # --- Legacy: one text file per event ---
     all_tracks_content = ""
-    track_files = []
-    
-    if event_spec.lower() == 'all':
+    if event_ids is None:
         track_files = sorted([f for f in os.listdir(tracks_dir) if f.endswith('_tracks.txt')])
-    elif '-' in event_spec:
-        try:
-            start_str, end_str = event_spec.split('-', 1)
-            start = int(start_str)
-            end = int(end_str)
-            
-            if start > end: # A small sanity check to allow users to enter ranges backwards
-                start, end = end, start
-
-            for i in range(start, end + 1):
-                track_files.append(f"event_{i:04d}_tracks.txt")
-        except ValueError:
-            return jsonify({"success": False, "error": "Invalid event range format. Use 'start-end' (e.g., '0-99')."}), 400
     else:
-        try:
-            event_id = int(event_spec)
-            track_files = [f"event_{event_id:04d}_tracks.txt"]
-        except ValueError:
-            return jsonify({"success": False, "error": "Invalid event specification. Use a single number, a range 'start-end', or 'all'."}), 400
+        track_files = [f"event_{i:04d}_tracks.txt" for i in event_ids]
 
     for filename in track_files:
         filepath = os.path.join(tracks_dir, filename)
@@ -1046,6 +1145,65 @@ def process_lors_route(version_id, job_id):
                 with LOR_PROCESSING_LOCK:
                     LOR_PROCESSING_STATUS[job_id] = {"status": "Reading HDF5...", "progress": 0, "total": 0}
 
+                # LORs already formed inside airpet-sim (/g4pet/digi/enable) only
+                # need to be copied out, if they were formed with the requested
+                # settings. Otherwise the stored hits are sorted again below; a
+                # run without hits keeps its own LORs and says so.
+                requested = {
+                    'coincidence_window_ns': coincidence_window_ns,
+                    'energy_cut': energy_cut,
+                    'energy_resolution': energy_resolution,
+                    'position_resolution_x': position_resolution.get('x', 0.0),
+                    'position_resolution_y': position_resolution.get('y', 0.0),
+                    'position_resolution_z': position_resolution.get('z', 0.0),
+                }
+                mismatch = None
+                with h5py.File(hdf5_path, 'r') as f:
+                    sim_lors = f['/default_ntuples/LORs'] if 'default_ntuples/LORs' in f else None
+                    if sim_lors is not None and int(sim_lors['entries'][()]) > 0:
+                        recorded = dict(f['digitizer'].attrs) if 'digitizer' in f else {}
+                        differing = [k for k, v in requested.items()
+                                     if k not in recorded or not np.isclose(float(recorded[k]), float(v))]
+                        if differing:
+                            mismatch = "LORs formed during the simulation use other settings (" + ", ".join(
+                                f"{k}: {float(recorded[k]):g}" if k in recorded else f"{k}: not recorded"
+                                for k in differing) + ")"
+                        has_hits = 'default_ntuples/Hits' in f and int(f['/default_ntuples/Hits']['entries'][()]) > 0
+                        if mismatch is None or not has_hits:
+                            col = lambda name: sim_lors[name]['pages'][:]
+                            final_starts = np.stack([col('StartX'), col('StartY'), col('StartZ')], axis=1).astype(np.float32)
+                            final_ends = np.stack([col('EndX'), col('EndY'), col('EndZ')], axis=1).astype(np.float32)
+                            tof_ns = col('TOF').astype(np.float32)
+                            weights = col('Weight').astype(np.float32) if 'Weight' in sim_lors else None
+                            settings = {k: float(recorded.get(k, 0.0)) for k in requested}
+                        else:
+                            final_starts = None
+                    else:
+                        final_starts = None
+
+                if final_starts is not None:
+                    extra = {'weights': weights} if weights is not None else {}
+                    np.savez_compressed(
+                        lors_output_path,
+                        start_coords=final_starts,
+                        end_coords=final_ends,
+                        tof_bins=np.zeros(len(final_starts), dtype=int),
+                        tof_ns=tof_ns,
+                        energy_cut=settings['energy_cut'],
+                        energy_resolution=settings['energy_resolution'],
+                        position_resolution={axis: settings[f'position_resolution_{axis}'] for axis in 'xyz'},
+                        **extra
+                    )
+                    message = f"Loaded {len(final_starts)} LORs formed during the simulation."
+                    if mismatch:
+                        message += f" {mismatch}; the run stored no hits to sort again."
+                    with LOR_PROCESSING_LOCK:
+                        LOR_PROCESSING_STATUS[job_id] = {"status": "Completed", "message": message}
+                    return
+                if mismatch:
+                    with LOR_PROCESSING_LOCK:
+                        LOR_PROCESSING_STATUS[job_id]["status"] = f"{mismatch}; sorting the stored hits again..."
+
                 # CHUNKED PROCESSING WITH INCREMENTAL WRITE TO PREVENT OOM
                 # Process in chunks and write valid LORs immediately to a temp HDF5
                 CHUNK_SIZE = 50000000 
@@ -1215,6 +1373,8 @@ def process_lors_route(version_id, job_id):
                         os.remove(temp_h5_path)
                     
                     msg = f"Processed {total_lors_found} LORs from {total_unique_events} events."
+                    if mismatch:
+                        msg += f" {mismatch}, so the stored hits were sorted again."
                 else:
                     if os.path.exists(temp_h5_path):
                         os.remove(temp_h5_path)
@@ -1248,6 +1408,8 @@ def run_reconstruction_route(version_id, job_id):
 
     data = request.get_json()
     iterations = data.get('iterations', 1)
+    subsets = int(data.get('subsets', 1))
+    engine = data.get('engine', 'auto') # 'auto' (native if built), 'native' or 'python'
     # Get image geometry parameters from the request
     img_shape = tuple(data.get('image_size', [128, 128, 128]))
     voxel_size = tuple(data.get('voxel_size', [2.0, 2.0, 2.0]))
@@ -1288,6 +1450,11 @@ def run_reconstruction_route(version_id, job_id):
             else:
                 position_resolution = pr.tolist()
 
+        if engine == 'native' or (engine == 'auto' and os.path.exists(RECON_EXECUTABLE)):
+            return run_native_reconstruction(pm, run_dir, lor_data, img_shape, voxel_size, image_origin,
+                                             iterations, subsets, normalization, ac_enabled, ac_shape, ac_mu,
+                                             ac_radius, ac_length)
+
         # Use parallelproj with numpy backend for this example
         import array_api_compat.numpy as xp
         import parallelproj
@@ -1369,7 +1536,8 @@ def run_reconstruction_route(version_id, job_id):
                 
                 # Call helper
                 path, sens_cpu = compute_and_save_sensitivity(pm, run_dir, lor_data, img_shape, voxel_size, image_origin,
-                                             ac_enabled, ac_shape, ac_input)
+                                             ac_enabled, ac_shape, ac_input,
+                                             ac_radius=ac_radius, ac_length=ac_length)
                 sensitivity_image = xp.asarray(sens_cpu, device=dev)
         
         if normalization and sensitivity_image is not None:
@@ -1450,14 +1618,138 @@ def run_reconstruction_route(version_id, job_id):
         traceback.print_exc()
         return jsonify({"success": False, "error": f"Reconstruction failed: {str(e)}"}), 500
 
+def run_native_reconstruction(pm, run_dir, lor_data, img_shape, voxel_size, image_origin,
+                              iterations, subsets, normalization, ac_enabled, ac_shape, ac_mu,
+                              ac_radius=None, ac_length=None):
+    """
+    Runs listmode OSEM with airpet-recon (OpenMP, C++) and writes reconstruction.h5
+    in the same layout as the Python MLEM. The sensitivity image is loaded from
+    (or computed into) sensitivity.h5 exactly as for the Python path.
+    """
+    if not os.path.exists(RECON_EXECUTABLE):
+        return jsonify({"success": False, "error": "airpet-recon is not built."}), 500
+
+    recon_output_path = os.path.join(run_dir, "reconstruction.h5")
+    sens_file = os.path.join(run_dir, "sensitivity.h5")
+    cmd = [RECON_EXECUTABLE,
+           "--shape", *[str(int(n)) for n in img_shape],
+           "--voxel-size", *[str(float(v)) for v in voxel_size],
+           "--iterations", str(int(iterations)),
+           "--subsets", str(max(1, subsets)),
+           "--output", recon_output_path]
+
+    if normalization:
+        sens_ok = False
+        if os.path.exists(sens_file):
+            with h5py.File(sens_file, 'r') as f:
+                sens_ok = 'sensitivity' in f and f['sensitivity'].shape == tuple(img_shape)
+        if not sens_ok:
+            print("Sensitivity Matrix not found or invalid. Computing now...")
+            compute_and_save_sensitivity(pm, run_dir, lor_data, img_shape, voxel_size, image_origin,
+                                         ac_enabled, ac_shape, ac_mu,
+                                         ac_radius=ac_radius, ac_length=ac_length)
+        cmd += ["--sensitivity", sens_file]
+
+    # airpet-recon reads HDF5; the LORs are handed over as plain datasets.
+    lors_h5_path = os.path.join(run_dir, "lors_recon.h5")
+    with h5py.File(lors_h5_path, 'w') as f:
+        f.create_dataset("start_coords", data=np.asarray(lor_data['start_coords'], dtype=np.float32))
+        f.create_dataset("end_coords", data=np.asarray(lor_data['end_coords'], dtype=np.float32))
+        if 'weights' in lor_data:
+            f.create_dataset("weights", data=np.asarray(lor_data['weights'], dtype=np.float32))
+    cmd += ["--lors", lors_h5_path]
+
+    try:
+        print(f"Running {' '.join(cmd)}")
+        result = subprocess.run(cmd, capture_output=True, text=True)
+        print(result.stdout)
+        if result.returncode != 0:
+            return jsonify({"success": False, "error": f"airpet-recon failed: {result.stderr.strip()}"}), 500
+    finally:
+        os.remove(lors_h5_path)
+
+    with h5py.File(recon_output_path, 'a') as f:
+        dset = f['image']
+        if 'energy_cut' in lor_data:
+            dset.attrs['energy_cut'] = lor_data['energy_cut']
+        if 'energy_resolution' in lor_data:
+            dset.attrs['energy_resolution'] = lor_data['energy_resolution']
+        if 'position_resolution' in lor_data:
+            dset.attrs['position_resolution'] = str(lor_data['position_resolution'])
+        image_shape = dset.shape
+
+    return jsonify({
+        "success": True,
+        "message": "Reconstruction complete.",
+        "image_shape": image_shape
+    })
+
+def compute_geometry_sensitivity(run_dir, img_shape, voxel_size, ac_enabled, ac_mu, ac_radius, ac_length):
+    """
+    Computes the sensitivity image with airpet-sim from the real detector geometry
+    (/g4pet/sensitivity/compute: all crystal-pair LORs of the run's SD volumes).
+    The result is cached per project version and grid; airpet-sim only recomputes
+    it when the GDML, the SD volumes or the settings changed.
+    Returns (path, image) or None if this run cannot use it.
+    """
+    run_mac = os.path.join(run_dir, "run.mac")
+    if not os.path.exists(GEANT4_EXECUTABLE) or not os.path.exists(run_mac):
+        return None
+    if ac_enabled and (not isinstance(ac_mu, (float, int)) or not ac_radius or not ac_length):
+        return None # Only a uniform attenuation cylinder is supported there.
+
+    version_dir = os.path.dirname(os.path.dirname(os.path.normpath(run_dir)))
+    cache_dir = os.path.join(version_dir, "geometry_cache")
+    os.makedirs(cache_dir, exist_ok=True)
+    grid_name = "x".join(str(int(n)) for n in img_shape) + "_" + "x".join(f"{float(v):g}" for v in voxel_size)
+    cache_file = os.path.join(cache_dir, f"sensitivity_{grid_name}mm.h5")
+
+    # Same geometry and SD setup as the simulation, then the sweep.
+    with open(run_mac) as f:
+        macro = [line.strip() for line in f if line.startswith("/g4pet/detector/")]
+    macro.append("/run/initialize")
+    macro.append(f"/g4pet/sensitivity/shape {int(img_shape[0])} {int(img_shape[1])} {int(img_shape[2])}")
+    macro.append(f"/g4pet/sensitivity/voxelSize {voxel_size[0]} {voxel_size[1]} {voxel_size[2]} mm")
+    if ac_enabled:
+        macro.append(f"/g4pet/sensitivity/attenuationCylinder {ac_radius} {ac_length} {ac_mu}")
+    macro.append(f"/g4pet/sensitivity/compute {cache_file}")
+    macro_path = os.path.join(run_dir, "sensitivity.mac")
+    with open(macro_path, 'w') as f:
+        f.write("\n".join(macro) + "\n")
+
+    print(f"Computing geometry sensitivity with {GEANT4_EXECUTABLE}...")
+    result = subprocess.run([GEANT4_EXECUTABLE, "sensitivity.mac"], cwd=run_dir,
+                            capture_output=True, text=True, env=get_geant4_env())
+    if result.returncode != 0 or not os.path.exists(cache_file):
+        print(f"Geometry sensitivity failed, falling back to random LORs: {result.stderr[-2000:]}")
+        return None
+
+    sens_file = os.path.join(run_dir, "sensitivity.h5")
+    shutil.copyfile(cache_file, sens_file)
+    with h5py.File(sens_file, 'r') as f:
+        sens = f['sensitivity'][()]
+    print(f"Sensitivity matrix saved to {sens_file}")
+    return sens_file, sens
+
 def compute_and_save_sensitivity(pm, run_dir, lor_data, img_shape, voxel_size, image_origin, 
-                                 ac_enabled, ac_shape, ac_mu, num_random_lors=20000000):
+                                 ac_enabled, ac_shape, ac_mu, num_random_lors=20000000,
+                                 ac_radius=None, ac_length=None, method='auto'):
     """
     Helper function to compute sensitivity matrix and save to HDF5.
     Returns path to saved file and metadata.
+    With method 'auto' or 'geometry', the geometry-exact airpet-sim mode is tried
+    first; 'random' always uses random cylinder LORs.
     """
     import numpy as np
     import h5py
+
+    if method != 'random':
+        geometry_result = compute_geometry_sensitivity(run_dir, img_shape, voxel_size, ac_enabled,
+                                                       ac_mu, ac_radius, ac_length)
+        if geometry_result is not None:
+            return geometry_result
+        if method == 'geometry':
+            raise RuntimeError("Geometry-exact sensitivity is not available for this run.")
     try:
         import parallelproj
     except ImportError:
@@ -1669,8 +1961,11 @@ def compute_sensitivity_route():
     ac_mu = float(data.get('ac_mu', 0.096)) # Default water
     ac_radius = float(data.get('ac_radius', 0.0)) # If 0, use default heuristics
     if ac_radius == 0: ac_radius = fov/2 * 0.9
+    ac_length = float(data.get('ac_length', fov))
     
     ran_lors = int(data.get('num_random_lors', 20000000))
+    method = data.get('method', 'auto') # 'auto', 'geometry' or 'random'
+
     
     try:
         version_dir = pm._get_version_dir(version_id)
@@ -1685,7 +1980,8 @@ def compute_sensitivity_route():
         
         # Call the helper to compute and save sensitivity
         compute_and_save_sensitivity(pm, run_dir, lor_data, img_shape, voxel_size, image_origin,
-                                     ac_enabled, 'cylinder', ac_mu, num_random_lors=ran_lors)
+                                     ac_enabled, 'cylinder', ac_mu, num_random_lors=ran_lors,
+                                     ac_radius=ac_radius, ac_length=ac_length, method=method)
                                      
         return jsonify({"success": True, "message": "Sensitivity Matrix computed."})
         
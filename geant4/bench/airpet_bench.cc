@@ -0,0 +1,312 @@
+// airpet-bench: reproducible throughput benchmark for airpet-sim.
+//
+// Runs canned workloads (see the *.gdml / *.mac files next to this source)
+// with fixed event counts and seeds, once per requested thread count, and
+// reports events/s, hits/s, the peak resident memory and the output size
+// per event. Results are printed as a table and appended to
+// bench_results.csv in the work directory, so runs of different builds can
+// be compared.
+
+#include <hdf5.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef AIRPET_BENCH_DIR
+#define AIRPET_BENCH_DIR "."
+#endif
+
+namespace {
+
+struct BenchCase {
+  std::string name;
+  std::string description;
+  long events;
+  bool optical;
+};
+
+const std::vector<BenchCase> kCases = {
+    {"silicon", "10 MeV e- on a 1 mm silicon plate", 20000, false},
+    {"pet_ring", "511 keV gammas in a BGO ring", 20000, false},
+    {"optical", "511 keV gammas in LYSO with optical photons", 200, true},
+};
+
+struct Result {
+  std::string caseName;
+  int threads = 1;
+  long events = 0;
+  double seconds = 0.;
+  long long hits = 0;
+  long maxRssKB = 0;
+  long long outputBytes = 0;
+  int exitCode = 0;
+};
+
+void PrintUsage() {
+  std::cerr << "Usage: airpet-bench [options]\n"
+            << "  --sim PATH        airpet-sim executable (default: next to airpet-bench)\n"
+            << "  --cases LIST      comma-separated cases: silicon,pet_ring,optical (default: all)\n"
+            << "  --threads LIST    comma-separated thread counts (default: 1)\n"
+            << "  --events N        events per run (default: per case)\n"
+            << "  --crystals N      crystals in the generated PET ring (default: 4096)\n"
+            << "  --workdir DIR     where runs and bench_results.csv go (default: bench_runs)\n";
+}
+
+std::vector<std::string> Split(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+bool CopyFile(const std::string& from, const std::string& to) {
+  std::ifstream in(from, std::ios::binary);
+  std::ofstream out(to, std::ios::binary);
+  if (!in || !out) return false;
+  out << in.rdbuf();
+  return true;
+}
+
+// The ring is generated rather than shipped, so its size can be scaled:
+// BGO crystals of 4.5 x 4.5 x 20 mm, 8 axial rings, on a circle sized so
+// neighbouring crystals do not touch.
+bool WritePetRing(const std::string& path, int crystals) {
+  const int rings = 8;
+  const int perRing = std::max(1, crystals / rings);
+  const double pitch = 5.0;  // mm, tangential and axial
+  const double radius = std::max(100.0, perRing * pitch / (2. * M_PI));
+  const double worldHalf = radius + 100.;
+
+  std::ofstream out(path);
+  if (!out) return false;
+  out << std::setprecision(9);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<!-- airpet-bench: PET ring with " << perRing * rings << " crystals -->\n"
+      << "<gdml>\n  <define/>\n  <materials/>\n  <solids>\n"
+      << "    <box name=\"world_solid\" x=\"" << 2 * worldHalf << "\" y=\"" << 2 * worldHalf
+      << "\" z=\"" << 2 * worldHalf << "\" lunit=\"mm\"/>\n"
+      << "    <box name=\"crystal_solid\" x=\"20\" y=\"4.5\" z=\"4.5\" lunit=\"mm\"/>\n"
+      << "  </solids>\n  <structure>\n"
+      << "    <volume name=\"Crystal_LV\">\n      <materialref ref=\"G4_BGO\"/>\n"
+      << "      <solidref ref=\"crystal_solid\"/>\n    </volume>\n"
+      << "    <volume name=\"World\">\n      <materialref ref=\"G4_AIR\"/>\n"
+      << "      <solidref ref=\"world_solid\"/>\n";
+  int copyNo = 0;
+  for (int ring = 0; ring < rings; ++ring) {
+    const double z = (ring - 0.5 * (rings - 1)) * pitch;
+    for (int i = 0; i < perRing; ++i, ++copyNo) {
+      const double phi = 2. * M_PI * i / perRing;
+      const double r = radius + 10.;  // crystal centre
+      // GDML rotations are passive, hence -phi.
+      out << "      <physvol name=\"crystal_" << copyNo << "\" copynumber=\"" << copyNo << "\">\n"
+          << "        <volumeref ref=\"Crystal_LV\"/>\n"
+          << "        <position name=\"crystal_" << copyNo << "_pos\" x=\"" << r * std::cos(phi)
+          << "\" y=\"" << r * std::sin(phi) << "\" z=\"" << z << "\" unit=\"mm\"/>\n"
+          << "        <rotation name=\"crystal_" << copyNo << "_rot\" z=\"" << -phi
+          << "\" unit=\"rad\"/>\n"
+          << "      </physvol>\n";
+    }
+  }
+  out << "    </volume>\n  </structure>\n"
+      << "  <setup name=\"Default\" version=\"1.0\">\n    <world ref=\"World\"/>\n  </setup>\n"
+      << "</gdml>\n";
+  return true;
+}
+
+long long FileSize(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? static_cast<long long>(info.st_size) : 0;
+}
+
+long long ReadHitEntries(const std::string& path) {
+  long long entries = 0;
+  H5E_BEGIN_TRY {
+    hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file >= 0) {
+      hid_t dataset = H5Dopen2(file, "/default_ntuples/Hits/entries", H5P_DEFAULT);
+      if (dataset >= 0) {
+        H5Dread(dataset, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &entries);
+        H5Dclose(dataset);
+      }
+      H5Fclose(file);
+    }
+  } H5E_END_TRY;
+  return entries;
+}
+
+// Event loop time from the "--> Run N finished: E events in S s" line.
+double ParseRunSeconds(const std::string& logPath) {
+  std::ifstream log(logPath);
+  std::string line;
+  double seconds = 0.;
+  while (std::getline(log, line)) {
+    auto pos = line.find(" events in ");
+    if (line.find("--> Run ") != std::string::npos && pos != std::string::npos) {
+      seconds = std::atof(line.c_str() + pos + std::strlen(" events in "));
+    }
+  }
+  return seconds;
+}
+
+Result RunCase(const std::string& sim, const std::string& workdir, const BenchCase& bench,
+               int threads, long events, int crystals) {
+  Result result;
+  result.caseName = bench.name;
+  result.threads = threads;
+  result.events = events;
+
+  const std::string runDir = workdir + "/" + bench.name + "_t" + std::to_string(threads);
+  mkdir(runDir.c_str(), 0755);
+
+  const std::string benchDir = AIRPET_BENCH_DIR;
+  CopyFile(benchDir + "/" + bench.name + ".mac", runDir + "/" + bench.name + ".mac");
+  if (bench.name == "pet_ring") {
+    WritePetRing(runDir + "/pet_ring.gdml", crystals);
+  } else {
+    CopyFile(benchDir + "/" + bench.name + ".gdml", runDir + "/" + bench.name + ".gdml");
+  }
+  {
+    std::ofstream macro(runDir + "/run.mac");
+    macro << "/control/execute " << bench.name << ".mac\n"
+          << "/run/beamOn " << events << "\n";
+  }
+  std::remove((runDir + "/output.hdf5").c_str());
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (chdir(runDir.c_str()) != 0) _exit(127);
+    int log = open("airpet-sim.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(log, STDOUT_FILENO);
+    dup2(log, STDERR_FILENO);
+    if (bench.optical) setenv("G4OPTICALPHYSICS", "on", 1);
+    const std::string threadArg = std::to_string(threads);
+    if (threads > 1) {
+      execl(sim.c_str(), sim.c_str(), "--run-manager", "tasking", "--threads",
+            threadArg.c_str(), "run.mac", static_cast<char*>(nullptr));
+    } else {
+      execl(sim.c_str(), sim.c_str(), "--run-manager", "serial", "run.mac",
+            static_cast<char*>(nullptr));
+    }
+    _exit(127);
+  }
+
+  int status = 0;
+  struct rusage usage;
+  std::memset(&usage, 0, sizeof(usage));
+  wait4(pid, &status, 0, &usage);
+  result.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  result.maxRssKB = usage.ru_maxrss;
+  result.seconds = ParseRunSeconds(runDir + "/airpet-sim.log");
+  result.hits = ReadHitEntries(runDir + "/output.hdf5");
+  result.outputBytes = FileSize(runDir + "/output.hdf5");
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string sim;
+  std::string workdir = "bench_runs";
+  std::vector<std::string> caseNames;
+  std::vector<int> threadCounts = {1};
+  long events = 0;
+  int crystals = 4096;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--sim" && hasValue) {
+      sim = argv[++i];
+    } else if (arg == "--cases" && hasValue) {
+      caseNames = Split(argv[++i]);
+    } else if (arg == "--threads" && hasValue) {
+      threadCounts.clear();
+      for (const auto& item : Split(argv[++i])) threadCounts.push_back(std::max(1, std::atoi(item.c_str())));
+    } else if (arg == "--events" && hasValue) {
+      events = std::atol(argv[++i]);
+    } else if (arg == "--crystals" && hasValue) {
+      crystals = std::atoi(argv[++i]);
+    } else if (arg == "--workdir" && hasValue) {
+      workdir = argv[++i];
+    } else {
+      PrintUsage();
+      return arg == "-h" || arg == "--help" ? 0 : 1;
+    }
+  }
+
+  if (sim.empty()) {
+    // Default: the airpet-sim built next to this executable.
+    std::string self = argv[0];
+    auto slash = self.rfind('/');
+    sim = (slash == std::string::npos ? std::string(".") : self.substr(0, slash)) + "/airpet-sim";
+  }
+  char resolved[4096];
+  if (realpath(sim.c_str(), resolved)) sim = resolved;
+  mkdir(workdir.c_str(), 0755);
+
+  std::vector<BenchCase> cases;
+  for (const auto& bench : kCases) {
+    bool selected = caseNames.empty();
+    for (const auto& name : caseNames) selected = selected || name == bench.name;
+    if (selected) cases.push_back(bench);
+  }
+  if (cases.empty()) {
+    std::cerr << "No known case selected.\n";
+    PrintUsage();
+    return 1;
+  }
+
+  const std::string csvPath = workdir + "/bench_results.csv";
+  const bool newCsv = FileSize(csvPath) == 0;
+  std::ofstream csv(csvPath, std::ios::app);
+  if (newCsv) {
+    csv << "case,threads,events,seconds,events_per_s,hits,hits_per_s,max_rss_mb,bytes_per_event,exit_code\n";
+  }
+
+  std::cout << std::left << std::setw(10) << "case" << std::right << std::setw(8) << "threads"
+            << std::setw(10) << "events" << std::setw(10) << "seconds" << std::setw(12) << "events/s"
+            << std::setw(14) << "hits/s" << std::setw(10) << "RSS MB" << std::setw(12) << "bytes/evt"
+            << "\n";
+
+  int failures = 0;
+  for (const auto& bench : cases) {
+    for (int threads : threadCounts) {
+      const long n = events > 0 ? events : bench.events;
+      const Result r = RunCase(sim, workdir, bench, threads, n, crystals);
+      const double eventsPerSecond = r.seconds > 0. ? r.events / r.seconds : 0.;
+      const double hitsPerSecond = r.seconds > 0. ? r.hits / r.seconds : 0.;
+      const double rssMB = r.maxRssKB / 1024.;
+      const double bytesPerEvent = r.events > 0 ? static_cast<double>(r.outputBytes) / r.events : 0.;
+      if (r.exitCode != 0 || r.seconds <= 0.) ++failures;
+
+      std::cout << std::left << std::setw(10) << r.caseName << std::right << std::setw(8) << r.threads
+                << std::setw(10) << r.events << std::fixed << std::setprecision(2)
+                << std::setw(10) << r.seconds << std::setw(12) << std::setprecision(1) << eventsPerSecond
+                << std::setw(14) << hitsPerSecond << std::setw(10) << rssMB
+                << std::setw(12) << bytesPerEvent << std::defaultfloat
+                << (r.exitCode != 0 ? "  (failed, see airpet-sim.log)" : "") << "\n";
+      csv << r.caseName << "," << r.threads << "," << r.events << "," << r.seconds << ","
+          << eventsPerSecond << "," << r.hits << "," << hitsPerSecond << "," << rssMB << ","
+          << bytesPerEvent << "," << r.exitCode << "\n";
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
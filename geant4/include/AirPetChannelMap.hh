@@ -0,0 +1,95 @@
+#ifndef AirPetChannelMap_h
+#define AirPetChannelMap_h 1
+
+#include "G4Threading.hh"
+#include "globals.hh"
+
+#include <array>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4VTouchable;
+
+/// Flat detector channel IDs for all sensitive volumes.
+///
+/// Built once per thread in DetectorConstruction::ConstructSDandField by
+/// walking the placed-volume tree from the world. Every placement path that
+/// ends in a volume with a sensitive detector gets a channel ID, numbered
+/// 0..N-1 in tree order, so all threads agree on the numbering. The key is
+/// the physical volume plus copy number at each depth of the touchable (up
+/// to kMaxDepth levels below the world), which keeps crystals of different
+/// modules apart even when they share a logical volume and copy number.
+///
+/// A lookup reads the touchable's volumes and copy numbers and does one
+/// hash-map probe; the per-channel volume name IDs are precomputed, so the
+/// sensitive detector does no name lookups per step.
+
+class AirPetChannelMap
+{
+public:
+  static constexpr G4int kMaxDepth = 8;
+
+  struct Channel {
+    const G4VPhysicalVolume* volume;
+    G4int copyNo;
+    G4int physicalVolumeID;  // AirPetNameTable IDs
+    G4int logicalVolumeID;
+  };
+
+  // Map of the calling thread.
+  static AirPetChannelMap* Instance();
+
+  // Rebuilds the map from the world volume; sensitive logical volumes are
+  // those with a sensitive detector attached on this thread.
+  void Build(const G4VPhysicalVolume* world);
+  void Clear();
+
+  // Channel ID of the volume at depth 0 of the touchable, or -1.
+  G4int GetChannelID(const G4VTouchable* touchable) const;
+
+  const Channel& GetChannel(G4int channelID) const { return fChannels[channelID]; }
+  size_t GetNumberOfChannels() const { return fChannels.size(); }
+
+  // Placement path of a channel, e.g. "crystal_PV:3/module_PV:12" (not for
+  // the hot path).
+  G4String GetPath(G4int channelID) const;
+
+private:
+  AirPetChannelMap() = default;
+
+  // Volume and copy number per depth, depth 0 being the sensitive volume.
+  struct Key {
+    std::array<const G4VPhysicalVolume*, kMaxDepth> volumes{};
+    std::array<G4int, kMaxDepth> copies{};
+    G4int depth = 0;
+    bool operator==(const Key& other) const {
+      return depth == other.depth && volumes == other.volumes && copies == other.copies;
+    }
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const;
+  };
+
+  struct PathLevel {
+    const G4VPhysicalVolume* volume;
+    G4int copyNo;
+  };
+
+  void Walk(const G4LogicalVolume* mother, std::vector<PathLevel>& path);
+  G4bool ContainsSensitive(const G4LogicalVolume* volume);
+  void AddChannel(const std::vector<PathLevel>& path);
+
+  std::vector<Channel> fChannels;
+  std::vector<Key> fChannelKeys;
+  std::unordered_map<Key, G4int, KeyHash> fIndex;
+  std::unordered_map<const G4LogicalVolume*, G4bool> fContainsSensitive;
+  G4bool fTruncatedPaths = false;
+
+  static G4ThreadLocal AirPetChannelMap* fInstance;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef AirPetCheckpoint_h
+#define AirPetCheckpoint_h 1
+
+#include "G4Threading.hh"
+#include "globals.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <utility>
+#include <vector>
+
+class AirPetOutputFile;
+
+/// Checkpoints of a run for /g4pet/run/resume (airpet-sim --resume).
+///
+/// The master RunAction owns one per run. Every thread reports the global
+/// EventIDs whose rows it has just appended to the output file; an event
+/// counts as written only once all its rows are in the file. Every
+/// /g4pet/run/checkpointEvery events, the output file is flushed and
+/// <output>.checkpoint records, consistently with it:
+///
+///   airpet-checkpoint 1
+///   run_id <R>
+///   seed <S>
+///   first_event <F>
+///   end_event <E>
+///   complete 0|1
+///   written_prefix <P>      all events in [F, P) are written
+///   written <a> <b>         ranges [a, b) written beyond P, if any
+///   ntuple <name> <rows>    row count of each ntuple at the checkpoint
+///   track_file <bytes> <events>  size of tracks.bin and tracks.idx entries
+///   end
+///
+/// It is written to a temporary file and renamed, so a killed job always
+/// leaves a complete checkpoint. Since the events are seeded from (seed,
+/// run ID, EventID) (see RunAction::SeedEvent), the seed is all the random
+/// engine state a resumed run needs.
+
+class AirPetCheckpoint
+{
+public:
+  struct State {
+    G4int runID = 0;
+    std::uint64_t seed = 0;
+    G4long firstEvent = 0;
+    G4long endEvent = 0;
+    G4bool complete = false;
+    G4long writtenPrefix = 0;
+    std::vector<std::pair<G4long, G4long>> writtenRanges;
+    std::vector<std::pair<G4String, size_t>> ntupleRows;
+    std::uint64_t trackFileSize = 0;
+    std::uint64_t trackFileEvents = 0;
+  };
+
+  static G4String FileName(const G4String& outputFileName) { return outputFileName + ".checkpoint"; }
+  static G4bool Read(const G4String& fileName, State& state);
+  static G4bool Write(const G4String& fileName, const State& state);
+
+  AirPetCheckpoint();
+
+  // Starts bookkeeping for a run over [state.firstEvent, state.endEvent);
+  // the events already written by a resumed run are taken from the state.
+  void Begin(const State& state, G4int eventsPerCheckpoint);
+  G4bool IsEnabled() const { return fEventsPerCheckpoint > 0; }
+
+  // Events written by the run this one resumes (read-only during the run).
+  G4bool WasWrittenBefore(G4int eventID) const { return fResumed.count(eventID) > 0; }
+
+  // Runs write (the output file append) and then marks the events written,
+  // both under the checkpoint lock, so that a checkpoint never sees one
+  // without the other.
+  void Append(const std::function<void()>& write, std::vector<G4int>& events);
+
+  // Called once per finished event; returns the checkpoint generation,
+  // which increases every eventsPerCheckpoint events. Threads flush their
+  // buffers and call Save when it changes.
+  G4int EventFinished();
+
+  // Flushes the file and writes the checkpoint of the current state.
+  void Save(AirPetOutputFile& outputFile, const G4String& fileName);
+  G4bool IsComplete() const;
+
+private:
+  State BuildState(AirPetOutputFile& outputFile) const;
+
+  State fBase;
+  G4int fEventsPerCheckpoint;
+  std::set<G4int> fResumed;
+  std::set<G4int> fWritten;   // beyond fPrefix
+  G4long fPrefix;
+  std::atomic<G4long> fFinished;
+  mutable G4Mutex fMutex;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef AirPetCrystalFastSim_h
+#define AirPetCrystalFastSim_h 1
+
+#include "G4EmCalculator.hh"
+#include "G4VFastSimulationModel.hh"
+#include "globals.hh"
+
+#include <set>
+
+class G4LogicalVolume;
+class G4Region;
+
+/// Local energy deposit of electrons in the SD crystals
+/// (/g4pet/detector/setFastSim).
+///
+/// Electrons in the given logical volumes are not transported: their whole
+/// kinetic energy is deposited where they are, in one step that the
+/// crystal's AirPetSensitiveDetector turns into (or adds to) the channel's
+/// hit as for a tracked electron. Gammas are still fully simulated, so the
+/// Compton and photoelectric interaction points, times and per-crystal
+/// energies keep their physics; only the electron range and its
+/// bremsstrahlung and fluorescence escapes are lost.
+///
+/// With contained-only (the default), an electron is only deposited if its
+/// range (from the restricted dE/dx tables, an upper bound of the CSDA
+/// range) is shorter than its distance to the crystal surface, so energy
+/// sharing between crystals is unchanged. An optional maximum energy leaves
+/// faster electrons to full tracking.
+///
+/// DetectorConstruction gives each SD volume (or the user region it is the
+/// root of) one instance per thread; G4FastSimulationPhysics, registered in
+/// main.cc, provides the process for e-.
+
+class AirPetCrystalFastSim : public G4VFastSimulationModel
+{
+public:
+  AirPetCrystalFastSim(const G4String& name, G4Region* envelope);
+  virtual ~AirPetCrystalFastSim() = default;
+
+  void SetVolumes(const std::set<const G4LogicalVolume*>& volumes) { fVolumes = volumes; }
+  void SetMaxEnergy(G4double energy) { fMaxEnergy = energy; }
+  void SetContainedOnly(G4bool containedOnly) { fContainedOnly = containedOnly; }
+
+  virtual G4bool IsApplicable(const G4ParticleDefinition& particle) override;
+  virtual G4bool ModelTrigger(const G4FastTrack& fastTrack) override;
+  virtual void DoIt(const G4FastTrack& fastTrack, G4FastStep& fastStep) override;
+
+private:
+  std::set<const G4LogicalVolume*> fVolumes;
+  G4double fMaxEnergy;     // 0: no limit
+  G4bool fContainedOnly;
+  G4EmCalculator fCalculator;
+};
+
+#endif
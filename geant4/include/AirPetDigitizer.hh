@@ -0,0 +1,77 @@
+#ifndef AirPetDigitizer_h
+#define AirPetDigitizer_h 1
+
+#include "AirPetHit.hh"
+#include "AirPetNtupleBuffer.hh"
+#include "G4ThreeVector.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+#include <vector>
+
+class AirPetOutputFile;
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithADouble;
+class G4UIcmdWithADoubleAndUnit;
+class G4UIcmdWith3VectorAndUnit;
+
+/// Optional in-simulation digitization and coincidence sorting.
+///
+/// At the end of each event the hits are smeared with the configured energy
+/// and position resolution, hits below the energy cut are dropped, and the
+/// two earliest remaining hits form a LOR if they lie within the coincidence
+/// window. This is the same rule the Python LOR pass applied to the stored
+/// hits. The LOR is appended to the "LORs" ntuple (start/end coordinates,
+/// energies and TOF = t2 - t1).
+///
+/// All settings come from the /g4pet/digi/ commands. They are written as
+/// attributes of /digitizer, so a reader can tell which settings formed the
+/// LORs of a file.
+
+class AirPetDigitizer : public G4UImessenger
+{
+public:
+  AirPetDigitizer();
+  virtual ~AirPetDigitizer();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+  G4bool IsEnabled() const { return fEnabled; }
+
+  // Column layout of the LORs ntuple.
+  static const std::vector<AirPetColumnSpec>& GetLORColumns();
+
+  // Digitizes the hits of one event; appends a row to the LOR buffer and
+  // returns true if a coincidence was found. The weight is the event's
+  // primary vertex weight (see AirPetAnnihilationSource).
+  G4bool ProcessEvent(G4int eventID, const std::vector<const AirPetHit*>& hits,
+                      G4double weight, AirPetNtupleBuffer& lors);
+
+  // Writes the settings (MeV, mm, ns) as attributes of /digitizer.
+  void WriteSettings(AirPetOutputFile& file) const;
+
+private:
+  struct Single {
+    G4double energy;
+    G4double time;
+    G4ThreeVector position;
+  };
+
+  G4bool fEnabled;
+  G4double fEnergyResolution;      // relative sigma
+  G4ThreeVector fPositionResolution; // sigma per axis
+  G4double fEnergyCut;
+  G4double fCoincidenceWindow;
+
+  // Reused between events.
+  std::vector<Single> fSingles;
+
+  G4UIdirectory*             fDigiDir;
+  G4UIcommand*               fEnableCmd;
+  G4UIcmdWithADouble*        fEnergyResolutionCmd;
+  G4UIcmdWith3VectorAndUnit* fPositionResolutionCmd;
+  G4UIcmdWithADoubleAndUnit* fEnergyCutCmd;
+  G4UIcmdWithADoubleAndUnit* fCoincidenceWindowCmd;
+};
+
+#endif
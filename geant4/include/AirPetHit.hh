@@ -6,11 +6,14 @@
 #include "G4Allocator.hh"
 #include "G4ThreeVector.hh"
 #include "G4String.hh"
+#include "AirPetNameTable.hh"
 
 /// Hit class for the AirPet sensitive detectors.
 ///
 /// It stores information about a particle step within a sensitive volume,
 /// including energy deposition, position, time, particle type, and volume info.
+/// Particle and volume names are stored as AirPetNameTable IDs, so creating
+/// a hit does no string allocation.
 
 class AirPetHit : public G4VHit
 {
@@ -35,10 +38,11 @@ class AirPetHit : public G4VHit
     void SetEdep(G4double edep)         { fEdep = edep; }
     void SetPosition(const G4ThreeVector& pos) { fPos = pos; }
     void SetTime(G4double time)         { fTime = time; }
-    void SetParticleName(const G4String& name) { fParticleName = name; }
-    void SetVolumeName(const G4String& name)   { fVolumeName = name; }
-    void SetPhysicalVolumeName(const G4String& name)   { fPhysicalVolumeName = name; }
+    void SetParticleID(G4int id)        { fParticleID = id; }
+    void SetVolumeID(G4int id)          { fVolumeID = id; }
+    void SetPhysicalVolumeID(G4int id)  { fPhysicalVolumeID = id; }
     void SetCopyNo(G4int copyNo)        { fCopyNo = copyNo; }
+    void SetChannelID(G4int id)         { fChannelID = id; }
     void AddEdep(G4double edep) { fEdep += edep; };
 
     // --- Getters ---
@@ -47,10 +51,17 @@ class AirPetHit : public G4VHit
     G4double GetEdep() const            { return fEdep; }
     G4ThreeVector GetPosition() const   { return fPos; }
     G4double GetTime() const            { return fTime; }
-    G4String GetParticleName() const    { return fParticleName; }
-    G4String GetVolumeName() const      { return fVolumeName; }
-    G4String GetPhysicalVolumeName() const { return fPhysicalVolumeName; }
+    G4int GetParticleID() const         { return fParticleID; }
+    G4int GetVolumeID() const           { return fVolumeID; }
+    G4int GetPhysicalVolumeID() const   { return fPhysicalVolumeID; }
+
+    // Name lookups through AirPetNameTable (not for the hot path)
+    G4String GetParticleName() const;
+    G4String GetVolumeName() const;
+    G4String GetPhysicalVolumeName() const;
     G4int GetCopyNo() const             { return fCopyNo; }
+    // Flat detector channel (AirPetChannelMap), or -1
+    G4int GetChannelID() const          { return fChannelID; }
 
   private:
     G4int         fTrackID;
@@ -58,10 +69,11 @@ class AirPetHit : public G4VHit
     G4double      fEdep;
     G4ThreeVector fPos;
     G4double      fTime;
-    G4String      fParticleName;
-    G4String      fVolumeName;
-    G4String      fPhysicalVolumeName;
+    G4int         fParticleID;
+    G4int         fVolumeID;
+    G4int         fPhysicalVolumeID;
     G4int         fCopyNo;
+    G4int         fChannelID;
 
     // Memory management
     static G4ThreadLocal G4Allocator<AirPetHit>* fAllocator;
@@ -0,0 +1,92 @@
+#ifndef AirPetJosephProjector_h
+#define AirPetJosephProjector_h 1
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/// Joseph line-integral projector on a regular image grid.
+///
+/// Shared by airpet-recon and the sensitivity mode of airpet-sim, so both
+/// agree with each other and with parallelproj (used by the Python path):
+/// the image is C-ordered [x][y][z], the origin is the centre of voxel
+/// (0, 0, 0), and a LOR is sampled once per voxel layer along its main axis
+/// with bilinear interpolation in the other two, scaled to mm.
+///
+/// No Geant4 types are used, so airpet-recon builds without Geant4.
+
+struct AirPetImageGrid
+{
+  int n[3];
+  float voxel[3];
+  float origin[3];
+
+  std::size_t voxels() const { return static_cast<std::size_t>(n[0]) * n[1] * n[2]; }
+
+  // Grid of the given size centred on the world origin, as in the Python
+  // reconstruction.
+  static AirPetImageGrid Centred(const int shape[3], const double voxelSize[3])
+  {
+    AirPetImageGrid grid;
+    for (int k = 0; k < 3; ++k) {
+      grid.n[k] = shape[k];
+      grid.voxel[k] = static_cast<float>(voxelSize[k]);
+      grid.origin[k] = -(0.5f * grid.n[k] - 0.5f) * grid.voxel[k];
+    }
+    return grid;
+  }
+};
+
+// Calls visit(voxelIndex, weight) for the interpolation weights of the LOR
+// from p0 to p1 (only the planes between the two end points).
+template <typename Visit>
+inline void AirPetTraceLOR(const AirPetImageGrid& grid, const float p0[3], const float p1[3], Visit&& visit)
+{
+  const float d[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+  const float ad[3] = {std::fabs(d[0]), std::fabs(d[1]), std::fabs(d[2])};
+  const int axis = (ad[0] >= ad[1] && ad[0] >= ad[2]) ? 0 : (ad[1] >= ad[2] ? 1 : 2);
+  if (ad[axis] == 0.f) return;
+  const int a = (axis + 1) % 3;
+  const int b = (axis + 2) % 3;
+
+  const float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  const float scale = grid.voxel[axis] * length / ad[axis];
+  const std::size_t stride[3] = {static_cast<std::size_t>(grid.n[1]) * grid.n[2],
+                                 static_cast<std::size_t>(grid.n[2]), 1};
+
+  const float f0 = (p0[axis] - grid.origin[axis]) / grid.voxel[axis];
+  const float f1 = (p1[axis] - grid.origin[axis]) / grid.voxel[axis];
+  const int first = std::max(0, static_cast<int>(std::ceil(std::min(f0, f1))));
+  const int last = std::min(grid.n[axis] - 1, static_cast<int>(std::floor(std::max(f0, f1))));
+
+  // Fractional voxel coordinates along a and b, linear in the plane index.
+  const float slopeA = (d[a] / d[axis]) * grid.voxel[axis] / grid.voxel[a];
+  const float slopeB = (d[b] / d[axis]) * grid.voxel[axis] / grid.voxel[b];
+  const float startA = (p0[a] + (grid.origin[axis] - p0[axis]) * d[a] / d[axis] - grid.origin[a]) / grid.voxel[a];
+  const float startB = (p0[b] + (grid.origin[axis] - p0[axis]) * d[b] / d[axis] - grid.origin[b]) / grid.voxel[b];
+  const int na = grid.n[a];
+  const int nb = grid.n[b];
+
+  for (int plane = first; plane <= last; ++plane) {
+    const float fa = startA + plane * slopeA;
+    const float fb = startB + plane * slopeB;
+    const float fa0 = std::floor(fa);
+    const float fb0 = std::floor(fb);
+    if (fa0 < -1.f || fa0 >= na || fb0 < -1.f || fb0 >= nb) continue;
+    const int ia = static_cast<int>(fa0);
+    const int ib = static_cast<int>(fb0);
+    const float wa = fa - fa0;
+    const float wb = fb - fb0;
+    const std::size_t base = plane * stride[axis];
+    if (ia >= 0) {
+      if (ib >= 0) visit(base + ia * stride[a] + ib * stride[b], scale * (1.f - wa) * (1.f - wb));
+      if (ib + 1 < nb) visit(base + ia * stride[a] + (ib + 1) * stride[b], scale * (1.f - wa) * wb);
+    }
+    if (ia + 1 < na) {
+      if (ib >= 0) visit(base + (ia + 1) * stride[a] + ib * stride[b], scale * wa * (1.f - wb));
+      if (ib + 1 < nb) visit(base + (ia + 1) * stride[a] + (ib + 1) * stride[b], scale * wa * wb);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef AirPetLiveStream_h
+#define AirPetLiveStream_h 1
+
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AirPetHit;
+class AirPetNtupleBuffer;
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWithAnInteger;
+class G4UIcmdWithADoubleAndUnit;
+
+/// Live summaries of a running job in a memory-mapped file (/g4pet/live/).
+///
+/// The file holds a fixed header (AirPetLiveHeader), the hit count of every
+/// detector channel, a spectrum of the hit energies and a ring of sampled
+/// LORs (every lorEvery-th LOR of each thread). Hits only count for events
+/// that pass the event filter, as in the Hits ntuple; events already written
+/// before a resume are not counted at all.
+///
+/// Each thread accumulates into thread-local histograms and merges them
+/// every few events. A publisher thread of the master is the only writer of
+/// the mapping: it copies the histograms under a sequence lock (odd while
+/// being written) and appends LORs to the ring, so readers never block the
+/// simulation. The file is created under a temporary name and renamed, so a
+/// reader never maps a partial header. See app.py (read_live_stream) for a
+/// reader.
+///
+/// RunAction owns one instance per thread; only the master's maps the file.
+
+/// Layout of the start of the file; all fields are little-endian.
+struct AirPetLiveHeader {
+  char magic[8];                // "AIRPLIV1"
+  std::uint32_t version;
+  std::uint32_t headerSize;     // offset of the first array
+  std::uint32_t state;          // AirPetLiveStream::State
+  std::uint32_t numChannels;
+  std::uint32_t spectrumBins;
+  std::uint32_t lorCapacity;    // ring slots
+  std::uint32_t lorRecordSize;  // sizeof(AirPetLiveLOR)
+  std::uint32_t lorEvery;
+  double spectrumMax;           // MeV
+  std::int64_t runID;
+  std::int64_t totalEvents;
+  std::uint64_t channelsOffset; // uint64[numChannels]
+  std::uint64_t spectrumOffset; // uint64[spectrumBins]
+  std::uint64_t lorOffset;      // AirPetLiveLOR[lorCapacity]
+  // Sequence lock of the four counters below and of both histograms.
+  std::uint64_t sequence;
+  std::int64_t eventsDone;
+  std::int64_t hits;
+  std::int64_t lors;            // all LORs, sampled or not
+  std::uint64_t updateTimeNs;   // system clock of the last update
+  // LOR ring: slot index % lorCapacity. Indices below lorCommitted are
+  // written; those below lorClaimed - lorCapacity may be overwritten.
+  std::uint64_t lorClaimed;
+  std::uint64_t lorCommitted;
+};
+
+/// One sampled LOR, as in the LORs ntuple (mm, MeV, ns).
+struct AirPetLiveLOR {
+  std::int32_t eventID;
+  float start[3];
+  float end[3];
+  float energy1;
+  float energy2;
+  float tof;
+  float weight;
+  std::int32_t reserved;
+};
+
+class AirPetLiveStream : public G4UImessenger
+{
+public:
+  enum State : std::uint32_t { kRunning = 1, kFinished = 2 };
+
+  AirPetLiveStream();
+  virtual ~AirPetLiveStream();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+  // Whether a stream is published in the current run (a relaxed load).
+  static G4bool IsActive() { return fActive.load(std::memory_order_relaxed); }
+
+  // Master: maps the file and starts the publisher; workers reset their
+  // histograms.
+  void BeginRun(G4bool isMaster, G4int runID, G4long totalEvents);
+  // Counts the event's hits; lors holds its LOR as the last row, if any.
+  static void AddEvent(const std::vector<const AirPetHit*>& hits, const AirPetNtupleBuffer* lors);
+  // Merges what this thread has not merged yet.
+  static void MergeThread();
+  // Master, after all threads have merged: final update, then unmaps.
+  void EndRun();
+
+private:
+  void Run();
+  void Publish(G4bool finished);
+  void Unmap();
+
+  G4String fFileName;           // empty: off
+  G4int fSpectrumBins;
+  G4double fSpectrumMax;
+  G4int fLorEvery;
+  G4int fLorCapacity;
+  G4int fInterval;              // ms
+
+  // Mapping and publisher of the master.
+  void* fMapping;
+  size_t fMappingSize;
+  std::thread fThread;
+  std::mutex fThreadMutex;
+  std::condition_variable fWake;
+  G4bool fStopping;
+
+  static std::atomic<bool> fActive;
+
+  G4UIdirectory*             fLiveDir;
+  G4UIcmdWithAString*        fFileCmd;
+  G4UIcmdWithAnInteger*      fSpectrumBinsCmd;
+  G4UIcmdWithADoubleAndUnit* fSpectrumMaxCmd;
+  G4UIcmdWithAnInteger*      fLorEveryCmd;
+  G4UIcmdWithAnInteger*      fLorCapacityCmd;
+  G4UIcmdWithAnInteger*      fIntervalCmd;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef AirPetNameTable_h
+#define AirPetNameTable_h 1
+
+#include "G4String.hh"
+#include "G4Threading.hh"
+#include "globals.hh"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class G4ParticleDefinition;
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+
+/// Run-level string table for particle and volume names.
+///
+/// Hits store small integer IDs instead of copies of the names. The table is
+/// shared by all threads, so an ID means the same name in every worker's
+/// output, and it is written once per file as the "Names" ntuple. Lookups by
+/// object pointer are served from a thread-local cache and only take the
+/// lock the first time a thread sees a particle or volume.
+
+class AirPetNameTable
+{
+public:
+  enum Category { kParticle = 0, kLogicalVolume, kPhysicalVolume, kNumCategories };
+
+  static AirPetNameTable* Instance();
+
+  // Returns the ID of a name, adding it to the table if needed.
+  G4int GetID(Category category, const G4String& name);
+
+  // Cached lookups used on the hot path.
+  G4int GetParticleID(const G4ParticleDefinition* particle);
+  G4int GetLogicalVolumeID(const G4LogicalVolume* volume);
+  G4int GetPhysicalVolumeID(const G4VPhysicalVolume* volume);
+
+  // Reverse lookup. Returns an empty string for an unknown ID.
+  G4String GetName(Category category, G4int id) const;
+
+  // Snapshot of all names of a category, indexed by ID.
+  std::vector<G4String> GetNames(Category category) const;
+
+  // Drops the thread-local pointer caches, e.g. after the geometry has been
+  // rebuilt and volume addresses may have been reused.
+  static void ClearThreadCache();
+
+private:
+  AirPetNameTable() = default;
+
+  using PointerCache = std::unordered_map<const void*, G4int>;
+  G4int CachedID(Category category, const void* key, const G4String& name);
+
+  mutable G4Mutex fMutex;
+  std::vector<G4String> fNames[kNumCategories];
+  std::unordered_map<std::string, G4int> fIDs[kNumCategories];
+
+  static G4ThreadLocal PointerCache* fCache;
+};
+
+#endif
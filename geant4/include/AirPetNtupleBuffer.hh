@@ -0,0 +1,65 @@
+#ifndef AirPetNtupleBuffer_h
+#define AirPetNtupleBuffer_h 1
+
+#include "globals.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// On-disk type of one ntuple column.
+enum class AirPetColumnType { kInt32, kFloat32, kFloat64, kString };
+
+/// Name and type of one ntuple column.
+struct AirPetColumnSpec
+{
+  G4String name;
+  AirPetColumnType type;
+};
+
+/// Per-thread, typed column storage for one ntuple.
+///
+/// Values are appended with the inline Fill methods (no virtual calls, no
+/// index checks) and handed to AirPetOutputFile in large chunks. Each column
+/// keeps a contiguous array of its native type, so a flush is one HDF5 write
+/// per column.
+
+class AirPetNtupleBuffer
+{
+public:
+  AirPetNtupleBuffer() = default;
+  explicit AirPetNtupleBuffer(const std::vector<AirPetColumnSpec>& columns);
+
+  // Resets the schema; any buffered rows are dropped.
+  void SetColumns(const std::vector<AirPetColumnSpec>& columns);
+  const std::vector<AirPetColumnSpec>& GetColumns() const { return fSpecs; }
+
+  // --- Filling (one value per column per row, then AddRow()) ---
+  void FillI(G4int col, G4int value)           { fColumns[col].ints.push_back(value); }
+  void FillF(G4int col, G4double value)        { fColumns[col].floats.push_back(static_cast<float>(value)); }
+  void FillD(G4int col, G4double value)        { fColumns[col].doubles.push_back(value); }
+  void FillS(G4int col, const G4String& value) { fColumns[col].strings.push_back(value); }
+  void AddRow() { ++fRows; }
+
+  // --- Access for the writer ---
+  size_t GetRows() const { return fRows; }
+  const void* GetData(G4int col) const;
+  const std::vector<std::string>& GetStrings(G4int col) const { return fColumns[col].strings; }
+
+  void Clear();
+  void Reserve(size_t rows);
+
+private:
+  struct Column {
+    std::vector<int32_t> ints;
+    std::vector<float> floats;
+    std::vector<double> doubles;
+    std::vector<std::string> strings;
+  };
+
+  std::vector<AirPetColumnSpec> fSpecs;
+  std::vector<Column> fColumns;
+  size_t fRows = 0;
+};
+
+#endif
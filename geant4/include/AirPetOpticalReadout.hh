@@ -0,0 +1,72 @@
+#ifndef AirPetOpticalReadout_h
+#define AirPetOpticalReadout_h 1
+
+#include "AirPetNtupleBuffer.hh"
+#include "AirPetPhotonHit.hh"
+#include "G4Threading.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+#include <vector>
+
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithADouble;
+class G4UIcmdWithADoubleAndUnit;
+class G4UIcmdWithAnInteger;
+
+/// Settings and output of the optical photon readout.
+///
+/// Photodetector volumes (/g4pet/detector/addPhotonSD) count the optical
+/// photons that reach them with an AirPetPhotonSD. At the end of each event
+/// their hits are written as one "PhotonCounts" row per channel (photon
+/// count and first arrival time) plus one "PhotonTimes" row per non-empty
+/// arrival-time bin.
+///
+/// With the fast path on (the default), optical photons get neither an
+/// AirPetTrajectory nor AirPetUserTrackInformation, so millions of photons
+/// per event cost only their tracking. Switch it off to draw photon tracks.
+///
+/// All settings come from the /g4pet/optical/ commands. Each thread's
+/// RunAction owns one instance; the photon SDs of the thread read it with
+/// GetThreadInstance().
+
+class AirPetOpticalReadout : public G4UImessenger
+{
+public:
+  AirPetOpticalReadout();
+  virtual ~AirPetOpticalReadout();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+  // Readout of the calling thread (null before its RunAction exists).
+  static const AirPetOpticalReadout* GetThreadInstance() { return fThreadInstance; }
+
+  G4bool GetFastPath() const { return fFastPath; }
+  G4double GetTimeBinWidth() const { return fTimeBinWidth; }
+  G4int GetNumTimeBins() const { return fNumTimeBins; }
+  G4double GetDetectionEfficiency() const { return fDetectionEfficiency; }
+
+  // Column layouts of the PhotonCounts and PhotonTimes ntuples.
+  static const std::vector<AirPetColumnSpec>& GetCountColumns();
+  static const std::vector<AirPetColumnSpec>& GetTimeColumns();
+
+  // Appends the rows of one photodetector hits collection.
+  void ProcessHits(G4int eventID, const AirPetPhotonHitsCollection& hits,
+                   AirPetNtupleBuffer& counts, AirPetNtupleBuffer& times) const;
+
+private:
+  G4bool fFastPath;
+  G4double fTimeBinWidth;
+  G4int fNumTimeBins;
+  G4double fDetectionEfficiency;
+
+  G4UIdirectory*             fOpticalDir;
+  G4UIcommand*               fFastPathCmd;
+  G4UIcmdWithADoubleAndUnit* fTimeBinWidthCmd;
+  G4UIcmdWithAnInteger*      fNumTimeBinsCmd;
+  G4UIcmdWithADouble*        fEfficiencyCmd;
+
+  static G4ThreadLocal AirPetOpticalReadout* fThreadInstance;
+};
+
+#endif
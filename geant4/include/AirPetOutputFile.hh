@@ -0,0 +1,91 @@
+#ifndef AirPetOutputFile_h
+#define AirPetOutputFile_h 1
+
+#include "AirPetNtupleBuffer.hh"
+#include "G4Threading.hh"
+#include "globals.hh"
+
+#include <hdf5.h>
+#include <utility>
+#include <vector>
+
+/// Native HDF5 output file for AirPet ntuples.
+///
+/// It writes the same layout as the Geant4 HDF5 analysis backend, i.e.
+/// /default_ntuples/<ntuple>/<column>/pages plus an "entries" row count, so
+/// existing readers keep working. Columns are stored with their native type
+/// (int32, float32, float64 or variable-length string) in chunked, shuffled
+/// and deflate-compressed datasets that grow as buffers are appended.
+///
+/// All HDF5 calls are serialized with one process-wide lock, since the HDF5
+/// library is not necessarily built thread-safe.
+
+class AirPetOutputFile
+{
+public:
+  AirPetOutputFile();
+  ~AirPetOutputFile();
+
+  // Creates (truncates) the file, or with append opens an existing one,
+  // whose ntuples CreateNtuple then continues. Returns false on failure.
+  G4bool Open(const G4String& filename, G4int compressionLevel = 1,
+              size_t chunkRows = 65536, G4bool append = false);
+  void Close();
+  G4bool IsOpen() const { return fFile >= 0; }
+  const G4String& GetFileName() const { return fFileName; }
+
+  // Books an ntuple and returns its ID in this file. An ntuple of that name
+  // already in an appended file is reopened, with its rows.
+  G4int CreateNtuple(const G4String& name, const std::vector<AirPetColumnSpec>& columns);
+
+  G4int GetNumberOfNtuples() const;
+  G4String GetNtupleName(G4int ntupleID) const;
+
+  // Drops the rows of an ntuple beyond the given count (resume from a
+  // checkpoint).
+  void Truncate(G4int ntupleID, size_t rows);
+
+  // Appends all rows of a buffer (which must have the ntuple's schema).
+  void AppendRows(G4int ntupleID, const AirPetNtupleBuffer& buffer);
+
+  // Number of rows written so far to an ntuple.
+  size_t GetEntries(G4int ntupleID) const;
+
+  // Writes a dense 3D grid (row-major, z fastest) as /scoring/<name>, with
+  // "origin", "voxel_size" (mm) and "unit" attributes.
+  void WriteGrid(const G4String& name, const G4double* data, const size_t shape[3],
+                 const G4double origin[3], const G4double voxelSize[3], const G4String& unit);
+
+  // Writes integer scalar attributes on the group /<name> (created if
+  // needed), e.g. the /shard manifest of a sharded run.
+  void WriteAttributes(const G4String& name, const std::vector<std::pair<G4String, G4long>>& values);
+  // The same for floating-point attributes.
+  void WriteDoubleAttributes(const G4String& name, const std::vector<std::pair<G4String, G4double>>& values);
+
+  // Flushes HDF5's internal buffers to disk.
+  void Flush();
+
+private:
+  struct Ntuple {
+    G4String name;
+    std::vector<AirPetColumnSpec> columns;
+    hid_t group;
+    std::vector<hid_t> datasets;
+    hid_t entries;
+    size_t rows;
+  };
+
+  hid_t CreateColumnDataset(hid_t group, const AirPetColumnSpec& spec);
+  G4bool ReopenNtuple(Ntuple& ntuple);
+  void WriteEntries(const Ntuple& ntuple);
+
+  G4String fFileName;
+  hid_t fFile;
+  hid_t fNtuplesGroup;
+  hid_t fStringType;
+  G4int fCompressionLevel;
+  size_t fChunkRows;
+  std::vector<Ntuple> fNtuples;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef AirPetOutputWriter_h
+#define AirPetOutputWriter_h 1
+
+#include "AirPetNtupleBuffer.hh"
+#include "globals.hh"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class AirPetCheckpoint;
+class AirPetOutputFile;
+
+/// Background writer of ntuple rows (/g4pet/run/outputQueueDepth).
+///
+/// The event threads move their filled row buffers into a Batch and queue
+/// it; one I/O thread per run does the HDF5 writes, compression included,
+/// so tracking goes on while the file is written. Written buffers are kept
+/// (cleared, with their capacity) and handed back to the next thread that
+/// flushes the same ntuple, so steady-state double buffering does not
+/// allocate.
+///
+/// The queue holds at most the given number of batches; a thread that
+/// finds it full waits (backpressure). The master prints the batches, rows,
+/// peak queue depth and wait time at the end of the run and writes them as
+/// attributes of the /output_writer group.
+
+class AirPetOutputWriter
+{
+public:
+  struct Batch {
+    std::vector<std::pair<G4int, AirPetNtupleBuffer>> buffers;  // ntuple ID, rows
+    std::vector<G4int> events;       // global EventIDs these rows complete
+    G4bool saveCheckpoint = false;   // write the checkpoint after the rows
+  };
+
+  AirPetOutputWriter() = default;
+  ~AirPetOutputWriter();
+
+  // Starts the I/O thread for a run; checkpoint may be null.
+  void Start(AirPetOutputFile* file, AirPetCheckpoint* checkpoint,
+             const G4String& checkpointFileName, size_t queueDepth);
+  // Writes all queued batches, stops the thread and prints the statistics.
+  void Stop();
+  G4bool IsRunning() const { return fThread.joinable(); }
+
+  // Queues a batch, waiting while the queue is full.
+  void Push(Batch&& batch);
+
+  // A cleared buffer of this ntuple from an earlier batch, or an empty one
+  // (no columns) if none is free.
+  AirPetNtupleBuffer TakeFreeBuffer(G4int ntupleID);
+
+  // Statistics of the last run, as (name, value) attributes.
+  std::vector<std::pair<G4String, G4long>> GetStatistics() const;
+
+private:
+  void Run();
+  void Write(Batch& batch);
+
+  AirPetOutputFile* fFile = nullptr;
+  AirPetCheckpoint* fCheckpoint = nullptr;
+  G4String fCheckpointFileName;
+  size_t fQueueDepth = 1;
+
+  std::thread fThread;
+  mutable std::mutex fMutex;
+  std::condition_variable fNotEmpty;
+  std::condition_variable fNotFull;
+  std::deque<Batch> fQueue;
+  std::map<G4int, std::vector<AirPetNtupleBuffer>> fFreeBuffers;
+  G4bool fStopping = false;
+
+  // Statistics (under fMutex)
+  uint64_t fBatches = 0;
+  uint64_t fRows = 0;
+  uint64_t fPeakDepth = 0;
+  uint64_t fWaits = 0;
+  G4double fWaitSeconds = 0.;
+  G4double fWriteSeconds = 0.;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef AirPetPhotonHit_h
+#define AirPetPhotonHit_h 1
+
+#include "G4VHit.hh"
+#include "G4THitsCollection.hh"
+#include "G4Allocator.hh"
+#include "globals.hh"
+
+#include <vector>
+
+/// Hit class for the photodetector sensitive detectors (AirPetPhotonSD).
+///
+/// One hit per detector channel and event: the number of detected optical
+/// photons, the earliest arrival time and an arrival-time histogram with
+/// the binning of /g4pet/optical/ (the last bin collects later photons).
+
+class AirPetPhotonHit : public G4VHit
+{
+  public:
+    AirPetPhotonHit(G4int channelID, G4int copyNo, G4int numTimeBins);
+    virtual ~AirPetPhotonHit();
+
+    inline void* operator new(size_t);
+    inline void  operator delete(void*);
+
+    virtual void Print();
+
+    void AddPhoton(G4double time, G4double timeBinWidth);
+
+    G4int GetChannelID() const                     { return fChannelID; }
+    G4int GetCopyNo() const                        { return fCopyNo; }
+    G4int GetPhotons() const                       { return fPhotons; }
+    G4double GetFirstTime() const                  { return fFirstTime; }
+    const std::vector<G4int>& GetTimeBins() const  { return fTimeBins; }
+
+  private:
+    G4int    fChannelID;
+    G4int    fCopyNo;
+    G4int    fPhotons;
+    G4double fFirstTime;
+    std::vector<G4int> fTimeBins;
+
+    // Memory management
+    static G4ThreadLocal G4Allocator<AirPetPhotonHit>* fAllocator;
+};
+
+using AirPetPhotonHitsCollection = G4THitsCollection<AirPetPhotonHit>;
+
+inline void* AirPetPhotonHit::operator new(size_t)
+{
+  if (!fAllocator) {
+      fAllocator = new G4Allocator<AirPetPhotonHit>;
+  }
+  return (void*) fAllocator->MallocSingle();
+}
+
+inline void AirPetPhotonHit::operator delete(void* aHit)
+{
+  fAllocator->FreeSingle((AirPetPhotonHit*) aHit);
+}
+
+#endif
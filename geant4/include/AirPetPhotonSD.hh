@@ -0,0 +1,45 @@
+#ifndef AirPetPhotonSD_h
+#define AirPetPhotonSD_h 1
+
+#include "G4VSensitiveDetector.hh"
+#include "AirPetPhotonHit.hh"
+
+#include <vector>
+
+class G4Step;
+class G4HCofThisEvent;
+
+/// Photodetector sensitive detector.
+///
+/// Counts the optical photons that take a step in its volumes and kills
+/// them (detected or absorbed, see /g4pet/optical/detectionEfficiency).
+/// Photons are binned per detector channel of the AirPetChannelMap into one
+/// AirPetPhotonHit per channel and event; other particles are ignored.
+/// The volume needs an RINDEX property so photons can enter it.
+
+class AirPetPhotonSD : public G4VSensitiveDetector
+{
+public:
+  AirPetPhotonSD(const G4String& name);
+  virtual ~AirPetPhotonSD();
+
+  //--- G4VSensitiveDetector virtual methods ---
+  virtual void Initialize(G4HCofThisEvent* hce) override;
+  virtual G4bool ProcessHits(G4Step* aStep, G4TouchableHistory* ROhist) override;
+
+private:
+  AirPetPhotonHitsCollection* fHitsCollection;
+
+  // Per-event hit of each channel (index = channel ID + 1, so that photons
+  // in volumes outside the channel map share slot 0). Only the entries in
+  // fTouchedSlots are reset in Initialize().
+  std::vector<AirPetPhotonHit*> fHitsBySlot;
+  std::vector<size_t> fTouchedSlots;
+
+  // Settings of /g4pet/optical/, read at the start of each event.
+  G4double fTimeBinWidth;
+  G4int fNumTimeBins;
+  G4double fDetectionEfficiency;
+};
+
+#endif
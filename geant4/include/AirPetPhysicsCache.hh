@@ -0,0 +1,65 @@
+#ifndef AirPetPhysicsCache_h
+#define AirPetPhysicsCache_h 1
+
+#include "G4UImessenger.hh"
+#include "G4VStateDependent.hh"
+#include "globals.hh"
+
+class G4VUserPhysicsList;
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithAString;
+
+/// Persistent cache of the built physics tables (/g4pet/physics/).
+///
+/// Each run that (re)builds the tables starts with the Idle -> Init state
+/// change, after the geometry is constructed. The cache then describes the
+/// physics list, the optical flag, the Geant4 version, the EM parameters,
+/// all materials, the logical volumes and the production cuts of every
+/// region; the FNV-1a hash of this key names the entry <cacheDir>/<hash>/.
+/// An existing entry with the same key.txt is retrieved instead of building
+/// the tables, otherwise the tables are stored there once built (Idle ->
+/// GeomClosed), through a temporary directory, so concurrent jobs never see
+/// a partial entry. Geant4 still checks that the stored couples match and
+/// rebuilds on a mismatch.
+///
+/// The cache directory defaults to $AIRPET_PHYSICS_CACHE, else
+/// $XDG_CACHE_HOME/airpet/physics or ~/.cache/airpet/physics;
+/// AIRPET_PHYSICS_CACHE=off disables it. Master thread only: workers share
+/// the master's tables.
+
+class AirPetPhysicsCache : public G4VStateDependent, public G4UImessenger
+{
+public:
+  AirPetPhysicsCache(G4VUserPhysicsList* physicsList, const G4String& physicsListName,
+                     G4bool opticalPhysics);
+  virtual ~AirPetPhysicsCache();
+
+  virtual G4bool Notify(G4ApplicationState requestedState) override;
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+  virtual G4String GetCurrentValue(G4UIcommand* command) override;
+
+private:
+  G4String BuildKey() const;
+  void PrepareRetrieve();
+  void StoreTables();
+
+  G4VUserPhysicsList* fPhysicsList;
+  G4String fPhysicsListName;
+  G4bool fOpticalPhysics;
+
+  G4bool fEnabled;
+  G4String fCacheDir;
+  // Entry of the current build, and whether it is being retrieved or is
+  // still to be stored.
+  G4String fEntryDir;
+  G4String fEntryKey;
+  G4bool fRetrieving;
+  G4bool fStorePending;
+
+  G4UIdirectory*      fPhysicsDir;
+  G4UIcommand*        fEnableCmd;
+  G4UIcmdWithAString* fCacheDirCmd;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef AirPetProfiler_h
+#define AirPetProfiler_h 1
+
+#include "AirPetNtupleBuffer.hh"
+#include "G4Threading.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+class G4UIdirectory;
+class G4UIcommand;
+
+/// Opt-in timing of the user hooks and the output path.
+///
+/// Each instrumented section accumulates a call count and CPU timestamp
+/// counter ticks in thread-local counters, so a measurement is two TSC reads
+/// and two additions; when profiling is off it is a single relaxed load.
+/// At the end of a run the worker counters are merged, and the master
+/// prints a breakdown and writes it as the "Profile" ntuple.
+///
+/// Enabled with /g4pet/profile/enable, or by default when built with
+/// -DAIRPET_PROFILING (CMake option AIRPET_ENABLE_PROFILING).
+
+class AirPetProfiler : public G4UImessenger
+{
+public:
+  enum Section {
+    kStepping = 0,     // SteppingAction::UserSteppingAction
+    kProcessHits,      // AirPetSensitiveDetector::ProcessHits
+    kPreTracking,      // TrackingAction::PreUserTrackingAction
+    kPostTracking,     // TrackingAction::PostUserTrackingAction
+    kEndOfEvent,       // EventAction::EndOfEventAction (includes the two below)
+    kDigitize,         // AirPetDigitizer::ProcessEvent
+    kOutputWrite,      // RunAction buffer flushes to the HDF5 file (on the I/O thread if async)
+    kOutputQueue,      // hand-off to the AirPetOutputWriter, including waits for a full queue
+    kNumSections
+  };
+
+  AirPetProfiler();
+  virtual ~AirPetProfiler();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+  static G4bool IsEnabled() { return fEnabled.load(std::memory_order_relaxed); }
+
+  static uint64_t Ticks()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  static void Add(Section section, uint64_t ticks)
+  {
+    fThreadCounters.calls[section] += 1;
+    fThreadCounters.ticks[section] += ticks;
+  }
+
+  // --- Run bookkeeping, called by the RunActions ---
+  static void BeginRun(G4bool isMaster);   // resets counters
+  static void MergeThread();               // adds this thread's counters
+  // Master only: prints the report and fills the Profile buffer.
+  static void Report(AirPetNtupleBuffer& profile);
+
+  static const std::vector<AirPetColumnSpec>& GetProfileColumns();
+
+private:
+  struct Counters {
+    uint64_t calls[kNumSections];
+    uint64_t ticks[kNumSections];
+  };
+
+  static std::atomic<bool> fEnabled;
+  static G4ThreadLocal Counters fThreadCounters;
+
+  G4UIdirectory* fProfileDir;
+  G4UIcommand* fEnableCmd;
+};
+
+/// Times the enclosing scope into one AirPetProfiler section.
+class AirPetProfileScope
+{
+public:
+  explicit AirPetProfileScope(AirPetProfiler::Section section)
+    : fSection(section), fStart(AirPetProfiler::IsEnabled() ? AirPetProfiler::Ticks() : 0) {}
+  ~AirPetProfileScope()
+  {
+    if (fStart) AirPetProfiler::Add(fSection, AirPetProfiler::Ticks() - fStart);
+  }
+
+private:
+  AirPetProfiler::Section fSection;
+  uint64_t fStart;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef AirPetScorer_h
+#define AirPetScorer_h 1
+
+#include "G4ThreeVector.hh"
+#include "G4Threading.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+class G4LogicalVolume;
+class G4Step;
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWith3VectorAndUnit;
+class AirPetOutputFile;
+
+/// Run-level energy-deposit scoring on a regular 3D grid.
+///
+/// Configured with the /g4pet/score/ commands (grid origin = lower corner,
+/// voxel size, shape). Without scoring volumes, the deposits of all
+/// AirPetSensitiveDetector steps are scored; with /g4pet/score/addVolume,
+/// every step in the listed logical volumes is scored instead (from the
+/// SteppingAction). Each step's energy goes to the voxel of its midpoint.
+///
+/// Every thread accumulates into its own cache-aligned dense array; worker
+/// arrays are added to the master's at the end of the run, which writes the
+/// total as one dataset /scoring/Edep (shape nx x ny x nz, MeV, x slowest)
+/// with origin and voxel size attributes. There is no per-hit I/O.
+
+class AirPetScorer : public G4UImessenger
+{
+public:
+  AirPetScorer();
+  virtual ~AirPetScorer();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+  G4bool IsEnabled() const { return fEnabled; }
+
+  // Scorer of the calling thread while a run with scoring is active, else
+  // null.
+  static AirPetScorer* GetActive() { return fActive; }
+
+  // Hot path: called from AirPetSensitiveDetector (no scoring volumes) or
+  // the SteppingAction (scoring volumes).
+  G4bool ScoresSensitiveDetectors() const { return fVolumeNames.empty(); }
+  G4bool ScoresVolume(const G4LogicalVolume* volume) const;
+  void AddStep(const G4Step* step);
+
+  // Run handling. The master writes the grid after the workers have merged.
+  void BeginRun();
+  void EndRun();
+  void MergeInto(AirPetScorer& master) const;
+  void Write(AirPetOutputFile& file) const;
+
+private:
+  // Zero-initialized doubles on 64-byte boundaries, so no two threads'
+  // grids share a cache line.
+  template <typename T>
+  struct AlignedAllocator {
+    using value_type = T;
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+    T* allocate(std::size_t n) {
+      return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(64)));
+    }
+    void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(64)); }
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+  };
+
+  G4bool fEnabled;
+  G4ThreeVector fOrigin;
+  G4ThreeVector fVoxelSize;
+  G4int fShape[3];
+  std::vector<G4String> fVolumeNames;
+  std::vector<const G4LogicalVolume*> fVolumes;
+
+  std::vector<G4double, AlignedAllocator<G4double>> fGrid;
+
+  G4UIdirectory*             fScoreDir;
+  G4UIcommand*               fEnableCmd;
+  G4UIcmdWith3VectorAndUnit* fOriginCmd;
+  G4UIcmdWith3VectorAndUnit* fVoxelSizeCmd;
+  G4UIcommand*               fShapeCmd;
+  G4UIcmdWithAString*        fAddVolumeCmd;
+  G4UIcommand*               fClearVolumesCmd;
+
+  static G4ThreadLocal AirPetScorer* fActive;
+};
+
+#endif
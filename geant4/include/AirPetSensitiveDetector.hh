@@ -4,13 +4,20 @@
 #include "G4VSensitiveDetector.hh"
 #include "AirPetHit.hh" // Includes the HitsCollection typedef
 
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
 class G4Step;
 class G4HCofThisEvent;
+class G4VPhysicalVolume;
 
 /// A generic sensitive detector for AIRPET.
 ///
-/// It creates instances of AirPetHit for every step with non-zero
-/// energy deposition and stores them in the AirPetHitsCollection.
+/// It creates one AirPetHit per detector channel (see AirPetChannelMap) and
+/// event, summing the energy of all steps with non-zero deposition, and
+/// stores them in the AirPetHitsCollection.
 
 class AirPetSensitiveDetector : public G4VSensitiveDetector
 {
@@ -24,7 +31,34 @@ public:
   virtual void EndOfEvent(G4HCofThisEvent* hce) override;
 
 private:
+  // Key identifying one hit per event: the placed volume (which also fixes
+  // the logical volume) plus its copy/replica number.
+  struct HitKey {
+    const G4VPhysicalVolume* volume;
+    G4int copyNo;
+    bool operator==(const HitKey& other) const {
+      return volume == other.volume && copyNo == other.copyNo;
+    }
+  };
+
+  struct HitKeyHash {
+    std::size_t operator()(const HitKey& key) const {
+      std::size_t h = std::hash<const void*>()(key.volume);
+      return h ^ (std::hash<G4int>()(key.copyNo) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+    }
+  };
+
   AirPetHitsCollection* fHitsCollection;
+
+  // Per-event hit of each channel, indexed by channel ID. Only the entries
+  // listed in fTouchedChannels are reset in Initialize().
+  std::vector<AirPetHit*> fHitsByChannel;
+  std::vector<G4int> fTouchedChannels;
+
+  // Per-event index into fHitsCollection for volumes outside the channel
+  // map, cleared in Initialize(). The buckets are kept between events so
+  // steady-state lookups do not allocate.
+  std::unordered_map<HitKey, AirPetHit*, HitKeyHash> fHitIndex;
 };
 
 #endif
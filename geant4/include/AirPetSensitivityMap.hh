@@ -0,0 +1,77 @@
+#ifndef AirPetSensitivityMap_h
+#define AirPetSensitivityMap_h 1
+
+#include "G4RotationMatrix.hh"
+#include "G4ThreeVector.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <random>
+#include <vector>
+
+class DetectorConstruction;
+class G4LogicalVolume;
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWithAnInteger;
+class G4UIcmdWith3VectorAndUnit;
+
+/// Sensitivity image from the real detector geometry.
+///
+/// /g4pet/sensitivity/compute <file> (after /run/initialize) finds every
+/// placement of the logical volumes with an energy-deposit SD (addSD), picks
+/// sample points inside each of these crystals, and backprojects the LORs
+/// of all crystal pairs with the Joseph projector of airpet-recon. An
+/// optional water-like cylinder (attenuationCylinder) weights each LOR with
+/// its survival probability. The pairs are split over threads, each with
+/// its own image.
+///
+/// The file has the layout of the web application's sensitivity.h5 (a
+/// "sensitivity" dataset with voxel_size, origin and threshold attributes)
+/// plus a geometry_key attribute: the GDML content hash, the SD volumes and
+/// all settings. A file with the same key is reused, so the image is only
+/// computed once per geometry.
+
+class AirPetSensitivityMap : public G4UImessenger
+{
+public:
+  explicit AirPetSensitivityMap(const DetectorConstruction* detector);
+  virtual ~AirPetSensitivityMap();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+private:
+  // Sample points (global, mm) of one crystal.
+  struct Crystal {
+    std::vector<float> points;  // x, y, z per sample
+  };
+
+  void Compute(const G4String& fileName);
+  G4String GetKey() const;
+  void CollectCrystals(const G4LogicalVolume* mother, const G4RotationMatrix& rotation,
+                       const G4ThreeVector& translation, const std::vector<G4String>& volumeNames,
+                       std::mt19937& engine, std::vector<Crystal>& crystals) const;
+  G4float Survival(const float p0[3], const float p1[3]) const;
+
+  const DetectorConstruction* fDetector;
+
+  G4int fShape[3];
+  G4ThreeVector fVoxelSize;
+  G4int fSamplesPerPair;
+  G4int fThreads;
+  // Attenuation cylinder along z, centred at the origin (mu in 1/mm).
+  G4double fCylinderRadius;
+  G4double fCylinderLength;
+  G4double fCylinderMu;
+
+  G4UIdirectory*             fSensitivityDir;
+  G4UIcommand*               fShapeCmd;
+  G4UIcmdWith3VectorAndUnit* fVoxelSizeCmd;
+  G4UIcmdWithAnInteger*      fSamplesCmd;
+  G4UIcmdWithAnInteger*      fThreadsCmd;
+  G4UIcommand*               fAttenuationCmd;
+  G4UIcmdWithAString*        fComputeCmd;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef AirPetServer_h
+#define AirPetServer_h 1
+
+#include "globals.hh"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+/// Job server for "airpet-sim --serve <socket>".
+///
+/// The process stays alive with geometry and physics built and runs jobs
+/// sent over a Unix domain socket back to back. A client sends one job as
+/// a block of lines:
+///
+///   job <id>
+///   dir <path>       (optional) working directory of the job
+///   gdml <path>      (optional) geometry, applied with /g4pet/detector/readFile
+///   output <path>    (optional) output file, default output.hdf5
+///   physics <name>   (optional) required physics list
+///   optical <bool>   (optional) required optical physics setting
+///   physics_cache <dir|off>  (optional) physics table cache for this job
+///   macro <path>     macro to execute
+///   end
+///
+/// and gets one JSON object per line back:
+///
+///   {"type":"accepted","job":"<id>"}
+///   {"type":"progress","job":"<id>","events":N,"total":M}
+///   {"type":"finished","job":"<id>","status":"ok|error|aborted","code":C}
+///
+/// A job whose directory or GDML file cannot be used finishes with status
+/// "error", code -1 and a "message". The server's own working directory is
+/// restored after every job.
+///
+/// The physics of the server is fixed when it starts; a job that asks for
+/// another physics list or optical setting is answered with
+///
+///   {"type":"finished","job":"<id>","status":"rejected","code":-1,"message":"..."}
+///
+/// and the client has to run it elsewhere.
+///
+/// While a job runs, the client may send "abort" to stop it after the
+/// current events. "shutdown" stops the server. Jobs are processed one at a
+/// time, in the order of the connections.
+
+class AirPetServer
+{
+public:
+  AirPetServer(const G4String& socketPath, const G4String& physicsListName, G4bool opticalPhysics);
+  ~AirPetServer();
+
+  // Serves connections until "shutdown" is received. Returns the process
+  // exit code.
+  G4int Serve();
+
+  // --- Progress hooks, callable from any thread ---
+  static void RunStarted(G4int totalEvents);
+  static void EventFinished() { fEventsDone.fetch_add(1, std::memory_order_relaxed); }
+  static G4bool AbortRequested() { return fAbortRequested.load(std::memory_order_relaxed); }
+  // Stops the current run after the events in flight (also async-signal
+  // safe, for SIGTERM in batch mode).
+  static void RequestAbort() { fAbortRequested.store(true, std::memory_order_relaxed); }
+
+private:
+  struct Job {
+    std::string id;
+    std::string dir;
+    std::string gdml;
+    std::string output;
+    std::string macro;
+    std::string physics;
+    std::string optical;
+    std::string physicsCache;
+  };
+
+  // What to do after a connection has been handled.
+  enum class Next { kContinue, kShutdown };
+
+  Next HandleConnection(int fd);
+  void RunJob(int fd, const Job& job);
+  // Why the server cannot run the job, or empty.
+  std::string CheckPhysics(const Job& job) const;
+  G4bool ReadLine(int fd, std::string& line);
+  void Send(int fd, const std::string& message);
+
+  G4String fSocketPath;
+  G4String fPhysicsListName;
+  G4bool fOpticalPhysics;
+  int fListenFd;
+  std::string fReadBuffer;
+  std::mutex fSendMutex;
+
+  static std::atomic<G4int> fEventsDone;
+  static std::atomic<G4int> fTotalEvents;
+  static std::atomic<bool> fAbortRequested;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef AirPetStackingAction_h
+#define AirPetStackingAction_h 1
+
+#include "AirPetNtupleBuffer.hh"
+#include "G4RotationMatrix.hh"
+#include "G4ThreeVector.hh"
+#include "G4Threading.hh"
+#include "G4UImessenger.hh"
+#include "G4UserStackingAction.hh"
+#include "globals.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+class G4LogicalVolume;
+class G4ParticleDefinition;
+class G4VSolid;
+class G4UIdirectory;
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWithADoubleAndUnit;
+
+/// Early track killing and secondary deferral (/g4pet/stack/).
+///
+/// Rules apply to secondaries when they are stacked:
+/// - killParticle <name>: never track this particle (e.g. neutrinos).
+/// - killBelow <particle> <energy> <unit> [volume]: kill the particle below
+///   the energy when created in the logical volume ("any", "nonSD" for all
+///   volumes without an SD, or a volume name). Its energy is not deposited.
+/// - killUnreachable: kill neutral particles whose straight line from the
+///   creation point misses the SD envelope: the bounding boxes of the single
+///   SD placements, each grown by reachMargin. A hierarchy of boxes keeps the
+///   test logarithmic in the number of crystals.
+/// - deferUnreachable: move those neutral particles to the waiting stack
+///   instead, so that SD-bound tracks are simulated first.
+/// - abortWithoutHits: once the urgent stack is empty and no SD has a hit
+///   yet, drop the deferred tracks (implies deferUnreachable).
+///
+/// Optical photons are never touched. Each thread counts the tracks, and
+/// their kinetic energy, removed by each rule; the master prints the totals
+/// and writes them as the "Stacking" ntuple.
+///
+/// ActionInitialization gives each worker one instance; the master RunAction
+/// owns one that only registers the commands.
+
+class AirPetStackingAction : public G4UserStackingAction, public G4UImessenger
+{
+public:
+  enum Rule {
+    kKillParticle = 0,
+    kKillBelow,
+    kKillUnreachable,
+    kDeferred,         // moved to the waiting stack (not removed)
+    kAbortedTracks,    // deferred tracks dropped by abortWithoutHits
+    kAbortedEvents,
+    kNumRules
+  };
+
+  AirPetStackingAction();
+  virtual ~AirPetStackingAction();
+
+  virtual void SetNewValue(G4UIcommand* command, G4String newValue) override;
+
+  // --- G4UserStackingAction virtual methods ---
+  virtual G4ClassificationOfNewTrack ClassifyNewTrack(const G4Track* track) override;
+  virtual void NewStage() override;
+  virtual void PrepareNewEvent() override;
+
+  // Whether any rule is set on any thread (the Stacking ntuple is booked).
+  static G4bool IsConfigured() { return fConfigured.load(std::memory_order_relaxed); }
+
+  // --- Run bookkeeping, called by the RunActions ---
+  static void BeginRun(G4bool isMaster);   // resets counters
+  static void MergeThread();               // adds this thread's counters
+  // Master only: prints the totals and fills the Stacking buffer.
+  static void Report(AirPetNtupleBuffer& stacking);
+
+  static const std::vector<AirPetColumnSpec>& GetStackingColumns();
+
+private:
+  struct EnergyRule {
+    const G4ParticleDefinition* particle;  // nullptr: all particles
+    G4String particleName;
+    G4double energy;
+    G4String volume;                       // "any", "nonSD" or a logical volume name
+  };
+
+  // Axis-aligned box in world coordinates.
+  struct Box {
+    G4ThreeVector min;
+    G4ThreeVector max;
+  };
+
+  // Node of the hierarchy over the envelope boxes. A leaf covers count boxes
+  // from first; an inner node (count 0) has its first child next to it.
+  struct Node {
+    Box bounds;
+    G4int first;
+    G4int count;
+    G4int second;
+  };
+
+  struct Counters {
+    uint64_t tracks[kNumRules];
+    G4double energy[kNumRules];
+  };
+
+  void UpdateConfigured();
+  void ResolveParticles();
+  void BuildEnvelope();
+  G4int BuildNode(size_t begin, size_t end);
+  void AddBox(const G4VSolid* solid, const G4RotationMatrix& rotation, const G4ThreeVector& translation);
+  void AddEnvelope(const G4LogicalVolume* volume, const G4RotationMatrix& rotation,
+                   const G4ThreeVector& translation);
+  G4bool CanReachSD(const G4Track* track) const;
+  static G4bool RayHitsBox(const G4ThreeVector& position, const G4ThreeVector& direction, const Box& box);
+  G4bool MatchesVolume(const EnergyRule& rule, const G4Track* track) const;
+  void Count(Rule rule, const G4Track* track);
+
+  // Settings
+  std::set<G4String> fKillParticleNames;
+  std::vector<EnergyRule> fEnergyRules;
+  G4bool fKillUnreachable;
+  G4bool fDeferUnreachable;
+  G4bool fAbortWithoutHits;
+  G4double fReachMargin;
+
+  // Per-thread state: resolved particles, SD envelope of the current
+  // geometry, and the stage of the current event.
+  std::set<const G4ParticleDefinition*> fKillParticles;
+  G4bool fParticlesResolved;
+  G4int fEnvelopeRunID;
+  std::vector<Box> fEnvelopeBoxes;    // one per SD placement
+  std::vector<Node> fEnvelopeNodes;   // root first; empty: no SD
+  G4int fStage;
+  G4double fDeferredEnergy;   // kinetic energy deferred in this event
+
+  static std::atomic<bool> fConfigured;
+  static G4ThreadLocal Counters fThreadCounters;
+
+  G4UIdirectory*             fStackDir;
+  G4UIcmdWithAString*        fKillParticleCmd;
+  G4UIcommand*               fKillBelowCmd;
+  G4UIcommand*               fKillUnreachableCmd;
+  G4UIcommand*               fDeferUnreachableCmd;
+  G4UIcommand*               fAbortWithoutHitsCmd;
+  G4UIcmdWithADoubleAndUnit* fReachMarginCmd;
+  G4UIcommand*               fClearCmd;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef AirPetTrackFile_h
+#define AirPetTrackFile_h 1
+
+#include "G4String.hh"
+#include "G4Threading.hh"
+#include "globals.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_set>
+#include <vector>
+
+class G4Event;
+
+/// Append-only binary file with the full trajectories of selected events.
+///
+/// Replaces the per-event event_XXXX_tracks.txt files. All threads append to
+/// <dir>/tracks.bin; each event is one contiguous block, and one fixed-size
+/// record per event is appended to <dir>/tracks.idx, so a reader can seek to
+/// any event (or memory-map both files) without parsing. Both files are
+/// flushed after every event, the block before its index record.
+///
+/// tracks.bin: 8-byte magic "AIRPTRK1", then event blocks:
+///   int32 eventID, int32 nTracks, and per track
+///   int32 trackID, int32 parentID, int32 pdg, int32 nameLength,
+///   char name[nameLength], int32 nPoints, float32 xyz[3 * nPoints] (mm)
+/// tracks.idx: records of { int64 eventID, uint64 offset, uint64 size }
+/// All values are little-endian.
+
+class AirPetTrackFile
+{
+public:
+  static AirPetTrackFile* Instance();
+
+  // Serializes the trajectories of an event and appends them. The files are
+  // (re)created in the given directory on the first write after Close(),
+  // unless Resume() was called.
+  // eventID is the global EventID written to both files.
+  void WriteEvent(const G4String& directory, const G4Event* event, G4int eventID);
+
+  // Closes both files; called once the run has finished.
+  void Close();
+
+  // Size of tracks.bin and number of events in tracks.idx, for a checkpoint
+  // (0 and 0 before the first write of a fresh run).
+  void GetState(uint64_t& size, uint64_t& events);
+
+  // Makes the next Open continue the files of an interrupted run: both are
+  // opened for update and cut back to the checkpointed size and event
+  // count. Events still listed in the index are not written again.
+  void Resume(uint64_t size, uint64_t events);
+
+private:
+  AirPetTrackFile() = default;
+
+  G4bool Open(const G4String& directory);
+  G4bool Reopen(const G4String& base);
+
+  G4Mutex fMutex;
+  std::FILE* fData = nullptr;
+  std::FILE* fIndex = nullptr;
+  uint64_t fOffset = 0;
+  uint64_t fEvents = 0;
+
+  // Set by Resume until the files are opened.
+  G4bool fResumePending = false;
+  uint64_t fResumeSize = 0;
+  uint64_t fResumeEvents = 0;
+  std::unordered_set<int64_t> fResumedEvents;
+
+  // Per-thread serialization buffer, reused between events.
+  static G4ThreadLocal std::vector<char>* fBuffer;
+};
+
+#endif
@@ -7,24 +7,35 @@
 #include "G4ParticleDefinition.hh"
 #include "G4TrajectoryPoint.hh" // Needed for the container typedef
 
+#include <vector>
+
 class G4Track;
 class G4Step;
 
 // Define the container type for trajectory points
 typedef std::vector<G4VTrajectoryPoint*> TrajectoryPointContainer;
 
+// Contiguous storage for the step positions of one trajectory
+typedef std::vector<G4ThreeVector> TrajectoryPositionBuffer;
+
 
 /// Custom trajectory class for Virtual PET.
 ///
 /// It extends the default G4VTrajectory to store additional useful information
 /// for analysis and visualization, such as initial/final volumes and creator process.
+///
+/// Step positions are kept in a contiguous buffer recycled through a
+/// thread-local pool. G4TrajectoryPoint objects are only created, all at
+/// once, if a caller actually uses the GetPoint(i) interface.
 
 class AirPetTrajectory : public G4VTrajectory
 {
 public:
   // --- Constructors and Destructor ---
   AirPetTrajectory();
-  AirPetTrajectory(const G4Track* aTrack);
+  // With storePoints false, only the initial/final state is kept and
+  // AppendStep() records nothing.
+  AirPetTrajectory(const G4Track* aTrack, G4bool storePoints = true);
   AirPetTrajectory(const AirPetTrajectory&); // Copy constructor
   virtual ~AirPetTrajectory();
 
@@ -50,6 +61,9 @@ public:
   G4ThreeVector GetInitialMomentum() const override { return fMomentumInit; }
   G4double GetCharge() const override       { return fParticleDef->GetPDGCharge(); }
 
+  // --- Direct access to the step positions (no point objects created) ---
+  const G4ThreeVector& GetPointPosition(G4int i) const { return (*fPositions)[i]; }
+
   // --- Custom Getters for our new data members ---
   G4String GetCreatorProcess() const    { return fCreatorProcess; }
   G4double GetMass() const              { return fParticleDef->GetPDGMass(); }
@@ -70,7 +84,15 @@ public:
   void SetParentMomentum(const G4ThreeVector& p) { fParentMomentum = p; }
 
 private:
-  TrajectoryPointContainer* fPositionRecord;
+  static TrajectoryPositionBuffer* AcquireBuffer();
+  static void ReleaseBuffer(TrajectoryPositionBuffer* buffer);
+  void ClearPointCache() const;
+
+  // Null for summary trajectories
+  TrajectoryPositionBuffer* fPositions;
+
+  // Built on the first GetPoint() call and dropped whenever positions change
+  mutable TrajectoryPointContainer* fPointCache;
 
   G4ParticleDefinition* fParticleDef;
   G4int                 fTrackID;
@@ -87,6 +109,7 @@ private:
   G4String              fCreatorProcess;
 
   static G4ThreadLocal G4Allocator<AirPetTrajectory>* fAllocator;
+  static G4ThreadLocal std::vector<TrajectoryPositionBuffer*>* fBufferPool;
 };
 
 
@@ -2,6 +2,7 @@
 #define AirPetUserTrackInformation_h 1
 
 #include "G4VUserTrackInformation.hh"
+#include "G4Allocator.hh"
 #include "G4ThreeVector.hh"
 #include "globals.hh"
 
@@ -9,7 +10,9 @@
 ///
 /// In this case, we use it to store the momentum of the parent particle
 /// at the exact vertex where the current track was created. This is useful
-//  for physics analysis, e.g., reconstructing kinematics.
+/// for physics analysis, e.g., reconstructing kinematics.
+/// Instances come from a thread-local G4Allocator since one is created for
+/// every secondary.
 
 class AirPetUserTrackInformation : public G4VUserTrackInformation
 {
@@ -17,12 +20,30 @@ public:
   AirPetUserTrackInformation();
   virtual ~AirPetUserTrackInformation();
 
+  inline void* operator new(size_t);
+  inline void  operator delete(void*);
+
   // --- Setters and Getters ---
   void SetParentMomentum(G4ThreeVector momentum) { fParentMomentum = momentum; }
   G4ThreeVector GetParentMomentum() const { return fParentMomentum; }
 
 private:
   G4ThreeVector fParentMomentum;
+
+  static G4ThreadLocal G4Allocator<AirPetUserTrackInformation>* fAllocator;
 };
 
+inline void* AirPetUserTrackInformation::operator new(size_t)
+{
+  if (!fAllocator) {
+    fAllocator = new G4Allocator<AirPetUserTrackInformation>;
+  }
+  return (void*)fAllocator->MallocSingle();
+}
+
+inline void AirPetUserTrackInformation::operator delete(void* info)
+{
+  fAllocator->FreeSingle((AirPetUserTrackInformation*)info);
+}
+
 #endif
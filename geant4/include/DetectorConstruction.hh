@@ -5,10 +5,16 @@
 #include "G4GDMLParser.hh"
 #include "globals.hh"
 #include <map>
+#include <set>
+#include <vector>
 
 // Forward declarations to avoid including heavy headers
 class G4VPhysicalVolume;
 class G4GenericMessenger;
+class AirPetSensitivityMap;
+class G4ProductionCuts;
+class G4UserLimits;
+class AirPetCrystalFastSim;
 
 /// The DetectorConstruction class.
 ///
@@ -16,7 +22,27 @@ class G4GenericMessenger;
 /// In this application, it does not define geometry programmatically. Instead,
 /// it loads a geometry from a GDML file specified via a UI command.
 /// It also manages the assignment of sensitive detectors to logical volumes,
-/// also controlled by UI commands.
+/// also controlled by UI commands, and builds the AirPetChannelMap of the
+/// sensitive placements.
+///
+/// After /run/initialize, a new GDML file or SD assignment only triggers a
+/// geometry rebuild at the next /run/beamOn; the physics stays initialized.
+///
+/// Overlap checking is off by default (/g4pet/detector/checkOverlaps). When
+/// enabled, a successful check is recorded in a marker keyed on a hash of the
+/// GDML content (in /g4pet/detector/geometryCacheDir, or next to the file),
+/// and later runs of identical geometry skip the check.
+///
+/// Named logical volumes can be grouped into G4Regions (addRegion), each
+/// with its own production cuts (setRegionCut) and maximum step length
+/// (setRegionStepLimit). The regions are rebuilt after every GDML load.
+///
+/// With setFastSim, electrons in the SD volumes are deposited locally by an
+/// AirPetCrystalFastSim. Each SD volume gets its own region for it, with the
+/// cuts it would otherwise have, unless it is the root of a user region.
+///
+/// It also owns the AirPetSensitivityMap (/g4pet/sensitivity/), which
+/// computes a sensitivity image from the placements of the SD volumes.
 
 class DetectorConstruction : public G4VUserDetectorConstruction
 {
@@ -31,17 +57,65 @@ public:
   // Messenger-callable methods
   void SetGDMLFile(G4String filename);
   void SetSensitiveDetector(G4String logicalVolumeName, G4String sdName);
+  void SetPhotonDetector(G4String logicalVolumeName, G4String sdName);
+  void ClearSensitiveDetectors();
+  void AddRegion(G4String regionName, G4String logicalVolumeName);
+  void SetRegionCut(G4String regionName, G4String value, G4String unit, G4String particle);
+  void SetRegionStepLimit(G4String regionName, G4String value, G4String unit);
+  void ClearRegions();
+  void SetFastSim(G4bool enabled);
+  void SetFastSimMaxEnergy(G4double energy);
+  void SetFastSimContainedOnly(G4bool containedOnly);
+
+  G4VPhysicalVolume* GetWorldVolume() const { return fWorldVolume; }
+  // Content hash of the GDML file (empty if unreadable).
+  G4String GetGeometryHash() const;
+  // Logical volumes with an energy-deposit SD (addSD, not addPhotonSD).
+  std::vector<G4String> GetSensitiveVolumeNames() const;
 
 private:
   void DefineCommands();
+  void CheckOverlaps();
+  void RequestGeometryRebuild();
+  void ClearBuiltRegions();
+  void BuildRegions();
+  void BuildFastSimRegions();
 
   // Member variables
   G4GDMLParser fParser;
   G4VPhysicalVolume* fWorldVolume;
   G4GenericMessenger* fMessenger;
+  AirPetSensitivityMap* fSensitivityMap;
 
   G4String fGDMLFilename;
+  G4bool fCheckOverlaps;
+  G4int fOverlapResolution;
+  G4String fGeometryCacheDir;
   std::map<G4String, G4String> fSensitiveDetectorsMap;
+  // SD names created as AirPetPhotonSD (addPhotonSD) instead of the generic SD.
+  std::set<G4String> fPhotonDetectorNames;
+
+  // Region settings by region name. Cuts are ranges by particle ("gamma",
+  // "e-", "e+", "proton"); a step limit of 0 means none.
+  struct RegionSettings {
+    std::vector<G4String> volumes;
+    std::map<G4String, G4double> cuts;
+    G4double maxStep = 0.;
+  };
+  std::map<G4String, RegionSettings> fRegionSettings;
+  // Cuts and limits owned by the regions built so far (by region name).
+  // The regions are emptied before each rebuild, never deleted.
+  std::map<G4String, G4ProductionCuts*> fRegionCuts;
+  std::map<G4String, G4UserLimits*> fRegionLimits;
+
+  // Fast simulation settings, and the SD volumes of each region that gets
+  // a model (filled by Construct, used by ConstructSDandField).
+  G4bool fFastSimEnabled;
+  G4double fFastSimMaxEnergy;
+  G4bool fFastSimContainedOnly;
+  std::map<G4String, std::vector<G4String>> fFastSimRegions;
+  // Models of this thread by region; they stay attached to their region.
+  static G4ThreadLocal std::map<G4String, AirPetCrystalFastSim*>* fFastSimModels;
 };
 
 #endif
\ No newline at end of file
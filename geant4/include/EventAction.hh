@@ -10,17 +10,31 @@
 class G4Event;
 class G4UIdirectory;
 class G4UIcommand;
+class RunAction;
+class AirPetHit;
+class AirPetNtupleBuffer;
+
+/// How much trajectory information is recorded for the tracks of an event.
+///  - kNone:    no AirPetTrajectory is created at all.
+///  - kSummary: one AirPetTrajectory per track (initial/final state) but no
+///              point list; enough for the Tracks ntuple.
+///  - kFull:    trajectories with every step point, for track files and vis.
+enum class TrajectoryMode { kNone, kSummary, kFull };
 
 /// The EventAction class.
 ///
 /// This class handles actions at the beginning and end of each event.
 /// Its main role is to retrieve data from sensitive detector hits collections
-/// and from the trajectory container, and then fill the n-tuples defined in RunAction.
+/// and from the trajectory container, and then fill the n-tuple buffers owned by
+/// the RunAction of the same thread.
 
 class EventAction : public G4UserEventAction, public G4UImessenger
 {
 public:
-  EventAction();
+  // The RunAction of the same thread provides the output buffers and run
+  // settings. It is null for the master-thread instance, which only
+  // registers the UI commands.
+  EventAction(RunAction* runAction = nullptr);
   virtual ~EventAction();
 
   // --- G4UserEventAction virtual methods ---
@@ -34,12 +48,44 @@ public:
   void SetTrackOutputDir(const G4String& dir) { fTrackOutputDir = dir; }
   void SetTrackEventRange(G4int start, G4int end);
 
+  // Trajectory mode chosen for the event currently being processed.
+  TrajectoryMode GetTrajectoryMode() const { return fCurrentTrajectoryMode; }
+
+  // Whether optical photons skip trajectories and user information
+  // (/g4pet/optical/fastPath).
+  G4bool GetOpticalFastPath() const;
+
+  // Whether secondaries should carry their parent's momentum in this event.
+  G4bool GetStoreParentMomentum() const {
+    return fStoreParentMomentum && fCurrentTrajectoryMode != TrajectoryMode::kNone;
+  }
+
 private:
-    void WriteTracksToFile(const G4Event* event);
+    void WriteTracksToFile(const G4Event* event, G4int eventID);
+    void WriteCrystalEdep(G4int eventID, AirPetNtupleBuffer& crystals);
+    TrajectoryMode DecideTrajectoryMode(G4int eventID) const;
+
+  RunAction* fRunAction;
 
-  // A vector to store the integer IDs of all hits collections.
-  // This is populated once in the first event.
+  // Integer IDs of the AirPetHit and photodetector hits collections,
+  // looked up again when the number of collections changes.
   std::vector<G4int> fHitsCollectionIDs;
+  std::vector<G4int> fPhotonCollectionIDs;
+  G4int fNumCollectionsSeen;
+
+  // Hits above threshold of the current event, used by the event filter,
+  // the CrystalEdep output and the digitizer (reused).
+  std::vector<const AirPetHit*> fEventHits;
+
+  // Primary vertex weight of the current event (1 unless the source is
+  // biased), written to the Weight columns.
+  G4double fEventWeight;
+
+  // Dense per-channel Edep sums for the CrystalEdep ntuple, and the
+  // channels set in the current event.
+  std::vector<G4double> fChannelEdep;
+  std::vector<bool> fChannelTouched;
+  std::vector<G4int> fTouchedChannels;
 
   // Flag to enable trajectory output to file.
   G4String fTrackOutputDir;
@@ -49,10 +95,20 @@ private:
   G4UIdirectory*   fEventDir;              
   G4UIcommand*     fTrackOutputDirCmd;     
   G4UIcommand*     fSetTrackEventRangeCmd;
+  G4UIcommand*     fTrajectoryModeCmd;
+  G4UIcommand*     fStoreParentMomentumCmd;
 
   // Event tracking range
   G4int fStartEventToTrack;
   G4int fEndEventToTrack;
+
+  // Trajectory storage: either forced by /g4pet/event/trajectoryMode, or
+  // decided per event from the run and event settings ("auto").
+  G4bool fAutoTrajectoryMode;
+  TrajectoryMode fForcedTrajectoryMode;
+  TrajectoryMode fCurrentTrajectoryMode;
+
+  G4bool fStoreParentMomentum;
 };
 
 #endif
\ No newline at end of file
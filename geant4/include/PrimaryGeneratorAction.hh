@@ -7,6 +7,7 @@
 // Forward declarations
 class G4GeneralParticleSource;
 class G4Event;
+class AirPetAnnihilationSource;
 
 /// The PrimaryGeneratorAction class.
 ///
@@ -16,6 +17,10 @@ class G4Event;
 /// the properties of the primary particle(s) using UI commands in a macro
 /// file, without needing to recompile the C++ code. This provides maximum
 /// flexibility for the virtual-pet application.
+///
+/// With /g4pet/source/type annihilation, events are instead generated by an
+/// AirPetAnnihilationSource (back-to-back 511 keV pairs at GPS positions,
+/// optionally biased into the scanner acceptance).
 
 class PrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction
 {
@@ -28,6 +33,7 @@ public:
 
 private:
   G4GeneralParticleSource* fGPS;
+  AirPetAnnihilationSource* fAnnihilationSource;
 };
 
 #endif
\ No newline at end of file
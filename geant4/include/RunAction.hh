@@ -1,27 +1,53 @@
 #ifndef RunAction_h
 #define RunAction_h 1
 
+#include "AirPetCheckpoint.hh"
+#include "AirPetDigitizer.hh"
+#include "AirPetLiveStream.hh"
+#include "AirPetOpticalReadout.hh"
+#include "AirPetNtupleBuffer.hh"
+#include "AirPetOutputFile.hh"
+#include "AirPetOutputWriter.hh"
+#include "AirPetProfiler.hh"
+#include "AirPetScorer.hh"
 #include "G4UImessenger.hh"
 #include "G4UserRunAction.hh"
 #include "globals.hh"
 
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
 // Forward declarations
 class G4Run;
+class EventAction;
+class AirPetAnnihilationSource;
+class AirPetStackingAction;
 class G4UIdirectory;
 class G4UIcommand;
 class G4UIcmdWithADoubleAndUnit;
+class G4UIcmdWithAString;
+class G4UIcmdWithAnInteger;
 
 /// The RunAction class.
 ///
 /// This class is responsible for actions that happen at the beginning and
 /// end of a simulation run. Its primary role here is to manage the creation,
-/// writing, and closing of the output n-tuple file using G4AnalysisManager.
+/// writing, and closing of the output n-tuple file. Rows are collected in
+/// per-thread AirPetNtupleBuffers and written in large chunks through
+/// AirPetOutputFile, keeping the Geant4 HDF5 ntuple layout. In MT mode the
+/// master owns the only output file and all worker threads append to it.
 
 class RunAction : public G4UserRunAction, public G4UImessenger {
 public:
-  // The constructor takes a pointer to the EventAction.
-  // This allows for communication between the two action classes if needed.
-  RunAction();
+  // On the master thread, the constructor takes ownership of an
+  // EventAction, an AirPetAnnihilationSource and an AirPetStackingAction
+  // that only serve to register the /g4pet/event/, /g4pet/source/ and
+  // /g4pet/stack/ UI commands there.
+  // Worker threads pass nothing.
+  RunAction(EventAction *masterEventAction = nullptr,
+            AirPetAnnihilationSource *masterSource = nullptr,
+            AirPetStackingAction *masterStacking = nullptr);
   virtual ~RunAction();
 
   // --- G4UserRunAction virtual methods ---
@@ -34,16 +60,159 @@ public:
   G4bool GetSaveHits() const { return fSaveHits; }
   G4double GetHitEnergyThreshold() const { return fHitEnergyThreshold; }
 
+  // Event-level keep/drop policy for the per-event ntuples (hits above
+  // threshold are counted). Dropped events write no Hits, CrystalEdep,
+  // LORs or Tracks rows and no trajectories to the track file.
+  G4int GetMinHitsPerEvent() const { return fMinHitsPerEvent; }
+  G4double GetMinEventEdep() const { return fMinEventEdep; }
+  G4bool GetRequireMultipleSDs() const { return fRequireMultipleSDs; }
+  G4bool HasEventFilter() const {
+    return fMinHitsPerEvent > 0 || fMinEventEdep > 0. || fRequireMultipleSDs;
+  }
+
+  // Per-thread row buffers filled by the EventAction (empty schema if the
+  // ntuple is not booked for this run).
+  AirPetNtupleBuffer &GetTracksBuffer() { return fTracksBuffer; }
+  AirPetNtupleBuffer &GetHitsBuffer() { return fHitsBuffer; }
+  AirPetNtupleBuffer &GetCrystalEdepBuffer() { return fCrystalEdepBuffer; }
+  AirPetNtupleBuffer &GetLORsBuffer() { return fLORsBuffer; }
+  AirPetNtupleBuffer &GetPhotonCountsBuffer() { return fPhotonCountsBuffer; }
+  AirPetNtupleBuffer &GetPhotonTimesBuffer() { return fPhotonTimesBuffer; }
+
+  // Digitization settings (/g4pet/digi/) of this thread.
+  AirPetDigitizer &GetDigitizer() { return fDigitizer; }
+
+  // Optical photon readout settings (/g4pet/optical/) of this thread.
+  const AirPetOpticalReadout &GetOpticalReadout() const { return fOpticalReadout; }
+
+  // Event range of this shard (/g4pet/run/shard and /g4pet/run/beamOn).
+  // Output EventIDs are global: the shard's first event plus the local ID.
+  G4int GetGlobalEventID(G4int eventID) const { return fFirstEvent + eventID; }
+
+  // Reseeds the random engine from the global seed, the run ID and the
+  // global EventID, so each event has the same random stream whichever
+  // shard or thread simulates it. Does nothing without /g4pet/run/seed.
+  void SeedEvent(G4int eventID) const;
+
+  // Whether a resumed run (/g4pet/run/resume) finds the rows of this global
+  // EventID already in the output file. Such events are not simulated again.
+  G4bool WasWrittenBefore(G4int globalEventID) const;
+
+  // Called by the EventAction after each event (global EventID); writes
+  // buffers that have reached the chunk size and takes the periodic
+  // checkpoints.
+  void EndOfEventFlush(G4int eventID);
+
 private:
+  G4String GetOutputFileName() const;
+  AirPetOutputFile &GetOutputFile();
+  // Writes (or queues for the output writer) the rows of this thread, and
+  // with saveCheckpoint the checkpoint after them.
+  void FlushBuffers(G4bool saveCheckpoint = false);
+  void TruncateToCheckpoint();
+  void WriteChannelMap();
+  void WriteNameTable();
+  void WriteProfile();
+  void WriteStacking();
+  void WriteShardManifest(const G4Run *aRun);
+  void BeamOnShard(G4long totalEvents);
+
   G4UIdirectory *fG4petDir;
   G4UIdirectory *fRunDir;
   G4UIcommand *fSaveParticlesCmd;
   G4UIcommand *fSaveHitsCmd;
   G4UIcmdWithADoubleAndUnit *fHitEnergyThresholdCmd;
+  G4UIcmdWithAString *fOutputFileCmd;
+  G4UIcmdWithAnInteger *fCompressionCmd;
+  G4UIcmdWithAnInteger *fChunkSizeCmd;
+  G4UIcmdWithAnInteger *fQueueDepthCmd;
+  G4UIcmdWithAString *fHitsFormatCmd;
+  G4UIcmdWithAnInteger *fMinHitsCmd;
+  G4UIcmdWithADoubleAndUnit *fMinEventEdepCmd;
+  G4UIcommand *fRequireMultipleSDsCmd;
+  G4UIcommand *fShardCmd;
+  G4UIcommand *fSeedCmd;
+  G4UIcommand *fBeamOnCmd;
+  G4UIcmdWithAnInteger *fCheckpointEveryCmd;
+  G4UIcommand *fResumeCmd;
+
+  EventAction *fMasterEventAction;
+  AirPetAnnihilationSource *fMasterSource;
+  AirPetStackingAction *fMasterStacking;
 
   G4bool fSaveParticles;
   G4bool fSaveHits;
   G4double fHitEnergyThreshold;
+  G4bool fSummedHits;
+  G4int fMinHitsPerEvent;
+  G4double fMinEventEdep;
+  G4bool fRequireMultipleSDs;
+
+  G4String fOutputFileName;
+  G4int fCompressionLevel;
+  G4int fChunkRows;
+  G4int fOutputQueueDepth;   // batches queued for the I/O thread (0 = synchronous writes)
+
+  // Sharding: this process simulates events [fFirstEvent, fFirstEvent +
+  // events of the run) of fTotalEvents. fRunSeed is the global seed in use
+  // for the current run (0 = Geant4's own seeding).
+  G4int fShardIndex;
+  G4int fShardCount;
+  std::uint64_t fGlobalSeed;
+  std::uint64_t fRunSeed;
+  G4int fRunID;
+  G4int fFirstEvent;
+  G4long fTotalEvents;
+  G4bool fShardBeamOn;
+  // Event range of the shard, of which a resumed run only simulates
+  // [fFirstEvent, fRangeEnd).
+  G4long fRangeBegin;
+  G4long fRangeEnd;
+
+  // Checkpointing (master): events per checkpoint (0 = off), and the
+  // checkpoint a resumed run continues.
+  G4int fCheckpointEvery;
+  G4bool fResume;
+  G4bool fResuming;
+  AirPetCheckpoint::State fResumeState;
+  AirPetCheckpoint fCheckpoint;
+  G4String fCheckpointFileName;
+  // Per thread: events whose rows are buffered but not yet written, and the
+  // last checkpoint generation seen.
+  std::vector<G4int> fPendingEvents;
+  G4int fCheckpointGeneration;
+
+  AirPetOutputFile fOutputFile;
+  AirPetOutputWriter fOutputWriter;
+  AirPetNtupleBuffer fTracksBuffer;
+  AirPetNtupleBuffer fHitsBuffer;
+  AirPetNtupleBuffer fCrystalEdepBuffer;
+  AirPetNtupleBuffer fLORsBuffer;
+  AirPetNtupleBuffer fPhotonCountsBuffer;
+  AirPetNtupleBuffer fPhotonTimesBuffer;
+  AirPetDigitizer fDigitizer;
+  AirPetOpticalReadout fOpticalReadout;
+  AirPetScorer fScorer;
+  AirPetProfiler fProfiler;
+  AirPetLiveStream fLiveStream;
+  G4int fTracksNtupleID;
+  G4int fHitsNtupleID;
+  G4int fCrystalEdepNtupleID;
+  G4int fNamesNtupleID;
+  G4int fChannelsNtupleID;
+  G4int fLORsNtupleID;
+  G4int fPhotonCountsNtupleID;
+  G4int fPhotonTimesNtupleID;
+  G4int fProfileNtupleID;
+  G4int fStackingNtupleID;
+
+  // Wall time of the event loop, reported by the master (airpet-bench
+  // parses this line).
+  std::chrono::steady_clock::time_point fRunStartTime;
+
+  // Master run action of the current run, whose file and ntuple IDs the
+  // worker threads use.
+  static RunAction *fMasterRunAction;
 };
 
 #endif
\ No newline at end of file
@@ -4,19 +4,25 @@
 #include "G4UserSteppingAction.hh"
 #include "globals.hh"
 
+class EventAction;
+
 /// User stepping action class.
 ///
 /// It is invoked at every step of every particle.
 /// Here, its main purpose is to catch the creation of secondary particles
-/// and attach information about the parent track to them.
+/// and attach information about the parent track to them. This is skipped
+/// when the EventAction reports that parent momenta are not needed.
 
 class SteppingAction : public G4UserSteppingAction
 {
 public:
-  SteppingAction();
+  SteppingAction(const EventAction* eventAction);
   virtual ~SteppingAction();
 
   virtual void UserSteppingAction(const G4Step* step) override;
+
+private:
+  const EventAction* fEventAction;
 };
 
 #endif
@@ -4,19 +4,25 @@
 #include "G4UserTrackingAction.hh"
 #include "globals.hh"
 
+class EventAction;
+
 /// User tracking action class.
 ///
 /// Its main purpose is to instantiate our custom AirPetTrajectory object
-/// for each track, ensuring that detailed information is stored.
+/// for each track, with the level of detail (none, summary or full points)
+/// that the EventAction chose for the current event.
 
 class TrackingAction : public G4UserTrackingAction
 {
 public:
-  TrackingAction();
+  TrackingAction(const EventAction* eventAction);
   virtual ~TrackingAction();
 
   virtual void PreUserTrackingAction(const G4Track* aTrack) override;
   virtual void PostUserTrackingAction(const G4Track* aTrack) override;
+
+private:
+  const EventAction* fEventAction;
 };
 
 #endif
@@ -5,18 +5,117 @@
 #include "G4VisExecutive.hh"
 
 #include "ActionInitialization.hh"
+#include "AirPetPhysicsCache.hh"
+#include "AirPetServer.hh"
 #include "DetectorConstruction.hh"
 
 // Physics Lists
 #include "G4PhysListFactory.hh"
 #include "G4VModularPhysicsList.hh"
+#include "G4FastSimulationPhysics.hh"
 #include "G4OpticalPhysics.hh"
+#include "G4StepLimiterPhysics.hh"
+
+#include <csignal>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+void PrintUsage() {
+  G4cerr << "Usage: airpet-sim [--run-manager serial|mt|tasking] [--threads N] [--shard k/N] [--resume] [--serve socket] [macro]" << G4endl;
+  G4cerr << "  --run-manager  Run manager type (default: serial, or G4RUN_MANAGER_TYPE)" << G4endl;
+  G4cerr << "  --threads      Number of worker threads for mt/tasking (can also be set" << G4endl;
+  G4cerr << "                 with /run/numberOfThreads before /run/initialize)" << G4endl;
+  G4cerr << "  --shard        Simulate shard k of N (0-based) of the events given to" << G4endl;
+  G4cerr << "                 /g4pet/run/beamOn; same as /g4pet/run/shard k N" << G4endl;
+  G4cerr << "  --resume       Continue from <output>.checkpoint (see /g4pet/run/checkpointEvery);" << G4endl;
+  G4cerr << "                 same as /g4pet/run/resume true" << G4endl;
+  G4cerr << "  --serve        Stay alive and run jobs sent over this Unix socket; the" << G4endl;
+  G4cerr << "                 macro, if given, is executed once before serving" << G4endl;
+}
+
+// Maps a command-line run manager name onto the Geant4 enum.
+G4bool ParseRunManagerType(const std::string& name, G4RunManagerType& type) {
+  if (name == "serial" || name == "Serial") {
+    type = G4RunManagerType::Serial;
+  } else if (name == "mt" || name == "MT") {
+    type = G4RunManagerType::MT;
+  } else if (name == "tasking" || name == "Tasking") {
+    type = G4RunManagerType::Tasking;
+  } else if (name == "default" || name == "Default") {
+    type = G4RunManagerType::Default;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// SIGTERM/SIGINT in batch mode end the run after the current events, so the
+// output file is closed and the last checkpoint written. A second signal
+// kills the process.
+void HandleTermination(int signal) {
+  AirPetServer::RequestAbort();
+  std::signal(signal, SIG_DFL);
+}
+
+} // namespace
 
 // Main program
 int main(int argc, char **argv) {
+  // --- Parse command-line options ---
+  // The run manager must be chosen before any macro is executed, so this
+  // cannot be a UI command. Serial remains the default for compatibility.
+  G4RunManagerType runManagerType = G4RunManagerType::Serial;
+  const char* envRunManager = std::getenv("G4RUN_MANAGER_TYPE");
+  if (envRunManager && !ParseRunManagerType(envRunManager, runManagerType)) {
+    G4cerr << "!!! WARNING: Unknown G4RUN_MANAGER_TYPE '" << envRunManager
+           << "'. Using serial." << G4endl;
+  }
+
+  G4int nThreads = 0;
+  G4String macroFile;
+  G4String serveSocket;
+  G4String shardCommand;
+  G4bool resume = false;
+  for (G4int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--run-manager" && i + 1 < argc) {
+      if (!ParseRunManagerType(argv[++i], runManagerType)) {
+        G4cerr << "!!! ERROR: Unknown run manager type '" << argv[i] << "'." << G4endl;
+        PrintUsage();
+        return 1;
+      }
+    } else if (arg == "--threads" && i + 1 < argc) {
+      nThreads = std::atoi(argv[++i]);
+    } else if (arg == "--shard" && i + 1 < argc) {
+      const std::string spec = argv[++i];
+      const size_t slash = spec.find('/');
+      if (slash == std::string::npos) {
+        G4cerr << "!!! ERROR: Expected --shard k/N, got '" << spec << "'." << G4endl;
+        PrintUsage();
+        return 1;
+      }
+      shardCommand = "/g4pet/run/shard " + spec.substr(0, slash) + " " + spec.substr(slash + 1);
+    } else if (arg == "--resume") {
+      resume = true;
+    } else if (arg == "--serve" && i + 1 < argc) {
+      serveSocket = argv[++i];
+    } else if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    } else if (macroFile.empty() && arg.rfind("--", 0) != 0) {
+      macroFile = arg;
+    } else {
+      G4cerr << "!!! ERROR: Unrecognized argument '" << arg << "'." << G4endl;
+      PrintUsage();
+      return 1;
+    }
+  }
+
   // Detect interactive mode (if no macro file is specified)
   G4UIExecutive *ui = nullptr;
-  if (argc == 1) {
+  if (macroFile.empty() && serveSocket.empty()) {
     ui = new G4UIExecutive(argc, argv);
   }
 
@@ -24,9 +123,14 @@ int main(int argc, char **argv) {
   G4int precision = 4;
   G4SteppingVerbose::UseBestUnit(precision);
 
-  // Construct the default run manager
-  auto *runManager =
-      G4RunManagerFactory::CreateRunManager(G4RunManagerType::Serial);
+  // Construct the run manager. For MT/tasking, a single geometry and physics
+  // build is shared by all worker threads.
+  auto *runManager = G4RunManagerFactory::CreateRunManager(runManagerType);
+  if (nThreads > 0) {
+    // Ignored by the serial run manager; /run/numberOfThreads in the macro
+    // still overrides this if it appears before /run/initialize.
+    runManager->SetNumberOfThreads(nThreads);
+  }
 
   // Set mandatory initialization classes
   // 1. DetectorConstruction
@@ -46,18 +150,35 @@ int main(int argc, char **argv) {
   G4VModularPhysicsList* physicsList = factory.GetReferencePhysList(physListName);
   if (!physicsList) {
     G4cerr << "!!! ERROR: Physics list '" << physListName << "' not found. Falling back to FTFP_BERT." << G4endl;
-    physicsList = factory.GetReferencePhysList("FTFP_BERT");
+    physListName = "FTFP_BERT";
+    physicsList = factory.GetReferencePhysList(physListName);
   }
 
   // Check for Optical Physics
   const char* envOptical = std::getenv("G4OPTICALPHYSICS");
-  if (envOptical && (std::string(envOptical) == "on" || std::string(envOptical) == "true")) {
+  const G4bool opticalPhysics =
+      envOptical && (std::string(envOptical) == "on" || std::string(envOptical) == "true");
+  if (opticalPhysics) {
     G4cout << "--> Registering G4OpticalPhysics..." << G4endl;
     physicsList->RegisterPhysics(new G4OpticalPhysics());
   }
 
+  // Applies the step limits of /g4pet/detector/setRegionStepLimit; without
+  // any limits it costs nothing.
+  physicsList->RegisterPhysics(new G4StepLimiterPhysics());
+
+  // Lets the electron models of /g4pet/detector/setFastSim act; electrons
+  // outside their regions only see a region lookup per step.
+  auto *fastSimulationPhysics = new G4FastSimulationPhysics();
+  fastSimulationPhysics->ActivateFastSimulation("e-");
+  physicsList->RegisterPhysics(fastSimulationPhysics);
+
   runManager->SetUserInitialization(physicsList);
 
+  // Reuses the physics tables of earlier jobs with the same physics list,
+  // materials and cuts (/g4pet/physics/).
+  auto *physicsCache = new AirPetPhysicsCache(physicsList, physListName, opticalPhysics);
+
   // 3. User action initialization
   runManager->SetUserInitialization(new ActionInitialization());
 
@@ -67,11 +188,28 @@ int main(int argc, char **argv) {
   // Get the pointer to the User Interface manager
   G4UImanager *UImanager = G4UImanager::GetUIpointer();
 
-  if (!ui) {
+  // The shard applies to every /g4pet/run/beamOn of the macro.
+  if (!shardCommand.empty() && UImanager->ApplyCommand(shardCommand) != 0) {
+    G4cerr << "!!! ERROR: Invalid shard '" << shardCommand << "'." << G4endl;
+    delete runManager;
+    return 1;
+  }
+  if (resume) UImanager->ApplyCommand("/g4pet/run/resume true");
+
+  G4int exitCode = 0;
+  if (!serveSocket.empty()) {
+    // --- SERVER MODE ---
+    // An optional startup macro (e.g. /run/initialize) builds physics once;
+    // the jobs then reuse it.
+    if (!macroFile.empty()) UImanager->ApplyCommand("/control/execute " + macroFile);
+    AirPetServer server(serveSocket, physListName, opticalPhysics);
+    exitCode = server.Serve();
+  } else if (!ui) {
     // Batch mode: execute the macro file provided as the first argument
+    std::signal(SIGTERM, HandleTermination);
+    std::signal(SIGINT, HandleTermination);
     G4String command = "/control/execute ";
-    G4String fileName = argv[1];
-    UImanager->ApplyCommand(command + fileName);
+    UImanager->ApplyCommand(command + macroFile);
   } else {
     // --- INTERACTIVE MODE ---
     // Initialize visualization
@@ -87,8 +225,9 @@ int main(int argc, char **argv) {
   }
 
   // Job termination
+  delete physicsCache;
   delete visManager;
   delete runManager;
 
-  return 0;
+  return exitCode;
 }
\ No newline at end of file
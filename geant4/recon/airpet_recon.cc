@@ -0,0 +1,406 @@
+// airpet-recon: listmode OSEM reconstruction of the LORs of a simulation.
+//
+// Reads the LORs either from the LORs ntuple of an airpet-sim output file
+// (/default_ntuples/LORs, written with /g4pet/digi/enable) or from an HDF5
+// file with start_coords / end_coords datasets (N x 3, mm), and writes
+// reconstruction.h5 in the layout the web application reads ("image",
+// x slowest, plus "sensitivity" when a sensitivity image is given).
+//
+// The projector is the Joseph line integral of AirPetJosephProjector.hh
+// (as in parallelproj), so results match the Python path. LOR coordinates are kept
+// as structure-of-arrays; events are distributed over OpenMP threads, and
+// every thread backprojects into its own image, summed after each subset.
+// Subsets are interleaved (event i goes to subset i mod S); with S = 1 this
+// is plain listmode MLEM.
+
+#include "AirPetJosephProjector.hh"
+
+#include <hdf5.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+  std::string lorsPath;
+  std::string outputPath = "reconstruction.h5";
+  std::string sensitivityPath;
+  int shape[3] = {128, 128, 128};
+  double voxelSize[3] = {2., 2., 2.};
+  int iterations = 1;
+  int subsets = 1;
+  int threads = 0;
+};
+
+// Listmode events, structure-of-arrays. Weight is the event weight of a
+// biased source (1 if the file has none).
+struct LORs {
+  std::vector<float> x0, y0, z0, x1, y1, z1;
+  std::vector<float> weight;
+  size_t size() const { return x0.size(); }
+};
+
+void PrintUsage() {
+  std::cerr << "Usage: airpet-recon --lors FILE [options]\n"
+            << "  --lors FILE          airpet-sim output (LORs ntuple) or HDF5 with start_coords/end_coords\n"
+            << "  --output FILE        output file (default: reconstruction.h5)\n"
+            << "  --sensitivity FILE   sensitivity.h5 with a 'sensitivity' dataset (default: none)\n"
+            << "  --shape NX NY NZ     image size in voxels (default: 128 128 128)\n"
+            << "  --voxel-size X Y Z   voxel size in mm (default: 2 2 2)\n"
+            << "  --iterations N       OSEM iterations (default: 1)\n"
+            << "  --subsets S          subsets per iteration (default: 1 = MLEM)\n"
+            << "  --threads N          OpenMP threads (default: all)\n";
+}
+
+// --- HDF5 input/output ---
+
+bool Exists(hid_t file, const char* path) {
+  htri_t exists = 0;
+  H5E_BEGIN_TRY { exists = H5Lexists(file, path, H5P_DEFAULT); } H5E_END_TRY;
+  if (exists <= 0) return false;
+  // H5Lexists only checks the last link, so check the object too.
+  H5E_BEGIN_TRY { exists = H5Oexists_by_name(file, path, H5P_DEFAULT); } H5E_END_TRY;
+  return exists > 0;
+}
+
+// Reads a whole dataset as floats; returns false if missing. dims gets the
+// dataset shape.
+bool ReadFloats(hid_t file, const char* path, std::vector<float>& data, std::vector<hsize_t>& dims) {
+  if (!Exists(file, path)) return false;
+  hid_t dataset = H5Dopen2(file, path, H5P_DEFAULT);
+  if (dataset < 0) return false;
+  hid_t space = H5Dget_space(dataset);
+  const int rank = H5Sget_simple_extent_ndims(space);
+  dims.assign(std::max(rank, 0), 0);
+  if (rank > 0) H5Sget_simple_extent_dims(space, dims.data(), nullptr);
+  const hssize_t count = H5Sget_simple_extent_npoints(space);
+  data.resize(static_cast<size_t>(std::max<hssize_t>(count, 0)));
+  herr_t status = data.empty() ? 0
+                               : H5Dread(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+  H5Sclose(space);
+  H5Dclose(dataset);
+  return status >= 0;
+}
+
+// Ntuple column of the custom layout: /default_ntuples/<nt>/<col>/pages,
+// valid up to /default_ntuples/<nt>/entries.
+bool ReadColumn(hid_t file, const std::string& ntuple, const char* column, size_t entries,
+                std::vector<float>& data) {
+  std::vector<hsize_t> dims;
+  const std::string path = "/default_ntuples/" + ntuple + "/" + column + "/pages";
+  if (!ReadFloats(file, path.c_str(), data, dims)) return false;
+  data.resize(std::min(data.size(), entries));
+  return true;
+}
+
+bool ReadLORs(const std::string& path, LORs& lors) {
+  hid_t file = -1;
+  H5E_BEGIN_TRY { file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT); } H5E_END_TRY;
+  if (file < 0) {
+    std::cerr << "airpet-recon: cannot open " << path << "\n";
+    return false;
+  }
+
+  bool ok = false;
+  if (Exists(file, "/default_ntuples/LORs/entries")) {
+    long long entries = 0;
+    hid_t dataset = H5Dopen2(file, "/default_ntuples/LORs/entries", H5P_DEFAULT);
+    H5Dread(dataset, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &entries);
+    H5Dclose(dataset);
+    const size_t n = static_cast<size_t>(std::max(0LL, entries));
+    ok = ReadColumn(file, "LORs", "StartX", n, lors.x0) && ReadColumn(file, "LORs", "StartY", n, lors.y0) &&
+         ReadColumn(file, "LORs", "StartZ", n, lors.z0) && ReadColumn(file, "LORs", "EndX", n, lors.x1) &&
+         ReadColumn(file, "LORs", "EndY", n, lors.y1) && ReadColumn(file, "LORs", "EndZ", n, lors.z1);
+    if (ok && !ReadColumn(file, "LORs", "Weight", n, lors.weight)) lors.weight.clear();
+  } else {
+    std::vector<float> start, end;
+    std::vector<hsize_t> startDims, endDims;
+    ok = ReadFloats(file, "start_coords", start, startDims) && ReadFloats(file, "end_coords", end, endDims) &&
+         startDims.size() == 2 && startDims[1] == 3 && startDims == endDims;
+    if (ok) {
+      const size_t n = startDims[0];
+      for (auto* column : {&lors.x0, &lors.y0, &lors.z0, &lors.x1, &lors.y1, &lors.z1}) column->resize(n);
+      for (size_t i = 0; i < n; ++i) {
+        lors.x0[i] = start[3 * i];
+        lors.y0[i] = start[3 * i + 1];
+        lors.z0[i] = start[3 * i + 2];
+        lors.x1[i] = end[3 * i];
+        lors.y1[i] = end[3 * i + 1];
+        lors.z1[i] = end[3 * i + 2];
+      }
+      std::vector<hsize_t> weightDims;
+      if (!ReadFloats(file, "weights", lors.weight, weightDims) || lors.weight.size() != n) lors.weight.clear();
+    }
+  }
+  H5Fclose(file);
+
+  if (!ok) {
+    std::cerr << "airpet-recon: " << path << " has neither a LORs ntuple nor start_coords/end_coords\n";
+    return false;
+  }
+  const size_t n = lors.x0.size();
+  if (lors.y0.size() != n || lors.z0.size() != n || lors.x1.size() != n || lors.y1.size() != n ||
+      lors.z1.size() != n) {
+    std::cerr << "airpet-recon: LOR columns of " << path << " differ in length\n";
+    return false;
+  }
+  if (lors.weight.empty()) lors.weight.assign(n, 1.f);
+  return true;
+}
+
+bool ReadSensitivity(const std::string& path, const AirPetImageGrid& grid, std::vector<float>& sensitivity) {
+  hid_t file = -1;
+  H5E_BEGIN_TRY { file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT); } H5E_END_TRY;
+  if (file < 0) {
+    std::cerr << "airpet-recon: cannot open " << path << "\n";
+    return false;
+  }
+  std::vector<hsize_t> dims;
+  const bool ok = ReadFloats(file, "sensitivity", sensitivity, dims);
+  H5Fclose(file);
+  if (!ok || dims.size() != 3 || static_cast<int>(dims[0]) != grid.n[0] ||
+      static_cast<int>(dims[1]) != grid.n[1] || static_cast<int>(dims[2]) != grid.n[2]) {
+    std::cerr << "airpet-recon: " << path << " has no sensitivity image of shape " << grid.n[0] << " x "
+              << grid.n[1] << " x " << grid.n[2] << "\n";
+    return false;
+  }
+  return true;
+}
+
+void WriteAttribute(hid_t object, const char* name, hid_t type, size_t count, const void* value) {
+  const hsize_t dims[1] = {count};
+  hid_t space = count == 1 ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, dims, nullptr);
+  hid_t attribute = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attribute, type, value);
+  H5Aclose(attribute);
+  H5Sclose(space);
+}
+
+hid_t WriteImage(hid_t file, const char* name, const AirPetImageGrid& grid, const std::vector<float>& image) {
+  const hsize_t dims[3] = {static_cast<hsize_t>(grid.n[0]), static_cast<hsize_t>(grid.n[1]),
+                           static_cast<hsize_t>(grid.n[2])};
+  hid_t space = H5Screate_simple(3, dims, nullptr);
+  hid_t dataset = H5Dcreate2(file, name, H5T_IEEE_F32LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  H5Dwrite(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, image.data());
+  H5Sclose(space);
+  return dataset;
+}
+
+bool WriteOutput(const Options& options, const AirPetImageGrid& grid, const std::vector<float>& image,
+                 const std::vector<float>& sensitivity, float threshold) {
+  hid_t file = H5Fcreate(options.outputPath.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (file < 0) {
+    std::cerr << "airpet-recon: cannot create " << options.outputPath << "\n";
+    return false;
+  }
+  hid_t dataset = WriteImage(file, "image", grid, image);
+  WriteAttribute(dataset, "voxel_size", H5T_NATIVE_DOUBLE, 3, options.voxelSize);
+  WriteAttribute(dataset, "origin", H5T_NATIVE_FLOAT, 3, grid.origin);
+  const long long iterations = options.iterations;
+  const long long subsets = options.subsets;
+  const signed char normalization = sensitivity.empty() ? 0 : 1;
+  WriteAttribute(dataset, "iterations", H5T_NATIVE_LLONG, 1, &iterations);
+  WriteAttribute(dataset, "subsets", H5T_NATIVE_LLONG, 1, &subsets);
+  WriteAttribute(dataset, "normalization", H5T_NATIVE_SCHAR, 1, &normalization);
+  H5Dclose(dataset);
+
+  if (!sensitivity.empty()) {
+    hid_t sens = WriteImage(file, "sensitivity", grid, sensitivity);
+    WriteAttribute(sens, "threshold", H5T_NATIVE_FLOAT, 1, &threshold);
+    H5Dclose(sens);
+  }
+  H5Fclose(file);
+  return true;
+}
+
+// --- OSEM ---
+
+int NumThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+int ThreadNumber() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Threads of the current parallel region; may be fewer than NumThreads().
+int TeamSize() {
+#ifdef _OPENMP
+  return omp_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+// One OSEM sub-iteration: backprojects weight / (forward projection of the
+// image) over the events of the subset into backprojection.
+void BackprojectRatio(const AirPetImageGrid& grid, const LORs& lors, int subset, int subsets,
+                      const std::vector<float>& image, std::vector<std::vector<float>>& threadImages,
+                      std::vector<float>& backprojection) {
+  const long long n = static_cast<long long>(lors.size());
+  const size_t voxels = grid.voxels();
+
+#pragma omp parallel
+  {
+    std::vector<float>& local = threadImages[ThreadNumber()];
+    std::fill(local.begin(), local.end(), 0.f);
+
+#pragma omp for schedule(dynamic, 4096)
+    for (long long i = subset; i < n; i += subsets) {
+      const float p0[3] = {lors.x0[i], lors.y0[i], lors.z0[i]};
+      const float p1[3] = {lors.x1[i], lors.y1[i], lors.z1[i]};
+      float expected = 0.f;
+      AirPetTraceLOR(grid, p0, p1, [&](size_t voxel, float w) { expected += w * image[voxel]; });
+      // LORs that miss the image (or its support) add nothing.
+      if (!(expected > 0.f)) continue;
+      const float ratio = lors.weight[i] / expected;
+      AirPetTraceLOR(grid, p0, p1, [&](size_t voxel, float w) { local[voxel] += w * ratio; });
+    }
+
+    // Only this team's buffers were zeroed above; the others may hold an
+    // earlier sub-iteration.
+    const int team = TeamSize();
+#pragma omp for schedule(static)
+    for (long long v = 0; v < static_cast<long long>(voxels); ++v) {
+      float sum = 0.f;
+      for (int t = 0; t < team; ++t) sum += threadImages[t][v];
+      backprojection[v] = sum;
+    }
+  }
+}
+
+bool ParseArgs(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    // Number of values each option takes.
+    int count = 0;
+    if (arg == "--lors" || arg == "--output" || arg == "--sensitivity" || arg == "--iterations" ||
+        arg == "--subsets" || arg == "--threads") {
+      count = 1;
+    } else if (arg == "--shape" || arg == "--voxel-size") {
+      count = 3;
+    } else if (arg == "--help" || arg == "-h") {
+      PrintUsage();
+      std::exit(0);
+    } else {
+      std::cerr << "airpet-recon: unknown option " << arg << "\n";
+      PrintUsage();
+      return false;
+    }
+    if (i + count >= argc) {
+      std::cerr << "airpet-recon: " << arg << " needs " << count << " value(s)\n";
+      return false;
+    }
+
+    if (arg == "--lors") {
+      options.lorsPath = argv[++i];
+    } else if (arg == "--output") {
+      options.outputPath = argv[++i];
+    } else if (arg == "--sensitivity") {
+      options.sensitivityPath = argv[++i];
+    } else if (arg == "--iterations") {
+      options.iterations = std::atoi(argv[++i]);
+    } else if (arg == "--subsets") {
+      options.subsets = std::atoi(argv[++i]);
+    } else if (arg == "--threads") {
+      options.threads = std::atoi(argv[++i]);
+    } else if (arg == "--shape") {
+      for (int k = 0; k < 3; ++k) options.shape[k] = std::atoi(argv[++i]);
+    } else {
+      for (int k = 0; k < 3; ++k) options.voxelSize[k] = std::atof(argv[++i]);
+    }
+  }
+  if (options.lorsPath.empty()) {
+    PrintUsage();
+    return false;
+  }
+  for (int k = 0; k < 3; ++k) {
+    if (options.shape[k] <= 0 || options.voxelSize[k] <= 0.) {
+      std::cerr << "airpet-recon: image shape and voxel size must be positive\n";
+      return false;
+    }
+  }
+  if (options.iterations < 0 || options.subsets < 1) {
+    std::cerr << "airpet-recon: need iterations >= 0 and subsets >= 1\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseArgs(argc, argv, options)) return 2;
+#ifdef _OPENMP
+  if (options.threads > 0) omp_set_num_threads(options.threads);
+#endif
+
+  const AirPetImageGrid grid = AirPetImageGrid::Centred(options.shape, options.voxelSize);
+  const size_t voxels = grid.voxels();
+
+  LORs lors;
+  if (!ReadLORs(options.lorsPath, lors)) return 1;
+  std::cout << "airpet-recon: " << lors.size() << " LORs, image " << grid.n[0] << " x " << grid.n[1] << " x "
+            << grid.n[2] << ", " << options.iterations << " iteration(s) x " << options.subsets
+            << " subset(s), " << NumThreads() << " thread(s)" << std::endl;
+
+  // Without a sensitivity image every voxel gets the same sensitivity (the
+  // Python path's normalization off).
+  std::vector<float> sensitivity;
+  float threshold = 0.f;
+  if (!options.sensitivityPath.empty()) {
+    if (!ReadSensitivity(options.sensitivityPath, grid, sensitivity)) return 1;
+    threshold = 1e-3f * *std::max_element(sensitivity.begin(), sensitivity.end());
+  }
+
+  std::vector<float> image(voxels, 1.f);
+  std::vector<float> backprojection(voxels, 0.f);
+  std::vector<std::vector<float>> threadImages(NumThreads(), std::vector<float>(voxels, 0.f));
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int iteration = 0; iteration < options.iterations; ++iteration) {
+    for (int subset = 0; subset < options.subsets; ++subset) {
+      BackprojectRatio(grid, lors, subset, options.subsets, image, threadImages, backprojection);
+      // Each subset sees 1/S of the events, hence of the sensitivity.
+      const float subsetsF = static_cast<float>(options.subsets);
+#pragma omp parallel for schedule(static)
+      for (long long v = 0; v < static_cast<long long>(voxels); ++v) {
+        if (sensitivity.empty()) {
+          image[v] *= subsetsF * backprojection[v];
+        } else if (sensitivity[v] >= threshold && sensitivity[v] > 0.f) {
+          image[v] *= subsetsF * backprojection[v] / sensitivity[v];
+        } else {
+          image[v] = 0.f;
+        }
+      }
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "airpet-recon: iteration " << iteration + 1 << "/" << options.iterations << " done ("
+              << seconds << " s)" << std::endl;
+  }
+
+  if (!WriteOutput(options, grid, image, sensitivity, threshold)) return 1;
+  std::cout << "airpet-recon: wrote " << options.outputPath << std::endl;
+  return 0;
+}
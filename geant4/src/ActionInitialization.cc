@@ -2,6 +2,8 @@
 
 // These are the action classes we are about to create in the next steps.
 // We include their headers here with the assumption they will exist.
+#include "AirPetAnnihilationSource.hh"
+#include "AirPetStackingAction.hh"
 #include "PrimaryGeneratorAction.hh"
 #include "RunAction.hh"
 #include "EventAction.hh"
@@ -20,9 +22,12 @@ void ActionInitialization::BuildForMaster() const
 {
   // The master thread manages the overall run. It does not process individual
   // events, so it only needs a RunAction.
-  // We pass a new EventAction instance to it to satisfy the constructor.
-  auto* eventAction = new EventAction();
-  SetUserAction(new RunAction());
+  // The master RunAction owns an EventAction, an annihilation source and a
+  // stacking action that are never used: they only exist so that the
+  // /g4pet/event/, /g4pet/source/ and /g4pet/stack/ commands are known to
+  // the master UI manager and get broadcast to the workers.
+  SetUserAction(new RunAction(new EventAction(), new AirPetAnnihilationSource(),
+                              new AirPetStackingAction()));
 }
 
 void ActionInitialization::Build() const
@@ -33,17 +38,25 @@ void ActionInitialization::Build() const
   // Primary particles are generated here.
   SetUserAction(new PrimaryGeneratorAction());
 
-  // The EventAction is created once per thread.
-  auto* eventAction = new EventAction();
-  SetUserAction(eventAction);
+  // The RunAction is created per thread and owns the thread's output
+  // buffers. Worker run actions do not own the EventAction; the worker run
+  // manager deletes it.
+  auto* runAction = new RunAction();
+  SetUserAction(runAction);
 
-  // The RunAction is also created per thread and takes the thread-local
-  // EventAction pointer. This allows it to access event data.
-  SetUserAction(new RunAction());
+  // The EventAction is created once per thread and fills the buffers of the
+  // RunAction above.
+  auto* eventAction = new EventAction(runAction);
+  SetUserAction(eventAction);
 
   // SteppingAction is called for every step in the simulation.
-  SetUserAction(new SteppingAction());
+  SetUserAction(new SteppingAction(eventAction));
 
   // TrackingAction is called at the beginning and end of every track.
-  SetUserAction(new TrackingAction());
+  // It reads the per-event trajectory mode from the EventAction.
+  SetUserAction(new TrackingAction(eventAction));
+
+  // The stacking action kills or defers secondaries (/g4pet/stack/); with
+  // no rules set, every track is urgent as without it.
+  SetUserAction(new AirPetStackingAction());
 }
\ No newline at end of file
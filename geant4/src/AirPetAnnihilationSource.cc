@@ -0,0 +1,137 @@
+#include "AirPetAnnihilationSource.hh"
+
+#include "G4Event.hh"
+#include "G4Gamma.hh"
+#include "G4GeneralParticleSource.hh"
+#include "G4GeneralParticleSourceData.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4PrimaryParticle.hh"
+#include "G4PrimaryVertex.hh"
+#include "G4SingleParticleSource.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4UIcmdWith3Vector.hh"
+#include "G4UIcmdWithADouble.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIdirectory.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  // FWHM of a Gaussian in units of its sigma.
+  const G4double kFWHMToSigma = 1. / (2. * std::sqrt(2. * std::log(2.)));
+}
+
+AirPetAnnihilationSource::AirPetAnnihilationSource()
+  : G4UImessenger(), fEnabled(false), fAcolinearitySigma(0.),
+    fAcceptanceCosTheta(1.), fAcceptanceAxis(0., 0., 1.), fGamma(nullptr)
+{
+  fSourceDir = new G4UIdirectory("/g4pet/source/");
+  fSourceDir->SetGuidance("Primary source selection and biasing.");
+
+  fTypeCmd = new G4UIcmdWithAString("/g4pet/source/type", this);
+  fTypeCmd->SetGuidance("gps: primaries from /gps/ as configured (default).");
+  fTypeCmd->SetGuidance("annihilation: two back-to-back 511 keV gammas per event at a GPS position.");
+  fTypeCmd->SetParameterName("type", false);
+  fTypeCmd->SetCandidates("gps annihilation");
+  fTypeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fAcolinearityCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/source/acolinearity", this);
+  fAcolinearityCmd->SetGuidance("FWHM of the Gaussian acolinearity of the two gammas (e.g. 0.5 deg).");
+  fAcolinearityCmd->SetParameterName("fwhm", false);
+  fAcolinearityCmd->SetUnitCategory("Angle");
+  fAcolinearityCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fAcceptanceCmd = new G4UIcmdWithADouble("/g4pet/source/acceptanceCosTheta", this);
+  fAcceptanceCmd->SetGuidance("Emit only with |cos(theta)| <= c around the acceptance axis (1 = no biasing).");
+  fAcceptanceCmd->SetGuidance("Events get the weight c.");
+  fAcceptanceCmd->SetParameterName("c", false);
+  fAcceptanceCmd->SetRange("c>0 && c<=1");
+  fAcceptanceCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fAxisCmd = new G4UIcmdWith3Vector("/g4pet/source/acceptanceAxis", this);
+  fAxisCmd->SetGuidance("Axis of the acceptance band (default: 0 0 1, the scanner axis).");
+  fAxisCmd->SetParameterName("x", "y", "z", false);
+  fAxisCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetAnnihilationSource::~AirPetAnnihilationSource()
+{
+  delete fTypeCmd;
+  delete fAcolinearityCmd;
+  delete fAcceptanceCmd;
+  delete fAxisCmd;
+  delete fSourceDir;
+}
+
+void AirPetAnnihilationSource::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fTypeCmd) {
+    fEnabled = (newValue == "annihilation");
+  } else if (command == fAcolinearityCmd) {
+    fAcolinearitySigma = fAcolinearityCmd->GetNewDoubleValue(newValue) * kFWHMToSigma;
+  } else if (command == fAcceptanceCmd) {
+    fAcceptanceCosTheta = fAcceptanceCmd->GetNewDoubleValue(newValue);
+  } else if (command == fAxisCmd) {
+    G4ThreeVector axis = fAxisCmd->GetNew3VectorValue(newValue);
+    if (axis.mag2() > 0.) fAcceptanceAxis = axis.unit();
+  }
+}
+
+G4ThreeVector AirPetAnnihilationSource::SampleDirection() const
+{
+  // Uniform on the band |cos(theta)| <= c, i.e. isotropic for c = 1.
+  const G4double cosTheta = fAcceptanceCosTheta * (2. * G4UniformRand() - 1.);
+  const G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta * cosTheta));
+  const G4double phi = twopi * G4UniformRand();
+  G4ThreeVector direction(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+  direction.rotateUz(fAcceptanceAxis);
+  return direction;
+}
+
+void AirPetAnnihilationSource::GeneratePrimaryVertex(G4Event* event, G4GeneralParticleSource* gps)
+{
+  if (!fGamma) fGamma = G4Gamma::Definition();
+
+  // Pick a GPS source by intensity; only its position and time are used.
+  // The shared source list is only read here.
+  G4GeneralParticleSourceData* sources = G4GeneralParticleSourceData::Instance();
+  G4SingleParticleSource* source = gps->GetCurrentSource();
+  const G4int nSources = sources->GetSourceVectorSize();
+  if (nSources > 1) {
+    G4double total = 0.;
+    for (G4int i = 0; i < nSources; ++i) total += sources->GetIntensity(i);
+    G4double pick = total * G4UniformRand();
+    for (G4int i = 0; i < nSources; ++i) {
+      source = sources->GetCurrentSource(i);
+      pick -= sources->GetIntensity(i);
+      if (pick < 0.) break;
+    }
+  }
+
+  const G4ThreeVector position = source->GetPosDist()->GenerateOne();
+  auto* vertex = new G4PrimaryVertex(position, source->GetParticleTime());
+
+  const G4ThreeVector direction = SampleDirection();
+  G4ThreeVector opposite = -direction;
+  if (fAcolinearitySigma > 0.) {
+    // Tilt the second gamma by a small Gaussian angle in a random plane.
+    const G4double deviation = G4RandGauss::shoot(0., fAcolinearitySigma);
+    opposite.rotate(deviation, direction.orthogonal().rotate(twopi * G4UniformRand(), direction));
+  }
+
+  const G4double energy = electron_mass_c2;
+  auto* gamma1 = new G4PrimaryParticle(fGamma);
+  gamma1->SetKineticEnergy(energy);
+  gamma1->SetMomentumDirection(direction);
+  auto* gamma2 = new G4PrimaryParticle(fGamma);
+  gamma2->SetKineticEnergy(energy);
+  gamma2->SetMomentumDirection(opposite);
+  vertex->SetPrimary(gamma1);
+  vertex->SetPrimary(gamma2);
+
+  vertex->SetWeight(fAcceptanceCosTheta);
+  event->AddPrimaryVertex(vertex);
+}
@@ -0,0 +1,136 @@
+#include "AirPetChannelMap.hh"
+#include "AirPetNameTable.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4VTouchable.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <functional>
+
+G4ThreadLocal AirPetChannelMap* AirPetChannelMap::fInstance = nullptr;
+
+AirPetChannelMap* AirPetChannelMap::Instance()
+{
+  if (!fInstance) fInstance = new AirPetChannelMap();
+  return fInstance;
+}
+
+std::size_t AirPetChannelMap::KeyHash::operator()(const Key& key) const
+{
+  std::size_t h = std::hash<G4int>()(key.depth);
+  for (G4int d = 0; d < key.depth; ++d) {
+    h ^= std::hash<const void*>()(key.volumes[d]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= std::hash<G4int>()(key.copies[d]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  }
+  return h;
+}
+
+void AirPetChannelMap::Clear()
+{
+  fChannels.clear();
+  fChannelKeys.clear();
+  fIndex.clear();
+  fContainsSensitive.clear();
+  fTruncatedPaths = false;
+}
+
+void AirPetChannelMap::Build(const G4VPhysicalVolume* world)
+{
+  Clear();
+  if (!world) return;
+
+  std::vector<PathLevel> path;
+  Walk(world->GetLogicalVolume(), path);
+
+  G4cout << "--> AirPetChannelMap: " << fChannels.size() << " detector channels" << G4endl;
+  if (fTruncatedPaths) {
+    G4Exception("AirPetChannelMap::Build", "ChannelPathTooDeep", JustWarning,
+                "Some sensitive volumes are nested deeper than AirPetChannelMap::kMaxDepth; "
+                "only the innermost levels identify their channels.");
+  }
+}
+
+G4bool AirPetChannelMap::ContainsSensitive(const G4LogicalVolume* volume)
+{
+  // Subtrees without sensitive volumes (e.g. voxelized phantoms) are skipped
+  // without visiting their copies.
+  auto it = fContainsSensitive.find(volume);
+  if (it != fContainsSensitive.end()) return it->second;
+
+  G4bool result = volume->GetSensitiveDetector() != nullptr;
+  for (size_t i = 0; !result && i < volume->GetNoDaughters(); ++i) {
+    result = ContainsSensitive(volume->GetDaughter(i)->GetLogicalVolume());
+  }
+  fContainsSensitive[volume] = result;
+  return result;
+}
+
+void AirPetChannelMap::Walk(const G4LogicalVolume* mother, std::vector<PathLevel>& path)
+{
+  for (size_t i = 0; i < mother->GetNoDaughters(); ++i) {
+    const G4VPhysicalVolume* daughter = mother->GetDaughter(i);
+    const G4LogicalVolume* volume = daughter->GetLogicalVolume();
+    if (!ContainsSensitive(volume)) continue;
+
+    // Replicas and parameterised volumes are navigated with their replica
+    // number as copy number; plain placements with their own copy number.
+    const G4bool replicated = daughter->IsReplicated();
+    const G4int copies = replicated ? daughter->GetMultiplicity() : 1;
+    for (G4int copy = 0; copy < copies; ++copy) {
+      path.push_back({daughter, replicated ? copy : daughter->GetCopyNo()});
+      if (volume->GetSensitiveDetector()) AddChannel(path);
+      Walk(volume, path);
+      path.pop_back();
+    }
+  }
+}
+
+void AirPetChannelMap::AddChannel(const std::vector<PathLevel>& path)
+{
+  const G4int levels = static_cast<G4int>(path.size());
+  Key key;
+  key.depth = std::min(levels, kMaxDepth);
+  if (levels > kMaxDepth) fTruncatedPaths = true;
+  for (G4int d = 0; d < key.depth; ++d) {
+    key.volumes[d] = path[levels - 1 - d].volume;
+    key.copies[d] = path[levels - 1 - d].copyNo;
+  }
+
+  const G4int channelID = static_cast<G4int>(fChannels.size());
+  if (!fIndex.emplace(key, channelID).second) return;
+
+  const PathLevel& leaf = path.back();
+  auto* nameTable = AirPetNameTable::Instance();
+  fChannels.push_back({leaf.volume, leaf.copyNo,
+                       nameTable->GetPhysicalVolumeID(leaf.volume),
+                       nameTable->GetLogicalVolumeID(leaf.volume->GetLogicalVolume())});
+  fChannelKeys.push_back(key);
+}
+
+G4int AirPetChannelMap::GetChannelID(const G4VTouchable* touchable) const
+{
+  if (fIndex.empty()) return -1;
+
+  Key key;
+  key.depth = std::min(touchable->GetHistoryDepth(), kMaxDepth);
+  for (G4int d = 0; d < key.depth; ++d) {
+    key.volumes[d] = touchable->GetVolume(d);
+    key.copies[d] = touchable->GetCopyNumber(d);
+  }
+  auto it = fIndex.find(key);
+  return it != fIndex.end() ? it->second : -1;
+}
+
+G4String AirPetChannelMap::GetPath(G4int channelID) const
+{
+  if (channelID < 0 || channelID >= static_cast<G4int>(fChannelKeys.size())) return "";
+  const Key& key = fChannelKeys[channelID];
+  G4String path;
+  for (G4int d = 0; d < key.depth; ++d) {
+    if (d > 0) path += "/";
+    path += key.volumes[d]->GetName() + ":" + std::to_string(key.copies[d]);
+  }
+  return path;
+}
@@ -0,0 +1,159 @@
+#include "AirPetCheckpoint.hh"
+#include "AirPetOutputFile.hh"
+#include "AirPetTrackFile.hh"
+
+#include "G4AutoLock.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+G4bool AirPetCheckpoint::Read(const G4String& fileName, State& state)
+{
+  std::ifstream in(fileName);
+  std::string magic;
+  G4int version = 0;
+  if (!(in >> magic >> version) || magic != "airpet-checkpoint" || version != 1) return false;
+
+  state = State();
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream is(line);
+    std::string keyword;
+    if (!(is >> keyword)) continue;
+    if (keyword == "run_id") {
+      is >> state.runID;
+    } else if (keyword == "seed") {
+      is >> state.seed;
+    } else if (keyword == "first_event") {
+      is >> state.firstEvent;
+    } else if (keyword == "end_event") {
+      is >> state.endEvent;
+    } else if (keyword == "complete") {
+      is >> state.complete;
+    } else if (keyword == "written_prefix") {
+      is >> state.writtenPrefix;
+    } else if (keyword == "written") {
+      std::pair<G4long, G4long> range;
+      if (is >> range.first >> range.second) state.writtenRanges.push_back(range);
+    } else if (keyword == "ntuple") {
+      std::string name;
+      size_t rows = 0;
+      if (is >> name >> rows) state.ntupleRows.emplace_back(name, rows);
+    } else if (keyword == "track_file") {
+      is >> state.trackFileSize >> state.trackFileEvents;
+    } else if (keyword == "end") {
+      return true;
+    }
+  }
+  // Without the closing line the file was cut short.
+  return false;
+}
+
+G4bool AirPetCheckpoint::Write(const G4String& fileName, const State& state)
+{
+  const G4String tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName);
+    if (!out) return false;
+    out << "airpet-checkpoint 1\n"
+        << "run_id " << state.runID << "\n"
+        << "seed " << state.seed << "\n"
+        << "first_event " << state.firstEvent << "\n"
+        << "end_event " << state.endEvent << "\n"
+        << "complete " << (state.complete ? 1 : 0) << "\n"
+        << "written_prefix " << state.writtenPrefix << "\n";
+    for (const auto& range : state.writtenRanges) {
+      out << "written " << range.first << " " << range.second << "\n";
+    }
+    for (const auto& ntuple : state.ntupleRows) {
+      out << "ntuple " << ntuple.first << " " << ntuple.second << "\n";
+    }
+    out << "track_file " << state.trackFileSize << " " << state.trackFileEvents << "\n";
+    out << "end\n";
+    out.flush();
+    if (!out) return false;
+  }
+  return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
+
+AirPetCheckpoint::AirPetCheckpoint()
+  : fEventsPerCheckpoint(0), fPrefix(0), fFinished(0)
+{}
+
+void AirPetCheckpoint::Begin(const State& state, G4int eventsPerCheckpoint)
+{
+  G4AutoLock lock(&fMutex);
+  fBase = state;
+  fEventsPerCheckpoint = eventsPerCheckpoint;
+  fPrefix = state.writtenPrefix;
+  fResumed.clear();
+  for (const auto& range : state.writtenRanges) {
+    for (G4long event = range.first; event < range.second; ++event) {
+      fResumed.insert(static_cast<G4int>(event));
+    }
+  }
+  fWritten = fResumed;
+  fFinished = 0;
+}
+
+void AirPetCheckpoint::Append(const std::function<void()>& write, std::vector<G4int>& events)
+{
+  G4AutoLock lock(&fMutex);
+  write();
+  for (G4int event : events) {
+    if (event >= fPrefix) fWritten.insert(event);
+  }
+  events.clear();
+  // Fold the contiguous part into the prefix, so the set stays small.
+  while (!fWritten.empty() && *fWritten.begin() == fPrefix) {
+    fWritten.erase(fWritten.begin());
+    ++fPrefix;
+  }
+}
+
+G4int AirPetCheckpoint::EventFinished()
+{
+  const G4long finished = ++fFinished;
+  return fEventsPerCheckpoint > 0 ? static_cast<G4int>(finished / fEventsPerCheckpoint) : 0;
+}
+
+AirPetCheckpoint::State AirPetCheckpoint::BuildState(AirPetOutputFile& outputFile) const
+{
+  State state = fBase;
+  state.writtenPrefix = fPrefix;
+  state.writtenRanges.clear();
+  for (G4int event : fWritten) {
+    if (!state.writtenRanges.empty() && state.writtenRanges.back().second == event) {
+      ++state.writtenRanges.back().second;
+    } else {
+      state.writtenRanges.emplace_back(event, event + 1);
+    }
+  }
+  state.complete = fPrefix >= fBase.endEvent;
+  state.ntupleRows.clear();
+  for (G4int id = 0; id < outputFile.GetNumberOfNtuples(); ++id) {
+    state.ntupleRows.emplace_back(outputFile.GetNtupleName(id), outputFile.GetEntries(id));
+  }
+  // EventAction writes the tracks of an event before its rows, so every
+  // written event has its tracks within this size.
+  AirPetTrackFile::Instance()->GetState(state.trackFileSize, state.trackFileEvents);
+  return state;
+}
+
+void AirPetCheckpoint::Save(AirPetOutputFile& outputFile, const G4String& fileName)
+{
+  G4AutoLock lock(&fMutex);
+  if (!outputFile.IsOpen()) return;
+  outputFile.Flush();
+  if (!Write(fileName, BuildState(outputFile))) {
+    G4Exception("AirPetCheckpoint::Save", "CheckpointError", JustWarning,
+                ("Could not write checkpoint " + fileName).c_str());
+  }
+}
+
+G4bool AirPetCheckpoint::IsComplete() const
+{
+  G4AutoLock lock(&fMutex);
+  return fPrefix >= fBase.endEvent;
+}
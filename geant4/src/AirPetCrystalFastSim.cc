@@ -0,0 +1,48 @@
+#include "AirPetCrystalFastSim.hh"
+
+#include "G4Electron.hh"
+#include "G4FastStep.hh"
+#include "G4FastTrack.hh"
+#include "G4LogicalVolume.hh"
+#include "G4NavigationHistory.hh"
+#include "G4Track.hh"
+#include "G4VSolid.hh"
+#include "G4VTouchable.hh"
+
+AirPetCrystalFastSim::AirPetCrystalFastSim(const G4String& name, G4Region* envelope)
+  : G4VFastSimulationModel(name, envelope), fMaxEnergy(0.), fContainedOnly(true)
+{}
+
+G4bool AirPetCrystalFastSim::IsApplicable(const G4ParticleDefinition& particle)
+{
+  return &particle == G4Electron::Definition();
+}
+
+G4bool AirPetCrystalFastSim::ModelTrigger(const G4FastTrack& fastTrack)
+{
+  const G4Track* track = fastTrack.GetPrimaryTrack();
+  // The envelope region may hold other volumes than the crystals.
+  const G4VTouchable* touchable = track->GetTouchable();
+  if (!fVolumes.count(touchable->GetVolume()->GetLogicalVolume())) return false;
+
+  const G4double energy = track->GetKineticEnergy();
+  if (fMaxEnergy > 0. && energy > fMaxEnergy) return false;
+  if (!fContainedOnly) return true;
+
+  // The distance is taken in the crystal itself, which need not be the
+  // envelope volume.
+  const G4ThreeVector localPosition =
+      touchable->GetHistory()->GetTopTransform().TransformPoint(track->GetPosition());
+  const G4double toSurface = touchable->GetSolid()->DistanceToOut(localPosition);
+  const G4double range = fCalculator.GetRangeFromRestricteDEDX(energy, G4Electron::Definition(),
+                                                               track->GetMaterial());
+  return range < toSurface;
+}
+
+void AirPetCrystalFastSim::DoIt(const G4FastTrack& fastTrack, G4FastStep& fastStep)
+{
+  const G4double energy = fastTrack.GetPrimaryTrack()->GetKineticEnergy();
+  fastStep.KillPrimaryTrack();
+  fastStep.ProposePrimaryTrackPathLength(0.);
+  fastStep.ProposeTotalEnergyDeposited(energy);
+}
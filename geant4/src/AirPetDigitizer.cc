@@ -0,0 +1,138 @@
+#include "AirPetDigitizer.hh"
+#include "AirPetOutputFile.hh"
+
+#include "G4SystemOfUnits.hh"
+#include "G4UIcmdWith3VectorAndUnit.hh"
+#include "G4UIcmdWithADouble.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+
+AirPetDigitizer::AirPetDigitizer()
+  : G4UImessenger(), fEnabled(false), fEnergyResolution(0.0),
+    fPositionResolution(0., 0., 0.), fEnergyCut(0.0),
+    fCoincidenceWindow(4.0 * ns)
+{
+  fDigiDir = new G4UIdirectory("/g4pet/digi/");
+  fDigiDir->SetGuidance("In-simulation digitization and coincidence sorting.");
+
+  fEnableCmd = new G4UIcommand("/g4pet/digi/enable", this);
+  fEnableCmd->SetGuidance("Form coincidences at the end of each event and write the LORs ntuple.");
+  fEnableCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fEnableCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fEnergyResolutionCmd = new G4UIcmdWithADouble("/g4pet/digi/energyResolution", this);
+  fEnergyResolutionCmd->SetGuidance("Relative energy resolution (sigma/E) applied to each hit.");
+  fEnergyResolutionCmd->SetParameterName("sigma", false);
+  fEnergyResolutionCmd->SetRange("sigma>=0");
+  fEnergyResolutionCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fPositionResolutionCmd = new G4UIcmdWith3VectorAndUnit("/g4pet/digi/positionResolution", this);
+  fPositionResolutionCmd->SetGuidance("Gaussian position resolution (sigma) along x, y and z.");
+  fPositionResolutionCmd->SetParameterName("sx", "sy", "sz", false);
+  fPositionResolutionCmd->SetUnitCategory("Length");
+  fPositionResolutionCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fEnergyCutCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/digi/energyCut", this);
+  fEnergyCutCmd->SetGuidance("Minimum smeared hit energy for a single.");
+  fEnergyCutCmd->SetParameterName("energy", false);
+  fEnergyCutCmd->SetUnitCategory("Energy");
+  fEnergyCutCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fCoincidenceWindowCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/digi/coincidenceWindow", this);
+  fCoincidenceWindowCmd->SetGuidance("Maximum time difference between the two singles of a LOR.");
+  fCoincidenceWindowCmd->SetParameterName("window", false);
+  fCoincidenceWindowCmd->SetUnitCategory("Time");
+  fCoincidenceWindowCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetDigitizer::~AirPetDigitizer()
+{
+  delete fEnableCmd;
+  delete fEnergyResolutionCmd;
+  delete fPositionResolutionCmd;
+  delete fEnergyCutCmd;
+  delete fCoincidenceWindowCmd;
+  delete fDigiDir;
+}
+
+void AirPetDigitizer::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fEnableCmd) {
+    fEnabled = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fEnergyResolutionCmd) {
+    fEnergyResolution = fEnergyResolutionCmd->GetNewDoubleValue(newValue);
+  } else if (command == fPositionResolutionCmd) {
+    fPositionResolution = fPositionResolutionCmd->GetNew3VectorValue(newValue);
+  } else if (command == fEnergyCutCmd) {
+    fEnergyCut = fEnergyCutCmd->GetNewDoubleValue(newValue);
+  } else if (command == fCoincidenceWindowCmd) {
+    fCoincidenceWindow = fCoincidenceWindowCmd->GetNewDoubleValue(newValue);
+  }
+}
+
+const std::vector<AirPetColumnSpec>& AirPetDigitizer::GetLORColumns()
+{
+  const auto I = AirPetColumnType::kInt32;
+  const auto F = AirPetColumnType::kFloat32;
+  static const std::vector<AirPetColumnSpec> columns = {
+      {"EventID", I}, {"StartX", F},  {"StartY", F},  {"StartZ", F},
+      {"EndX", F},    {"EndY", F},    {"EndZ", F},    {"Energy1", F},
+      {"Energy2", F}, {"TOF", F},     {"Weight", F}};
+  return columns;
+}
+
+G4bool AirPetDigitizer::ProcessEvent(G4int eventID, const std::vector<const AirPetHit*>& hits,
+                                     G4double weight, AirPetNtupleBuffer& lors)
+{
+  fSingles.clear();
+  for (const AirPetHit* hit : hits) {
+    G4double energy = hit->GetEdep();
+    if (fEnergyResolution > 0.) energy *= 1. + G4RandGauss::shoot(0., fEnergyResolution);
+    if (energy < fEnergyCut) continue;
+
+    G4ThreeVector position = hit->GetPosition();
+    if (fPositionResolution.x() > 0.) position.setX(position.x() + G4RandGauss::shoot(0., fPositionResolution.x()));
+    if (fPositionResolution.y() > 0.) position.setY(position.y() + G4RandGauss::shoot(0., fPositionResolution.y()));
+    if (fPositionResolution.z() > 0.) position.setZ(position.z() + G4RandGauss::shoot(0., fPositionResolution.z()));
+
+    fSingles.push_back({energy, hit->GetTime(), position});
+  }
+  if (fSingles.size() < 2) return false;
+
+  // Only the two earliest singles take part in the coincidence.
+  std::partial_sort(fSingles.begin(), fSingles.begin() + 2, fSingles.end(),
+                    [](const Single& a, const Single& b) { return a.time < b.time; });
+  const Single& first = fSingles[0];
+  const Single& second = fSingles[1];
+  const G4double tof = second.time - first.time;
+  if (tof >= fCoincidenceWindow) return false;
+
+  lors.FillI(0, eventID);
+  lors.FillF(1, first.position.x());
+  lors.FillF(2, first.position.y());
+  lors.FillF(3, first.position.z());
+  lors.FillF(4, second.position.x());
+  lors.FillF(5, second.position.y());
+  lors.FillF(6, second.position.z());
+  lors.FillF(7, first.energy);
+  lors.FillF(8, second.energy);
+  lors.FillF(9, tof / ns);
+  lors.FillF(10, weight);
+  lors.AddRow();
+  return true;
+}
+
+void AirPetDigitizer::WriteSettings(AirPetOutputFile& file) const
+{
+  file.WriteDoubleAttributes("digitizer", {{"energy_resolution", fEnergyResolution},
+                                           {"position_resolution_x", fPositionResolution.x() / mm},
+                                           {"position_resolution_y", fPositionResolution.y() / mm},
+                                           {"position_resolution_z", fPositionResolution.z() / mm},
+                                           {"energy_cut", fEnergyCut / MeV},
+                                           {"coincidence_window_ns", fCoincidenceWindow / ns}});
+}
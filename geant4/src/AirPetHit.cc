@@ -16,10 +16,11 @@ AirPetHit::AirPetHit()
     fEdep(0.),
     fPos(0,0,0),
     fTime(0.),
-    fParticleName(""),
-    fVolumeName(""),
-    fPhysicalVolumeName(""),
-    fCopyNo(-1)
+    fParticleID(-1),
+    fVolumeID(-1),
+    fPhysicalVolumeID(-1),
+    fCopyNo(-1),
+    fChannelID(-1)
 {}
 
 AirPetHit::~AirPetHit() {}
@@ -31,10 +32,11 @@ AirPetHit::AirPetHit(const AirPetHit& right) : G4VHit()
   fEdep = right.fEdep;
   fPos = right.fPos;
   fTime = right.fTime;
-  fParticleName = right.fParticleName;
-  fVolumeName = right.fVolumeName;
-  fPhysicalVolumeName = right.fPhysicalVolumeName;
+  fParticleID = right.fParticleID;
+  fVolumeID = right.fVolumeID;
+  fPhysicalVolumeID = right.fPhysicalVolumeID;
   fCopyNo = right.fCopyNo;
+  fChannelID = right.fChannelID;
 }
 
 const AirPetHit& AirPetHit::operator=(const AirPetHit& right)
@@ -44,14 +46,30 @@ const AirPetHit& AirPetHit::operator=(const AirPetHit& right)
   fEdep = right.fEdep;
   fPos = right.fPos;
   fTime = right.fTime;
-  fParticleName = right.fParticleName;
-  fVolumeName = right.fVolumeName;
-  fPhysicalVolumeName = right.fPhysicalVolumeName;
+  fParticleID = right.fParticleID;
+  fVolumeID = right.fVolumeID;
+  fPhysicalVolumeID = right.fPhysicalVolumeID;
   fCopyNo = right.fCopyNo;
+  fChannelID = right.fChannelID;
 
   return *this;
 }
 
+G4String AirPetHit::GetParticleName() const
+{
+  return AirPetNameTable::Instance()->GetName(AirPetNameTable::kParticle, fParticleID);
+}
+
+G4String AirPetHit::GetVolumeName() const
+{
+  return AirPetNameTable::Instance()->GetName(AirPetNameTable::kLogicalVolume, fVolumeID);
+}
+
+G4String AirPetHit::GetPhysicalVolumeName() const
+{
+  return AirPetNameTable::Instance()->GetName(AirPetNameTable::kPhysicalVolume, fPhysicalVolumeID);
+}
+
 int AirPetHit::operator==(const AirPetHit& right) const
 {
   return (this == &right) ? 1 : 0;
@@ -74,10 +92,10 @@ void AirPetHit::Draw()
 
 void AirPetHit::Print()
 {
-  G4cout << "  trackID: " << fTrackID << " particle: " << fParticleName
+  G4cout << "  trackID: " << fTrackID << " particle: " << GetParticleName()
          << " parentID: " << fParentID
-         << " phys volume: " << fPhysicalVolumeName
-         << " volume: " << fVolumeName << "[" << fCopyNo << "]"
+         << " phys volume: " << GetPhysicalVolumeName()
+         << " volume: " << GetVolumeName() << "[" << fCopyNo << "]"
          << " Edep: " << std::setw(7) << G4BestUnit(fEdep,"Energy")
          << " Position: " << std::setw(7) << G4BestUnit(fPos,"Length")
          << " Time: " << std::setw(7) << G4BestUnit(fTime, "Time")
@@ -0,0 +1,356 @@
+#include "AirPetLiveStream.hh"
+#include "AirPetChannelMap.hh"
+#include "AirPetHit.hh"
+#include "AirPetNtupleBuffer.hh"
+
+#include "G4AutoLock.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithAnInteger.hh"
+#include "G4UIdirectory.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::atomic<bool> AirPetLiveStream::fActive{false};
+
+// The layout read by app.py.
+static_assert(sizeof(AirPetLiveHeader) == 144, "AirPetLiveHeader layout changed");
+static_assert(sizeof(AirPetLiveLOR) == 48, "AirPetLiveLOR layout changed");
+
+namespace {
+  G4Mutex liveMutex = G4MUTEX_INITIALIZER;
+
+  // Run totals merged from all threads, and sampled LORs not yet in the ring.
+  std::vector<std::uint64_t> totalChannels;
+  std::vector<std::uint64_t> totalSpectrum;
+  std::vector<AirPetLiveLOR> pendingLORs;
+  std::int64_t totalEvents = 0;
+  std::int64_t totalHits = 0;
+  std::int64_t totalLORs = 0;
+
+  // Settings of the current run, set by the master before workers start.
+  G4double binWidth = 0.;
+  G4int lorEvery = 1;
+  size_t lorCapacity = 0;
+  std::chrono::steady_clock::duration mergeInterval;
+
+  // The clock is only read every kMergeCheckEvents events.
+  constexpr G4int kMergeCheckEvents = 64;
+
+  struct LocalCounts {
+    std::vector<std::uint64_t> channels;
+    std::vector<std::uint64_t> spectrum;
+    std::vector<AirPetLiveLOR> lors;
+    std::int64_t events = 0;
+    std::int64_t hits = 0;
+    std::int64_t lorsSeen = 0;     // all LORs of the thread, for the sampling
+    std::int64_t lorsUnmerged = 0;
+    G4int eventsSinceCheck = 0;
+    std::chrono::steady_clock::time_point lastMerge;
+  };
+  G4ThreadLocal LocalCounts* localCounts = nullptr;
+
+  size_t AlignUp(size_t offset) { return (offset + 63) & ~size_t(63); }
+}
+
+AirPetLiveStream::AirPetLiveStream()
+  : G4UImessenger(), fSpectrumBins(256), fSpectrumMax(1. * MeV), fLorEvery(10),
+    fLorCapacity(65536), fInterval(250), fMapping(nullptr), fMappingSize(0), fStopping(false)
+{
+  fLiveDir = new G4UIdirectory("/g4pet/live/");
+  fLiveDir->SetGuidance("Live hit and LOR summaries in a memory-mapped file.");
+
+  fFileCmd = new G4UIcmdWithAString("/g4pet/live/file", this);
+  fFileCmd->SetGuidance("Publish live summaries of each run to this file (none: off).");
+  fFileCmd->SetParameterName("file", false);
+  fFileCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fSpectrumBinsCmd = new G4UIcmdWithAnInteger("/g4pet/live/spectrumBins", this);
+  fSpectrumBinsCmd->SetGuidance("Number of bins of the hit energy spectrum (default: 256).");
+  fSpectrumBinsCmd->SetParameterName("bins", false);
+  fSpectrumBinsCmd->SetRange("bins>0");
+  fSpectrumBinsCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fSpectrumMaxCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/live/spectrumMax", this);
+  fSpectrumMaxCmd->SetGuidance("Upper edge of the hit energy spectrum (default: 1 MeV).");
+  fSpectrumMaxCmd->SetParameterName("energy", false);
+  fSpectrumMaxCmd->SetUnitCategory("Energy");
+  fSpectrumMaxCmd->SetRange("energy>0");
+  fSpectrumMaxCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fLorEveryCmd = new G4UIcmdWithAnInteger("/g4pet/live/lorEvery", this);
+  fLorEveryCmd->SetGuidance("Publish every N-th LOR of each thread (default: 10).");
+  fLorEveryCmd->SetParameterName("n", false);
+  fLorEveryCmd->SetRange("n>0");
+  fLorEveryCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fLorCapacityCmd = new G4UIcmdWithAnInteger("/g4pet/live/lorCapacity", this);
+  fLorCapacityCmd->SetGuidance("Number of LORs kept in the ring (default: 65536).");
+  fLorCapacityCmd->SetParameterName("n", false);
+  fLorCapacityCmd->SetRange("n>0");
+  fLorCapacityCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fIntervalCmd = new G4UIcmdWithAnInteger("/g4pet/live/interval", this);
+  fIntervalCmd->SetGuidance("Milliseconds between updates of the file (default: 250).");
+  fIntervalCmd->SetParameterName("ms", false);
+  fIntervalCmd->SetRange("ms>0");
+  fIntervalCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetLiveStream::~AirPetLiveStream()
+{
+  if (fMapping) EndRun();
+  delete fIntervalCmd;
+  delete fLorCapacityCmd;
+  delete fLorEveryCmd;
+  delete fSpectrumMaxCmd;
+  delete fSpectrumBinsCmd;
+  delete fFileCmd;
+  delete fLiveDir;
+}
+
+void AirPetLiveStream::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fFileCmd) {
+    fFileName = (newValue == "none" || newValue == "off") ? G4String() : newValue;
+  } else if (command == fSpectrumBinsCmd) {
+    fSpectrumBins = fSpectrumBinsCmd->GetNewIntValue(newValue);
+  } else if (command == fSpectrumMaxCmd) {
+    fSpectrumMax = fSpectrumMaxCmd->GetNewDoubleValue(newValue);
+  } else if (command == fLorEveryCmd) {
+    fLorEvery = fLorEveryCmd->GetNewIntValue(newValue);
+  } else if (command == fLorCapacityCmd) {
+    fLorCapacity = fLorCapacityCmd->GetNewIntValue(newValue);
+  } else if (command == fIntervalCmd) {
+    fInterval = fIntervalCmd->GetNewIntValue(newValue);
+  }
+}
+
+void AirPetLiveStream::BeginRun(G4bool isMaster, G4int runID, G4long events)
+{
+  if (isMaster) {
+    if (fMapping) EndRun();
+    fActive = false;
+    if (fFileName.empty()) return;
+
+    const size_t numChannels = AirPetChannelMap::Instance()->GetNumberOfChannels();
+    const size_t headerSize = AlignUp(sizeof(AirPetLiveHeader));
+    const size_t spectrumOffset = headerSize + numChannels * sizeof(std::uint64_t);
+    const size_t lorOffset = AlignUp(spectrumOffset + fSpectrumBins * sizeof(std::uint64_t));
+    fMappingSize = lorOffset + fLorCapacity * sizeof(AirPetLiveLOR);
+
+    // Built under a temporary name: readers see the previous file or a
+    // complete header.
+    const G4String tmpName = fFileName + ".tmp" + std::to_string(getpid());
+    const int fd = open(tmpName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void* mapping = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(fMappingSize)) == 0) {
+      mapping = mmap(nullptr, fMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) close(fd);
+    if (mapping == MAP_FAILED) {
+      unlink(tmpName.c_str());
+      G4Exception("AirPetLiveStream::BeginRun", "LiveStreamError", JustWarning,
+                  ("Cannot map the live stream file " + tmpName).c_str());
+      return;
+    }
+
+    auto* header = static_cast<AirPetLiveHeader*>(mapping);
+    std::memcpy(header->magic, "AIRPLIV1", 8);
+    header->version = 1;
+    header->headerSize = static_cast<std::uint32_t>(headerSize);
+    header->state = kRunning;
+    header->numChannels = static_cast<std::uint32_t>(numChannels);
+    header->spectrumBins = static_cast<std::uint32_t>(fSpectrumBins);
+    header->lorCapacity = static_cast<std::uint32_t>(fLorCapacity);
+    header->lorRecordSize = static_cast<std::uint32_t>(sizeof(AirPetLiveLOR));
+    header->lorEvery = static_cast<std::uint32_t>(fLorEvery);
+    header->spectrumMax = fSpectrumMax / MeV;
+    header->runID = runID;
+    header->totalEvents = events;
+    header->channelsOffset = headerSize;
+    header->spectrumOffset = spectrumOffset;
+    header->lorOffset = lorOffset;
+    if (std::rename(tmpName.c_str(), fFileName.c_str()) != 0) {
+      munmap(mapping, fMappingSize);
+      unlink(tmpName.c_str());
+      G4Exception("AirPetLiveStream::BeginRun", "LiveStreamError", JustWarning,
+                  ("Cannot create the live stream file " + fFileName).c_str());
+      return;
+    }
+    fMapping = mapping;
+
+    {
+      G4AutoLock lock(&liveMutex);
+      totalChannels.assign(numChannels, 0);
+      totalSpectrum.assign(fSpectrumBins, 0);
+      pendingLORs.clear();
+      totalEvents = totalHits = totalLORs = 0;
+      binWidth = fSpectrumMax / fSpectrumBins;
+      lorEvery = fLorEvery;
+      lorCapacity = fLorCapacity;
+      mergeInterval = std::chrono::milliseconds(fInterval) / 2;
+    }
+    fStopping = false;
+    fThread = std::thread(&AirPetLiveStream::Run, this);
+    fActive = true;
+    G4cout << "--> Live stream: " << fFileName << G4endl;
+  }
+
+  // Every thread that processes events (the master too, in sequential mode).
+  if (!IsActive()) return;
+  if (!localCounts) localCounts = new LocalCounts;
+  localCounts->channels.assign(totalChannels.size(), 0);
+  localCounts->spectrum.assign(totalSpectrum.size(), 0);
+  localCounts->lors.clear();
+  localCounts->events = localCounts->hits = localCounts->lorsSeen = localCounts->lorsUnmerged = 0;
+  localCounts->eventsSinceCheck = 0;
+  localCounts->lastMerge = std::chrono::steady_clock::now();
+}
+
+void AirPetLiveStream::AddEvent(const std::vector<const AirPetHit*>& hits,
+                                const AirPetNtupleBuffer* lors)
+{
+  LocalCounts* local = localCounts;
+  if (!local || !IsActive()) return;
+
+  ++local->events;
+  local->hits += hits.size();
+  const size_t numChannels = local->channels.size();
+  const size_t numBins = local->spectrum.size();
+  for (const AirPetHit* hit : hits) {
+    const G4int channelID = hit->GetChannelID();
+    if (channelID >= 0 && static_cast<size_t>(channelID) < numChannels) ++local->channels[channelID];
+    const size_t bin = static_cast<size_t>(hit->GetEdep() / binWidth);
+    if (bin < numBins) ++local->spectrum[bin];
+  }
+
+  if (lors && lors->GetRows() > 0) {
+    ++local->lorsUnmerged;
+    if (++local->lorsSeen % lorEvery == 0) {
+      // The event's LOR is the last row; columns as in GetLORColumns().
+      const size_t row = lors->GetRows() - 1;
+      auto F = [&](G4int col) { return static_cast<const float*>(lors->GetData(col))[row]; };
+      AirPetLiveLOR lor;
+      lor.eventID = static_cast<const std::int32_t*>(lors->GetData(0))[row];
+      lor.start[0] = F(1);
+      lor.start[1] = F(2);
+      lor.start[2] = F(3);
+      lor.end[0] = F(4);
+      lor.end[1] = F(5);
+      lor.end[2] = F(6);
+      lor.energy1 = F(7);
+      lor.energy2 = F(8);
+      lor.tof = F(9);
+      lor.weight = F(10);
+      lor.reserved = 0;
+      local->lors.push_back(lor);
+    }
+  }
+
+  if (++local->eventsSinceCheck < kMergeCheckEvents) return;
+  local->eventsSinceCheck = 0;
+  if (std::chrono::steady_clock::now() - local->lastMerge >= mergeInterval) MergeThread();
+}
+
+void AirPetLiveStream::MergeThread()
+{
+  LocalCounts* local = localCounts;
+  if (!local || !IsActive()) return;
+
+  {
+    G4AutoLock lock(&liveMutex);
+    for (size_t i = 0; i < local->channels.size(); ++i) totalChannels[i] += local->channels[i];
+    for (size_t i = 0; i < local->spectrum.size(); ++i) totalSpectrum[i] += local->spectrum[i];
+    totalEvents += local->events;
+    totalHits += local->hits;
+    totalLORs += local->lorsUnmerged;
+    pendingLORs.insert(pendingLORs.end(), local->lors.begin(), local->lors.end());
+    // The ring only keeps the newest ones anyway.
+    if (pendingLORs.size() > lorCapacity) {
+      pendingLORs.erase(pendingLORs.begin(), pendingLORs.end() - lorCapacity);
+    }
+  }
+  std::fill(local->channels.begin(), local->channels.end(), 0);
+  std::fill(local->spectrum.begin(), local->spectrum.end(), 0);
+  local->lors.clear();
+  local->events = local->hits = local->lorsUnmerged = 0;
+  local->lastMerge = std::chrono::steady_clock::now();
+}
+
+void AirPetLiveStream::EndRun()
+{
+  if (!fMapping) return;
+  {
+    std::lock_guard<std::mutex> lock(fThreadMutex);
+    fStopping = true;
+  }
+  fWake.notify_all();
+  if (fThread.joinable()) fThread.join();
+  Publish(true);
+  fActive = false;
+  msync(fMapping, fMappingSize, MS_ASYNC);
+  Unmap();
+}
+
+void AirPetLiveStream::Run()
+{
+  std::unique_lock<std::mutex> lock(fThreadMutex);
+  while (!fWake.wait_for(lock, std::chrono::milliseconds(fInterval), [this] { return fStopping; })) {
+    lock.unlock();
+    Publish(false);
+    lock.lock();
+  }
+}
+
+void AirPetLiveStream::Publish(G4bool finished)
+{
+  // The only writer of the mapping. Readers retry while the sequence is odd
+  // or changed during their copy.
+  auto* header = static_cast<AirPetLiveHeader*>(fMapping);
+  char* base = static_cast<char*>(fMapping);
+  G4AutoLock lock(&liveMutex);
+
+  const std::uint64_t sequence = header->sequence;
+  __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(base + header->channelsOffset, totalChannels.data(),
+              totalChannels.size() * sizeof(std::uint64_t));
+  std::memcpy(base + header->spectrumOffset, totalSpectrum.data(),
+              totalSpectrum.size() * sizeof(std::uint64_t));
+  header->eventsDone = totalEvents;
+  header->hits = totalHits;
+  header->lors = totalLORs;
+  header->updateTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+  __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+  if (!pendingLORs.empty()) {
+    // Claim the slots first, so readers can tell which records they may
+    // have seen half overwritten.
+    std::uint64_t index = header->lorCommitted;
+    const std::uint64_t end = index + pendingLORs.size();
+    __atomic_store_n(&header->lorClaimed, end, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto* ring = reinterpret_cast<AirPetLiveLOR*>(base + header->lorOffset);
+    for (const AirPetLiveLOR& lor : pendingLORs) ring[index++ % lorCapacity] = lor;
+    __atomic_store_n(&header->lorCommitted, end, __ATOMIC_RELEASE);
+    pendingLORs.clear();
+  }
+
+  if (finished) __atomic_store_n(&header->state, static_cast<std::uint32_t>(kFinished), __ATOMIC_RELEASE);
+}
+
+void AirPetLiveStream::Unmap()
+{
+  munmap(fMapping, fMappingSize);
+  fMapping = nullptr;
+  fMappingSize = 0;
+}
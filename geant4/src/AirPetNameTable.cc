@@ -0,0 +1,72 @@
+#include "AirPetNameTable.hh"
+
+#include "G4AutoLock.hh"
+#include "G4LogicalVolume.hh"
+#include "G4ParticleDefinition.hh"
+#include "G4VPhysicalVolume.hh"
+
+G4ThreadLocal AirPetNameTable::PointerCache* AirPetNameTable::fCache = nullptr;
+
+AirPetNameTable* AirPetNameTable::Instance()
+{
+  static AirPetNameTable instance;
+  return &instance;
+}
+
+G4int AirPetNameTable::GetID(Category category, const G4String& name)
+{
+  G4AutoLock lock(&fMutex);
+  auto it = fIDs[category].find(name);
+  if (it != fIDs[category].end()) return it->second;
+
+  G4int id = static_cast<G4int>(fNames[category].size());
+  fNames[category].push_back(name);
+  fIDs[category].emplace(name, id);
+  return id;
+}
+
+G4int AirPetNameTable::CachedID(Category category, const void* key, const G4String& name)
+{
+  // One cache serves all categories; the pointers never collide because
+  // they point to distinct objects.
+  if (!fCache) fCache = new PointerCache();
+  auto it = fCache->find(key);
+  if (it != fCache->end()) return it->second;
+
+  G4int id = GetID(category, name);
+  fCache->emplace(key, id);
+  return id;
+}
+
+G4int AirPetNameTable::GetParticleID(const G4ParticleDefinition* particle)
+{
+  return CachedID(kParticle, particle, particle->GetParticleName());
+}
+
+G4int AirPetNameTable::GetLogicalVolumeID(const G4LogicalVolume* volume)
+{
+  return CachedID(kLogicalVolume, volume, volume->GetName());
+}
+
+G4int AirPetNameTable::GetPhysicalVolumeID(const G4VPhysicalVolume* volume)
+{
+  return CachedID(kPhysicalVolume, volume, volume->GetName());
+}
+
+G4String AirPetNameTable::GetName(Category category, G4int id) const
+{
+  G4AutoLock lock(&fMutex);
+  if (id < 0 || id >= static_cast<G4int>(fNames[category].size())) return "";
+  return fNames[category][id];
+}
+
+std::vector<G4String> AirPetNameTable::GetNames(Category category) const
+{
+  G4AutoLock lock(&fMutex);
+  return fNames[category];
+}
+
+void AirPetNameTable::ClearThreadCache()
+{
+  if (fCache) fCache->clear();
+}
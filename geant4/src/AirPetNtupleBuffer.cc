@@ -0,0 +1,49 @@
+#include "AirPetNtupleBuffer.hh"
+
+AirPetNtupleBuffer::AirPetNtupleBuffer(const std::vector<AirPetColumnSpec>& columns)
+{
+  SetColumns(columns);
+}
+
+void AirPetNtupleBuffer::SetColumns(const std::vector<AirPetColumnSpec>& columns)
+{
+  fSpecs = columns;
+  fColumns.assign(columns.size(), Column());
+  fRows = 0;
+}
+
+const void* AirPetNtupleBuffer::GetData(G4int col) const
+{
+  const Column& column = fColumns[col];
+  switch (fSpecs[col].type) {
+    case AirPetColumnType::kInt32:   return column.ints.data();
+    case AirPetColumnType::kFloat32: return column.floats.data();
+    case AirPetColumnType::kFloat64: return column.doubles.data();
+    case AirPetColumnType::kString:  return nullptr; // see GetStrings()
+  }
+  return nullptr;
+}
+
+void AirPetNtupleBuffer::Clear()
+{
+  // clear() keeps the capacity, so steady-state filling does not allocate
+  for (auto& column : fColumns) {
+    column.ints.clear();
+    column.floats.clear();
+    column.doubles.clear();
+    column.strings.clear();
+  }
+  fRows = 0;
+}
+
+void AirPetNtupleBuffer::Reserve(size_t rows)
+{
+  for (size_t i = 0; i < fColumns.size(); ++i) {
+    switch (fSpecs[i].type) {
+      case AirPetColumnType::kInt32:   fColumns[i].ints.reserve(rows); break;
+      case AirPetColumnType::kFloat32: fColumns[i].floats.reserve(rows); break;
+      case AirPetColumnType::kFloat64: fColumns[i].doubles.reserve(rows); break;
+      case AirPetColumnType::kString:  fColumns[i].strings.reserve(rows); break;
+    }
+  }
+}
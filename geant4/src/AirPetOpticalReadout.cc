@@ -0,0 +1,116 @@
+#include "AirPetOpticalReadout.hh"
+
+#include "G4SystemOfUnits.hh"
+#include "G4UIcmdWithADouble.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcmdWithAnInteger.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+
+G4ThreadLocal AirPetOpticalReadout* AirPetOpticalReadout::fThreadInstance = nullptr;
+
+AirPetOpticalReadout::AirPetOpticalReadout()
+  : G4UImessenger(), fFastPath(true), fTimeBinWidth(0.5 * ns),
+    fNumTimeBins(200), fDetectionEfficiency(1.0)
+{
+  fThreadInstance = this;
+
+  fOpticalDir = new G4UIdirectory("/g4pet/optical/");
+  fOpticalDir->SetGuidance("Optical photon readout (photodetectors added with /g4pet/detector/addPhotonSD).");
+
+  fFastPathCmd = new G4UIcommand("/g4pet/optical/fastPath", this);
+  fFastPathCmd->SetGuidance("Skip trajectories and track user information for optical photons (default: true).");
+  fFastPathCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fFastPathCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fTimeBinWidthCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/optical/timeBinWidth", this);
+  fTimeBinWidthCmd->SetGuidance("Width of the photon arrival-time bins.");
+  fTimeBinWidthCmd->SetParameterName("width", false);
+  fTimeBinWidthCmd->SetUnitCategory("Time");
+  fTimeBinWidthCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fNumTimeBinsCmd = new G4UIcmdWithAnInteger("/g4pet/optical/timeBins", this);
+  fNumTimeBinsCmd->SetGuidance("Number of arrival-time bins; the last one also collects later photons.");
+  fNumTimeBinsCmd->SetParameterName("bins", false);
+  fNumTimeBinsCmd->SetRange("bins>0");
+  fNumTimeBinsCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fEfficiencyCmd = new G4UIcmdWithADouble("/g4pet/optical/detectionEfficiency", this);
+  fEfficiencyCmd->SetGuidance("Probability that a photon reaching a photodetector is counted.");
+  fEfficiencyCmd->SetParameterName("efficiency", false);
+  fEfficiencyCmd->SetRange("efficiency>=0 && efficiency<=1");
+  fEfficiencyCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetOpticalReadout::~AirPetOpticalReadout()
+{
+  if (fThreadInstance == this) fThreadInstance = nullptr;
+  delete fFastPathCmd;
+  delete fTimeBinWidthCmd;
+  delete fNumTimeBinsCmd;
+  delete fEfficiencyCmd;
+  delete fOpticalDir;
+}
+
+void AirPetOpticalReadout::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fFastPathCmd) {
+    fFastPath = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fTimeBinWidthCmd) {
+    fTimeBinWidth = fTimeBinWidthCmd->GetNewDoubleValue(newValue);
+  } else if (command == fNumTimeBinsCmd) {
+    fNumTimeBins = fNumTimeBinsCmd->GetNewIntValue(newValue);
+  } else if (command == fEfficiencyCmd) {
+    fDetectionEfficiency = fEfficiencyCmd->GetNewDoubleValue(newValue);
+  }
+}
+
+const std::vector<AirPetColumnSpec>& AirPetOpticalReadout::GetCountColumns()
+{
+  static const std::vector<AirPetColumnSpec> columns = {
+      {"EventID", AirPetColumnType::kInt32},   {"ChannelID", AirPetColumnType::kInt32},
+      {"CopyNo", AirPetColumnType::kInt32},    {"Photons", AirPetColumnType::kInt32},
+      {"FirstTime", AirPetColumnType::kFloat64}};
+  return columns;
+}
+
+const std::vector<AirPetColumnSpec>& AirPetOpticalReadout::GetTimeColumns()
+{
+  // Bin i covers [i, i+1) * TimeBinWidth (ns) of global time.
+  static const std::vector<AirPetColumnSpec> columns = {
+      {"EventID", AirPetColumnType::kInt32},   {"ChannelID", AirPetColumnType::kInt32},
+      {"Bin", AirPetColumnType::kInt32},       {"Photons", AirPetColumnType::kInt32},
+      {"TimeBinWidth", AirPetColumnType::kFloat32}};
+  return columns;
+}
+
+void AirPetOpticalReadout::ProcessHits(G4int eventID, const AirPetPhotonHitsCollection& hits,
+                                       AirPetNtupleBuffer& counts, AirPetNtupleBuffer& times) const
+{
+  for (size_t i = 0; i < hits.GetSize(); ++i) {
+    const auto* hit = static_cast<const AirPetPhotonHit*>(hits.GetHit(i));
+    if (hit->GetPhotons() == 0) continue;
+
+    if (!counts.GetColumns().empty()) {
+      counts.FillI(0, eventID);
+      counts.FillI(1, hit->GetChannelID());
+      counts.FillI(2, hit->GetCopyNo());
+      counts.FillI(3, hit->GetPhotons());
+      counts.FillD(4, hit->GetFirstTime());
+      counts.AddRow();
+    }
+
+    if (times.GetColumns().empty()) continue;
+    const std::vector<G4int>& bins = hit->GetTimeBins();
+    for (size_t bin = 0; bin < bins.size(); ++bin) {
+      if (bins[bin] == 0) continue;
+      times.FillI(0, eventID);
+      times.FillI(1, hit->GetChannelID());
+      times.FillI(2, static_cast<G4int>(bin));
+      times.FillI(3, bins[bin]);
+      times.FillF(4, fTimeBinWidth / ns);
+      times.AddRow();
+    }
+  }
+}
@@ -0,0 +1,357 @@
+#include "AirPetOutputFile.hh"
+
+#include "G4AutoLock.hh"
+
+namespace {
+  G4Mutex hdf5Mutex = G4MUTEX_INITIALIZER;
+
+  hid_t MemoryType(AirPetColumnType type, hid_t stringType)
+  {
+    switch (type) {
+      case AirPetColumnType::kInt32:   return H5T_NATIVE_INT32;
+      case AirPetColumnType::kFloat32: return H5T_NATIVE_FLOAT;
+      case AirPetColumnType::kFloat64: return H5T_NATIVE_DOUBLE;
+      case AirPetColumnType::kString:  return stringType;
+    }
+    return H5T_NATIVE_INT32;
+  }
+
+  hid_t FileType(AirPetColumnType type, hid_t stringType)
+  {
+    switch (type) {
+      case AirPetColumnType::kInt32:   return H5T_STD_I32LE;
+      case AirPetColumnType::kFloat32: return H5T_IEEE_F32LE;
+      case AirPetColumnType::kFloat64: return H5T_IEEE_F64LE;
+      case AirPetColumnType::kString:  return stringType;
+    }
+    return H5T_STD_I32LE;
+  }
+}
+
+AirPetOutputFile::AirPetOutputFile()
+  : fFile(-1), fNtuplesGroup(-1), fStringType(-1),
+    fCompressionLevel(1), fChunkRows(65536)
+{}
+
+AirPetOutputFile::~AirPetOutputFile()
+{
+  Close();
+}
+
+G4bool AirPetOutputFile::Open(const G4String& filename, G4int compressionLevel, size_t chunkRows,
+                              G4bool append)
+{
+  Close();
+  G4AutoLock lock(&hdf5Mutex);
+
+  fFileName = filename;
+  fCompressionLevel = compressionLevel;
+  fChunkRows = chunkRows > 0 ? chunkRows : 1;
+
+  if (append) {
+    H5E_BEGIN_TRY {
+      fFile = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (fFile < 0) {
+      G4Exception("AirPetOutputFile::Open", "OutputFileError", JustWarning,
+                  ("Could not open output file for appending: " + filename).c_str());
+      return false;
+    }
+  } else {
+    fFile = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (fFile < 0) {
+      G4Exception("AirPetOutputFile::Open", "OutputFileError", JustWarning,
+                  ("Could not create output file: " + filename).c_str());
+      return false;
+    }
+  }
+  fNtuplesGroup = H5Lexists(fFile, "default_ntuples", H5P_DEFAULT) > 0
+                      ? H5Gopen2(fFile, "default_ntuples", H5P_DEFAULT)
+                      : H5Gcreate2(fFile, "default_ntuples", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  fStringType = H5Tcopy(H5T_C_S1);
+  H5Tset_size(fStringType, H5T_VARIABLE);
+  return true;
+}
+
+void AirPetOutputFile::Close()
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0) return;
+
+  for (auto& ntuple : fNtuples) {
+    for (hid_t dataset : ntuple.datasets) H5Dclose(dataset);
+    H5Dclose(ntuple.entries);
+    H5Gclose(ntuple.group);
+  }
+  fNtuples.clear();
+
+  H5Tclose(fStringType);
+  H5Gclose(fNtuplesGroup);
+  H5Fclose(fFile);
+  fStringType = fNtuplesGroup = fFile = -1;
+}
+
+hid_t AirPetOutputFile::CreateColumnDataset(hid_t group, const AirPetColumnSpec& spec)
+{
+  hid_t columnGroup = H5Gcreate2(group, spec.name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  hsize_t dims = 0;
+  hsize_t maxDims = H5S_UNLIMITED;
+  hid_t space = H5Screate_simple(1, &dims, &maxDims);
+
+  hsize_t chunk = fChunkRows;
+  hid_t props = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(props, 1, &chunk);
+  if (fCompressionLevel > 0) {
+    // Variable-length strings only store heap references in the chunk, so
+    // shuffling them gains nothing.
+    if (spec.type != AirPetColumnType::kString) H5Pset_shuffle(props);
+    H5Pset_deflate(props, fCompressionLevel);
+  }
+
+  hid_t dataset = H5Dcreate2(columnGroup, "pages", FileType(spec.type, fStringType),
+                             space, H5P_DEFAULT, props, H5P_DEFAULT);
+  H5Pclose(props);
+  H5Sclose(space);
+  H5Gclose(columnGroup);
+  return dataset;
+}
+
+G4int AirPetOutputFile::CreateNtuple(const G4String& name, const std::vector<AirPetColumnSpec>& columns)
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0) return -1;
+
+  Ntuple ntuple;
+  ntuple.name = name;
+  ntuple.columns = columns;
+  ntuple.rows = 0;
+  if (H5Lexists(fNtuplesGroup, name.c_str(), H5P_DEFAULT) > 0) {
+    if (!ReopenNtuple(ntuple)) {
+      G4Exception("AirPetOutputFile::CreateNtuple", "OutputFileError", JustWarning,
+                  ("Existing ntuple has other columns: " + name).c_str());
+      return -1;
+    }
+    fNtuples.push_back(ntuple);
+    return static_cast<G4int>(fNtuples.size()) - 1;
+  }
+  ntuple.group = H5Gcreate2(fNtuplesGroup, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  for (const auto& spec : columns) {
+    ntuple.datasets.push_back(CreateColumnDataset(ntuple.group, spec));
+  }
+
+  hid_t scalar = H5Screate(H5S_SCALAR);
+  ntuple.entries = H5Dcreate2(ntuple.group, "entries", H5T_STD_I64LE, scalar,
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  H5Sclose(scalar);
+
+  fNtuples.push_back(ntuple);
+  WriteEntries(fNtuples.back());
+  return static_cast<G4int>(fNtuples.size()) - 1;
+}
+
+G4bool AirPetOutputFile::ReopenNtuple(Ntuple& ntuple)
+{
+  ntuple.group = H5Gopen2(fNtuplesGroup, ntuple.name.c_str(), H5P_DEFAULT);
+  ntuple.entries = H5Dopen2(ntuple.group, "entries", H5P_DEFAULT);
+  long long rows = 0;
+  if (ntuple.entries >= 0) H5Dread(ntuple.entries, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &rows);
+  ntuple.rows = static_cast<size_t>(rows);
+
+  G4bool ok = ntuple.entries >= 0;
+  for (const auto& spec : ntuple.columns) {
+    const G4String path = spec.name + "/pages";
+    hid_t dataset = -1;
+    H5E_BEGIN_TRY {
+      dataset = H5Dopen2(ntuple.group, path.c_str(), H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (dataset < 0) ok = false;
+    ntuple.datasets.push_back(dataset);
+  }
+  if (!ok) {
+    for (hid_t dataset : ntuple.datasets) {
+      if (dataset >= 0) H5Dclose(dataset);
+    }
+    if (ntuple.entries >= 0) H5Dclose(ntuple.entries);
+    H5Gclose(ntuple.group);
+  }
+  return ok;
+}
+
+G4int AirPetOutputFile::GetNumberOfNtuples() const
+{
+  G4AutoLock lock(&hdf5Mutex);
+  return static_cast<G4int>(fNtuples.size());
+}
+
+G4String AirPetOutputFile::GetNtupleName(G4int ntupleID) const
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (ntupleID < 0 || ntupleID >= static_cast<G4int>(fNtuples.size())) return "";
+  return fNtuples[ntupleID].name;
+}
+
+void AirPetOutputFile::Truncate(G4int ntupleID, size_t rows)
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0 || ntupleID < 0 || ntupleID >= static_cast<G4int>(fNtuples.size())) return;
+
+  Ntuple& ntuple = fNtuples[ntupleID];
+  if (rows >= ntuple.rows) return;
+  const hsize_t newSize = rows;
+  for (hid_t dataset : ntuple.datasets) H5Dset_extent(dataset, &newSize);
+  ntuple.rows = rows;
+  WriteEntries(ntuple);
+}
+
+void AirPetOutputFile::WriteEntries(const Ntuple& ntuple)
+{
+  long long rows = static_cast<long long>(ntuple.rows);
+  H5Dwrite(ntuple.entries, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &rows);
+}
+
+void AirPetOutputFile::AppendRows(G4int ntupleID, const AirPetNtupleBuffer& buffer)
+{
+  const hsize_t count = buffer.GetRows();
+  if (count == 0) return;
+
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0 || ntupleID < 0 || ntupleID >= static_cast<G4int>(fNtuples.size())) return;
+
+  Ntuple& ntuple = fNtuples[ntupleID];
+  const hsize_t start = ntuple.rows;
+  const hsize_t newSize = start + count;
+  hid_t memSpace = H5Screate_simple(1, &count, nullptr);
+
+  std::vector<const char*> stringPointers;
+  for (size_t col = 0; col < ntuple.columns.size(); ++col) {
+    hid_t dataset = ntuple.datasets[col];
+    H5Dset_extent(dataset, &newSize);
+
+    hid_t fileSpace = H5Dget_space(dataset);
+    H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, &start, nullptr, &count, nullptr);
+
+    const void* data = buffer.GetData(col);
+    if (ntuple.columns[col].type == AirPetColumnType::kString) {
+      const auto& strings = buffer.GetStrings(col);
+      stringPointers.resize(strings.size());
+      for (size_t i = 0; i < strings.size(); ++i) stringPointers[i] = strings[i].c_str();
+      data = stringPointers.data();
+    }
+
+    H5Dwrite(dataset, MemoryType(ntuple.columns[col].type, fStringType),
+             memSpace, fileSpace, H5P_DEFAULT, data);
+    H5Sclose(fileSpace);
+  }
+  H5Sclose(memSpace);
+
+  ntuple.rows = newSize;
+  WriteEntries(ntuple);
+}
+
+size_t AirPetOutputFile::GetEntries(G4int ntupleID) const
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (ntupleID < 0 || ntupleID >= static_cast<G4int>(fNtuples.size())) return 0;
+  return fNtuples[ntupleID].rows;
+}
+
+void AirPetOutputFile::WriteGrid(const G4String& name, const G4double* data, const size_t shape[3],
+                                 const G4double origin[3], const G4double voxelSize[3],
+                                 const G4String& unit)
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0) return;
+
+  hid_t group = H5Lexists(fFile, "scoring", H5P_DEFAULT) > 0
+                    ? H5Gopen2(fFile, "scoring", H5P_DEFAULT)
+                    : H5Gcreate2(fFile, "scoring", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  // An appended file may hold the grid of an interrupted run.
+  if (H5Lexists(group, name.c_str(), H5P_DEFAULT) > 0) H5Ldelete(group, name.c_str(), H5P_DEFAULT);
+
+  const hsize_t dims[3] = {shape[0], shape[1], shape[2]};
+  hid_t space = H5Screate_simple(3, dims, nullptr);
+  hid_t props = H5Pcreate(H5P_DATASET_CREATE);
+  if (fCompressionLevel > 0) {
+    // One yz plane per chunk.
+    const hsize_t chunk[3] = {1, dims[1], dims[2]};
+    H5Pset_chunk(props, 3, chunk);
+    H5Pset_shuffle(props);
+    H5Pset_deflate(props, fCompressionLevel);
+  }
+  hid_t dataset = H5Dcreate2(group, name.c_str(), H5T_IEEE_F64LE, space,
+                             H5P_DEFAULT, props, H5P_DEFAULT);
+  H5Dwrite(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+
+  const hsize_t three = 3;
+  hid_t vectorSpace = H5Screate_simple(1, &three, nullptr);
+  hid_t attribute = H5Acreate2(dataset, "origin", H5T_IEEE_F64LE, vectorSpace, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attribute, H5T_NATIVE_DOUBLE, origin);
+  H5Aclose(attribute);
+  attribute = H5Acreate2(dataset, "voxel_size", H5T_IEEE_F64LE, vectorSpace, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attribute, H5T_NATIVE_DOUBLE, voxelSize);
+  H5Aclose(attribute);
+  H5Sclose(vectorSpace);
+
+  hid_t scalar = H5Screate(H5S_SCALAR);
+  const char* unitString = unit.c_str();
+  attribute = H5Acreate2(dataset, "unit", fStringType, scalar, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attribute, fStringType, &unitString);
+  H5Aclose(attribute);
+  H5Sclose(scalar);
+
+  H5Dclose(dataset);
+  H5Pclose(props);
+  H5Sclose(space);
+  H5Gclose(group);
+}
+
+void AirPetOutputFile::WriteAttributes(const G4String& name,
+                                       const std::vector<std::pair<G4String, G4long>>& values)
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0) return;
+
+  hid_t group = H5Lexists(fFile, name.c_str(), H5P_DEFAULT) > 0
+                    ? H5Gopen2(fFile, name.c_str(), H5P_DEFAULT)
+                    : H5Gcreate2(fFile, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  hid_t scalar = H5Screate(H5S_SCALAR);
+  for (const auto& value : values) {
+    if (H5Aexists(group, value.first.c_str()) > 0) H5Adelete(group, value.first.c_str());
+    const int64_t number = value.second;
+    hid_t attribute = H5Acreate2(group, value.first.c_str(), H5T_STD_I64LE, scalar, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attribute, H5T_NATIVE_INT64, &number);
+    H5Aclose(attribute);
+  }
+  H5Sclose(scalar);
+  H5Gclose(group);
+}
+
+void AirPetOutputFile::WriteDoubleAttributes(const G4String& name,
+                                             const std::vector<std::pair<G4String, G4double>>& values)
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile < 0) return;
+
+  hid_t group = H5Lexists(fFile, name.c_str(), H5P_DEFAULT) > 0
+                    ? H5Gopen2(fFile, name.c_str(), H5P_DEFAULT)
+                    : H5Gcreate2(fFile, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  hid_t scalar = H5Screate(H5S_SCALAR);
+  for (const auto& value : values) {
+    if (H5Aexists(group, value.first.c_str()) > 0) H5Adelete(group, value.first.c_str());
+    const double number = value.second;
+    hid_t attribute = H5Acreate2(group, value.first.c_str(), H5T_IEEE_F64LE, scalar, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attribute, H5T_NATIVE_DOUBLE, &number);
+    H5Aclose(attribute);
+  }
+  H5Sclose(scalar);
+  H5Gclose(group);
+}
+
+void AirPetOutputFile::Flush()
+{
+  G4AutoLock lock(&hdf5Mutex);
+  if (fFile >= 0) H5Fflush(fFile, H5F_SCOPE_GLOBAL);
+}
@@ -0,0 +1,123 @@
+#include "AirPetOutputWriter.hh"
+#include "AirPetCheckpoint.hh"
+#include "AirPetOutputFile.hh"
+#include "AirPetProfiler.hh"
+
+#include <chrono>
+
+AirPetOutputWriter::~AirPetOutputWriter()
+{
+  Stop();
+}
+
+void AirPetOutputWriter::Start(AirPetOutputFile* file, AirPetCheckpoint* checkpoint,
+                               const G4String& checkpointFileName, size_t queueDepth)
+{
+  Stop();
+  fFile = file;
+  fCheckpoint = checkpoint;
+  fCheckpointFileName = checkpointFileName;
+  fQueueDepth = queueDepth > 0 ? queueDepth : 1;
+  fStopping = false;
+  fBatches = fRows = fPeakDepth = fWaits = 0;
+  fWaitSeconds = fWriteSeconds = 0.;
+  fThread = std::thread(&AirPetOutputWriter::Run, this);
+}
+
+void AirPetOutputWriter::Stop()
+{
+  if (!fThread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStopping = true;
+  }
+  fNotEmpty.notify_all();
+  fThread.join();
+  fFreeBuffers.clear();
+
+  G4cout << "--> Output writer: " << fBatches << " batches, " << fRows << " rows, "
+         << fWriteSeconds << " s writing; peak queue " << fPeakDepth << "/" << fQueueDepth
+         << ", " << fWaits << " waits for a full queue (" << fWaitSeconds << " s)" << G4endl;
+}
+
+void AirPetOutputWriter::Push(Batch&& batch)
+{
+  std::unique_lock<std::mutex> lock(fMutex);
+  if (fQueue.size() >= fQueueDepth) {
+    // Backpressure: the disk is slower than the event loop.
+    const auto start = std::chrono::steady_clock::now();
+    fNotFull.wait(lock, [this] { return fQueue.size() < fQueueDepth; });
+    ++fWaits;
+    fWaitSeconds += std::chrono::duration<G4double>(std::chrono::steady_clock::now() - start).count();
+  }
+  fQueue.push_back(std::move(batch));
+  if (fQueue.size() > fPeakDepth) fPeakDepth = fQueue.size();
+  lock.unlock();
+  fNotEmpty.notify_one();
+}
+
+AirPetNtupleBuffer AirPetOutputWriter::TakeFreeBuffer(G4int ntupleID)
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  auto it = fFreeBuffers.find(ntupleID);
+  if (it == fFreeBuffers.end() || it->second.empty()) return AirPetNtupleBuffer();
+  AirPetNtupleBuffer buffer = std::move(it->second.back());
+  it->second.pop_back();
+  return buffer;
+}
+
+std::vector<std::pair<G4String, G4long>> AirPetOutputWriter::GetStatistics() const
+{
+  std::lock_guard<std::mutex> lock(fMutex);
+  return {{"batches", static_cast<G4long>(fBatches)},
+          {"rows", static_cast<G4long>(fRows)},
+          {"queue_depth", static_cast<G4long>(fQueueDepth)},
+          {"peak_queue_depth", static_cast<G4long>(fPeakDepth)},
+          {"full_queue_waits", static_cast<G4long>(fWaits)},
+          {"full_queue_wait_us", static_cast<G4long>(fWaitSeconds * 1e6)},
+          {"write_us", static_cast<G4long>(fWriteSeconds * 1e6)}};
+}
+
+void AirPetOutputWriter::Run()
+{
+  while (true) {
+    Batch batch;
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      fNotEmpty.wait(lock, [this] { return fStopping || !fQueue.empty(); });
+      if (fQueue.empty()) break;   // stopping, and everything is written
+      batch = std::move(fQueue.front());
+      fQueue.pop_front();
+    }
+    fNotFull.notify_one();
+
+    const auto start = std::chrono::steady_clock::now();
+    Write(batch);
+    const G4double seconds = std::chrono::duration<G4double>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(fMutex);
+    ++fBatches;
+    fWriteSeconds += seconds;
+    for (auto& entry : batch.buffers) {
+      fRows += entry.second.GetRows();
+      entry.second.Clear();
+      fFreeBuffers[entry.first].push_back(std::move(entry.second));
+    }
+  }
+  // This thread's OutputWrite time goes into the run's profile.
+  AirPetProfiler::MergeThread();
+}
+
+void AirPetOutputWriter::Write(Batch& batch)
+{
+  AirPetProfileScope profile(AirPetProfiler::kOutputWrite);
+  auto write = [&]() {
+    for (const auto& entry : batch.buffers) fFile->AppendRows(entry.first, entry.second);
+  };
+  if (fCheckpoint && fCheckpoint->IsEnabled()) {
+    fCheckpoint->Append(write, batch.events);
+    if (batch.saveCheckpoint) fCheckpoint->Save(*fFile, fCheckpointFileName);
+  } else {
+    write();
+  }
+}
@@ -0,0 +1,37 @@
+#include "AirPetPhotonHit.hh"
+
+#include "G4UnitsTable.hh"
+#include "G4ios.hh"
+
+G4ThreadLocal G4Allocator<AirPetPhotonHit>* AirPetPhotonHit::fAllocator = nullptr;
+
+AirPetPhotonHit::AirPetPhotonHit(G4int channelID, G4int copyNo, G4int numTimeBins)
+  : G4VHit(),
+    fChannelID(channelID),
+    fCopyNo(copyNo),
+    fPhotons(0),
+    fFirstTime(DBL_MAX),
+    fTimeBins(numTimeBins > 0 ? numTimeBins : 1, 0)
+{}
+
+AirPetPhotonHit::~AirPetPhotonHit() {}
+
+void AirPetPhotonHit::AddPhoton(G4double time, G4double timeBinWidth)
+{
+  ++fPhotons;
+  if (time < fFirstTime) fFirstTime = time;
+
+  const G4int last = static_cast<G4int>(fTimeBins.size()) - 1;
+  G4int bin = timeBinWidth > 0. ? static_cast<G4int>(time / timeBinWidth) : 0;
+  if (bin < 0) bin = 0;
+  if (bin > last) bin = last;
+  ++fTimeBins[bin];
+}
+
+void AirPetPhotonHit::Print()
+{
+  G4cout << "  channel: " << fChannelID << "[" << fCopyNo << "]"
+         << " photons: " << fPhotons
+         << " first: " << G4BestUnit(fFirstTime, "Time")
+         << G4endl;
+}
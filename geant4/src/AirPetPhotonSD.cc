@@ -0,0 +1,70 @@
+#include "AirPetPhotonSD.hh"
+#include "AirPetChannelMap.hh"
+#include "AirPetOpticalReadout.hh"
+#include "AirPetProfiler.hh"
+#include "G4HCofThisEvent.hh"
+#include "G4OpticalPhoton.hh"
+#include "G4SDManager.hh"
+#include "G4Step.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Track.hh"
+#include "G4VTouchable.hh"
+#include "Randomize.hh"
+
+AirPetPhotonSD::AirPetPhotonSD(const G4String& name)
+ : G4VSensitiveDetector(name),
+   fHitsCollection(nullptr),
+   fTimeBinWidth(0.5 * ns),
+   fNumTimeBins(200),
+   fDetectionEfficiency(1.0)
+{
+  collectionName.insert(name + "PhotonHitsCollection");
+}
+
+AirPetPhotonSD::~AirPetPhotonSD()
+{}
+
+void AirPetPhotonSD::Initialize(G4HCofThisEvent* hce)
+{
+  fHitsCollection = new AirPetPhotonHitsCollection(SensitiveDetectorName, collectionName[0]);
+  G4int hcID = G4SDManager::GetSDMpointer()->GetCollectionID(collectionName[0]);
+  hce->AddHitsCollection(hcID, fHitsCollection);
+
+  for (size_t slot : fTouchedSlots) fHitsBySlot[slot] = nullptr;
+  fTouchedSlots.clear();
+
+  if (const AirPetOpticalReadout* readout = AirPetOpticalReadout::GetThreadInstance()) {
+    fTimeBinWidth = readout->GetTimeBinWidth();
+    fNumTimeBins = readout->GetNumTimeBins();
+    fDetectionEfficiency = readout->GetDetectionEfficiency();
+  }
+}
+
+G4bool AirPetPhotonSD::ProcessHits(G4Step* aStep, G4TouchableHistory* /*ROhist*/)
+{
+  AirPetProfileScope profile(AirPetProfiler::kProcessHits);
+
+  G4Track* track = aStep->GetTrack();
+  if (track->GetDefinition() != G4OpticalPhoton::Definition()) return false;
+
+  // The photon ends here, whether or not it is counted.
+  track->SetTrackStatus(fStopAndKill);
+  if (fDetectionEfficiency < 1.0 && G4UniformRand() >= fDetectionEfficiency) return false;
+
+  G4StepPoint* preStepPoint = aStep->GetPreStepPoint();
+  const AirPetChannelMap* channelMap = AirPetChannelMap::Instance();
+  const G4int channelID = channelMap->GetChannelID(preStepPoint->GetTouchable());
+
+  const size_t slot = static_cast<size_t>(channelID + 1);
+  if (slot >= fHitsBySlot.size()) fHitsBySlot.resize(channelMap->GetNumberOfChannels() + 1, nullptr);
+  AirPetPhotonHit*& hit = fHitsBySlot[slot];
+  if (!hit) {
+    const G4int copyNo = channelID >= 0 ? channelMap->GetChannel(channelID).copyNo
+                                        : preStepPoint->GetTouchable()->GetCopyNumber();
+    hit = new AirPetPhotonHit(channelID, copyNo, fNumTimeBins);
+    fHitsCollection->insert(hit);
+    fTouchedSlots.push_back(slot);
+  }
+  hit->AddPhoton(preStepPoint->GetGlobalTime(), fTimeBinWidth);
+  return true;
+}
@@ -0,0 +1,216 @@
+#include "AirPetPhysicsCache.hh"
+
+#include "G4EmParameters.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Material.hh"
+#include "G4ProductionCuts.hh"
+#include "G4ProductionCutsTable.hh"
+#include "G4Region.hh"
+#include "G4RegionStore.hh"
+#include "G4StateManager.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Threading.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+#include "G4Version.hh"
+#include "G4VUserPhysicsList.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+  // FNV-1a hash of a string, as 16 hex digits.
+  G4String HashString(const std::string& text)
+  {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+      hash ^= c;
+      hash *= 1099511628211ull;
+    }
+    std::ostringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex.str();
+  }
+
+  std::string ReadFile(const std::string& fileName)
+  {
+    std::ifstream in(fileName, std::ios::binary);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+  }
+
+  G4String DefaultCacheDir()
+  {
+    if (const char* dir = std::getenv("AIRPET_PHYSICS_CACHE")) return dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) return G4String(xdg) + "/airpet/physics";
+    if (const char* home = std::getenv("HOME")) return G4String(home) + "/.cache/airpet/physics";
+    return "";
+  }
+}
+
+AirPetPhysicsCache::AirPetPhysicsCache(G4VUserPhysicsList* physicsList, const G4String& physicsListName,
+                                       G4bool opticalPhysics)
+  : G4VStateDependent(), G4UImessenger(),
+    fPhysicsList(physicsList), fPhysicsListName(physicsListName), fOpticalPhysics(opticalPhysics),
+    fCacheDir(DefaultCacheDir()), fRetrieving(false), fStorePending(false)
+{
+  fEnabled = !fCacheDir.empty() && fCacheDir != "off";
+
+  fPhysicsDir = new G4UIdirectory("/g4pet/physics/");
+  fPhysicsDir->SetGuidance("Cache of the built physics tables.");
+
+  fEnableCmd = new G4UIcommand("/g4pet/physics/cache", this);
+  fEnableCmd->SetGuidance("Retrieve physics tables from the cache, and store newly built ones (default: on).");
+  fEnableCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fEnableCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fCacheDirCmd = new G4UIcmdWithAString("/g4pet/physics/cacheDir", this);
+  fCacheDirCmd->SetGuidance("Directory of the physics table cache (default: $AIRPET_PHYSICS_CACHE,");
+  fCacheDirCmd->SetGuidance("else ~/.cache/airpet/physics).");
+  fCacheDirCmd->SetParameterName("dir", false);
+  fCacheDirCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetPhysicsCache::~AirPetPhysicsCache()
+{
+  delete fCacheDirCmd;
+  delete fEnableCmd;
+  delete fPhysicsDir;
+}
+
+void AirPetPhysicsCache::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fEnableCmd) {
+    fEnabled = G4UIcommand::ConvertToBool(newValue) && !fCacheDir.empty() && fCacheDir != "off";
+  } else if (command == fCacheDirCmd) {
+    fCacheDir = newValue;
+    fEnabled = !fCacheDir.empty() && fCacheDir != "off";
+  }
+}
+
+G4String AirPetPhysicsCache::GetCurrentValue(G4UIcommand* command)
+{
+  if (command == fEnableCmd) return G4UIcommand::ConvertToString(fEnabled);
+  if (command == fCacheDirCmd) return fCacheDir;
+  return "";
+}
+
+G4bool AirPetPhysicsCache::Notify(G4ApplicationState requestedState)
+{
+  if (!G4Threading::IsMasterThread()) return true;
+  // During the notification the state manager still reports the old state.
+  const G4ApplicationState currentState = G4StateManager::GetStateManager()->GetCurrentState();
+  if (currentState == G4State_Idle && requestedState == G4State_Init) {
+    PrepareRetrieve();
+  } else if (currentState == G4State_Idle && requestedState == G4State_GeomClosed) {
+    // The tables of this run are built; workers build theirs from the
+    // master's, not from the cache.
+    if (fStorePending || (fRetrieving && !fPhysicsList->IsPhysicsTableRetrieved())) StoreTables();
+    if (fRetrieving) fPhysicsList->ResetPhysicsTableRetrieved();
+    fRetrieving = fStorePending = false;
+  }
+  return true;
+}
+
+G4String AirPetPhysicsCache::BuildKey() const
+{
+  std::ostringstream key;
+  key << std::setprecision(12)
+      << "geant4 " << G4VERSION_NUMBER << "\n"
+      << "physics_list " << fPhysicsListName << "\n"
+      << "optical " << (fOpticalPhysics ? 1 : 0) << "\n"
+      << "default_cut_mm " << fPhysicsList->GetDefaultCutValue() / mm << "\n";
+  const G4ProductionCutsTable* cutsTable = G4ProductionCutsTable::GetProductionCutsTable();
+  key << "energy_range_MeV " << cutsTable->GetLowEdgeEnergy() / MeV << " "
+      << cutsTable->GetHighEdgeEnergy() / MeV << "\n";
+  G4EmParameters::Instance()->StreamInfo(key);
+
+  // Materials, including the element composition the tables are built from.
+  for (const G4Material* material : *G4Material::GetMaterialTable()) {
+    key << "material " << material->GetName() << " " << material->GetDensity() / (g / cm3) << " "
+        << material->GetState() << " " << material->GetTemperature() / kelvin << " "
+        << material->GetPressure() / atmosphere << " "
+        << material->GetIonisation()->GetMeanExcitationEnergy() / eV;
+    const G4ElementVector* elements = material->GetElementVector();
+    const G4double* fractions = material->GetFractionVector();
+    for (size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+      key << " " << (*elements)[i]->GetZ() << ":" << (*elements)[i]->GetN() << ":" << fractions[i];
+    }
+    key << "\n";
+  }
+  // Which materials are used where, and the cuts of each region.
+  for (const G4LogicalVolume* volume : *G4LogicalVolumeStore::GetInstance()) {
+    key << "volume " << volume->GetName() << " "
+        << (volume->GetMaterial() ? volume->GetMaterial()->GetName() : G4String("none")) << "\n";
+  }
+  for (const G4Region* region : *G4RegionStore::GetInstance()) {
+    key << "region " << region->GetName();
+    const G4ProductionCuts* cuts = region->GetProductionCuts();
+    for (G4int i = 0; i < 4; ++i) key << " " << (cuts ? cuts->GetProductionCut(i) / mm : -1.);
+    auto root = const_cast<G4Region*>(region)->GetRootLogicalVolumeIterator();
+    for (size_t i = 0; i < region->GetNumberOfRootVolumes(); ++i, ++root) key << " " << (*root)->GetName();
+    key << "\n";
+  }
+  return key.str();
+}
+
+void AirPetPhysicsCache::PrepareRetrieve()
+{
+  fRetrieving = fStorePending = false;
+  if (!fEnabled) return;
+
+  fEntryKey = BuildKey();
+  fEntryDir = fCacheDir + "/" + HashString(fEntryKey);
+  if (ReadFile(fEntryDir + "/key.txt") == fEntryKey) {
+    G4cout << "--> Physics tables from the cache " << fEntryDir << G4endl;
+    fPhysicsList->SetPhysicsTableRetrieved(fEntryDir);
+    fRetrieving = true;
+  } else {
+    fPhysicsList->ResetPhysicsTableRetrieved();
+    fStorePending = true;
+  }
+}
+
+void AirPetPhysicsCache::StoreTables()
+{
+  namespace fs = std::filesystem;
+  std::error_code error;
+  const G4String tmpDir = fEntryDir + ".tmp" + std::to_string(getpid());
+  fs::remove_all(tmpDir.c_str(), error);
+  fs::create_directories(tmpDir.c_str(), error);
+  G4bool stored = !error && fPhysicsList->StorePhysicsTable(tmpDir);
+  if (stored) {
+    std::ofstream out(tmpDir + "/key.txt", std::ios::binary);
+    out << fEntryKey;
+    out.close();
+    stored = static_cast<bool>(out);
+  }
+  if (stored) {
+    // An entry that failed to retrieve is replaced. If another job has just
+    // stored the same entry, the rename fails and that one is kept.
+    if (fRetrieving) fs::remove_all(fEntryDir.c_str(), error);
+    fs::rename(tmpDir.c_str(), fEntryDir.c_str(), error);
+    if (error) {
+      fs::remove_all(tmpDir.c_str(), error);
+      stored = ReadFile(fEntryDir + "/key.txt") == fEntryKey;
+      if (stored) return;
+    }
+  }
+  if (!stored) {
+    fs::remove_all(tmpDir.c_str(), error);
+    G4Exception("AirPetPhysicsCache::StoreTables", "PhysicsCacheError", JustWarning,
+                ("Could not store the physics tables in " + fEntryDir).c_str());
+    return;
+  }
+  G4cout << "--> Physics tables stored in the cache " << fEntryDir << G4endl;
+}
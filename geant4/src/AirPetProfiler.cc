@@ -0,0 +1,129 @@
+#include "AirPetProfiler.hh"
+
+#include "G4AutoLock.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+
+#include <chrono>
+#include <iomanip>
+
+#ifdef AIRPET_PROFILING
+std::atomic<bool> AirPetProfiler::fEnabled{true};
+#else
+std::atomic<bool> AirPetProfiler::fEnabled{false};
+#endif
+G4ThreadLocal AirPetProfiler::Counters AirPetProfiler::fThreadCounters = {};
+
+namespace {
+  G4Mutex profileMutex = G4MUTEX_INITIALIZER;
+
+  const char* kSectionNames[AirPetProfiler::kNumSections] = {
+      "SteppingAction", "ProcessHits", "PreUserTrackingAction",
+      "PostUserTrackingAction", "EndOfEventAction", "Digitizer", "OutputWrite", "OutputQueue"};
+
+  // Run totals, merged from all threads.
+  uint64_t totalCalls[AirPetProfiler::kNumSections];
+  uint64_t totalTicks[AirPetProfiler::kNumSections];
+  G4int activeThreads = 0;
+
+  // Tick rate calibration against the wall clock over the run.
+  uint64_t runStartTicks = 0;
+  std::chrono::steady_clock::time_point runStartTime;
+}
+
+AirPetProfiler::AirPetProfiler()
+  : G4UImessenger()
+{
+  fProfileDir = new G4UIdirectory("/g4pet/profile/");
+  fProfileDir->SetGuidance("Timing of the user actions and the output path.");
+
+  fEnableCmd = new G4UIcommand("/g4pet/profile/enable", this);
+  fEnableCmd->SetGuidance("Time the user hooks and print a breakdown at the end of each run.");
+  fEnableCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fEnableCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetProfiler::~AirPetProfiler()
+{
+  delete fEnableCmd;
+  delete fProfileDir;
+}
+
+void AirPetProfiler::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fEnableCmd) fEnabled = G4UIcommand::ConvertToBool(newValue);
+}
+
+const std::vector<AirPetColumnSpec>& AirPetProfiler::GetProfileColumns()
+{
+  static const std::vector<AirPetColumnSpec> columns = {
+      {"Section", AirPetColumnType::kString},
+      {"Calls", AirPetColumnType::kFloat64},
+      {"Seconds", AirPetColumnType::kFloat64},
+      {"NsPerCall", AirPetColumnType::kFloat64},
+      {"Fraction", AirPetColumnType::kFloat64}};
+  return columns;
+}
+
+void AirPetProfiler::BeginRun(G4bool isMaster)
+{
+  fThreadCounters = Counters();
+  if (!isMaster) return;
+
+  G4AutoLock lock(&profileMutex);
+  for (G4int i = 0; i < kNumSections; ++i) totalCalls[i] = totalTicks[i] = 0;
+  activeThreads = 0;
+  runStartTicks = Ticks();
+  runStartTime = std::chrono::steady_clock::now();
+}
+
+void AirPetProfiler::MergeThread()
+{
+  G4AutoLock lock(&profileMutex);
+  G4bool active = false;
+  for (G4int i = 0; i < kNumSections; ++i) {
+    totalCalls[i] += fThreadCounters.calls[i];
+    totalTicks[i] += fThreadCounters.ticks[i];
+    if (fThreadCounters.calls[i] > 0) active = true;
+  }
+  if (active) ++activeThreads;
+  fThreadCounters = Counters();
+}
+
+void AirPetProfiler::Report(AirPetNtupleBuffer& profile)
+{
+  if (!IsEnabled()) return;
+
+  G4AutoLock lock(&profileMutex);
+  const G4double wallSeconds =
+      std::chrono::duration<G4double>(std::chrono::steady_clock::now() - runStartTime).count();
+  const G4double ticksPerSecond =
+      wallSeconds > 0. ? static_cast<G4double>(Ticks() - runStartTicks) / wallSeconds : 1.;
+  // Fractions are relative to the wall time of all threads that did work.
+  const G4double threadSeconds = wallSeconds * (activeThreads > 0 ? activeThreads : 1);
+
+  G4cout << G4endl << "-------- AirPet profile (" << activeThreads << " thread(s), "
+         << std::fixed << std::setprecision(3) << wallSeconds << " s wall) --------" << G4endl;
+  G4cout << std::left << std::setw(24) << "Section" << std::right << std::setw(14) << "Calls"
+         << std::setw(12) << "Seconds" << std::setw(12) << "ns/call" << std::setw(9) << "%" << G4endl;
+  for (G4int i = 0; i < kNumSections; ++i) {
+    const G4double seconds = totalTicks[i] / ticksPerSecond;
+    const G4double nsPerCall = totalCalls[i] > 0 ? 1e9 * seconds / totalCalls[i] : 0.;
+    const G4double fraction = threadSeconds > 0. ? seconds / threadSeconds : 0.;
+    G4cout << std::left << std::setw(24) << kSectionNames[i] << std::right
+           << std::setw(14) << totalCalls[i] << std::setw(12) << std::setprecision(3) << seconds
+           << std::setw(12) << std::setprecision(1) << nsPerCall
+           << std::setw(9) << std::setprecision(2) << 100. * fraction << G4endl;
+
+    if (profile.GetColumns().empty()) continue;
+    profile.FillS(0, kSectionNames[i]);
+    profile.FillD(1, static_cast<G4double>(totalCalls[i]));
+    profile.FillD(2, seconds);
+    profile.FillD(3, nsPerCall);
+    profile.FillD(4, fraction);
+    profile.AddRow();
+  }
+  G4cout << std::defaultfloat << std::setprecision(6)
+         << "(EndOfEventAction includes Digitizer, OutputQueue and synchronous OutputWrite)" << G4endl << G4endl;
+}
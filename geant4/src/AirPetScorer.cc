@@ -0,0 +1,165 @@
+#include "AirPetScorer.hh"
+#include "AirPetOutputFile.hh"
+
+#include "G4AutoLock.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Step.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Tokenizer.hh"
+#include "G4UIcmdWith3VectorAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  G4Mutex scoreMutex = G4MUTEX_INITIALIZER;
+}
+
+G4ThreadLocal AirPetScorer* AirPetScorer::fActive = nullptr;
+
+AirPetScorer::AirPetScorer()
+  : G4UImessenger(), fEnabled(false), fOrigin(0., 0., 0.),
+    fVoxelSize(1. * mm, 1. * mm, 1. * mm), fShape{1, 1, 1}
+{
+  fScoreDir = new G4UIdirectory("/g4pet/score/");
+  fScoreDir->SetGuidance("Energy-deposit scoring on a 3D voxel grid.");
+
+  fEnableCmd = new G4UIcommand("/g4pet/score/enable", this);
+  fEnableCmd->SetGuidance("Accumulate Edep on the grid and write /scoring/Edep at the end of the run.");
+  fEnableCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fEnableCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fOriginCmd = new G4UIcmdWith3VectorAndUnit("/g4pet/score/origin", this);
+  fOriginCmd->SetGuidance("Lower corner of the grid.");
+  fOriginCmd->SetParameterName("x", "y", "z", false);
+  fOriginCmd->SetUnitCategory("Length");
+  fOriginCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fVoxelSizeCmd = new G4UIcmdWith3VectorAndUnit("/g4pet/score/voxelSize", this);
+  fVoxelSizeCmd->SetGuidance("Voxel size along x, y and z.");
+  fVoxelSizeCmd->SetParameterName("dx", "dy", "dz", false);
+  fVoxelSizeCmd->SetUnitCategory("Length");
+  fVoxelSizeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fShapeCmd = new G4UIcommand("/g4pet/score/shape", this);
+  fShapeCmd->SetGuidance("Number of voxels along x, y and z.");
+  fShapeCmd->SetParameter(new G4UIparameter("nx", 'i', false));
+  fShapeCmd->SetParameter(new G4UIparameter("ny", 'i', false));
+  fShapeCmd->SetParameter(new G4UIparameter("nz", 'i', false));
+  fShapeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fAddVolumeCmd = new G4UIcmdWithAString("/g4pet/score/addVolume", this);
+  fAddVolumeCmd->SetGuidance("Score every step in this logical volume (instead of the SD deposits).");
+  fAddVolumeCmd->SetParameterName("LogicalVolumeName", false);
+  fAddVolumeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fClearVolumesCmd = new G4UIcommand("/g4pet/score/clearVolumes", this);
+  fClearVolumesCmd->SetGuidance("Go back to scoring the sensitive detector deposits.");
+  fClearVolumesCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetScorer::~AirPetScorer()
+{
+  if (fActive == this) fActive = nullptr;
+  delete fEnableCmd;
+  delete fOriginCmd;
+  delete fVoxelSizeCmd;
+  delete fShapeCmd;
+  delete fAddVolumeCmd;
+  delete fClearVolumesCmd;
+  delete fScoreDir;
+}
+
+void AirPetScorer::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fEnableCmd) {
+    fEnabled = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fOriginCmd) {
+    fOrigin = fOriginCmd->GetNew3VectorValue(newValue);
+  } else if (command == fVoxelSizeCmd) {
+    fVoxelSize = fVoxelSizeCmd->GetNew3VectorValue(newValue);
+  } else if (command == fShapeCmd) {
+    G4Tokenizer next(newValue);
+    for (G4int axis = 0; axis < 3; ++axis) fShape[axis] = std::max(1, StoI(next()));
+  } else if (command == fAddVolumeCmd) {
+    fVolumeNames.push_back(newValue);
+  } else if (command == fClearVolumesCmd) {
+    fVolumeNames.clear();
+  }
+}
+
+void AirPetScorer::BeginRun()
+{
+  fActive = nullptr;
+  fGrid.clear();
+  fVolumes.clear();
+  if (!fEnabled) return;
+
+  fGrid.assign(static_cast<size_t>(fShape[0]) * fShape[1] * fShape[2], 0.);
+
+  G4LogicalVolumeStore* lvStore = G4LogicalVolumeStore::GetInstance();
+  for (const auto& name : fVolumeNames) {
+    G4LogicalVolume* volume = lvStore->GetVolume(name, false);
+    if (!volume) {
+      G4Exception("AirPetScorer::BeginRun", "ScoringVolumeNotFound", JustWarning,
+                  ("Logical volume '" + name + "' not found; it is not scored.").c_str());
+      continue;
+    }
+    fVolumes.push_back(volume);
+  }
+  fActive = this;
+}
+
+void AirPetScorer::EndRun()
+{
+  fActive = nullptr;
+}
+
+G4bool AirPetScorer::ScoresVolume(const G4LogicalVolume* volume) const
+{
+  return std::find(fVolumes.begin(), fVolumes.end(), volume) != fVolumes.end();
+}
+
+void AirPetScorer::AddStep(const G4Step* step)
+{
+  const G4double edep = step->GetTotalEnergyDeposit();
+  if (edep == 0.) return;
+
+  const G4ThreeVector point =
+      0.5 * (step->GetPreStepPoint()->GetPosition() + step->GetPostStepPoint()->GetPosition()) - fOrigin;
+  const G4double ix = std::floor(point.x() / fVoxelSize.x());
+  const G4double iy = std::floor(point.y() / fVoxelSize.y());
+  const G4double iz = std::floor(point.z() / fVoxelSize.z());
+  if (ix < 0. || iy < 0. || iz < 0. || ix >= fShape[0] || iy >= fShape[1] || iz >= fShape[2]) return;
+
+  const size_t index = (static_cast<size_t>(ix) * fShape[1] + static_cast<size_t>(iy)) * fShape[2] +
+                       static_cast<size_t>(iz);
+  fGrid[index] += edep;
+}
+
+void AirPetScorer::MergeInto(AirPetScorer& master) const
+{
+  if (fGrid.empty()) return;
+  G4AutoLock lock(&scoreMutex);
+  if (master.fGrid.size() != fGrid.size()) return;
+  for (size_t i = 0; i < fGrid.size(); ++i) master.fGrid[i] += fGrid[i];
+}
+
+void AirPetScorer::Write(AirPetOutputFile& file) const
+{
+  if (fGrid.empty()) return;
+  G4AutoLock lock(&scoreMutex);
+
+  std::vector<G4double> edep(fGrid.size());
+  for (size_t i = 0; i < fGrid.size(); ++i) edep[i] = fGrid[i] / MeV;
+  const size_t shape[3] = {static_cast<size_t>(fShape[0]), static_cast<size_t>(fShape[1]),
+                           static_cast<size_t>(fShape[2])};
+  const G4double origin[3] = {fOrigin.x() / mm, fOrigin.y() / mm, fOrigin.z() / mm};
+  const G4double voxelSize[3] = {fVoxelSize.x() / mm, fVoxelSize.y() / mm, fVoxelSize.z() / mm};
+  file.WriteGrid("Edep", edep.data(), shape, origin, voxelSize, "MeV");
+}
@@ -1,9 +1,16 @@
 #include "AirPetSensitiveDetector.hh"
+#include "AirPetChannelMap.hh"
+#include "AirPetNameTable.hh"
+#include "AirPetProfiler.hh"
+#include "AirPetScorer.hh"
 #include "G4HCofThisEvent.hh"
 #include "G4SDManager.hh"
 #include "G4Step.hh"
 #include "G4Track.hh"
 #include "G4TouchableHistory.hh"
+#include "G4VTouchable.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
 #include "G4ios.hh"
 
 AirPetSensitiveDetector::AirPetSensitiveDetector(const G4String& name)
@@ -28,36 +35,59 @@ void AirPetSensitiveDetector::Initialize(G4HCofThisEvent* hce)
 
   // Add the collection to the Hits Collection of this Event
   hce->AddHitsCollection(hcID, fHitsCollection);
+
+  // Forget the previous event's hits (the bucket array is retained)
+  for (G4int channelID : fTouchedChannels) fHitsByChannel[channelID] = nullptr;
+  fTouchedChannels.clear();
+  fHitIndex.clear();
 }
 
 G4bool AirPetSensitiveDetector::ProcessHits(G4Step* aStep, G4TouchableHistory* /*ROhist*/)
 {
+  AirPetProfileScope profile(AirPetProfiler::kProcessHits);
+
   // Get the energy deposited in this step
   G4double edep = aStep->GetTotalEnergyDeposit();
 
   // If no energy was deposited, do nothing
   if (edep == 0.) return false;
 
+  // Voxel scoring of the SD deposits (/g4pet/score/)
+  AirPetScorer* scorer = AirPetScorer::GetActive();
+  if (scorer && scorer->ScoresSensitiveDetectors()) scorer->AddStep(aStep);
+
   // --- Find existing hit or create new one ---
+  // Volumes known to the channel map (all of them, normally) are looked up
+  // by their flat channel ID, which also fixes the volume IDs and copy
+  // number of the hit.
   G4StepPoint* preStepPoint = aStep->GetPreStepPoint();
-  G4TouchableHistory* touchable = (G4TouchableHistory*)(preStepPoint->GetTouchable());
-  G4int copyNo = touchable->GetReplicaNumber();
-  if (copyNo == 0) {
-        copyNo = touchable->GetVolume()->GetCopyNo();
-  }
-
-  // We check if a hit for this crystal (identified by its name + copy number)
-  // already exists in the collection for this event.
-  for (size_t i = 0; i < fHitsCollection->GetSize(); ++i) {
-    auto existingHit = static_cast<AirPetHit*>(fHitsCollection->GetHit(i));
-
-    if (existingHit->GetPhysicalVolumeName() == touchable->GetVolume()->GetName() && 
-        existingHit->GetVolumeName() == touchable->GetVolume()->GetLogicalVolume()->GetName() && 
-        existingHit->GetCopyNo() == copyNo) {
-      // It exists! Add the energy to it and we're done.
-      existingHit->AddEdep(edep);
+  const G4VTouchable* touchable = preStepPoint->GetTouchable();
+  const AirPetChannelMap* channelMap = AirPetChannelMap::Instance();
+  const G4int channelID = channelMap->GetChannelID(touchable);
+
+  AirPetHit** slot = nullptr;
+  if (channelID >= 0) {
+    if (static_cast<size_t>(channelID) >= fHitsByChannel.size()) {
+      fHitsByChannel.resize(channelMap->GetNumberOfChannels(), nullptr);
+    }
+    slot = &fHitsByChannel[channelID];
+    if (*slot) {
+      (*slot)->AddEdep(edep);
+      return true;
+    }
+    fTouchedChannels.push_back(channelID);
+  } else {
+    // Fallback for volumes outside the map: one hit per placed volume +
+    // copy number.
+    G4int copyNo = touchable->GetReplicaNumber();
+    if (copyNo == 0) copyNo = touchable->GetVolume()->GetCopyNo();
+    // try_emplace only allocates a node when the key is new.
+    auto inserted = fHitIndex.try_emplace(HitKey{touchable->GetVolume(), copyNo}, nullptr);
+    if (!inserted.second) {
+      inserted.first->second->AddEdep(edep);
       return true;
     }
+    slot = &inserted.first->second;
   }
 
   // --- If we get here, it's the first time this crystal was hit in this event ---
@@ -68,12 +98,23 @@ G4bool AirPetSensitiveDetector::ProcessHits(G4Step* aStep, G4TouchableHistory* /
   G4Track* track = aStep->GetTrack();
   newHit->SetTrackID(track->GetTrackID());
   newHit->SetParentID(track->GetParentID());
-  newHit->SetParticleName(track->GetDefinition()->GetParticleName());
-
-  // Get information from the PreStepPoint (where the step started)
-  newHit->SetPhysicalVolumeName(touchable->GetVolume()->GetName());
-  newHit->SetVolumeName(touchable->GetVolume()->GetLogicalVolume()->GetName());
-  newHit->SetCopyNo(copyNo);
+  auto* nameTable = AirPetNameTable::Instance();
+  newHit->SetParticleID(nameTable->GetParticleID(track->GetDefinition()));
+
+  newHit->SetChannelID(channelID);
+  if (channelID >= 0) {
+    const AirPetChannelMap::Channel& channel = channelMap->GetChannel(channelID);
+    newHit->SetPhysicalVolumeID(channel.physicalVolumeID);
+    newHit->SetVolumeID(channel.logicalVolumeID);
+    newHit->SetCopyNo(channel.copyNo);
+  } else {
+    G4VPhysicalVolume* volume = touchable->GetVolume();
+    G4int copyNo = touchable->GetReplicaNumber();
+    if (copyNo == 0) copyNo = volume->GetCopyNo();
+    newHit->SetPhysicalVolumeID(nameTable->GetPhysicalVolumeID(volume));
+    newHit->SetVolumeID(nameTable->GetLogicalVolumeID(volume->GetLogicalVolume()));
+    newHit->SetCopyNo(copyNo);
+  }
 
   // Get information from the PostStepPoint (where the step ended)
   G4StepPoint* postStepPoint = aStep->GetPostStepPoint();
@@ -81,8 +122,9 @@ G4bool AirPetSensitiveDetector::ProcessHits(G4Step* aStep, G4TouchableHistory* /
   newHit->SetPosition(postStepPoint->GetPosition());
   newHit->SetTime(postStepPoint->GetGlobalTime());
 
-  // Add the hit to our collection for this event
+  // Add the hit to our collection for this event and index it
   fHitsCollection->insert(newHit);
+  *slot = newHit;
 
   return true;
 }
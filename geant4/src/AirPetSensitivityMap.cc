@@ -0,0 +1,371 @@
+#include "AirPetSensitivityMap.hh"
+#include "AirPetJosephProjector.hh"
+#include "DetectorConstruction.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4ReplicaNavigation.hh"
+#include "G4RotationMatrix.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Threading.hh"
+#include "G4Tokenizer.hh"
+#include "G4UIcmdWith3VectorAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithAnInteger.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+#include "G4VPVParameterisation.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4VSolid.hh"
+#include "G4ios.hh"
+
+#include <hdf5.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <thread>
+
+namespace {
+  void WriteAttribute(hid_t object, const char* name, hid_t type, size_t count, const void* value)
+  {
+    const hsize_t dims[1] = {count};
+    hid_t space = count == 1 ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, dims, nullptr);
+    hid_t attribute = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attribute, type, value);
+    H5Aclose(attribute);
+    H5Sclose(space);
+  }
+
+  void WriteStringAttribute(hid_t object, const char* name, const std::string& value)
+  {
+    hid_t type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, std::max<size_t>(1, value.size()));
+    WriteAttribute(object, name, type, 1, value.data());
+    H5Tclose(type);
+  }
+
+  // geometry_key attribute of the sensitivity dataset of a file, or "".
+  std::string ReadKey(const G4String& fileName)
+  {
+    std::string key;
+    H5E_BEGIN_TRY {
+      hid_t file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      if (file >= 0) {
+        hid_t dataset = H5Dopen2(file, "sensitivity", H5P_DEFAULT);
+        if (dataset >= 0) {
+          hid_t attribute = H5Aopen(dataset, "geometry_key", H5P_DEFAULT);
+          if (attribute >= 0) {
+            hid_t type = H5Aget_type(attribute);
+            if (H5Tget_class(type) == H5T_STRING && !H5Tis_variable_str(type)) {
+              key.resize(H5Tget_size(type));
+              if (H5Aread(attribute, type, &key[0]) < 0) key.clear();
+              key = key.c_str();  // drop padding
+            }
+            H5Tclose(type);
+            H5Aclose(attribute);
+          }
+          H5Dclose(dataset);
+        }
+        H5Fclose(file);
+      }
+    } H5E_END_TRY;
+    return key;
+  }
+}
+
+AirPetSensitivityMap::AirPetSensitivityMap(const DetectorConstruction* detector)
+  : G4UImessenger(), fDetector(detector), fShape{128, 128, 128},
+    fVoxelSize(2. * mm, 2. * mm, 2. * mm), fSamplesPerPair(1), fThreads(0),
+    fCylinderRadius(0.), fCylinderLength(0.), fCylinderMu(0.)
+{
+  fSensitivityDir = new G4UIdirectory("/g4pet/sensitivity/");
+  fSensitivityDir->SetGuidance("Sensitivity image from the detector geometry (for reconstruction).");
+
+  fShapeCmd = new G4UIcommand("/g4pet/sensitivity/shape", this);
+  fShapeCmd->SetGuidance("Image size in voxels along x, y and z; the image is centred on the origin.");
+  fShapeCmd->SetParameter(new G4UIparameter("nx", 'i', false));
+  fShapeCmd->SetParameter(new G4UIparameter("ny", 'i', false));
+  fShapeCmd->SetParameter(new G4UIparameter("nz", 'i', false));
+  fShapeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fShapeCmd->SetToBeBroadcasted(false);
+
+  fVoxelSizeCmd = new G4UIcmdWith3VectorAndUnit("/g4pet/sensitivity/voxelSize", this);
+  fVoxelSizeCmd->SetGuidance("Voxel size along x, y and z.");
+  fVoxelSizeCmd->SetParameterName("dx", "dy", "dz", false);
+  fVoxelSizeCmd->SetUnitCategory("Length");
+  fVoxelSizeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fVoxelSizeCmd->SetToBeBroadcasted(false);
+
+  fSamplesCmd = new G4UIcmdWithAnInteger("/g4pet/sensitivity/samplesPerPair", this);
+  fSamplesCmd->SetGuidance("LORs per crystal pair, between random points inside the crystals.");
+  fSamplesCmd->SetGuidance("1 (default) uses the crystal centres.");
+  fSamplesCmd->SetParameterName("samples", false);
+  fSamplesCmd->SetRange("samples>0");
+  fSamplesCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fSamplesCmd->SetToBeBroadcasted(false);
+
+  fThreadsCmd = new G4UIcmdWithAnInteger("/g4pet/sensitivity/threads", this);
+  fThreadsCmd->SetGuidance("Threads for the pair sweep (0 = all cores).");
+  fThreadsCmd->SetParameterName("threads", false);
+  fThreadsCmd->SetRange("threads>=0");
+  fThreadsCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fThreadsCmd->SetToBeBroadcasted(false);
+
+  fAttenuationCmd = new G4UIcommand("/g4pet/sensitivity/attenuationCylinder", this);
+  fAttenuationCmd->SetGuidance("Attenuating cylinder along z, centred at the origin.");
+  fAttenuationCmd->SetGuidance("Radius and length in mm, mu in 1/cm (0 = no attenuation).");
+  fAttenuationCmd->SetParameter(new G4UIparameter("radius", 'd', false));
+  fAttenuationCmd->SetParameter(new G4UIparameter("length", 'd', false));
+  fAttenuationCmd->SetParameter(new G4UIparameter("mu", 'd', false));
+  fAttenuationCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fAttenuationCmd->SetToBeBroadcasted(false);
+
+  fComputeCmd = new G4UIcmdWithAString("/g4pet/sensitivity/compute", this);
+  fComputeCmd->SetGuidance("Compute the sensitivity image into this HDF5 file.");
+  fComputeCmd->SetGuidance("An existing file for the same geometry and settings is kept.");
+  fComputeCmd->SetParameterName("filename", false);
+  fComputeCmd->AvailableForStates(G4State_Idle);
+  fComputeCmd->SetToBeBroadcasted(false);
+}
+
+AirPetSensitivityMap::~AirPetSensitivityMap()
+{
+  delete fShapeCmd;
+  delete fVoxelSizeCmd;
+  delete fSamplesCmd;
+  delete fThreadsCmd;
+  delete fAttenuationCmd;
+  delete fComputeCmd;
+  delete fSensitivityDir;
+}
+
+void AirPetSensitivityMap::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fShapeCmd) {
+    G4Tokenizer next(newValue);
+    for (G4int axis = 0; axis < 3; ++axis) fShape[axis] = std::max(1, StoI(next()));
+  } else if (command == fVoxelSizeCmd) {
+    fVoxelSize = fVoxelSizeCmd->GetNew3VectorValue(newValue);
+  } else if (command == fSamplesCmd) {
+    fSamplesPerPair = fSamplesCmd->GetNewIntValue(newValue);
+  } else if (command == fThreadsCmd) {
+    fThreads = fThreadsCmd->GetNewIntValue(newValue);
+  } else if (command == fAttenuationCmd) {
+    G4Tokenizer next(newValue);
+    fCylinderRadius = StoD(next()) * mm;
+    fCylinderLength = StoD(next()) * mm;
+    fCylinderMu = StoD(next()) / cm;
+  } else if (command == fComputeCmd) {
+    Compute(newValue);
+  }
+}
+
+G4String AirPetSensitivityMap::GetKey() const
+{
+  std::ostringstream key;
+  key << fDetector->GetGeometryHash() << " sd";
+  for (const auto& name : fDetector->GetSensitiveVolumeNames()) key << " " << name;
+  key << " shape " << fShape[0] << " " << fShape[1] << " " << fShape[2]
+      << " voxel " << fVoxelSize.x() / mm << " " << fVoxelSize.y() / mm << " " << fVoxelSize.z() / mm
+      << " samples " << fSamplesPerPair
+      << " cylinder " << fCylinderRadius / mm << " " << fCylinderLength / mm << " " << fCylinderMu * cm;
+  return key.str();
+}
+
+void AirPetSensitivityMap::CollectCrystals(const G4LogicalVolume* mother, const G4RotationMatrix& rotation,
+                                           const G4ThreeVector& translation,
+                                           const std::vector<G4String>& volumeNames,
+                                           std::mt19937& engine, std::vector<Crystal>& crystals) const
+{
+  for (size_t i = 0; i < mother->GetNoDaughters(); ++i) {
+    G4VPhysicalVolume* volume = mother->GetDaughter(i);
+    G4LogicalVolume* logical = volume->GetLogicalVolume();
+    const G4bool sensitive =
+        std::find(volumeNames.begin(), volumeNames.end(), logical->GetName()) != volumeNames.end();
+    if (!sensitive && logical->GetNoDaughters() == 0) continue;
+
+    G4VPVParameterisation* parameterisation = volume->GetParameterisation();
+    const G4int copies = volume->IsReplicated() ? volume->GetMultiplicity() : 1;
+    for (G4int copy = 0; copy < copies; ++copy) {
+      // Replicas and parameterised volumes are moved to each copy, as the
+      // navigator does.
+      G4VSolid* solid = logical->GetSolid();
+      if (parameterisation) {
+        parameterisation->ComputeTransformation(copy, volume);
+        solid = parameterisation->ComputeSolid(copy, volume);
+        solid->ComputeDimensions(parameterisation, copy, volume);
+      } else if (volume->IsReplicated()) {
+        G4ReplicaNavigation().ComputeTransformation(copy, volume);
+      }
+      const G4RotationMatrix daughterRotation = rotation * volume->GetObjectRotationValue();
+      const G4ThreeVector daughterTranslation = rotation * volume->GetObjectTranslation() + translation;
+
+      if (sensitive) {
+        // Random points inside the solid (its bounding-box centre for one
+        // sample), in global coordinates.
+        G4ThreeVector pMin, pMax;
+        solid->BoundingLimits(pMin, pMax);
+        std::uniform_real_distribution<G4double> uniform(0., 1.);
+        Crystal crystal;
+        for (G4int sample = 0; sample < fSamplesPerPair; ++sample) {
+          G4ThreeVector local = 0.5 * (pMin + pMax);
+          if (fSamplesPerPair > 1) {
+            for (G4int attempt = 0; attempt < 1000; ++attempt) {
+              const G4ThreeVector point(pMin.x() + uniform(engine) * (pMax.x() - pMin.x()),
+                                        pMin.y() + uniform(engine) * (pMax.y() - pMin.y()),
+                                        pMin.z() + uniform(engine) * (pMax.z() - pMin.z()));
+              if (solid->Inside(point) != kOutside) {
+                local = point;
+                break;
+              }
+            }
+          }
+          const G4ThreeVector global = daughterRotation * local + daughterTranslation;
+          crystal.points.push_back(static_cast<float>(global.x() / mm));
+          crystal.points.push_back(static_cast<float>(global.y() / mm));
+          crystal.points.push_back(static_cast<float>(global.z() / mm));
+        }
+        crystals.push_back(std::move(crystal));
+      }
+      CollectCrystals(logical, daughterRotation, daughterTranslation, volumeNames, engine, crystals);
+    }
+  }
+}
+
+G4float AirPetSensitivityMap::Survival(const float p0[3], const float p1[3]) const
+{
+  if (fCylinderMu <= 0.) return 1.f;
+
+  // Part of the segment p0 + t (p1 - p0), t in [0, 1], inside the cylinder.
+  const G4double d[3] = {G4double(p1[0]) - p0[0], G4double(p1[1]) - p0[1], G4double(p1[2]) - p0[2]};
+  G4double tMin = 0., tMax = 1.;
+  const G4double radius = fCylinderRadius / mm;
+  const G4double a = d[0] * d[0] + d[1] * d[1];
+  const G4double b = 2. * (p0[0] * d[0] + p0[1] * d[1]);
+  const G4double c = G4double(p0[0]) * p0[0] + G4double(p0[1]) * p0[1] - radius * radius;
+  if (a > 0.) {
+    const G4double discriminant = b * b - 4. * a * c;
+    if (discriminant <= 0.) return 1.f;
+    const G4double root = std::sqrt(discriminant);
+    tMin = std::max(tMin, (-b - root) / (2. * a));
+    tMax = std::min(tMax, (-b + root) / (2. * a));
+  } else if (c > 0.) {
+    return 1.f;
+  }
+  const G4double halfLength = 0.5 * fCylinderLength / mm;
+  if (d[2] != 0.) {
+    const G4double t0 = (-halfLength - p0[2]) / d[2];
+    const G4double t1 = (halfLength - p0[2]) / d[2];
+    tMin = std::max(tMin, std::min(t0, t1));
+    tMax = std::min(tMax, std::max(t0, t1));
+  } else if (std::fabs(p0[2]) > halfLength) {
+    return 1.f;
+  }
+  if (tMax <= tMin) return 1.f;
+
+  const G4double chord = (tMax - tMin) * std::sqrt(a + d[2] * d[2]);
+  return static_cast<G4float>(std::exp(-fCylinderMu * mm * chord));
+}
+
+void AirPetSensitivityMap::Compute(const G4String& fileName)
+{
+  const G4VPhysicalVolume* world = fDetector->GetWorldVolume();
+  const std::vector<G4String> volumeNames = fDetector->GetSensitiveVolumeNames();
+  if (!world || volumeNames.empty()) {
+    G4Exception("AirPetSensitivityMap::Compute", "NoDetectors", JustWarning,
+                "No geometry or no sensitive volumes (addSD); no sensitivity image computed.");
+    return;
+  }
+
+  const G4String key = GetKey();
+  if (ReadKey(fileName) == key) {
+    G4cout << "--> Sensitivity image " << fileName << " is up to date for this geometry." << G4endl;
+    return;
+  }
+
+  // Fixed seed, so the same geometry always gives the same image.
+  std::mt19937 engine(20240601u);
+  std::vector<Crystal> crystals;
+  CollectCrystals(world->GetLogicalVolume(), G4RotationMatrix(), world->GetObjectTranslation(),
+                  volumeNames, engine, crystals);
+  const size_t numCrystals = crystals.size();
+  if (numCrystals < 2) {
+    G4Exception("AirPetSensitivityMap::Compute", "NoDetectors", JustWarning,
+                "Fewer than two sensitive placements; no sensitivity image computed.");
+    return;
+  }
+
+  const double voxelSize[3] = {fVoxelSize.x() / mm, fVoxelSize.y() / mm, fVoxelSize.z() / mm};
+  const AirPetImageGrid grid = AirPetImageGrid::Centred(fShape, voxelSize);
+  const G4int numThreads = fThreads > 0 ? fThreads : std::max(1, G4Threading::G4GetNumberOfCores());
+  const unsigned long long numPairs = static_cast<unsigned long long>(numCrystals) * (numCrystals - 1) / 2;
+  G4cout << "--> Sensitivity: " << numCrystals << " crystals, " << numPairs << " pairs x "
+         << fSamplesPerPair << " LOR(s), " << numThreads << " thread(s)" << G4endl;
+
+  // Rows of the pair triangle are handed out one at a time, which keeps the
+  // threads balanced although rows get shorter.
+  const auto start = std::chrono::steady_clock::now();
+  const G4int samples = fSamplesPerPair;
+  const G4float sampleWeight = 1.f / samples;
+  std::vector<std::vector<G4float>> images(numThreads, std::vector<G4float>(grid.voxels(), 0.f));
+  std::atomic<size_t> nextRow(0);
+  auto sweep = [&](std::vector<G4float>& image) {
+    for (size_t i = nextRow++; i < numCrystals; i = nextRow++) {
+      const float* first = crystals[i].points.data();
+      for (size_t j = i + 1; j < numCrystals; ++j) {
+        const float* second = crystals[j].points.data();
+        for (G4int sample = 0; sample < samples; ++sample) {
+          // Pair sample k of one crystal with a shifted sample of the other,
+          // so the sub-LORs of a pair are not all parallel.
+          const float* p0 = first + 3 * sample;
+          const float* p1 = second + 3 * ((sample + j) % samples);
+          const G4float weight = sampleWeight * Survival(p0, p1);
+          AirPetTraceLOR(grid, p0, p1, [&](size_t voxel, float w) { image[voxel] += w * weight; });
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (G4int t = 1; t < numThreads; ++t) threads.emplace_back(sweep, std::ref(images[t]));
+  sweep(images[0]);
+  for (auto& thread : threads) thread.join();
+
+  std::vector<G4float>& sensitivity = images[0];
+  for (G4int t = 1; t < numThreads; ++t) {
+    for (size_t v = 0; v < sensitivity.size(); ++v) sensitivity[v] += images[t][v];
+  }
+  const G4float threshold = 1e-3f * *std::max_element(sensitivity.begin(), sensitivity.end());
+  const G4double seconds = std::chrono::duration<G4double>(std::chrono::steady_clock::now() - start).count();
+
+  hid_t file = -1;
+  H5E_BEGIN_TRY { file = H5Fcreate(fileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT); } H5E_END_TRY;
+  if (file < 0) {
+    G4Exception("AirPetSensitivityMap::Compute", "OutputFile", JustWarning,
+                ("Cannot create " + fileName).c_str());
+    return;
+  }
+  const hsize_t dims[3] = {static_cast<hsize_t>(fShape[0]), static_cast<hsize_t>(fShape[1]),
+                           static_cast<hsize_t>(fShape[2])};
+  hid_t space = H5Screate_simple(3, dims, nullptr);
+  hid_t dataset = H5Dcreate2(file, "sensitivity", H5T_IEEE_F32LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  H5Dwrite(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, sensitivity.data());
+  H5Sclose(space);
+
+  const long long pairs = static_cast<long long>(numPairs);
+  const long long samplesPerPair = fSamplesPerPair;
+  const signed char attenuation = fCylinderMu > 0. ? 1 : 0;
+  WriteAttribute(dataset, "voxel_size", H5T_NATIVE_DOUBLE, 3, voxelSize);
+  WriteAttribute(dataset, "origin", H5T_NATIVE_FLOAT, 3, grid.origin);
+  WriteAttribute(dataset, "threshold", H5T_NATIVE_FLOAT, 1, &threshold);
+  WriteAttribute(dataset, "num_pairs", H5T_NATIVE_LLONG, 1, &pairs);
+  WriteAttribute(dataset, "samples_per_pair", H5T_NATIVE_LLONG, 1, &samplesPerPair);
+  WriteAttribute(dataset, "ac_enabled", H5T_NATIVE_SCHAR, 1, &attenuation);
+  WriteStringAttribute(dataset, "geometry_key", key);
+  H5Dclose(dataset);
+  H5Fclose(file);
+
+  G4cout << "--> Sensitivity image written to " << fileName << " (" << seconds << " s)" << G4endl;
+}
@@ -0,0 +1,302 @@
+#include "AirPetServer.hh"
+
+#include "G4UIcommand.hh"
+#include "G4UImanager.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+std::atomic<G4int> AirPetServer::fEventsDone{0};
+std::atomic<G4int> AirPetServer::fTotalEvents{0};
+std::atomic<bool> AirPetServer::fAbortRequested{false};
+
+namespace {
+  // Job IDs and messages come from the client; escape them for JSON.
+  std::string Quote(const std::string& text)
+  {
+    std::string quoted = "\"";
+    for (char c : text) {
+      if (c == '"' || c == '\\') quoted += '\\';
+      if (static_cast<unsigned char>(c) >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+  }
+
+  std::string CurrentDirectory()
+  {
+    std::vector<char> buffer(4096);
+    while (!getcwd(buffer.data(), buffer.size())) {
+      if (errno != ERANGE) return "";
+      buffer.resize(buffer.size() * 2);
+    }
+    return buffer.data();
+  }
+}
+
+AirPetServer::AirPetServer(const G4String& socketPath, const G4String& physicsListName,
+                           G4bool opticalPhysics)
+  : fSocketPath(socketPath), fPhysicsListName(physicsListName), fOpticalPhysics(opticalPhysics),
+    fListenFd(-1)
+{}
+
+AirPetServer::~AirPetServer()
+{
+  if (fListenFd >= 0) {
+    close(fListenFd);
+    unlink(fSocketPath.c_str());
+  }
+}
+
+void AirPetServer::RunStarted(G4int totalEvents)
+{
+  fEventsDone = 0;
+  fTotalEvents = totalEvents;
+}
+
+G4int AirPetServer::Serve()
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (fSocketPath.size() >= sizeof(address.sun_path)) {
+    G4cerr << "!!! ERROR: Socket path too long: " << fSocketPath << G4endl;
+    return 1;
+  }
+  std::copy(fSocketPath.begin(), fSocketPath.end(), address.sun_path);
+
+  fListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(fSocketPath.c_str());
+  if (fListenFd < 0 ||
+      bind(fListenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+      listen(fListenFd, 16) < 0) {
+    G4cerr << "!!! ERROR: Cannot listen on " << fSocketPath << G4endl;
+    return 1;
+  }
+  G4cout << "--> airpet-sim serving jobs on " << fSocketPath << G4endl;
+
+  while (true) {
+    int fd = accept(fListenFd, nullptr, nullptr);
+    if (fd < 0) {
+      // A client that gave up before being accepted, or a signal.
+      if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+      G4cerr << "!!! ERROR: accept on " << fSocketPath << " failed: " << std::strerror(errno) << G4endl;
+      // Out of descriptors or memory: retrying at once would only spin.
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        continue;
+      }
+      return 1;
+    }
+    fReadBuffer.clear();
+    Next next = HandleConnection(fd);
+    close(fd);
+    if (next == Next::kShutdown) break;
+  }
+  return 0;
+}
+
+AirPetServer::Next AirPetServer::HandleConnection(int fd)
+{
+  Job job;
+  std::string line;
+  while (ReadLine(fd, line)) {
+    std::istringstream words(line);
+    std::string key, value;
+    words >> key;
+    std::getline(words >> std::ws, value);
+
+    if (key == "shutdown") return Next::kShutdown;
+    // An abort that arrives after its job has finished.
+    if (key == "abort") continue;
+    if (key == "job") {
+      job = Job();
+      job.id = value;
+    } else if (key == "dir") {
+      job.dir = value;
+    } else if (key == "gdml") {
+      job.gdml = value;
+    } else if (key == "output") {
+      job.output = value;
+    } else if (key == "physics") {
+      job.physics = value;
+    } else if (key == "optical") {
+      job.optical = value;
+    } else if (key == "physics_cache") {
+      job.physicsCache = value;
+    } else if (key == "macro") {
+      job.macro = value;
+    } else if (key == "end") {
+      if (job.macro.empty()) {
+        Send(fd, "{\"type\":\"error\",\"job\":" + Quote(job.id) + ",\"message\":\"no macro given\"}");
+      } else {
+        RunJob(fd, job);
+      }
+      job = Job();
+    } else if (!key.empty()) {
+      Send(fd, "{\"type\":\"error\",\"message\":" + Quote("unknown request: " + key) + "}");
+    }
+  }
+  return Next::kContinue;
+}
+
+std::string AirPetServer::CheckPhysics(const Job& job) const
+{
+  if (!job.physics.empty() && job.physics != fPhysicsListName) {
+    return "server runs physics list " + fPhysicsListName + ", job needs " + job.physics;
+  }
+  if (!job.optical.empty() && G4UIcommand::ConvertToBool(job.optical.c_str()) != fOpticalPhysics) {
+    return std::string("server runs ") + (fOpticalPhysics ? "with" : "without") + " optical physics";
+  }
+  return "";
+}
+
+void AirPetServer::RunJob(int fd, const Job& job)
+{
+  const std::string mismatch = CheckPhysics(job);
+  if (!mismatch.empty()) {
+    Send(fd, "{\"type\":\"finished\",\"job\":" + Quote(job.id) +
+             ",\"status\":\"rejected\",\"code\":-1,\"message\":" + Quote(mismatch) + "}");
+    return;
+  }
+  Send(fd, "{\"type\":\"accepted\",\"job\":" + Quote(job.id) + "}");
+  auto fail = [&](const std::string& message) {
+    Send(fd, "{\"type\":\"finished\",\"job\":" + Quote(job.id) +
+             ",\"status\":\"error\",\"code\":-1,\"message\":" + Quote(message) + "}");
+  };
+
+  // The directory of the server is restored after the job, so relative
+  // paths of the next job do not depend on this one.
+  const std::string serverDir = CurrentDirectory();
+  if (!job.dir.empty() && chdir(job.dir.c_str()) != 0) {
+    fail("cannot change to directory " + job.dir + ": " + std::strerror(errno));
+    return;
+  }
+  auto restoreDir = [&]() {
+    if (!job.dir.empty() && !serverDir.empty() && chdir(serverDir.c_str()) != 0) {
+      G4cerr << "!!! WARNING: Cannot return to " << serverDir << G4endl;
+    }
+  };
+  // /g4pet/detector/readFile ends the process on a file it cannot read.
+  if (!job.gdml.empty() && access(job.gdml.c_str(), R_OK) != 0) {
+    fail("cannot read GDML file " + job.gdml + ": " + std::strerror(errno));
+    restoreDir();
+    return;
+  }
+
+  G4UImanager* uiManager = G4UImanager::GetUIpointer();
+  fEventsDone = 0;
+  fTotalEvents = 0;
+
+  fAbortRequested = false;
+
+  // Reports progress and watches for "abort" while the run executes on
+  // this thread. The abort itself is done by the event loop threads, which
+  // poll AbortRequested() at the start of every event. Other lines the
+  // client sends meanwhile (e.g. its next request) are kept for
+  // HandleConnection.
+  std::atomic<bool> done{false};
+  std::string received;   // complete lines and a partial last line
+  std::string kept;
+  std::thread monitor([&]() {
+    G4bool connected = true;
+    while (!done) {
+      if (!connected || fAbortRequested) {
+        // Nothing more to watch for; the socket is left alone.
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+      } else {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 250) > 0) {
+          char buffer[256];
+          ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+          if (n <= 0) {
+            // A closed connection also aborts: nobody waits for the result.
+            connected = false;
+            fAbortRequested = true;
+          } else {
+            received.append(buffer, n);
+            size_t newline;
+            while ((newline = received.find('\n')) != std::string::npos) {
+              std::string line = received.substr(0, newline);
+              received.erase(0, newline + 1);
+              if (!line.empty() && line.back() == '\r') line.pop_back();
+              if (line == "abort") {
+                fAbortRequested = true;
+              } else {
+                kept += line + "\n";
+              }
+            }
+          }
+        }
+      }
+      if (!connected) continue;
+      std::ostringstream progress;
+      progress << "{\"type\":\"progress\",\"job\":" << Quote(job.id)
+               << ",\"events\":" << fEventsDone.load() << ",\"total\":" << fTotalEvents.load() << "}";
+      Send(fd, progress.str());
+    }
+  });
+
+  // Settings that must not leak from the previous job: the SD mapping is
+  // rebuilt from the job's macro, the output file is always set and the live
+  // stream is only written where the job asks for it.
+  uiManager->ApplyCommand("/g4pet/detector/clearSD");
+  uiManager->ApplyCommand("/g4pet/live/file none");
+  uiManager->ApplyCommand("/g4pet/run/outputFile " + (job.output.empty() ? std::string("output.hdf5") : job.output));
+  // The job's physics table cache only applies to this job.
+  const G4String cacheDir = uiManager->GetCurrentValues("/g4pet/physics/cacheDir");
+  const G4String cacheEnabled = uiManager->GetCurrentValues("/g4pet/physics/cache");
+  if (!job.physicsCache.empty()) uiManager->ApplyCommand("/g4pet/physics/cacheDir " + job.physicsCache);
+  G4int code = 0;
+  if (!job.gdml.empty()) code = uiManager->ApplyCommand("/g4pet/detector/readFile " + job.gdml);
+  if (code == 0) code = uiManager->ApplyCommand("/control/execute " + job.macro);
+  if (!job.physicsCache.empty()) {
+    if (!cacheDir.empty()) uiManager->ApplyCommand("/g4pet/physics/cacheDir " + cacheDir);
+    uiManager->ApplyCommand("/g4pet/physics/cache " + cacheEnabled);
+  }
+
+  done = true;
+  monitor.join();
+  fReadBuffer += kept + received;
+  restoreDir();
+
+  std::ostringstream finished;
+  finished << "{\"type\":\"finished\",\"job\":" << Quote(job.id) << ",\"status\":\""
+           << (fAbortRequested ? "aborted" : (code == 0 ? "ok" : "error")) << "\",\"code\":" << code << "}";
+  Send(fd, finished.str());
+}
+
+G4bool AirPetServer::ReadLine(int fd, std::string& line)
+{
+  while (true) {
+    auto newline = fReadBuffer.find('\n');
+    if (newline != std::string::npos) {
+      line = fReadBuffer.substr(0, newline);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      fReadBuffer.erase(0, newline + 1);
+      return true;
+    }
+    char buffer[4096];
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) return false;
+    fReadBuffer.append(buffer, n);
+  }
+}
+
+void AirPetServer::Send(int fd, const std::string& message)
+{
+  std::lock_guard<std::mutex> lock(fSendMutex);
+  const std::string data = message + "\n";
+  // MSG_NOSIGNAL: a client that went away must not kill the server.
+  send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+}
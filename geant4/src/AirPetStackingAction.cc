@@ -0,0 +1,464 @@
+#include "AirPetStackingAction.hh"
+
+#include "G4AutoLock.hh"
+#include "G4Event.hh"
+#include "G4EventManager.hh"
+#include "G4HCofThisEvent.hh"
+#include "G4LogicalVolume.hh"
+#include "G4OpticalPhoton.hh"
+#include "G4ParticleDefinition.hh"
+#include "G4ParticleTable.hh"
+#include "G4Run.hh"
+#include "G4RunManager.hh"
+#include "G4StackManager.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Track.hh"
+#include "G4TransportationManager.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcommand.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+#include "G4UnitsTable.hh"
+#include "G4VHitsCollection.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4VSolid.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+std::atomic<bool> AirPetStackingAction::fConfigured{false};
+G4ThreadLocal AirPetStackingAction::Counters AirPetStackingAction::fThreadCounters = {};
+
+namespace {
+  G4Mutex stackingMutex = G4MUTEX_INITIALIZER;
+
+  // Leaves of the envelope hierarchy hold at most this many boxes.
+  const size_t kBoxesPerLeaf = 4;
+
+  const char* kRuleNames[AirPetStackingAction::kNumRules] = {
+      "killParticle", "killBelow", "killUnreachable", "deferred", "abortedTracks", "abortedEvents"};
+
+  // Run totals, merged from all threads.
+  uint64_t totalTracks[AirPetStackingAction::kNumRules];
+  G4double totalEnergy[AirPetStackingAction::kNumRules];
+
+  // Whether a logical volume or one of its descendants has an SD.
+  G4bool HasSD(const G4LogicalVolume* volume)
+  {
+    if (volume->GetSensitiveDetector()) return true;
+    for (size_t i = 0; i < volume->GetNoDaughters(); ++i) {
+      if (HasSD(volume->GetDaughter(i)->GetLogicalVolume())) return true;
+    }
+    return false;
+  }
+}
+
+AirPetStackingAction::AirPetStackingAction()
+  : G4UserStackingAction(), G4UImessenger(),
+    fKillUnreachable(false), fDeferUnreachable(false), fAbortWithoutHits(false),
+    fReachMargin(1. * cm), fParticlesResolved(false), fEnvelopeRunID(-1),
+    fStage(0), fDeferredEnergy(0.)
+{
+  fStackDir = new G4UIdirectory("/g4pet/stack/");
+  fStackDir->SetGuidance("Early track killing and secondary deferral.");
+
+  fKillParticleCmd = new G4UIcmdWithAString("/g4pet/stack/killParticle", this);
+  fKillParticleCmd->SetGuidance("Do not track secondaries of this particle (e.g. nu_e, anti_nu_e).");
+  fKillParticleCmd->SetParameterName("particle", false);
+  fKillParticleCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fKillBelowCmd = new G4UIcommand("/g4pet/stack/killBelow", this);
+  fKillBelowCmd->SetGuidance("Kill secondaries of a particle below a kinetic energy when created in a volume.");
+  fKillBelowCmd->SetGuidance("Volume: any, nonSD (volumes without an SD) or a logical volume name.");
+  fKillBelowCmd->SetGuidance("Their energy is not deposited; do not use this in scored volumes.");
+  fKillBelowCmd->SetParameter(new G4UIparameter("particle", 's', false));
+  fKillBelowCmd->SetParameter(new G4UIparameter("energy", 'd', false));
+  fKillBelowCmd->SetParameter(new G4UIparameter("unit", 's', false));
+  auto* volumeParameter = new G4UIparameter("volume", 's', true);
+  volumeParameter->SetDefaultValue("nonSD");
+  fKillBelowCmd->SetParameter(volumeParameter);
+  fKillBelowCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fKillUnreachableCmd = new G4UIcommand("/g4pet/stack/killUnreachable", this);
+  fKillUnreachableCmd->SetGuidance("Kill neutral secondaries whose line of flight misses the SD envelope.");
+  fKillUnreachableCmd->SetGuidance("Photons scattered back into the detector later are lost.");
+  fKillUnreachableCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fKillUnreachableCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fDeferUnreachableCmd = new G4UIcommand("/g4pet/stack/deferUnreachable", this);
+  fDeferUnreachableCmd->SetGuidance("Track neutral secondaries that miss the SD envelope last (waiting stack).");
+  fDeferUnreachableCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fDeferUnreachableCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fAbortWithoutHitsCmd = new G4UIcommand("/g4pet/stack/abortWithoutHits", this);
+  fAbortWithoutHitsCmd->SetGuidance("Drop the deferred tracks of events without SD hits once all others are done.");
+  fAbortWithoutHitsCmd->SetGuidance("Implies deferUnreachable.");
+  fAbortWithoutHitsCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fAbortWithoutHitsCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fReachMarginCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/stack/reachMargin", this);
+  fReachMarginCmd->SetGuidance("Margin added around the bounding box of each SD placement (default 1 cm).");
+  fReachMarginCmd->SetParameterName("margin", false);
+  fReachMarginCmd->SetUnitCategory("Length");
+  fReachMarginCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+  fClearCmd = new G4UIcommand("/g4pet/stack/clearRules", this);
+  fClearCmd->SetGuidance("Remove all stacking rules.");
+  fClearCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+AirPetStackingAction::~AirPetStackingAction()
+{
+  delete fKillParticleCmd;
+  delete fKillBelowCmd;
+  delete fKillUnreachableCmd;
+  delete fDeferUnreachableCmd;
+  delete fAbortWithoutHitsCmd;
+  delete fReachMarginCmd;
+  delete fClearCmd;
+  delete fStackDir;
+}
+
+void AirPetStackingAction::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+  if (command == fKillParticleCmd) {
+    fKillParticleNames.insert(newValue);
+  } else if (command == fKillBelowCmd) {
+    std::istringstream is(newValue);
+    EnergyRule rule;
+    G4double value = 0.;
+    G4String unit;
+    is >> rule.particleName >> value >> unit >> rule.volume;
+    if (G4UnitDefinition::GetCategory(unit) != "Energy") {
+      G4Exception("AirPetStackingAction::SetNewValue", "InvalidUnit", JustWarning,
+                  ("Not an energy unit: " + unit).c_str());
+      return;
+    }
+    rule.particle = nullptr;
+    rule.energy = value * G4UnitDefinition::GetValueOf(unit);
+    if (rule.volume.empty()) rule.volume = "nonSD";
+    fEnergyRules.push_back(rule);
+  } else if (command == fKillUnreachableCmd) {
+    fKillUnreachable = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fDeferUnreachableCmd) {
+    fDeferUnreachable = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fAbortWithoutHitsCmd) {
+    fAbortWithoutHits = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fReachMarginCmd) {
+    fReachMargin = fReachMarginCmd->GetNewDoubleValue(newValue);
+  } else if (command == fClearCmd) {
+    fKillParticleNames.clear();
+    fEnergyRules.clear();
+    fKillUnreachable = fDeferUnreachable = fAbortWithoutHits = false;
+  }
+  // Particle names are resolved on the next event (the particle table may
+  // not be complete yet), and the envelope is rebuilt for a new margin.
+  fParticlesResolved = false;
+  fEnvelopeRunID = -1;
+  UpdateConfigured();
+}
+
+void AirPetStackingAction::UpdateConfigured()
+{
+  fConfigured = !fKillParticleNames.empty() || !fEnergyRules.empty() || fKillUnreachable ||
+                fDeferUnreachable || fAbortWithoutHits;
+}
+
+void AirPetStackingAction::ResolveParticles()
+{
+  G4ParticleTable* particleTable = G4ParticleTable::GetParticleTable();
+  fKillParticles.clear();
+  for (const G4String& name : fKillParticleNames) {
+    const G4ParticleDefinition* particle = particleTable->FindParticle(name);
+    if (particle) {
+      fKillParticles.insert(particle);
+    } else {
+      G4Exception("AirPetStackingAction::ResolveParticles", "UnknownParticle", JustWarning,
+                  ("killParticle: unknown particle " + name).c_str());
+    }
+  }
+  for (EnergyRule& rule : fEnergyRules) {
+    rule.particle = rule.particleName == "all" ? nullptr : particleTable->FindParticle(rule.particleName);
+    if (!rule.particle && rule.particleName != "all") {
+      G4Exception("AirPetStackingAction::ResolveParticles", "UnknownParticle", JustWarning,
+                  ("killBelow: unknown particle " + rule.particleName).c_str());
+    }
+  }
+  fParticlesResolved = true;
+}
+
+void AirPetStackingAction::BuildEnvelope()
+{
+  // Bounding boxes of the SD placements of this thread's geometry.
+  // Replicated and parameterised daughters are covered by the box of their
+  // mother, so the envelope never misses a copy.
+  fEnvelopeBoxes.clear();
+  fEnvelopeNodes.clear();
+  const G4VPhysicalVolume* world = G4TransportationManager::GetTransportationManager()
+                                       ->GetNavigatorForTracking()->GetWorldVolume();
+  if (world) AddEnvelope(world->GetLogicalVolume(), G4RotationMatrix(), world->GetObjectTranslation());
+  if (!fEnvelopeBoxes.empty()) BuildNode(0, fEnvelopeBoxes.size());
+}
+
+G4int AirPetStackingAction::BuildNode(size_t begin, size_t end)
+{
+  const G4int index = static_cast<G4int>(fEnvelopeNodes.size());
+  fEnvelopeNodes.emplace_back();
+  Node node{fEnvelopeBoxes[begin], static_cast<G4int>(begin), static_cast<G4int>(end - begin), -1};
+  for (size_t i = begin + 1; i < end; ++i) {
+    const Box& box = fEnvelopeBoxes[i];
+    node.bounds.min.set(std::min(node.bounds.min.x(), box.min.x()), std::min(node.bounds.min.y(), box.min.y()),
+                        std::min(node.bounds.min.z(), box.min.z()));
+    node.bounds.max.set(std::max(node.bounds.max.x(), box.max.x()), std::max(node.bounds.max.y(), box.max.y()),
+                        std::max(node.bounds.max.z(), box.max.z()));
+  }
+  if (end - begin > kBoxesPerLeaf) {
+    // Split at the median box centre along the longest axis.
+    const G4ThreeVector extent = node.bounds.max - node.bounds.min;
+    const G4int axis = extent.x() >= extent.y() ? (extent.x() >= extent.z() ? 0 : 2)
+                                                : (extent.y() >= extent.z() ? 1 : 2);
+    const size_t middle = begin + (end - begin) / 2;
+    std::nth_element(fEnvelopeBoxes.begin() + begin, fEnvelopeBoxes.begin() + middle,
+                     fEnvelopeBoxes.begin() + end, [axis](const Box& a, const Box& b) {
+                       return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+                     });
+    node.count = 0;
+    BuildNode(begin, middle);
+    node.second = BuildNode(middle, end);
+  }
+  fEnvelopeNodes[index] = node;
+  return index;
+}
+
+void AirPetStackingAction::AddBox(const G4VSolid* solid, const G4RotationMatrix& rotation,
+                                  const G4ThreeVector& translation)
+{
+  G4ThreeVector pMin, pMax;
+  solid->BoundingLimits(pMin, pMax);
+  const G4double infinity = std::numeric_limits<G4double>::max();
+  Box box{G4ThreeVector(infinity, infinity, infinity), G4ThreeVector(-infinity, -infinity, -infinity)};
+  for (G4int corner = 0; corner < 8; ++corner) {
+    const G4ThreeVector local((corner & 1) ? pMax.x() : pMin.x(), (corner & 2) ? pMax.y() : pMin.y(),
+                              (corner & 4) ? pMax.z() : pMin.z());
+    const G4ThreeVector global = rotation * local + translation;
+    box.min.set(std::min(box.min.x(), global.x()), std::min(box.min.y(), global.y()),
+                std::min(box.min.z(), global.z()));
+    box.max.set(std::max(box.max.x(), global.x()), std::max(box.max.y(), global.y()),
+                std::max(box.max.z(), global.z()));
+  }
+  const G4ThreeVector margin(fReachMargin, fReachMargin, fReachMargin);
+  box.min -= margin;
+  box.max += margin;
+  fEnvelopeBoxes.push_back(box);
+}
+
+void AirPetStackingAction::AddEnvelope(const G4LogicalVolume* volume, const G4RotationMatrix& rotation,
+                                       const G4ThreeVector& translation)
+{
+  for (size_t i = 0; i < volume->GetNoDaughters(); ++i) {
+    const G4VPhysicalVolume* daughter = volume->GetDaughter(i);
+    const G4LogicalVolume* logical = daughter->GetLogicalVolume();
+    if (!HasSD(logical)) continue;
+    if (daughter->IsReplicated()) {
+      // The copies are only positioned while navigating; use the mother.
+      AddBox(volume->GetSolid(), rotation, translation);
+      continue;
+    }
+    const G4RotationMatrix daughterRotation = rotation * daughter->GetObjectRotationValue();
+    const G4ThreeVector daughterTranslation = rotation * daughter->GetObjectTranslation() + translation;
+    if (logical->GetSensitiveDetector()) AddBox(logical->GetSolid(), daughterRotation, daughterTranslation);
+    AddEnvelope(logical, daughterRotation, daughterTranslation);
+  }
+}
+
+G4bool AirPetStackingAction::CanReachSD(const G4Track* track) const
+{
+  if (fEnvelopeNodes.empty()) return true;
+
+  // Walk down the hierarchy along the ray from the creation point. Nodes
+  // are balanced, so the stack depth stays near log2 of the box count.
+  const G4ThreeVector& position = track->GetPosition();
+  const G4ThreeVector& direction = track->GetMomentumDirection();
+  G4int stack[64];
+  G4int depth = 0;
+  stack[depth++] = 0;
+  while (depth > 0) {
+    const G4int index = stack[--depth];
+    const Node& node = fEnvelopeNodes[index];
+    if (!RayHitsBox(position, direction, node.bounds)) continue;
+    if (node.count == 0) {
+      stack[depth++] = node.second;
+      stack[depth++] = index + 1;
+      continue;
+    }
+    for (G4int i = node.first; i < node.first + node.count; ++i) {
+      if (RayHitsBox(position, direction, fEnvelopeBoxes[i])) return true;
+    }
+  }
+  return false;
+}
+
+G4bool AirPetStackingAction::RayHitsBox(const G4ThreeVector& position, const G4ThreeVector& direction,
+                                        const Box& box)
+{
+  // Slab test of the ray from t = 0; a ray that starts inside the box hits.
+  G4double tMin = 0.;
+  G4double tMax = std::numeric_limits<G4double>::max();
+  for (G4int k = 0; k < 3; ++k) {
+    if (direction[k] == 0.) {
+      if (position[k] < box.min[k] || position[k] > box.max[k]) return false;
+      continue;
+    }
+    G4double t0 = (box.min[k] - position[k]) / direction[k];
+    G4double t1 = (box.max[k] - position[k]) / direction[k];
+    if (t0 > t1) std::swap(t0, t1);
+    tMin = std::max(tMin, t0);
+    tMax = std::min(tMax, t1);
+    if (tMax < tMin) return false;
+  }
+  return true;
+}
+
+G4bool AirPetStackingAction::MatchesVolume(const EnergyRule& rule, const G4Track* track) const
+{
+  if (rule.volume == "any") return true;
+  const G4VPhysicalVolume* volume = track->GetVolume();
+  if (!volume) return false;
+  const G4LogicalVolume* logical = volume->GetLogicalVolume();
+  if (rule.volume == "nonSD") return !logical->GetSensitiveDetector();
+  return logical->GetName() == rule.volume;
+}
+
+void AirPetStackingAction::Count(Rule rule, const G4Track* track)
+{
+  fThreadCounters.tracks[rule] += 1;
+  fThreadCounters.energy[rule] += track->GetKineticEnergy();
+}
+
+void AirPetStackingAction::PrepareNewEvent()
+{
+  fStage = 0;
+  fDeferredEnergy = 0.;
+  if (!IsConfigured()) return;
+  if (!fParticlesResolved) ResolveParticles();
+  // The geometry may have been rebuilt between runs.
+  const G4Run* run = G4RunManager::GetRunManager()->GetCurrentRun();
+  const G4int runID = run ? run->GetRunID() : 0;
+  if ((fKillUnreachable || fDeferUnreachable || fAbortWithoutHits) && runID != fEnvelopeRunID) {
+    BuildEnvelope();
+    fEnvelopeRunID = runID;
+  }
+}
+
+G4ClassificationOfNewTrack AirPetStackingAction::ClassifyNewTrack(const G4Track* track)
+{
+  // Primaries and optical photons (see the optical fast path) are kept.
+  if (track->GetParentID() == 0 || !IsConfigured()) return fUrgent;
+  const G4ParticleDefinition* particle = track->GetDefinition();
+  if (particle == G4OpticalPhoton::Definition()) return fUrgent;
+
+  if (!fKillParticles.empty() && fKillParticles.count(particle)) {
+    Count(kKillParticle, track);
+    return fKill;
+  }
+
+  for (const EnergyRule& rule : fEnergyRules) {
+    if (rule.particle && rule.particle != particle) continue;
+    if (track->GetKineticEnergy() >= rule.energy || !MatchesVolume(rule, track)) continue;
+    Count(kKillBelow, track);
+    return fKill;
+  }
+
+  // Only neutral particles fly straight until they interact.
+  const G4bool defer = fDeferUnreachable || fAbortWithoutHits;
+  if ((fKillUnreachable || defer) && particle->GetPDGCharge() == 0. && !CanReachSD(track)) {
+    if (fKillUnreachable) {
+      Count(kKillUnreachable, track);
+      return fKill;
+    }
+    // Secondaries of deferred tracks are classified again in later stages.
+    if (fStage == 0) {
+      Count(kDeferred, track);
+      fDeferredEnergy += track->GetKineticEnergy();
+      return fWaiting;
+    }
+  }
+  return fUrgent;
+}
+
+void AirPetStackingAction::NewStage()
+{
+  // Stage 0 is over: every track that was not deferred is done.
+  if (fStage++ > 0 || !fAbortWithoutHits) return;
+
+  const G4Event* event = G4EventManager::GetEventManager()->GetConstCurrentEvent();
+  const G4HCofThisEvent* hce = event ? event->GetHCofThisEvent() : nullptr;
+  if (hce) {
+    for (G4int i = 0; i < hce->GetCapacity(); ++i) {
+      const G4VHitsCollection* collection = hce->GetHC(i);
+      if (collection && collection->GetSize() > 0) return;
+    }
+  }
+
+  // The stack manager has already moved the deferred tracks to the urgent
+  // stack; they are all still unprocessed, so they are what is dropped.
+  fThreadCounters.tracks[kAbortedTracks] += stackManager->GetNUrgentTrack();
+  fThreadCounters.energy[kAbortedTracks] += fDeferredEnergy;
+  fThreadCounters.tracks[kAbortedEvents] += 1;
+  stackManager->clear();
+}
+
+const std::vector<AirPetColumnSpec>& AirPetStackingAction::GetStackingColumns()
+{
+  static const std::vector<AirPetColumnSpec> columns = {
+      {"Rule", AirPetColumnType::kString},
+      {"Tracks", AirPetColumnType::kFloat64},
+      {"Energy", AirPetColumnType::kFloat64}};
+  return columns;
+}
+
+void AirPetStackingAction::BeginRun(G4bool isMaster)
+{
+  fThreadCounters = Counters();
+  if (!isMaster) return;
+
+  G4AutoLock lock(&stackingMutex);
+  for (G4int i = 0; i < kNumRules; ++i) {
+    totalTracks[i] = 0;
+    totalEnergy[i] = 0.;
+  }
+}
+
+void AirPetStackingAction::MergeThread()
+{
+  G4AutoLock lock(&stackingMutex);
+  for (G4int i = 0; i < kNumRules; ++i) {
+    totalTracks[i] += fThreadCounters.tracks[i];
+    totalEnergy[i] += fThreadCounters.energy[i];
+  }
+  fThreadCounters = Counters();
+}
+
+void AirPetStackingAction::Report(AirPetNtupleBuffer& stacking)
+{
+  if (!IsConfigured()) return;
+
+  G4AutoLock lock(&stackingMutex);
+  G4cout << G4endl << "-------- AirPet stacking --------" << G4endl;
+  G4cout << std::left << std::setw(18) << "Rule" << std::right << std::setw(14) << "Tracks"
+         << std::setw(16) << "Energy (MeV)" << G4endl;
+  for (G4int i = 0; i < kNumRules; ++i) {
+    G4cout << std::left << std::setw(18) << kRuleNames[i] << std::right << std::setw(14)
+           << totalTracks[i] << std::setw(16) << totalEnergy[i] / MeV << G4endl;
+
+    if (stacking.GetColumns().empty()) continue;
+    stacking.FillS(0, kRuleNames[i]);
+    stacking.FillD(1, static_cast<G4double>(totalTracks[i]));
+    stacking.FillD(2, totalEnergy[i] / MeV);
+    stacking.AddRow();
+  }
+  G4cout << "(abortedTracks: deferred tracks dropped, with their kinetic energy)" << G4endl << G4endl;
+}
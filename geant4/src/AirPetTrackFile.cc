@@ -0,0 +1,177 @@
+#include "AirPetTrackFile.hh"
+
+#include "AirPetTrajectory.hh"
+#include "G4AutoLock.hh"
+#include "G4Event.hh"
+#include "G4TrajectoryContainer.hh"
+
+#include <cstring>
+
+#include <unistd.h>
+
+G4ThreadLocal std::vector<char>* AirPetTrackFile::fBuffer = nullptr;
+
+namespace {
+  const char kMagic[8] = {'A', 'I', 'R', 'P', 'T', 'R', 'K', '1'};
+  const uint64_t kIndexRecordSize = sizeof(int64_t) + 2 * sizeof(uint64_t);
+
+  uint64_t FileSize(std::FILE* file)
+  {
+    std::fseek(file, 0, SEEK_END);
+    return static_cast<uint64_t>(std::ftell(file));
+  }
+
+  template <typename T>
+  void Put(std::vector<char>& buffer, T value)
+  {
+    const size_t size = buffer.size();
+    buffer.resize(size + sizeof(T));
+    std::memcpy(buffer.data() + size, &value, sizeof(T));
+  }
+}
+
+AirPetTrackFile* AirPetTrackFile::Instance()
+{
+  static AirPetTrackFile instance;
+  return &instance;
+}
+
+G4bool AirPetTrackFile::Open(const G4String& directory)
+{
+  G4String base = directory.empty() ? G4String(".") : directory;
+  if (base.back() != '/') base += "/";
+
+  fEvents = 0;
+  if (fResumePending) {
+    fResumePending = false;
+    if (Reopen(base)) return true;
+  }
+  fData = std::fopen((base + "tracks.bin").c_str(), "wb");
+  fIndex = std::fopen((base + "tracks.idx").c_str(), "wb");
+  if (!fData || !fIndex) {
+    G4Exception("AirPetTrackFile::Open", "TrackFileError", JustWarning,
+                ("Could not create track files in " + base).c_str());
+    if (fData) std::fclose(fData);
+    if (fIndex) std::fclose(fIndex);
+    fData = fIndex = nullptr;
+    return false;
+  }
+  std::fwrite(kMagic, 1, sizeof(kMagic), fData);
+  fOffset = sizeof(kMagic);
+  return true;
+}
+
+G4bool AirPetTrackFile::Reopen(const G4String& base)
+{
+  // Nothing was written before the checkpoint: start the files anew.
+  if (fResumeSize == 0) return false;
+
+  fData = std::fopen((base + "tracks.bin").c_str(), "r+b");
+  fIndex = std::fopen((base + "tracks.idx").c_str(), "r+b");
+  const uint64_t indexSize = fResumeEvents * kIndexRecordSize;
+  if (!fData || !fIndex || FileSize(fData) < fResumeSize || FileSize(fIndex) < indexSize ||
+      ftruncate(fileno(fData), static_cast<off_t>(fResumeSize)) != 0 ||
+      ftruncate(fileno(fIndex), static_cast<off_t>(indexSize)) != 0) {
+    G4Exception("AirPetTrackFile::Reopen", "TrackFileError", JustWarning,
+                ("Track files in " + base + " do not match the checkpoint; starting them anew.").c_str());
+    if (fData) std::fclose(fData);
+    if (fIndex) std::fclose(fIndex);
+    fData = fIndex = nullptr;
+    return false;
+  }
+
+  // Events whose tracks were written before the run was interrupted may be
+  // simulated again if their rows were not; they keep their first block.
+  fResumedEvents.clear();
+  std::fseek(fIndex, 0, SEEK_SET);
+  for (uint64_t i = 0; i < fResumeEvents; ++i) {
+    int64_t record[3];
+    if (std::fread(record, sizeof(int64_t), 3, fIndex) != 3) break;
+    fResumedEvents.insert(record[0]);
+  }
+  std::fseek(fData, 0, SEEK_END);
+  std::fseek(fIndex, 0, SEEK_END);
+  fOffset = fResumeSize;
+  fEvents = fResumeEvents;
+  return true;
+}
+
+void AirPetTrackFile::WriteEvent(const G4String& directory, const G4Event* event, G4int eventID)
+{
+  G4TrajectoryContainer* trajectoryContainer = event->GetTrajectoryContainer();
+  if (!trajectoryContainer) return;
+
+  // Serialize outside the lock; only the append itself is serialized.
+  if (!fBuffer) fBuffer = new std::vector<char>();
+  std::vector<char>& buffer = *fBuffer;
+  buffer.clear();
+
+  Put<int32_t>(buffer, eventID);
+  Put<int32_t>(buffer, 0); // number of tracks, patched below
+  int32_t nTracks = 0;
+  for (size_t i = 0; i < trajectoryContainer->size(); ++i) {
+    auto traj = dynamic_cast<AirPetTrajectory*>((*trajectoryContainer)[i]);
+    if (!traj) continue;
+    ++nTracks;
+    const G4String& name = traj->GetParticleName();
+    Put<int32_t>(buffer, traj->GetTrackID());
+    Put<int32_t>(buffer, traj->GetParentID());
+    Put<int32_t>(buffer, traj->GetPDGEncoding());
+    Put<int32_t>(buffer, static_cast<int32_t>(name.size()));
+    buffer.insert(buffer.end(), name.begin(), name.end());
+    const G4int nPoints = traj->GetPointEntries();
+    Put<int32_t>(buffer, nPoints);
+    for (G4int j = 0; j < nPoints; ++j) {
+      const G4ThreeVector& pos = traj->GetPointPosition(j);
+      Put<float>(buffer, static_cast<float>(pos.x()));
+      Put<float>(buffer, static_cast<float>(pos.y()));
+      Put<float>(buffer, static_cast<float>(pos.z()));
+    }
+  }
+  std::memcpy(buffer.data() + sizeof(int32_t), &nTracks, sizeof(int32_t));
+
+  G4AutoLock lock(&fMutex);
+  if (!fData && !Open(directory)) return;
+  if (!fResumedEvents.empty() && fResumedEvents.count(eventID)) return;
+
+  // The block reaches the file before its index record, so a reader (or a
+  // crashed run) never sees an index entry past the end of tracks.bin.
+  std::fwrite(buffer.data(), 1, buffer.size(), fData);
+  std::fflush(fData);
+  const int64_t indexEventID = eventID;
+  const uint64_t size = buffer.size();
+  std::fwrite(&indexEventID, sizeof(indexEventID), 1, fIndex);
+  std::fwrite(&fOffset, sizeof(fOffset), 1, fIndex);
+  std::fwrite(&size, sizeof(size), 1, fIndex);
+  std::fflush(fIndex);
+  fOffset += size;
+  ++fEvents;
+}
+
+void AirPetTrackFile::Close()
+{
+  G4AutoLock lock(&fMutex);
+  if (fData) std::fclose(fData);
+  if (fIndex) std::fclose(fIndex);
+  fData = fIndex = nullptr;
+  fOffset = 0;
+  fEvents = 0;
+  fResumePending = false;
+  fResumedEvents.clear();
+}
+
+void AirPetTrackFile::GetState(uint64_t& size, uint64_t& events)
+{
+  G4AutoLock lock(&fMutex);
+  // Not reopened yet: the files still end where the checkpoint said.
+  size = fData ? fOffset : (fResumePending ? fResumeSize : 0);
+  events = fData ? fEvents : (fResumePending ? fResumeEvents : 0);
+}
+
+void AirPetTrackFile::Resume(uint64_t size, uint64_t events)
+{
+  G4AutoLock lock(&fMutex);
+  fResumePending = true;
+  fResumeSize = size;
+  fResumeEvents = events;
+}
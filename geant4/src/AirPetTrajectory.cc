@@ -6,16 +6,51 @@
 #include "G4Polyline.hh"
 
 G4ThreadLocal G4Allocator<AirPetTrajectory>* AirPetTrajectory::fAllocator = nullptr;
+G4ThreadLocal std::vector<TrajectoryPositionBuffer*>* AirPetTrajectory::fBufferPool = nullptr;
+
+namespace {
+  // Buffers kept for reuse per thread, and the largest buffer worth keeping.
+  // Longer ones (rare, e.g. optical photons bouncing around) are freed.
+  const size_t kMaxPooledBuffers = 4096;
+  const size_t kMaxPooledCapacity = 1024;
+  const size_t kInitialCapacity = 16;
+}
+
+TrajectoryPositionBuffer* AirPetTrajectory::AcquireBuffer()
+{
+  if (fBufferPool && !fBufferPool->empty()) {
+    TrajectoryPositionBuffer* buffer = fBufferPool->back();
+    fBufferPool->pop_back();
+    return buffer;
+  }
+  auto* buffer = new TrajectoryPositionBuffer();
+  buffer->reserve(kInitialCapacity);
+  return buffer;
+}
+
+void AirPetTrajectory::ReleaseBuffer(TrajectoryPositionBuffer* buffer)
+{
+  if (!buffer) return;
+  if (!fBufferPool) fBufferPool = new std::vector<TrajectoryPositionBuffer*>();
+  if (fBufferPool->size() >= kMaxPooledBuffers || buffer->capacity() > kMaxPooledCapacity) {
+    delete buffer;
+    return;
+  }
+  buffer->clear();
+  fBufferPool->push_back(buffer);
+}
 
 AirPetTrajectory::AirPetTrajectory()
   : G4VTrajectory(),
-    fPositionRecord(nullptr),
+    fPositions(nullptr),
+    fPointCache(nullptr),
     fParticleDef(nullptr),
     fTrackID(-1), fParentID(-1),
     fTimeInit(0.), fTimeFinal(0.)
 {}
 
-AirPetTrajectory::AirPetTrajectory(const G4Track* aTrack) : G4VTrajectory()
+AirPetTrajectory::AirPetTrajectory(const G4Track* aTrack, G4bool storePoints)
+  : G4VTrajectory(), fPositions(nullptr), fPointCache(nullptr)
 {
   fParticleDef    = aTrack->GetDefinition();
   fTrackID        = aTrack->GetTrackID();
@@ -33,12 +68,16 @@ AirPetTrajectory::AirPetTrajectory(const G4Track* aTrack) : G4VTrajectory()
     fCreatorProcess = "primary";
   }
 
-  fPositionRecord = new TrajectoryPointContainer();
-  fPositionRecord->push_back(new G4TrajectoryPoint(aTrack->GetPosition()));
+  if (storePoints) {
+    fPositions = AcquireBuffer();
+    fPositions->push_back(aTrack->GetPosition());
+  }
 }
 
 AirPetTrajectory::AirPetTrajectory(const AirPetTrajectory& other)
-  : G4VTrajectory(other) // Use base class copy constructor
+  : G4VTrajectory(other), // Use base class copy constructor
+    fPositions(nullptr),
+    fPointCache(nullptr)
 {
   fParticleDef = other.fParticleDef;
   fTrackID = other.fTrackID;
@@ -54,26 +93,27 @@ AirPetTrajectory::AirPetTrajectory(const AirPetTrajectory& other)
   fVolFinal = other.fVolFinal;
   fCreatorProcess = other.fCreatorProcess;
 
-  // Deep copy the position record
-  fPositionRecord = new TrajectoryPointContainer();
-  for (size_t i = 0; i < other.fPositionRecord->size(); ++i) {
-      // We must cast the G4VTrajectoryPoint to the concrete G4TrajectoryPoint
-      auto* oldPoint = dynamic_cast<G4TrajectoryPoint*>((*other.fPositionRecord)[i]);
-      if (oldPoint) {
-          fPositionRecord->push_back(new G4TrajectoryPoint(*oldPoint));
-      }
+  // Copy the position record (summary trajectories have none)
+  if (other.fPositions) {
+    fPositions = AcquireBuffer();
+    *fPositions = *other.fPositions;
   }
 }
 
 AirPetTrajectory::~AirPetTrajectory()
 {
-  if (fPositionRecord) {
-    for (auto& i : *fPositionRecord) {
-      delete i;
-    }
-    fPositionRecord->clear();
-    delete fPositionRecord;
+  ClearPointCache();
+  ReleaseBuffer(fPositions);
+}
+
+void AirPetTrajectory::ClearPointCache() const
+{
+  if (!fPointCache) return;
+  for (auto& i : *fPointCache) {
+    delete i;
   }
+  delete fPointCache;
+  fPointCache = nullptr;
 }
 
 void AirPetTrajectory::ShowTrajectory(std::ostream& os) const
@@ -85,11 +125,12 @@ void AirPetTrajectory::ShowTrajectory(std::ostream& os) const
 void AirPetTrajectory::DrawTrajectory() const
 {
   G4VVisManager* pVVisManager = G4VVisManager::GetConcreteInstance();
-  if (!pVVisManager) return;
+  if (!pVVisManager || !fPositions) return;
 
   G4Polyline polyline;
-  for (size_t i = 0; i < fPositionRecord->size(); ++i) {
-      polyline.push_back((*fPositionRecord)[i]->GetPosition());
+  polyline.reserve(fPositions->size());
+  for (const auto& pos : *fPositions) {
+      polyline.push_back(pos);
   }
 
   G4Colour colour(0.2, 0.2, 0.2); // Default grey
@@ -108,17 +149,30 @@ void AirPetTrajectory::DrawTrajectory() const
 
 void AirPetTrajectory::AppendStep(const G4Step* aStep)
 {
-  fPositionRecord->push_back(new G4TrajectoryPoint(aStep->GetPostStepPoint()->GetPosition()));
+  if (!fPositions) return;
+  ClearPointCache();
+  fPositions->push_back(aStep->GetPostStepPoint()->GetPosition());
 }
 
 G4int AirPetTrajectory::GetPointEntries() const
 {
-  return fPositionRecord ? fPositionRecord->size() : 0;
+  return fPositions ? fPositions->size() : 0;
 }
 
 G4VTrajectoryPoint* AirPetTrajectory::GetPoint(G4int i) const
 {
-  return (fPositionRecord && i < (G4int)fPositionRecord->size()) ? (*fPositionRecord)[i] : nullptr;
+  if (!fPositions || i < 0 || i >= (G4int)fPositions->size()) return nullptr;
+
+  // Materialize point objects only for callers of the generic interface
+  // (e.g. G4VTrajectory::ShowTrajectory or attribute-based vis models).
+  if (!fPointCache) {
+    fPointCache = new TrajectoryPointContainer();
+    fPointCache->reserve(fPositions->size());
+    for (const auto& pos : *fPositions) {
+      fPointCache->push_back(new G4TrajectoryPoint(pos));
+    }
+  }
+  return (*fPointCache)[i];
 }
 
 
@@ -127,16 +181,14 @@ void AirPetTrajectory::MergeTrajectory(G4VTrajectory* secondTrajectory)
   if (!secondTrajectory) return;
 
   auto seco = dynamic_cast<AirPetTrajectory*>(secondTrajectory);
-  if (!seco) return;
+  if (!seco || !fPositions || !seco->fPositions) return;
+
+  ClearPointCache();
+  seco->ClearPointCache();
 
-  G4int ent = seco->GetPointEntries();
   // Skip the first point of the second trajectory as it's a duplicate
-  for (G4int i = 1; i < ent; ++i)
-  {
-    fPositionRecord->push_back((*(seco->fPositionRecord))[i]);
+  if (seco->fPositions->size() > 1) {
+    fPositions->insert(fPositions->end(), seco->fPositions->begin() + 1, seco->fPositions->end());
   }
-  // The merged trajectory now owns the points, so we clear the second one
-  // without deleting the points.
-  (*(seco->fPositionRecord))[0] = nullptr; // Prevent double deletion
-  seco->fPositionRecord->clear();
-}
\ No newline at end of file
+  seco->fPositions->clear();
+}
@@ -1,5 +1,7 @@
 #include "AirPetUserTrackInformation.hh"
 
+G4ThreadLocal G4Allocator<AirPetUserTrackInformation>* AirPetUserTrackInformation::fAllocator = nullptr;
+
 AirPetUserTrackInformation::AirPetUserTrackInformation()
   : G4VUserTrackInformation()
 {}
@@ -1,4 +1,9 @@
 #include "DetectorConstruction.hh"
+#include "AirPetChannelMap.hh"
+#include "AirPetCrystalFastSim.hh"
+#include "AirPetNameTable.hh"
+#include "AirPetPhotonSD.hh"
+#include "AirPetSensitivityMap.hh"
 #include "AirPetSensitiveDetector.hh"
 
 #include "G4RunManager.hh"
@@ -11,21 +16,65 @@
 #include "G4LogicalVolumeStore.hh"
 #include "G4SolidStore.hh"
 #include "G4PhysicalVolumeStore.hh"
+#include "G4ProductionCuts.hh"
+#include "G4ProductionCutsTable.hh"
+#include "G4Region.hh"
+#include "G4RegionStore.hh"
+#include "G4UnitsTable.hh"
+#include "G4UserLimits.hh"
 #include "G4GeometryManager.hh"
+#include "G4StateManager.hh"
+#include "G4VPhysicalVolume.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+  // FNV-1a hash of the file content, as 16 hex digits (empty if unreadable).
+  G4String HashFile(const G4String& filename)
+  {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return "";
+    std::uint64_t hash = 14695981039346656037ull;
+    char buffer[1 << 16];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+      for (std::streamsize i = 0; i < file.gcount(); ++i) {
+        hash ^= static_cast<unsigned char>(buffer[i]);
+        hash *= 1099511628211ull;
+      }
+    }
+    std::ostringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex.str();
+  }
+}
+
+G4ThreadLocal std::map<G4String, AirPetCrystalFastSim*>* DetectorConstruction::fFastSimModels = nullptr;
 
 DetectorConstruction::DetectorConstruction()
  : G4VUserDetectorConstruction(),
    fWorldVolume(nullptr),
    fMessenger(nullptr),
-   fGDMLFilename("default.gdml") // A default name
+   fSensitivityMap(nullptr),
+   fGDMLFilename("default.gdml"), // A default name
+   fCheckOverlaps(false),
+   fOverlapResolution(1000),
+   fFastSimEnabled(false),
+   fFastSimMaxEnergy(0.),
+   fFastSimContainedOnly(true)
 {
-  // The G4GDMLParser can be configured to check for overlaps
-  fParser.SetOverlapCheck(true);
+  // Overlaps are checked after parsing (see CheckOverlaps), not by the parser.
+  fParser.SetOverlapCheck(false);
   DefineCommands();
+  fSensitivityMap = new AirPetSensitivityMap(this);
 }
 
 DetectorConstruction::~DetectorConstruction()
 {
+  delete fSensitivityMap;
   delete fMessenger;
 }
 
@@ -43,6 +92,12 @@ void DetectorConstruction::DefineCommands()
       .SetStates(G4State_PreInit, G4State_Idle)
       .SetToBeBroadcasted(false);
 
+  // Command to drop all SD assignments, e.g. before loading a new geometry
+  fMessenger->DeclareMethod("clearSD", &DetectorConstruction::ClearSensitiveDetectors)
+      .SetGuidance("Remove all sensitive detector assignments.")
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
   // Command to add a Sensitive Detector to a Logical Volume
   fMessenger->DeclareMethod("addSD", &DetectorConstruction::SetSensitiveDetector)
       .SetGuidance("Assign a sensitive detector to a logical volume.")
@@ -51,6 +106,91 @@ void DetectorConstruction::DefineCommands()
       .SetParameterName("SensitiveDetectorName", /*omittable=*/false)
       .SetStates(G4State_PreInit, G4State_Idle)
       .SetToBeBroadcasted(false);
+
+  // Command to add a photodetector (optical photon counting) SD
+  fMessenger->DeclareMethod("addPhotonSD", &DetectorConstruction::SetPhotonDetector)
+      .SetGuidance("Assign a photodetector that counts optical photons to a logical volume.")
+      .SetGuidance("Usage: /g4pet/detector/addPhotonSD <LogicalVolumeName> <SensitiveDetectorName>")
+      .SetParameterName("LogicalVolumeName",     /*omittable=*/false)
+      .SetParameterName("SensitiveDetectorName", /*omittable=*/false)
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  // Regions with their own cuts and step limits
+  fMessenger->DeclareMethod("addRegion", &DetectorConstruction::AddRegion)
+      .SetGuidance("Add a logical volume (and its daughters) to a region, created if needed.")
+      .SetGuidance("Usage: /g4pet/detector/addRegion <RegionName> <LogicalVolumeName>")
+      .SetParameterName(0, "RegionName",        /*omittable=*/false)
+      .SetParameterName(1, "LogicalVolumeName", /*omittable=*/false)
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareMethod("setRegionCut", &DetectorConstruction::SetRegionCut)
+      .SetGuidance("Set the production cut (range) of a region, for one particle or all.")
+      .SetGuidance("Usage: /g4pet/detector/setRegionCut <RegionName> <value> <unit> [gamma|e-|e+|proton|all]")
+      .SetParameterName(0, "RegionName", /*omittable=*/false)
+      .SetParameterName(1, "value",      /*omittable=*/false)
+      .SetParameterName(2, "unit",       /*omittable=*/false)
+      .SetParameterName(3, "particle",   /*omittable=*/true)
+      .SetDefaultValue(3, "all")
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareMethod("setRegionStepLimit", &DetectorConstruction::SetRegionStepLimit)
+      .SetGuidance("Set the maximum step length in a region (0 = no limit).")
+      .SetGuidance("Usage: /g4pet/detector/setRegionStepLimit <RegionName> <value> <unit>")
+      .SetParameterName(0, "RegionName", /*omittable=*/false)
+      .SetParameterName(1, "value",      /*omittable=*/false)
+      .SetParameterName(2, "unit",       /*omittable=*/false)
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareMethod("clearRegions", &DetectorConstruction::ClearRegions)
+      .SetGuidance("Remove all region assignments, cuts and step limits.")
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareMethod("setFastSim", &DetectorConstruction::SetFastSim)
+      .SetGuidance("Deposit electrons in the SD volumes locally instead of tracking them")
+      .SetGuidance("(default: false, i.e. full simulation). Gammas are always tracked.")
+      .SetParameterName("flag", true)
+      .SetDefaultValue("true")
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareMethodWithUnit("setFastSimMaxEnergy", "keV", &DetectorConstruction::SetFastSimMaxEnergy)
+      .SetGuidance("Track electrons above this energy in full (0 = no limit).")
+      .SetParameterName("energy", false)
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareMethod("setFastSimContainedOnly", &DetectorConstruction::SetFastSimContainedOnly)
+      .SetGuidance("Only deposit electrons whose range ends inside their crystal (default: true).")
+      .SetParameterName("flag", true)
+      .SetDefaultValue("true")
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareProperty("checkOverlaps", fCheckOverlaps)
+      .SetGuidance("Check the geometry for overlaps after loading it (default: false).")
+      .SetGuidance("A passed check is cached per GDML content hash (see geometryCacheDir).")
+      .SetParameterName("flag", true)
+      .SetDefaultValue("true")
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareProperty("overlapResolution", fOverlapResolution)
+      .SetGuidance("Number of surface points per volume for the overlap check.")
+      .SetParameterName("points", false)
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
+
+  fMessenger->DeclareProperty("geometryCacheDir", fGeometryCacheDir)
+      .SetGuidance("Directory for overlap-check markers, shared between runs.")
+      .SetGuidance("Without it the marker is written next to the GDML file.")
+      .SetParameterName("dir", false)
+      .SetStates(G4State_PreInit, G4State_Idle)
+      .SetToBeBroadcasted(false);
 }
 
 // This method is defined for the messenger (takes G4Strings)
@@ -62,7 +202,217 @@ void DetectorConstruction::SetSensitiveDetector(G4String logicalVolumeName, G4St
 
   // Tell the RunManager that the detector setup has changed and needs to be rebuilt.
   // This will ensure ConstructSDandField() is called again before the next run.
-  //G4RunManager::GetRunManager()->ReinitializeGeometry();
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::SetPhotonDetector(G4String logicalVolumeName, G4String sdName)
+{
+  fPhotonDetectorNames.insert(sdName);
+  SetSensitiveDetector(logicalVolumeName, sdName);
+}
+
+void DetectorConstruction::ClearSensitiveDetectors()
+{
+  fSensitiveDetectorsMap.clear();
+  fPhotonDetectorNames.clear();
+  G4cout << "--> Cleared all sensitive detector assignments" << G4endl;
+  RequestGeometryRebuild();
+}
+
+namespace {
+  // Length given as value and unit on the command line (-1 if invalid).
+  G4double ParseLength(const G4String& value, const G4String& unit)
+  {
+    if (G4UnitDefinition::GetCategory(unit) != "Length") {
+      G4Exception("DetectorConstruction", "InvalidUnit", JustWarning,
+                  ("Not a length unit: " + unit).c_str());
+      return -1.;
+    }
+    return G4UIcommand::ConvertToDouble(value) * G4UnitDefinition::GetValueOf(unit);
+  }
+}
+
+void DetectorConstruction::AddRegion(G4String regionName, G4String logicalVolumeName)
+{
+  fRegionSettings[regionName].volumes.push_back(logicalVolumeName);
+  G4cout << "--> Requested region '" << regionName << "' for logical volume '"
+         << logicalVolumeName << "'" << G4endl;
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::SetRegionCut(G4String regionName, G4String value, G4String unit,
+                                        G4String particle)
+{
+  const G4double cut = ParseLength(value, unit);
+  if (cut < 0.) return;
+  if (particle != "all" && particle != "gamma" && particle != "e-" && particle != "e+" &&
+      particle != "proton") {
+    G4Exception("DetectorConstruction::SetRegionCut", "InvalidParticle", JustWarning,
+                ("Production cuts exist for gamma, e-, e+ and proton, not " + particle).c_str());
+    return;
+  }
+  auto& cuts = fRegionSettings[regionName].cuts;
+  for (const char* name : {"gamma", "e-", "e+", "proton"}) {
+    if (particle == "all" || particle == name) cuts[name] = cut;
+  }
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::SetRegionStepLimit(G4String regionName, G4String value, G4String unit)
+{
+  const G4double maxStep = ParseLength(value, unit);
+  if (maxStep < 0.) return;
+  fRegionSettings[regionName].maxStep = maxStep;
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::ClearRegions()
+{
+  fRegionSettings.clear();
+  G4cout << "--> Cleared all region assignments" << G4endl;
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::SetFastSim(G4bool enabled)
+{
+  fFastSimEnabled = enabled;
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::SetFastSimMaxEnergy(G4double energy)
+{
+  fFastSimMaxEnergy = energy;
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::SetFastSimContainedOnly(G4bool containedOnly)
+{
+  fFastSimContainedOnly = containedOnly;
+  RequestGeometryRebuild();
+}
+
+void DetectorConstruction::ClearBuiltRegions()
+{
+  // Regions persist across geometry rebuilds (the cuts table refers to
+  // them), so the regions of the previous build are only emptied.
+  G4RegionStore* regionStore = G4RegionStore::GetInstance();
+  for (const auto& pair : fRegionCuts) {
+    G4Region* region = regionStore->GetRegion(pair.first, false);
+    if (!region) continue;
+    std::vector<G4LogicalVolume*> roots(region->GetRootLogicalVolumeIterator(),
+                                        region->GetRootLogicalVolumeIterator() +
+                                            region->GetNumberOfRootVolumes());
+    for (G4LogicalVolume* volume : roots) region->RemoveRootLogicalVolume(volume, false);
+    region->SetUserLimits(nullptr);
+  }
+}
+
+void DetectorConstruction::BuildRegions()
+{
+  G4RegionStore* regionStore = G4RegionStore::GetInstance();
+  G4LogicalVolumeStore* lvStore = G4LogicalVolumeStore::GetInstance();
+  const G4ProductionCuts* defaultCuts =
+      G4ProductionCutsTable::GetProductionCutsTable()->GetDefaultProductionCuts();
+  for (const auto& pair : fRegionSettings) {
+    const RegionSettings& settings = pair.second;
+    G4Region* region = regionStore->FindOrCreateRegion(pair.first);
+    for (const G4String& lvName : settings.volumes) {
+      G4LogicalVolume* logicalVolume = lvStore->GetVolume(lvName, false);
+      if (!logicalVolume) {
+        G4cerr << "--> WARNING: Logical Volume '" << lvName
+               << "' not found in geometry. Cannot add it to region '"
+               << pair.first << "'." << G4endl;
+        continue;
+      }
+      region->AddRootLogicalVolume(logicalVolume);
+    }
+
+    // Each region owns its cuts, starting from the defaults of the physics
+    // list, so settings removed since the last build do not linger.
+    G4ProductionCuts*& cuts = fRegionCuts[pair.first];
+    if (!cuts) cuts = new G4ProductionCuts();
+    std::vector<G4double> ranges = defaultCuts->GetProductionCuts();
+    cuts->SetProductionCuts(ranges);
+    for (const auto& cut : settings.cuts) cuts->SetProductionCut(cut.second, cut.first);
+    region->SetProductionCuts(cuts);
+
+    // Only applied by G4StepLimiterPhysics, registered in main.cc.
+    G4UserLimits*& limits = fRegionLimits[pair.first];
+    if (settings.maxStep > 0.) {
+      if (!limits) limits = new G4UserLimits();
+      limits->SetMaxAllowedStep(settings.maxStep);
+      region->SetUserLimits(limits);
+    }
+
+    G4cout << "--> Region '" << pair.first << "': " << region->GetNumberOfRootVolumes()
+           << " root volume(s)";
+    for (const auto& cut : settings.cuts) {
+      G4cout << ", " << cut.first << " cut " << G4BestUnit(cut.second, "Length");
+    }
+    if (settings.maxStep > 0.) G4cout << ", max step " << G4BestUnit(settings.maxStep, "Length");
+    G4cout << G4endl;
+  }
+}
+
+void DetectorConstruction::BuildFastSimRegions()
+{
+  fFastSimRegions.clear();
+  if (!fFastSimEnabled) return;
+
+  G4RegionStore* regionStore = G4RegionStore::GetInstance();
+  G4LogicalVolumeStore* lvStore = G4LogicalVolumeStore::GetInstance();
+  const G4ProductionCuts* defaultCuts =
+      G4ProductionCutsTable::GetProductionCutsTable()->GetDefaultProductionCuts();
+  for (const G4String& lvName : GetSensitiveVolumeNames()) {
+    G4LogicalVolume* logicalVolume = lvStore->GetVolume(lvName, false);
+    if (!logicalVolume) continue;
+    G4Region* region = logicalVolume->GetRegion();
+    if (!(region && logicalVolume->IsRootRegion() && fRegionSettings.count(region->GetName()))) {
+      // A region of its own, with the cuts and step limit of the user region
+      // it lies in (set by BuildRegions), or the defaults. Like the user
+      // regions it is only emptied before a rebuild.
+      const G4Region* inherited = region;
+      const G4String regionName = "AirPetFastSim_" + lvName;
+      region = regionStore->FindOrCreateRegion(regionName);
+      G4ProductionCuts*& cuts = fRegionCuts[regionName];
+      if (!cuts) cuts = new G4ProductionCuts();
+      std::vector<G4double> ranges = (inherited && inherited->GetProductionCuts())
+                                         ? inherited->GetProductionCuts()->GetProductionCuts()
+                                         : defaultCuts->GetProductionCuts();
+      cuts->SetProductionCuts(ranges);
+      region->SetProductionCuts(cuts);
+      region->SetUserLimits(inherited ? inherited->GetUserLimits() : nullptr);
+      region->AddRootLogicalVolume(logicalVolume);
+    }
+    fFastSimRegions[region->GetName()].push_back(lvName);
+    G4cout << "--> Fast simulation of electrons in '" << lvName << "' (region '"
+           << region->GetName() << "')" << G4endl;
+  }
+}
+
+G4String DetectorConstruction::GetGeometryHash() const
+{
+  return HashFile(fGDMLFilename);
+}
+
+std::vector<G4String> DetectorConstruction::GetSensitiveVolumeNames() const
+{
+  std::vector<G4String> names;
+  for (const auto& pair : fSensitiveDetectorsMap) {
+    if (!fPhotonDetectorNames.count(pair.second)) names.push_back(pair.first);
+  }
+  return names;
+}
+
+void DetectorConstruction::RequestGeometryRebuild()
+{
+  // Before /run/initialize the geometry is built anyway. Afterwards, only
+  // the geometry and SD mapping are rebuilt at the next /run/beamOn, while
+  // the physics list and its tables stay initialized. In MT mode the
+  // request is propagated to the workers, which then call
+  // ConstructSDandField() again.
+  if (G4StateManager::GetStateManager()->GetCurrentState() != G4State_Idle) return;
+  G4RunManager::GetRunManager()->ReinitializeGeometry();
 }
 
 void DetectorConstruction::SetGDMLFile(G4String filename)
@@ -81,8 +431,7 @@ void DetectorConstruction::SetGDMLFile(G4String filename)
   G4cout << "--> Geometry will be loaded from: " << fGDMLFilename << G4endl;
 
   // Inform the RunManager that the geometry needs to be rebuilt
-  //G4RunManager::GetRunManager()->ReinitializeGeometry();
-  //G4cout << "--> Geometry will be loaded from: " << fGDMLFilename << G4endl;
+  RequestGeometryRebuild();
 }
 
 G4VPhysicalVolume* DetectorConstruction::Construct()
@@ -96,10 +445,17 @@ G4VPhysicalVolume* DetectorConstruction::Construct()
 
   // Clear any previously loaded geometry
   G4GeometryManager::GetInstance()->OpenGeometry();
+  // The old volumes are still valid here, so they can leave their regions.
+  ClearBuiltRegions();
   G4PhysicalVolumeStore::GetInstance()->Clean();
   G4LogicalVolumeStore::GetInstance()->Clean();
   G4SolidStore::GetInstance()->Clean();
 
+  // Volume addresses may be reused by the new geometry.
+  AirPetNameTable::ClearThreadCache();
+  // Drop the parser's name maps from a previous file.
+  if (fWorldVolume) fParser.Clear();
+
   // Parse the GDML file
   // The parser will create all materials, solids, and logical/physical volumes.
   fParser.Read(fGDMLFilename, false); // false = do not validate schema
@@ -113,13 +469,58 @@ G4VPhysicalVolume* DetectorConstruction::Construct()
                 "Could not find the World Volume in the GDML file.");
   }
 
+  if (fCheckOverlaps) CheckOverlaps();
+  BuildRegions();
+  BuildFastSimRegions();
+
   return fWorldVolume;
 }
 
+void DetectorConstruction::CheckOverlaps()
+{
+  // A passed check is recorded in a marker keyed on the content hash of the
+  // GDML file, so an edited file is always checked again. The marker also
+  // stores the resolution, so a finer check is not skipped either.
+  const G4String hash = HashFile(fGDMLFilename);
+  const G4String markerName = fGeometryCacheDir.empty()
+      ? fGDMLFilename + ".checked"
+      : fGeometryCacheDir + "/" + hash + ".checked";
+  std::ostringstream key;
+  key << hash << " " << fOverlapResolution;
+
+  std::string cached;
+  std::ifstream marker(markerName);
+  if (!hash.empty() && marker && std::getline(marker, cached) && cached == key.str()) {
+    G4cout << "--> Overlap check skipped: " << fGDMLFilename
+           << " passed an identical check before (" << markerName << ")." << G4endl;
+    return;
+  }
+
+  G4cout << "--> Checking geometry for overlaps..." << G4endl;
+  G4bool overlaps = false;
+  for (G4VPhysicalVolume* volume : *G4PhysicalVolumeStore::GetInstance()) {
+    if (volume->CheckOverlaps(fOverlapResolution)) overlaps = true;
+  }
+
+  if (overlaps) {
+    G4Exception("DetectorConstruction::CheckOverlaps()",
+                "GeometryOverlap", JustWarning,
+                "Overlapping volumes found (see above).");
+    std::remove(markerName.c_str());
+    return;
+  }
+  std::ofstream out(markerName);
+  if (out) out << key.str() << "\n";
+}
+
 void DetectorConstruction::ConstructSDandField()
 {
 
   G4cout << G4endl << "-------- DetectorConstruction::ConstructSDandField --------" << G4endl;
+
+  // Called on every thread after each (re)build of the geometry, so this is
+  // where worker threads forget the volume pointers of the old geometry.
+  AirPetNameTable::ClearThreadCache();
   
   G4SDManager* sdManager = G4SDManager::GetSDMpointer();
   G4LogicalVolumeStore* lvStore = G4LogicalVolumeStore::GetInstance();
@@ -149,8 +550,14 @@ void DetectorConstruction::ConstructSDandField()
              << "' to logical volume '" << lvName << "'" << G4endl;
     }
     else {
-      // If it doesn't exist, create a new instance of our generic SD
-      auto* airpetSD = new AirPetSensitiveDetector(sdName);
+      // If it doesn't exist, create a new instance of our generic SD (or a
+      // photodetector for names given to addPhotonSD)
+      G4VSensitiveDetector* airpetSD = nullptr;
+      if (fPhotonDetectorNames.count(sdName)) {
+        airpetSD = new AirPetPhotonSD(sdName);
+      } else {
+        airpetSD = new AirPetSensitiveDetector(sdName);
+      }
       sdManager->AddNewDetector(airpetSD);
       // Use the base class's method to attach the SD
       G4VUserDetectorConstruction::SetSensitiveDetector(logicalVolume, airpetSD);
@@ -158,4 +565,27 @@ void DetectorConstruction::ConstructSDandField()
              << "' to logical volume '" << lvName << "'" << G4endl;
     }
   }
+
+  // Fast simulation models are created once per thread and region; a
+  // rebuild only changes their volumes (none if no longer wanted).
+  if (!fFastSimModels) fFastSimModels = new std::map<G4String, AirPetCrystalFastSim*>();
+  for (auto& model : *fFastSimModels) model.second->SetVolumes({});
+  G4RegionStore* regionStore = G4RegionStore::GetInstance();
+  for (const auto& pair : fFastSimRegions) {
+    G4Region* region = regionStore->GetRegion(pair.first, false);
+    if (!region) continue;
+    AirPetCrystalFastSim*& model = (*fFastSimModels)[pair.first];
+    if (!model) model = new AirPetCrystalFastSim("AirPetCrystalFastSim_" + pair.first, region);
+    std::set<const G4LogicalVolume*> volumes;
+    for (const G4String& lvName : pair.second) {
+      if (G4LogicalVolume* logicalVolume = lvStore->GetVolume(lvName, false)) volumes.insert(logicalVolume);
+    }
+    model->SetVolumes(volumes);
+    model->SetMaxEnergy(fFastSimMaxEnergy);
+    model->SetContainedOnly(fFastSimContainedOnly);
+  }
+
+  // Number the sensitive placements once, so hits get their channel ID
+  // without walking the touchable or looking up names per step.
+  AirPetChannelMap::Instance()->Build(fWorldVolume);
 }
\ No newline at end of file
@@ -1,12 +1,18 @@
 #include "EventAction.hh"
+#include "AirPetChannelMap.hh"
 #include "AirPetHit.hh"
+#include "AirPetLiveStream.hh"
+#include "AirPetPhotonSD.hh"
+#include "AirPetProfiler.hh"
+#include "AirPetServer.hh"
+#include "AirPetTrackFile.hh"
 #include "AirPetTrajectory.hh"
 #include "RunAction.hh"
 #include "TrackingAction.hh"
-#include "G4AnalysisManager.hh"
 #include "G4Event.hh"
 #include "G4HCofThisEvent.hh"
 #include "G4HCtable.hh"
+#include "G4PrimaryVertex.hh"
 #include "G4RunManager.hh"
 #include "G4SDManager.hh"
 #include "G4TrajectoryContainer.hh"
@@ -15,12 +21,14 @@
 #include "G4UIcommand.hh"
 #include "G4UIdirectory.hh"
 #include "G4UIparameter.hh"
-#include <fstream>
+#include "G4VVisManager.hh"
 
-EventAction::EventAction()
-    : G4UserEventAction(), fTrackOutputDir("."), fStartEventToTrack(0),
-      fEndEventToTrack(0) {
-  fHitsCollectionIDs.push_back(-1);
+EventAction::EventAction(RunAction *runAction)
+    : G4UserEventAction(), fRunAction(runAction), fNumCollectionsSeen(-1), fEventWeight(1.),
+      fTrackOutputDir("."), fStartEventToTrack(0),
+      fEndEventToTrack(0), fAutoTrajectoryMode(true),
+      fForcedTrajectoryMode(TrajectoryMode::kFull),
+      fCurrentTrajectoryMode(TrajectoryMode::kFull), fStoreParentMomentum(true) {
   fG4petDir = new G4UIdirectory("/g4pet/");
   fEventDir = new G4UIdirectory("/g4pet/event/");
   fTrackOutputDirCmd = new G4UIcommand("/g4pet/event/printTracksToDir", this);
@@ -30,6 +38,19 @@ EventAction::EventAction()
   fSetTrackEventRangeCmd->SetParameter(new G4UIparameter("startEvent", 'i', false));
   fSetTrackEventRangeCmd->SetParameter(new G4UIparameter("endEvent", 'i', false));
   fSetTrackEventRangeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fTrajectoryModeCmd = new G4UIcommand("/g4pet/event/trajectoryMode", this);
+  fTrajectoryModeCmd->SetGuidance("Trajectory storage: auto, none, summary or full.");
+  fTrajectoryModeCmd->SetGuidance("auto records full points for events in the track range (or when");
+  fTrajectoryModeCmd->SetGuidance("visualization is active), summaries if saveParticles is on, else none.");
+  auto *modeParam = new G4UIparameter("mode", 's', true);
+  modeParam->SetDefaultValue("auto");
+  modeParam->SetParameterCandidates("auto none summary full");
+  fTrajectoryModeCmd->SetParameter(modeParam);
+  fTrajectoryModeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fStoreParentMomentumCmd = new G4UIcommand("/g4pet/event/storeParentMomentum", this);
+  fStoreParentMomentumCmd->SetGuidance("Attach the parent momentum to every secondary track.");
+  fStoreParentMomentumCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fStoreParentMomentumCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
 }
 
 EventAction::~EventAction() {}
@@ -41,6 +62,17 @@ void EventAction::SetNewValue(G4UIcommand *command, G4String newValue) {
     G4Tokenizer next(newValue);
     fStartEventToTrack = StoI(next());
     fEndEventToTrack = StoI(next());
+  } else if (command == fStoreParentMomentumCmd) {
+    fStoreParentMomentum = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fTrajectoryModeCmd) {
+    fAutoTrajectoryMode = (newValue == "auto");
+    if (newValue == "none") {
+      fForcedTrajectoryMode = TrajectoryMode::kNone;
+    } else if (newValue == "summary") {
+      fForcedTrajectoryMode = TrajectoryMode::kSummary;
+    } else {
+      fForcedTrajectoryMode = TrajectoryMode::kFull;
+    }
   }
 }
 
@@ -49,107 +81,235 @@ void EventAction::SetTrackEventRange(G4int start, G4int end) {
   fEndEventToTrack = end;
 }
 
-void EventAction::BeginOfEventAction(const G4Event * /*event*/) {}
+G4bool EventAction::GetOpticalFastPath() const {
+  return fRunAction && fRunAction->GetOpticalReadout().GetFastPath();
+}
+
+TrajectoryMode EventAction::DecideTrajectoryMode(G4int eventID) const {
+  if (!fAutoTrajectoryMode) return fForcedTrajectoryMode;
+
+  // Events written to track files, and anything drawn by the vis manager,
+  // need every step point.
+  if (eventID >= fStartEventToTrack && eventID <= fEndEventToTrack) return TrajectoryMode::kFull;
+  if (G4VVisManager::GetConcreteInstance()) return TrajectoryMode::kFull;
+
+  // The Tracks ntuple only needs initial/final state per track.
+  if (fRunAction && fRunAction->GetSaveParticles()) return TrajectoryMode::kSummary;
+
+  return TrajectoryMode::kNone;
+}
+
+void EventAction::BeginOfEventAction(const G4Event *event) {
+  // In server mode a client may cancel the job; stop after current events.
+  if (AirPetServer::AbortRequested()) G4RunManager::GetRunManager()->AbortRun(true);
+  const G4int eventID = fRunAction ? fRunAction->GetGlobalEventID(event->GetEventID()) : event->GetEventID();
+  fCurrentTrajectoryMode = DecideTrajectoryMode(eventID);
+}
 
 void EventAction::EndOfEventAction(const G4Event *event) {
-  auto analysisManager = G4AnalysisManager::Instance();
-  auto runAction = static_cast<const RunAction *>(G4RunManager::GetRunManager()->GetUserRunAction());
+  AirPetProfileScope profile(AirPetProfiler::kEndOfEvent);
+  auto runAction = fRunAction;
   if (!runAction) return;
 
-  if (runAction->GetSaveHits()) {
-    G4int hits_ntuple_ID = runAction->GetSaveParticles() ? 1 : 0;
-    if (fHitsCollectionIDs[0] == -1) {
+  // Global EventID of a sharded run.
+  const G4int eventID = runAction->GetGlobalEventID(event->GetEventID());
+  // A resumed run already has the rows of this event.
+  if (runAction->WasWrittenBefore(eventID)) {
+    runAction->EndOfEventFlush(eventID);
+    AirPetServer::EventFinished();
+    return;
+  }
+  AirPetNtupleBuffer &hits = runAction->GetHitsBuffer();
+  AirPetNtupleBuffer &crystals = runAction->GetCrystalEdepBuffer();
+  AirPetNtupleBuffer &lors = runAction->GetLORsBuffer();
+  AirPetNtupleBuffer &photonCounts = runAction->GetPhotonCountsBuffer();
+  AirPetNtupleBuffer &photonTimes = runAction->GetPhotonTimesBuffer();
+  const G4bool writePhotons = runAction->GetSaveHits() &&
+                              !(photonCounts.GetColumns().empty() && photonTimes.GetColumns().empty());
+  const G4bool writeHits = runAction->GetSaveHits() && !hits.GetColumns().empty();
+  const G4bool writeCrystals = runAction->GetSaveHits() && !crystals.GetColumns().empty();
+  const G4bool digitize = runAction->GetDigitizer().IsEnabled() && !lors.GetColumns().empty();
+  const G4bool filter = runAction->HasEventFilter();
+  const G4bool live = AirPetLiveStream::IsActive();
+  G4bool keepEvent = true;
+  fEventWeight = event->GetPrimaryVertex() ? event->GetPrimaryVertex()->GetWeight() : 1.;
+  if (writeHits || writeCrystals || digitize || filter || writePhotons || live) {
+    // Collections are looked up again whenever SDs were added (e.g. after
+    // a geometry rebuild); photodetector collections are kept apart.
+    G4SDManager *sdManager = G4SDManager::GetSDMpointer();
+    G4HCtable *hcTable = sdManager->GetHCtable();
+    if (hcTable->entries() != fNumCollectionsSeen) {
+      fNumCollectionsSeen = hcTable->entries();
       fHitsCollectionIDs.clear();
-      G4SDManager *sdManager = G4SDManager::GetSDMpointer();
-      G4HCtable *hcTable = sdManager->GetHCtable();
+      fPhotonCollectionIDs.clear();
       for (G4int i = 0; i < hcTable->entries(); ++i) {
         G4int cID = sdManager->GetCollectionID(hcTable->GetHCname(i));
-        if (cID >= 0) fHitsCollectionIDs.push_back(cID);
+        if (cID < 0) continue;
+        auto sd = sdManager->FindSensitiveDetector(hcTable->GetSDname(i), false);
+        if (dynamic_cast<AirPetPhotonSD *>(sd)) {
+          fPhotonCollectionIDs.push_back(cID);
+        } else {
+          fHitsCollectionIDs.push_back(cID);
+        }
       }
     }
+
+    // Gather the hits above threshold first, so the event can be judged as
+    // a whole before anything is written.
+    fEventHits.clear();
+    G4int detectorsHit = 0;
+    G4double totalEdep = 0.;
     G4HCofThisEvent *hce = event->GetHCofThisEvent();
     if (hce) {
       for (G4int cID : fHitsCollectionIDs) {
         auto hitsCollection = static_cast<AirPetHitsCollection *>(hce->GetHC(cID));
-        if (hitsCollection) {
-          for (size_t i = 0; i < hitsCollection->GetSize(); ++i) {
-            auto hit = static_cast<AirPetHit *>(hitsCollection->GetHit(i));
-            if (hit->GetEdep() < runAction->GetHitEnergyThreshold()) continue;
-            analysisManager->FillNtupleIColumn(hits_ntuple_ID, 0, event->GetEventID());
-            analysisManager->FillNtupleIColumn(hits_ntuple_ID, 1, hit->GetCopyNo());
-            analysisManager->FillNtupleSColumn(hits_ntuple_ID, 2, hit->GetParticleName());
-            analysisManager->FillNtupleIColumn(hits_ntuple_ID, 3, hit->GetTrackID());
-            analysisManager->FillNtupleIColumn(hits_ntuple_ID, 4, hit->GetParentID());
-            analysisManager->FillNtupleDColumn(hits_ntuple_ID, 5, hit->GetEdep());
-            analysisManager->FillNtupleDColumn(hits_ntuple_ID, 6, hit->GetPosition().x());
-            analysisManager->FillNtupleDColumn(hits_ntuple_ID, 7, hit->GetPosition().y());
-            analysisManager->FillNtupleDColumn(hits_ntuple_ID, 8, hit->GetPosition().z());
-            analysisManager->FillNtupleDColumn(hits_ntuple_ID, 9, hit->GetTime());
-            analysisManager->AddNtupleRow(hits_ntuple_ID);
-          }
+        if (!hitsCollection) continue;
+        const size_t before = fEventHits.size();
+        for (size_t i = 0; i < hitsCollection->GetSize(); ++i) {
+          auto hit = static_cast<AirPetHit *>(hitsCollection->GetHit(i));
+          if (hit->GetEdep() < runAction->GetHitEnergyThreshold()) continue;
+          fEventHits.push_back(hit);
+          totalEdep += hit->GetEdep();
         }
+        if (fEventHits.size() > before) ++detectorsHit;
       }
     }
+
+    // Event-level keep/drop policy (/g4pet/run/minHitsPerEvent etc.).
+    // Dropped events write no Hits, CrystalEdep, LORs or Tracks rows.
+    if (filter) {
+      keepEvent = static_cast<G4int>(fEventHits.size()) >= runAction->GetMinHitsPerEvent() &&
+                  totalEdep >= runAction->GetMinEventEdep() &&
+                  (!runAction->GetRequireMultipleSDs() || detectorsHit >= 2);
+    }
+
+    if (keepEvent && writeHits) {
+      for (const AirPetHit *hit : fEventHits) {
+        hits.FillI(0, eventID);
+        hits.FillI(1, hit->GetCopyNo());
+        hits.FillI(2, hit->GetParticleID());
+        hits.FillI(3, hit->GetTrackID());
+        hits.FillI(4, hit->GetParentID());
+        hits.FillF(5, hit->GetEdep());
+        hits.FillF(6, hit->GetPosition().x());
+        hits.FillF(7, hit->GetPosition().y());
+        hits.FillF(8, hit->GetPosition().z());
+        hits.FillD(9, hit->GetTime());
+        hits.FillI(10, hit->GetVolumeID());
+        hits.FillI(11, hit->GetPhysicalVolumeID());
+        hits.FillI(12, hit->GetChannelID());
+        hits.FillF(13, fEventWeight);
+        hits.AddRow();
+      }
+    }
+    if (keepEvent && writeCrystals) WriteCrystalEdep(eventID, crystals);
+    if (keepEvent && writePhotons && hce) {
+      for (G4int cID : fPhotonCollectionIDs) {
+        auto photonHits = static_cast<AirPetPhotonHitsCollection *>(hce->GetHC(cID));
+        if (photonHits) {
+          runAction->GetOpticalReadout().ProcessHits(eventID, *photonHits,
+                                                     photonCounts, photonTimes);
+        }
+      }
+    }
+    G4bool hasLOR = false;
+    if (keepEvent && digitize) {
+      AirPetProfileScope digiProfile(AirPetProfiler::kDigitize);
+      hasLOR = runAction->GetDigitizer().ProcessEvent(eventID, fEventHits, fEventWeight, lors);
+    }
+    if (live) {
+      AirPetLiveStream::AddEvent(keepEvent ? fEventHits : std::vector<const AirPetHit *>(),
+                                 hasLOR ? &lors : nullptr);
+    }
   }
 
-  if (runAction->GetSaveParticles()) {
+  AirPetNtupleBuffer &tracks = runAction->GetTracksBuffer();
+  if (keepEvent && runAction->GetSaveParticles() && !tracks.GetColumns().empty()) {
     G4TrajectoryContainer *trajectoryContainer = event->GetTrajectoryContainer();
     if (trajectoryContainer) {
       for (size_t i = 0; i < trajectoryContainer->size(); ++i) {
         auto traj = dynamic_cast<AirPetTrajectory *>((*trajectoryContainer)[i]);
         if (traj) {
-          analysisManager->FillNtupleIColumn(0, 0, event->GetEventID());
-          analysisManager->FillNtupleSColumn(0, 1, traj->GetParticleName());
-          analysisManager->FillNtupleIColumn(0, 2, traj->GetTrackID());
-          analysisManager->FillNtupleIColumn(0, 3, traj->GetParentID());
-          analysisManager->FillNtupleDColumn(0, 4, traj->GetMass());
-          analysisManager->FillNtupleDColumn(0, 5, traj->GetInitialPosition().x());
-          analysisManager->FillNtupleDColumn(0, 6, traj->GetInitialPosition().y());
-          analysisManager->FillNtupleDColumn(0, 7, traj->GetInitialPosition().z());
-          analysisManager->FillNtupleDColumn(0, 8, traj->GetInitialTime());
-          analysisManager->FillNtupleDColumn(0, 9, traj->GetFinalPosition().x());
-          analysisManager->FillNtupleDColumn(0, 10, traj->GetFinalPosition().y());
-          analysisManager->FillNtupleDColumn(0, 11, traj->GetFinalPosition().z());
-          analysisManager->FillNtupleDColumn(0, 12, traj->GetFinalTime());
-          analysisManager->FillNtupleDColumn(0, 13, traj->GetInitialMomentum().x());
-          analysisManager->FillNtupleDColumn(0, 14, traj->GetInitialMomentum().y());
-          analysisManager->FillNtupleDColumn(0, 15, traj->GetInitialMomentum().z());
-          analysisManager->FillNtupleDColumn(0, 16, traj->GetFinalMomentum().x());
-          analysisManager->FillNtupleDColumn(0, 17, traj->GetFinalMomentum().y());
-          analysisManager->FillNtupleDColumn(0, 18, traj->GetFinalMomentum().z());
-          analysisManager->FillNtupleSColumn(0, 19, traj->GetInitialVolume());
-          analysisManager->FillNtupleSColumn(0, 20, traj->GetFinalVolume());
-          analysisManager->FillNtupleSColumn(0, 21, traj->GetCreatorProcess());
-          analysisManager->AddNtupleRow(0);
+          tracks.FillI(0, eventID);
+          tracks.FillS(1, traj->GetParticleName());
+          tracks.FillI(2, traj->GetTrackID());
+          tracks.FillI(3, traj->GetParentID());
+          tracks.FillF(4, traj->GetMass());
+          tracks.FillF(5, traj->GetInitialPosition().x());
+          tracks.FillF(6, traj->GetInitialPosition().y());
+          tracks.FillF(7, traj->GetInitialPosition().z());
+          tracks.FillD(8, traj->GetInitialTime());
+          tracks.FillF(9, traj->GetFinalPosition().x());
+          tracks.FillF(10, traj->GetFinalPosition().y());
+          tracks.FillF(11, traj->GetFinalPosition().z());
+          tracks.FillD(12, traj->GetFinalTime());
+          tracks.FillF(13, traj->GetInitialMomentum().x());
+          tracks.FillF(14, traj->GetInitialMomentum().y());
+          tracks.FillF(15, traj->GetInitialMomentum().z());
+          tracks.FillF(16, traj->GetFinalMomentum().x());
+          tracks.FillF(17, traj->GetFinalMomentum().y());
+          tracks.FillF(18, traj->GetFinalMomentum().z());
+          tracks.FillS(19, traj->GetInitialVolume());
+          tracks.FillS(20, traj->GetFinalVolume());
+          tracks.FillS(21, traj->GetCreatorProcess());
+          tracks.AddRow();
         }
       }
     }
   }
 
-  G4int eventID = event->GetEventID();
-  if (eventID >= fStartEventToTrack && eventID <= fEndEventToTrack) {
-    WriteTracksToFile(event);
+  // Before the flush: once an event's rows are written, a checkpoint takes
+  // its tracks as written too.
+  if (keepEvent && fCurrentTrajectoryMode == TrajectoryMode::kFull &&
+      eventID >= fStartEventToTrack && eventID <= fEndEventToTrack) {
+    WriteTracksToFile(event, eventID);
   }
+
+  runAction->EndOfEventFlush(eventID);
+  AirPetServer::EventFinished();
 }
 
-void EventAction::WriteTracksToFile(const G4Event *event) {
-  G4TrajectoryContainer *trajectoryContainer = event->GetTrajectoryContainer();
-  if (!trajectoryContainer) return;
-  std::ostringstream filename;
-  filename << fTrackOutputDir << "/event_" << std::setw(4) << std::setfill('0') << event->GetEventID() << "_tracks.txt";
-  std::ofstream outFile(filename.str());
-  if (!outFile.is_open()) return;
-  outFile << "# EventID ParticleName TrackID ParentID PDGCode\n";
-  for (size_t i = 0; i < trajectoryContainer->size(); ++i) {
-    auto traj = dynamic_cast<AirPetTrajectory *>((*trajectoryContainer)[i]);
-    if (traj) {
-      outFile << "T " << event->GetEventID() << " " << traj->GetParticleName() << " " << traj->GetTrackID() << " " << traj->GetParentID() << " " << traj->GetPDGEncoding() << "\n";
-      for (int j = 0; j < traj->GetPointEntries(); ++j) {
-        G4VTrajectoryPoint *point = traj->GetPoint(j);
-        const G4ThreeVector &pos = point->GetPosition();
-        outFile << pos.x() << " " << pos.y() << " " << pos.z() << "\n";
-      }
+void EventAction::WriteCrystalEdep(G4int eventID, AirPetNtupleBuffer &crystals) {
+  // Sum the deposits of each detector channel in a dense array (channel IDs
+  // are contiguous, see AirPetChannelMap), then write one row per channel
+  // hit. fTouchedChannels remembers which entries to write and reset; the
+  // flag, not the sum, marks them, since a deposit may be 0.
+  for (const AirPetHit *hit : fEventHits) {
+    const G4int channelID = hit->GetChannelID();
+    if (channelID < 0) {
+      // Volume outside the channel map: its hit is written as is.
+      crystals.FillI(0, eventID);
+      crystals.FillI(1, channelID);
+      crystals.FillI(2, hit->GetCopyNo());
+      crystals.FillF(3, hit->GetEdep());
+      crystals.FillF(4, fEventWeight);
+      crystals.AddRow();
+      continue;
+    }
+    if (static_cast<size_t>(channelID) >= fChannelEdep.size()) {
+      fChannelEdep.resize(channelID + 1, 0.);
+      fChannelTouched.resize(channelID + 1, false);
+    }
+    if (!fChannelTouched[channelID]) {
+      fChannelTouched[channelID] = true;
+      fTouchedChannels.push_back(channelID);
     }
+    fChannelEdep[channelID] += hit->GetEdep();
   }
-  outFile.close();
+  const AirPetChannelMap *channelMap = AirPetChannelMap::Instance();
+  for (G4int channelID : fTouchedChannels) {
+    crystals.FillI(0, eventID);
+    crystals.FillI(1, channelID);
+    crystals.FillI(2, channelMap->GetChannel(channelID).copyNo);
+    crystals.FillF(3, fChannelEdep[channelID]);
+    crystals.FillF(4, fEventWeight);
+    crystals.AddRow();
+    fChannelEdep[channelID] = 0.;
+    fChannelTouched[channelID] = false;
+  }
+  fTouchedChannels.clear();
+}
+
+void EventAction::WriteTracksToFile(const G4Event *event, G4int eventID) {
+  AirPetTrackFile::Instance()->WriteEvent(fTrackOutputDir, event, eventID);
 }
@@ -1,13 +1,17 @@
 #include "PrimaryGeneratorAction.hh"
+#include "AirPetAnnihilationSource.hh"
+#include "RunAction.hh"
 
 #include "G4Event.hh"
 #include "G4GeneralParticleSource.hh"
 #include "G4ParticleDefinition.hh"
 #include "G4ParticleTable.hh"
+#include "G4RunManager.hh"
 #include "G4SystemOfUnits.hh"
 
 PrimaryGeneratorAction::PrimaryGeneratorAction()
-    : G4VUserPrimaryGeneratorAction(), fGPS(nullptr) {
+    : G4VUserPrimaryGeneratorAction(), fGPS(nullptr),
+      fAnnihilationSource(nullptr) {
   // Instantiate the General Particle Source
   fGPS = new G4GeneralParticleSource();
 
@@ -35,11 +39,29 @@ PrimaryGeneratorAction::PrimaryGeneratorAction()
 
   // Set default angular distribution (isotropic)
   source->GetAngDist()->SetAngDistType("iso");
+
+  // The /g4pet/source/ commands.
+  fAnnihilationSource = new AirPetAnnihilationSource();
 }
 
-PrimaryGeneratorAction::~PrimaryGeneratorAction() { delete fGPS; }
+PrimaryGeneratorAction::~PrimaryGeneratorAction() {
+  delete fAnnihilationSource;
+  delete fGPS;
+}
 
 void PrimaryGeneratorAction::GeneratePrimaries(G4Event *anEvent) {
+  // With /g4pet/run/seed, the event's random stream depends only on its
+  // global EventID, not on the shard or thread that simulates it.
+  auto *runAction = dynamic_cast<const RunAction *>(G4RunManager::GetRunManager()->GetUserRunAction());
+  if (runAction) runAction->SeedEvent(anEvent->GetEventID());
+  // Events a resumed run already has stay empty.
+  if (runAction && runAction->WasWrittenBefore(runAction->GetGlobalEventID(anEvent->GetEventID()))) return;
+
+  // Back-to-back pairs: GPS only provides the vertex position.
+  if (fAnnihilationSource->IsEnabled()) {
+    fAnnihilationSource->GeneratePrimaryVertex(anEvent, fGPS);
+    return;
+  }
 
   // The G4GeneralParticleSource is configured via UI commands.
   // All we have to do here is tell it to generate the primary vertex.
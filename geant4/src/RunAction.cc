@@ -1,17 +1,122 @@
 #include "RunAction.hh"
+#include "AirPetAnnihilationSource.hh"
+#include "AirPetChannelMap.hh"
+#include "AirPetNameTable.hh"
+#include "AirPetPhotonSD.hh"
+#include "AirPetServer.hh"
+#include "AirPetStackingAction.hh"
+#include "AirPetTrackFile.hh"
 #include "EventAction.hh"
 #include "G4AnalysisManager.hh"
 #include "G4Run.hh"
 #include "G4RunManager.hh"
+#include "G4SDManager.hh"
 #include "G4SystemOfUnits.hh"
 #include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithAnInteger.hh"
 #include "G4UIcommand.hh"
 #include "G4UIdirectory.hh"
+#include "G4UImanager.hh"
 #include "G4UIparameter.hh"
+#include "Randomize.hh"
 
-RunAction::RunAction()
-    : G4UserRunAction(), fSaveParticles(false), fSaveHits(true),
-      fHitEnergyThreshold(0.0) {
+#include <cstdlib>
+#include <set>
+#include <sstream>
+
+namespace {
+  const auto I = AirPetColumnType::kInt32;
+  const auto F = AirPetColumnType::kFloat32;
+  const auto D = AirPetColumnType::kFloat64;
+  const auto S = AirPetColumnType::kString;
+
+  const std::vector<AirPetColumnSpec> kTracksColumns = {
+      {"EventID", I},      {"ParticleName", S}, {"TrackID", I},
+      {"ParentID", I},     {"Mass", F},         {"InitialPosX", F},
+      {"InitialPosY", F},  {"InitialPosZ", F},  {"InitialTime", D},
+      {"FinalPosX", F},    {"FinalPosY", F},    {"FinalPosZ", F},
+      {"FinalTime", D},    {"InitialMomX", F},  {"InitialMomY", F},
+      {"InitialMomZ", F},  {"FinalMomX", F},    {"FinalMomY", F},
+      {"FinalMomZ", F},    {"InitialVolume", S}, {"FinalVolume", S},
+      {"CreatorProcess", S}};
+
+  const std::vector<AirPetColumnSpec> kHitsColumns = {
+      {"EventID", I}, {"CopyNo", I}, {"ParticleID", I}, {"TrackID", I},
+      {"ParentID", I}, {"Edep", F},  {"PosX", F},       {"PosY", F},
+      {"PosZ", F},    {"Time", D},   {"VolumeID", I},   {"PhysicalVolumeID", I},
+      {"ChannelID", I}, {"Weight", F}};
+
+  // Per-event summed energy per detector channel (hitsFormat summed).
+  const std::vector<AirPetColumnSpec> kCrystalEdepColumns = {
+      {"EventID", I}, {"ChannelID", I}, {"CopyNo", I}, {"Edep", F},
+      {"Weight", F}};
+
+  // Detector channels of the geometry (AirPetChannelMap), written once.
+  const std::vector<AirPetColumnSpec> kChannelsColumns = {
+      {"ChannelID", I}, {"CopyNo", I}, {"VolumeID", I}, {"PhysicalVolumeID", I},
+      {"Path", S}};
+
+  // Table: 0 = particle, 1 = logical volume, 2 = physical volume.
+  const std::vector<AirPetColumnSpec> kNamesColumns = {
+      {"Table", I}, {"ID", I}, {"Name", S}};
+
+  // Whether any photodetector SD exists, i.e. the photon ntuples are needed.
+  G4bool HasPhotonDetectors() {
+    G4SDManager *sdManager = G4SDManager::GetSDMpointerIfExist();
+    if (!sdManager) return false;
+    G4HCtable *hcTable = sdManager->GetHCtable();
+    for (G4int i = 0; i < hcTable->entries(); ++i) {
+      if (dynamic_cast<AirPetPhotonSD *>(
+              sdManager->FindSensitiveDetector(hcTable->GetSDname(i), false))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Moves a filled buffer into the batch and replaces it with a recycled
+  // (or new) buffer of the same ntuple.
+  void MoveToBatch(AirPetOutputWriter &writer, AirPetOutputWriter::Batch &batch, G4int ntupleID,
+                   AirPetNtupleBuffer &buffer, size_t chunkRows) {
+    if (ntupleID < 0 || buffer.GetRows() == 0) return;
+    AirPetNtupleBuffer next = writer.TakeFreeBuffer(ntupleID);
+    if (next.GetColumns().empty()) {
+      next.SetColumns(buffer.GetColumns());
+      next.Reserve(chunkRows);
+    }
+    batch.buffers.emplace_back(ntupleID, std::move(buffer));
+    buffer = std::move(next);
+  }
+
+  // SplitMix64 finalizer: decorrelates consecutive seeds and event numbers.
+  std::uint64_t MixSeed(std::uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+  }
+}
+
+RunAction *RunAction::fMasterRunAction = nullptr;
+
+RunAction::RunAction(EventAction *masterEventAction,
+                     AirPetAnnihilationSource *masterSource,
+                     AirPetStackingAction *masterStacking)
+    : G4UserRunAction(), fMasterEventAction(masterEventAction), fMasterSource(masterSource),
+      fMasterStacking(masterStacking),
+      fSaveParticles(false), fSaveHits(true), fHitEnergyThreshold(0.0),
+      fSummedHits(false), fMinHitsPerEvent(0), fMinEventEdep(0.0), fRequireMultipleSDs(false),
+      fCompressionLevel(1), fChunkRows(65536), fOutputQueueDepth(4),
+      fShardIndex(0), fShardCount(1), fGlobalSeed(0), fRunSeed(0), fRunID(0),
+      fFirstEvent(0), fTotalEvents(0), fShardBeamOn(false), fRangeBegin(0), fRangeEnd(0),
+      fCheckpointEvery(0), fResume(false), fResuming(false), fCheckpointGeneration(0),
+      fTracksNtupleID(-1), fHitsNtupleID(-1), fCrystalEdepNtupleID(-1), fNamesNtupleID(-1),
+      fChannelsNtupleID(-1),
+      fLORsNtupleID(-1), fPhotonCountsNtupleID(-1), fPhotonTimesNtupleID(-1),
+      fProfileNtupleID(-1), fStackingNtupleID(-1) {
+  // The analysis manager is no longer used for ntuples, but it still
+  // provides /analysis/setFileName, which generated macros rely on.
   auto analysisManager = G4AnalysisManager::Instance();
   analysisManager->SetDefaultFileType("hdf5");
   analysisManager->SetVerboseLevel(1);
@@ -28,9 +133,83 @@ RunAction::RunAction()
   fHitEnergyThresholdCmd->SetDefaultValue(0.0);
   fHitEnergyThresholdCmd->SetUnitCategory("Energy");
   fHitEnergyThresholdCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fOutputFileCmd = new G4UIcmdWithAString("/g4pet/run/outputFile", this);
+  fOutputFileCmd->SetGuidance("Output HDF5 file (default: /analysis/setFileName, else output.hdf5).");
+  fOutputFileCmd->SetParameterName("filename", false);
+  fOutputFileCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fCompressionCmd = new G4UIcmdWithAnInteger("/g4pet/run/outputCompression", this);
+  fCompressionCmd->SetGuidance("Deflate level of the output datasets (0 = uncompressed).");
+  fCompressionCmd->SetParameterName("level", false);
+  fCompressionCmd->SetRange("level>=0 && level<=9");
+  fCompressionCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fChunkSizeCmd = new G4UIcmdWithAnInteger("/g4pet/run/outputChunkSize", this);
+  fChunkSizeCmd->SetGuidance("Rows buffered per thread before a write (also the HDF5 chunk size).");
+  fChunkSizeCmd->SetParameterName("rows", false);
+  fChunkSizeCmd->SetRange("rows>0");
+  fChunkSizeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fQueueDepthCmd = new G4UIcmdWithAnInteger("/g4pet/run/outputQueueDepth", this);
+  fQueueDepthCmd->SetGuidance("Chunks queued for the background output thread before event threads wait");
+  fQueueDepthCmd->SetGuidance("(default 4; 0 = write on the event threads).");
+  fQueueDepthCmd->SetParameterName("batches", false);
+  fQueueDepthCmd->SetRange("batches>=0");
+  fQueueDepthCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fHitsFormatCmd = new G4UIcmdWithAString("/g4pet/run/hitsFormat", this);
+  fHitsFormatCmd->SetGuidance("hits: one Hits row per hit (default).");
+  fHitsFormatCmd->SetGuidance("summed: one CrystalEdep row (EventID, ChannelID, CopyNo, Edep) per channel and event.");
+  fHitsFormatCmd->SetParameterName("format", false);
+  fHitsFormatCmd->SetCandidates("hits summed");
+  fHitsFormatCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fMinHitsCmd = new G4UIcmdWithAnInteger("/g4pet/run/minHitsPerEvent", this);
+  fMinHitsCmd->SetGuidance("Only write events with at least this many hits above threshold.");
+  fMinHitsCmd->SetParameterName("hits", false);
+  fMinHitsCmd->SetRange("hits>=0");
+  fMinHitsCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fMinEventEdepCmd = new G4UIcmdWithADoubleAndUnit("/g4pet/run/minEventEdep", this);
+  fMinEventEdepCmd->SetGuidance("Only write events whose hits above threshold sum to at least this energy.");
+  fMinEventEdepCmd->SetParameterName("energy", false);
+  fMinEventEdepCmd->SetUnitCategory("Energy");
+  fMinEventEdepCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fRequireMultipleSDsCmd = new G4UIcommand("/g4pet/run/requireMultipleSDs", this);
+  fRequireMultipleSDsCmd->SetGuidance("Only write events with hits in at least two sensitive detectors.");
+  fRequireMultipleSDsCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fRequireMultipleSDsCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fShardCmd = new G4UIcommand("/g4pet/run/shard", this);
+  fShardCmd->SetGuidance("Simulate shard k of N of the events given to /g4pet/run/beamOn.");
+  fShardCmd->SetGuidance("Shards cover contiguous ranges of global EventIDs.");
+  fShardCmd->SetParameter(new G4UIparameter("k", 'i', false));
+  fShardCmd->SetParameter(new G4UIparameter("N", 'i', false));
+  fShardCmd->SetRange("k>=0 && N>0 && k<N");
+  fShardCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fSeedCmd = new G4UIcommand("/g4pet/run/seed", this);
+  fSeedCmd->SetGuidance("Global seed: every event is seeded from (seed, run ID, global EventID),");
+  fSeedCmd->SetGuidance("so results do not depend on sharding or threads (0 = Geant4 seeding).");
+  fSeedCmd->SetParameter(new G4UIparameter("seed", 's', false));
+  fSeedCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fBeamOnCmd = new G4UIcommand("/g4pet/run/beamOn", this);
+  fBeamOnCmd->SetGuidance("Like /run/beamOn, but the count is the total over all shards;");
+  fBeamOnCmd->SetGuidance("only this shard's event range is simulated.");
+  fBeamOnCmd->SetParameter(new G4UIparameter("events", 'i', false));
+  fBeamOnCmd->SetRange("events>=0");
+  fBeamOnCmd->AvailableForStates(G4State_Idle);
+  fBeamOnCmd->SetToBeBroadcasted(false);
+  fCheckpointEveryCmd = new G4UIcmdWithAnInteger("/g4pet/run/checkpointEvery", this);
+  fCheckpointEveryCmd->SetGuidance("Flush the output file and write <output>.checkpoint every N events (0 = off).");
+  fCheckpointEveryCmd->SetParameterName("events", false);
+  fCheckpointEveryCmd->SetRange("events>=0");
+  fCheckpointEveryCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+  fResumeCmd = new G4UIcommand("/g4pet/run/resume", this);
+  fResumeCmd->SetGuidance("Continue the next /g4pet/run/beamOn from <output>.checkpoint, if any:");
+  fResumeCmd->SetGuidance("the output file is kept and only the events it lacks are simulated.");
+  fResumeCmd->SetParameter(new G4UIparameter("value", 'b', true));
+  fResumeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
 }
 
-RunAction::~RunAction() {}
+RunAction::~RunAction() {
+  if (fMasterRunAction == this) fMasterRunAction = nullptr;
+  delete fMasterEventAction;
+  delete fMasterSource;
+  delete fMasterStacking;
+}
 
 void RunAction::SetNewValue(G4UIcommand *command, G4String newValue) {
   if (command == fSaveParticlesCmd) {
@@ -39,59 +218,450 @@ void RunAction::SetNewValue(G4UIcommand *command, G4String newValue) {
     fSaveHits = G4UIcommand::ConvertToBool(newValue);
   } else if (command == fHitEnergyThresholdCmd) {
     fHitEnergyThreshold = fHitEnergyThresholdCmd->GetNewDoubleValue(newValue);
+  } else if (command == fOutputFileCmd) {
+    fOutputFileName = newValue;
+  } else if (command == fCompressionCmd) {
+    fCompressionLevel = fCompressionCmd->GetNewIntValue(newValue);
+  } else if (command == fChunkSizeCmd) {
+    fChunkRows = fChunkSizeCmd->GetNewIntValue(newValue);
+  } else if (command == fQueueDepthCmd) {
+    fOutputQueueDepth = fQueueDepthCmd->GetNewIntValue(newValue);
+  } else if (command == fHitsFormatCmd) {
+    fSummedHits = (newValue == "summed");
+  } else if (command == fMinHitsCmd) {
+    fMinHitsPerEvent = fMinHitsCmd->GetNewIntValue(newValue);
+  } else if (command == fMinEventEdepCmd) {
+    fMinEventEdep = fMinEventEdepCmd->GetNewDoubleValue(newValue);
+  } else if (command == fRequireMultipleSDsCmd) {
+    fRequireMultipleSDs = G4UIcommand::ConvertToBool(newValue);
+  } else if (command == fShardCmd) {
+    std::istringstream is(newValue);
+    is >> fShardIndex >> fShardCount;
+  } else if (command == fSeedCmd) {
+    fGlobalSeed = std::strtoull(newValue.c_str(), nullptr, 10);
+  } else if (command == fBeamOnCmd) {
+    BeamOnShard(G4UIcommand::ConvertToInt(newValue));
+  } else if (command == fCheckpointEveryCmd) {
+    fCheckpointEvery = fCheckpointEveryCmd->GetNewIntValue(newValue);
+  } else if (command == fResumeCmd) {
+    fResume = G4UIcommand::ConvertToBool(newValue);
   }
 }
 
-void RunAction::BeginOfRunAction(const G4Run * /*aRun*/) {
-  auto analysisManager = G4AnalysisManager::Instance();
-  G4cout << "--> RunAction::BeginOfRunAction: Opening output.hdf5" << G4endl;
-  analysisManager->OpenFile("output.hdf5");
-  if (fSaveParticles) {
-    analysisManager->CreateNtuple("Tracks", "Particle Trajectories");
-    analysisManager->CreateNtupleIColumn("EventID");
-    analysisManager->CreateNtupleSColumn("ParticleName");
-    analysisManager->CreateNtupleIColumn("TrackID");
-    analysisManager->CreateNtupleIColumn("ParentID");
-    analysisManager->CreateNtupleDColumn("Mass");
-    analysisManager->CreateNtupleDColumn("InitialPosX");
-    analysisManager->CreateNtupleDColumn("InitialPosY");
-    analysisManager->CreateNtupleDColumn("InitialPosZ");
-    analysisManager->CreateNtupleDColumn("InitialTime");
-    analysisManager->CreateNtupleDColumn("FinalPosX");
-    analysisManager->CreateNtupleDColumn("FinalPosY");
-    analysisManager->CreateNtupleDColumn("FinalPosZ");
-    analysisManager->CreateNtupleDColumn("FinalTime");
-    analysisManager->CreateNtupleDColumn("InitialMomX");
-    analysisManager->CreateNtupleDColumn("InitialMomY");
-    analysisManager->CreateNtupleDColumn("InitialMomZ");
-    analysisManager->CreateNtupleDColumn("FinalMomX");
-    analysisManager->CreateNtupleDColumn("FinalMomY");
-    analysisManager->CreateNtupleDColumn("FinalMomZ");
-    analysisManager->CreateNtupleSColumn("InitialVolume");
-    analysisManager->CreateNtupleSColumn("FinalVolume");
-    analysisManager->CreateNtupleSColumn("CreatorProcess");
-    analysisManager->FinishNtuple(0);
-  }
-  if (fSaveHits) {
-    G4int hits_ntuple_ID = fSaveParticles ? 1 : 0;
-    analysisManager->CreateNtuple("Hits", "Sensitive Detector Hits");
-    analysisManager->CreateNtupleIColumn("EventID");
-    analysisManager->CreateNtupleIColumn("CopyNo");
-    analysisManager->CreateNtupleSColumn("ParticleName");
-    analysisManager->CreateNtupleIColumn("TrackID");
-    analysisManager->CreateNtupleIColumn("ParentID");
-    analysisManager->CreateNtupleDColumn("Edep");
-    analysisManager->CreateNtupleDColumn("PosX");
-    analysisManager->CreateNtupleDColumn("PosY");
-    analysisManager->CreateNtupleDColumn("PosZ");
-    analysisManager->CreateNtupleDColumn("Time");
-    analysisManager->FinishNtuple(hits_ntuple_ID);
-  }
-}
-
-void RunAction::EndOfRunAction(const G4Run * /*aRun*/) {
-  auto analysisManager = G4AnalysisManager::Instance();
+void RunAction::BeamOnShard(G4long totalEvents) {
+  // Integer split, so the N ranges tile [0, totalEvents) exactly.
+  const G4long first = totalEvents * fShardIndex / fShardCount;
+  const G4long end = totalEvents * (fShardIndex + 1) / fShardCount;
+  G4cout << "--> Shard " << fShardIndex << "/" << fShardCount << ": events [" << first
+         << ", " << end << ") of " << totalEvents << G4endl;
+  fFirstEvent = static_cast<G4int>(first);
+  fTotalEvents = totalEvents;
+  fRangeBegin = first;
+  fRangeEnd = end;
+  fResuming = false;
+  if (fResume) {
+    // Events before the written prefix are skipped altogether; the others
+    // the checkpoint already has are simulated empty.
+    const G4String checkpointName = AirPetCheckpoint::FileName(GetOutputFileName());
+    AirPetCheckpoint::State state;
+    if (!AirPetCheckpoint::Read(checkpointName, state)) {
+      G4cout << "--> No checkpoint " << checkpointName << ": starting from the first event" << G4endl;
+    } else if (state.firstEvent != first || state.endEvent != end) {
+      G4Exception("RunAction::BeamOnShard", "AirPet_CheckpointRange", JustWarning,
+                  ("Checkpoint " + checkpointName + " is for events [" + std::to_string(state.firstEvent) +
+                   ", " + std::to_string(state.endEvent) + "); starting over.").c_str());
+    } else if (state.complete) {
+      G4cout << "--> Checkpoint " << checkpointName << ": all events are already written" << G4endl;
+      return;
+    } else {
+      G4cout << "--> Resuming from " << checkpointName << ": events from " << state.writtenPrefix
+             << " of [" << first << ", " << end << ")" << G4endl;
+      fResumeState = state;
+      fResuming = true;
+      fFirstEvent = static_cast<G4int>(state.writtenPrefix);
+    }
+  }
+  fShardBeamOn = true;
+  G4UImanager::GetUIpointer()->ApplyCommand("/run/beamOn " + std::to_string(end - fFirstEvent));
+  fShardBeamOn = false;
+  fResuming = false;
+}
+
+G4bool RunAction::WasWrittenBefore(G4int globalEventID) const {
+  return fMasterRunAction && fMasterRunAction->fResuming &&
+         fMasterRunAction->fCheckpoint.WasWrittenBefore(globalEventID);
+}
+
+void RunAction::SeedEvent(G4int eventID) const {
+  if (fRunSeed == 0) return;
+  std::uint64_t state = MixSeed(fRunSeed);
+  state = MixSeed(state ^ static_cast<std::uint64_t>(fRunID));
+  state = MixSeed(state ^ static_cast<std::uint64_t>(GetGlobalEventID(eventID)));
+  // Two non-zero 31-bit seeds, as all Geant4 engines accept them.
+  long seeds[3] = {static_cast<long>(state & 0x7fffffff) + 1,
+                   static_cast<long>((state >> 32) & 0x7fffffff) + 1, 0};
+  G4Random::setTheSeeds(seeds);
+}
+
+G4String RunAction::GetOutputFileName() const {
+  if (!fOutputFileName.empty()) return fOutputFileName;
+  const G4String &analysisName = G4AnalysisManager::Instance()->GetFileName();
+  return analysisName.empty() ? G4String("output.hdf5") : analysisName;
+}
+
+AirPetOutputFile &RunAction::GetOutputFile() {
+  return fMasterRunAction ? fMasterRunAction->fOutputFile : fOutputFile;
+}
+
+void RunAction::BeginOfRunAction(const G4Run *aRun) {
+  fTracksBuffer.SetColumns({});
+  fHitsBuffer.SetColumns({});
+  fCrystalEdepBuffer.SetColumns({});
+  fLORsBuffer.SetColumns({});
+  fPhotonCountsBuffer.SetColumns({});
+  fPhotonTimesBuffer.SetColumns({});
+  AirPetProfiler::BeginRun(IsMaster());
+  AirPetStackingAction::BeginRun(IsMaster());
+  fScorer.BeginRun();
+
+  if (IsMaster()) {
+    // The master (or the only thread in sequential mode) owns the single
+    // output file. Its BeginOfRunAction runs before any worker starts its
+    // event loop and its EndOfRunAction after all workers have finished, so
+    // workers can append to it for the whole run.
+    fMasterRunAction = this;
+    fRunStartTime = std::chrono::steady_clock::now();
+    fRunID = aRun->GetRunID();
+    if (!fShardBeamOn) {
+      // Plain /run/beamOn: the run is the whole event range.
+      if (fShardCount > 1) {
+        G4Exception("RunAction::BeginOfRunAction", "AirPet_ShardBeamOn", JustWarning,
+                    "Sharded run started with /run/beamOn; use /g4pet/run/beamOn for global EventIDs.");
+      }
+      if (fResume) {
+        G4Exception("RunAction::BeginOfRunAction", "AirPet_ResumeBeamOn", JustWarning,
+                    "/g4pet/run/resume only applies to /g4pet/run/beamOn; starting over.");
+      }
+      fFirstEvent = 0;
+      fTotalEvents = aRun->GetNumberOfEventToBeProcessed();
+      fRangeBegin = 0;
+      fRangeEnd = fTotalEvents;
+      fResuming = false;
+    }
+    fRunSeed = fGlobalSeed;
+    if (fResuming) {
+      // The random streams of the events depend on these two only.
+      fRunID = fResumeState.runID;
+      fRunSeed = fResumeState.seed;
+    } else if (fRunSeed == 0 && fShardCount > 1) {
+      // Without a common seed every shard would repeat the same events.
+      G4Exception("RunAction::BeginOfRunAction", "AirPet_ShardSeed", JustWarning,
+                  "Sharded run without /g4pet/run/seed; using seed 1.");
+      fRunSeed = 1;
+    } else if (fRunSeed == 0 && fCheckpointEvery > 0) {
+      // A resumed run must be able to replay the random stream of any event.
+      fRunSeed = (static_cast<std::uint64_t>(G4UniformRand() * 4294967296.) << 32) |
+                 static_cast<std::uint64_t>(G4UniformRand() * 4294967296.) | 1;
+      G4cout << "--> Checkpointing without /g4pet/run/seed: using seed " << fRunSeed << G4endl;
+    }
+    AirPetServer::RunStarted(aRun->GetNumberOfEventToBeProcessed());
+    G4String fileName = GetOutputFileName();
+    G4cout << "--> RunAction::BeginOfRunAction: Opening " << fileName << G4endl;
+    if (!fOutputFile.Open(fileName, fCompressionLevel, fChunkRows, fResuming) && fResuming) {
+      G4Exception("RunAction::BeginOfRunAction", "AirPet_ResumeFile", RunMustBeAborted,
+                  ("Cannot resume without the output file " + fileName).c_str());
+    }
+
+    fTracksNtupleID = fHitsNtupleID = fCrystalEdepNtupleID = fNamesNtupleID = fChannelsNtupleID = fLORsNtupleID = -1;
+    fPhotonCountsNtupleID = fPhotonTimesNtupleID = fProfileNtupleID = fStackingNtupleID = -1;
+    if (fSaveParticles) fTracksNtupleID = fOutputFile.CreateNtuple("Tracks", kTracksColumns);
+    if (fSaveHits) {
+      if (fSummedHits) {
+        fCrystalEdepNtupleID = fOutputFile.CreateNtuple("CrystalEdep", kCrystalEdepColumns);
+      } else {
+        fHitsNtupleID = fOutputFile.CreateNtuple("Hits", kHitsColumns);
+      }
+      // Lookup table for the integer ID columns, filled once in EndOfRunAction.
+      fNamesNtupleID = fOutputFile.CreateNtuple("Names", kNamesColumns);
+      fChannelsNtupleID = fOutputFile.CreateNtuple("Channels", kChannelsColumns);
+    }
+    if (fSaveHits && HasPhotonDetectors()) {
+      fPhotonCountsNtupleID = fOutputFile.CreateNtuple("PhotonCounts", AirPetOpticalReadout::GetCountColumns());
+      fPhotonTimesNtupleID = fOutputFile.CreateNtuple("PhotonTimes", AirPetOpticalReadout::GetTimeColumns());
+    }
+    if (fDigitizer.IsEnabled()) {
+      fLORsNtupleID = fOutputFile.CreateNtuple("LORs", AirPetDigitizer::GetLORColumns());
+    }
+    if (AirPetProfiler::IsEnabled()) {
+      fProfileNtupleID = fOutputFile.CreateNtuple("Profile", AirPetProfiler::GetProfileColumns());
+    }
+    if (AirPetStackingAction::IsConfigured()) {
+      fStackingNtupleID = fOutputFile.CreateNtuple("Stacking", AirPetStackingAction::GetStackingColumns());
+    }
+
+    AirPetCheckpoint::State state;
+    if (fResuming) {
+      TruncateToCheckpoint();
+      AirPetTrackFile::Instance()->Resume(fResumeState.trackFileSize, fResumeState.trackFileEvents);
+      state = fResumeState;
+      if (fScorer.IsEnabled()) {
+        G4Exception("RunAction::BeginOfRunAction", "AirPet_ResumeScoring", JustWarning,
+                    "Scoring grids of a resumed run only cover the events simulated after the resume.");
+      }
+    } else {
+      state.runID = fRunID;
+      state.seed = fRunSeed;
+      state.firstEvent = fRangeBegin;
+      state.endEvent = fRangeEnd;
+      state.writtenPrefix = fRangeBegin;
+    }
+    fCheckpointFileName = AirPetCheckpoint::FileName(fileName);
+    fCheckpoint.Begin(state, fCheckpointEvery);
+    if (fOutputQueueDepth > 0 && fOutputFile.IsOpen()) {
+      fOutputWriter.Start(&fOutputFile, &fCheckpoint, fCheckpointFileName, fOutputQueueDepth);
+    }
+    fLiveStream.BeginRun(true, fRunID, aRun->GetNumberOfEventToBeProcessed());
+  } else {
+    // Workers use the master's event range and seed.
+    if (fMasterRunAction) {
+      fRunID = fMasterRunAction->fRunID;
+      fRunSeed = fMasterRunAction->fRunSeed;
+      fFirstEvent = fMasterRunAction->fFirstEvent;
+      fTotalEvents = fMasterRunAction->fTotalEvents;
+    }
+    // Workers write into the ntuples booked by the master.
+    fTracksNtupleID = fMasterRunAction ? fMasterRunAction->fTracksNtupleID : -1;
+    fHitsNtupleID = fMasterRunAction ? fMasterRunAction->fHitsNtupleID : -1;
+    fCrystalEdepNtupleID = fMasterRunAction ? fMasterRunAction->fCrystalEdepNtupleID : -1;
+    fNamesNtupleID = fChannelsNtupleID = -1;
+    fLORsNtupleID = fMasterRunAction ? fMasterRunAction->fLORsNtupleID : -1;
+    fPhotonCountsNtupleID = fMasterRunAction ? fMasterRunAction->fPhotonCountsNtupleID : -1;
+    fPhotonTimesNtupleID = fMasterRunAction ? fMasterRunAction->fPhotonTimesNtupleID : -1;
+    fLiveStream.BeginRun(false, fRunID, fTotalEvents);
+  }
+
+  fPendingEvents.clear();
+  fCheckpointGeneration = 0;
+
+  // Buffers only get a schema for booked ntuples; the EventAction skips
+  // buffers without columns.
+  if (fTracksNtupleID >= 0) {
+    fTracksBuffer.SetColumns(kTracksColumns);
+    fTracksBuffer.Reserve(fChunkRows);
+  }
+  if (fHitsNtupleID >= 0) {
+    fHitsBuffer.SetColumns(kHitsColumns);
+    fHitsBuffer.Reserve(fChunkRows);
+  }
+  if (fCrystalEdepNtupleID >= 0) {
+    fCrystalEdepBuffer.SetColumns(kCrystalEdepColumns);
+    fCrystalEdepBuffer.Reserve(fChunkRows);
+  }
+  if (fLORsNtupleID >= 0) {
+    fLORsBuffer.SetColumns(AirPetDigitizer::GetLORColumns());
+    fLORsBuffer.Reserve(fChunkRows);
+  }
+  if (fPhotonCountsNtupleID >= 0) {
+    fPhotonCountsBuffer.SetColumns(AirPetOpticalReadout::GetCountColumns());
+    fPhotonCountsBuffer.Reserve(fChunkRows);
+  }
+  if (fPhotonTimesNtupleID >= 0) {
+    fPhotonTimesBuffer.SetColumns(AirPetOpticalReadout::GetTimeColumns());
+    fPhotonTimesBuffer.Reserve(fChunkRows);
+  }
+}
+
+void RunAction::EndOfEventFlush(G4int eventID) {
+  AirPetCheckpoint *checkpoint =
+      fMasterRunAction && fMasterRunAction->fCheckpoint.IsEnabled() ? &fMasterRunAction->fCheckpoint : nullptr;
+  if (checkpoint) fPendingEvents.push_back(eventID);
+  if (fHitsBuffer.GetRows() >= static_cast<size_t>(fChunkRows) ||
+      fTracksBuffer.GetRows() >= static_cast<size_t>(fChunkRows) ||
+      fCrystalEdepBuffer.GetRows() >= static_cast<size_t>(fChunkRows) ||
+      fLORsBuffer.GetRows() >= static_cast<size_t>(fChunkRows) ||
+      fPhotonCountsBuffer.GetRows() >= static_cast<size_t>(fChunkRows) ||
+      fPhotonTimesBuffer.GetRows() >= static_cast<size_t>(fChunkRows)) {
+    FlushBuffers();
+  }
+  if (!checkpoint) return;
+
+  // Every thread writes its buffered events once per generation, so the
+  // checkpoint is not held back by rows waiting in other threads.
+  const G4int generation = checkpoint->EventFinished();
+  if (generation != fCheckpointGeneration) {
+    fCheckpointGeneration = generation;
+    FlushBuffers(true);
+  }
+}
+
+void RunAction::TruncateToCheckpoint() {
+  // Per-event ntuples go back to their rows at the checkpoint; anything
+  // after it belongs to events that are simulated again. The run summaries
+  // (Names, Channels, Profile, Stacking) are written anew at the end.
+  const std::set<G4int> perEvent = {fTracksNtupleID, fHitsNtupleID, fCrystalEdepNtupleID,
+                                    fLORsNtupleID, fPhotonCountsNtupleID, fPhotonTimesNtupleID};
+  for (G4int id = 0; id < fOutputFile.GetNumberOfNtuples(); ++id) {
+    size_t rows = 0;
+    if (perEvent.count(id)) {
+      for (const auto &ntuple : fResumeState.ntupleRows) {
+        if (ntuple.first == fOutputFile.GetNtupleName(id)) rows = ntuple.second;
+      }
+    }
+    fOutputFile.Truncate(id, rows);
+  }
+}
+
+void RunAction::FlushBuffers(G4bool saveCheckpoint) {
+  // Each flush happens at an event boundary, so the rows of one event always
+  // stay contiguous even though chunks from different threads interleave.
+  // EventIDs are handed out by the master and are already globally unique.
+  AirPetOutputWriter *writer =
+      fMasterRunAction && fMasterRunAction->fOutputWriter.IsRunning() ? &fMasterRunAction->fOutputWriter : nullptr;
+  AirPetProfileScope profile(writer ? AirPetProfiler::kOutputQueue : AirPetProfiler::kOutputWrite);
+  AirPetCheckpoint *checkpoint =
+      fMasterRunAction && fMasterRunAction->fCheckpoint.IsEnabled() ? &fMasterRunAction->fCheckpoint : nullptr;
+
+  if (writer) {
+    // The buffers are moved, not copied; the I/O thread writes them in
+    // queue order, with the checkpoint if requested.
+    AirPetOutputWriter::Batch batch;
+    MoveToBatch(*writer, batch, fTracksNtupleID, fTracksBuffer, fChunkRows);
+    MoveToBatch(*writer, batch, fHitsNtupleID, fHitsBuffer, fChunkRows);
+    MoveToBatch(*writer, batch, fCrystalEdepNtupleID, fCrystalEdepBuffer, fChunkRows);
+    MoveToBatch(*writer, batch, fLORsNtupleID, fLORsBuffer, fChunkRows);
+    MoveToBatch(*writer, batch, fPhotonCountsNtupleID, fPhotonCountsBuffer, fChunkRows);
+    MoveToBatch(*writer, batch, fPhotonTimesNtupleID, fPhotonTimesBuffer, fChunkRows);
+    // Rows of unbooked ntuples are dropped, as AppendRows would.
+    fTracksBuffer.Clear();
+    fHitsBuffer.Clear();
+    fCrystalEdepBuffer.Clear();
+    fLORsBuffer.Clear();
+    fPhotonCountsBuffer.Clear();
+    fPhotonTimesBuffer.Clear();
+    batch.events.swap(fPendingEvents);
+    batch.saveCheckpoint = saveCheckpoint && checkpoint;
+    if (!batch.buffers.empty() || !batch.events.empty() || batch.saveCheckpoint) writer->Push(std::move(batch));
+    return;
+  }
+
+  AirPetOutputFile &outputFile = GetOutputFile();
+  auto write = [&]() {
+    outputFile.AppendRows(fTracksNtupleID, fTracksBuffer);
+    fTracksBuffer.Clear();
+    outputFile.AppendRows(fHitsNtupleID, fHitsBuffer);
+    fHitsBuffer.Clear();
+    outputFile.AppendRows(fCrystalEdepNtupleID, fCrystalEdepBuffer);
+    fCrystalEdepBuffer.Clear();
+    outputFile.AppendRows(fLORsNtupleID, fLORsBuffer);
+    fLORsBuffer.Clear();
+    outputFile.AppendRows(fPhotonCountsNtupleID, fPhotonCountsBuffer);
+    fPhotonCountsBuffer.Clear();
+    outputFile.AppendRows(fPhotonTimesNtupleID, fPhotonTimesBuffer);
+    fPhotonTimesBuffer.Clear();
+  };
+  // With checkpoints, the rows and the events they complete are recorded
+  // together.
+  if (checkpoint) {
+    checkpoint->Append(write, fPendingEvents);
+    if (saveCheckpoint) checkpoint->Save(fMasterRunAction->fOutputFile, fMasterRunAction->fCheckpointFileName);
+  } else {
+    write();
+  }
+}
+
+void RunAction::EndOfRunAction(const G4Run *aRun) {
+  FlushBuffers();
+  AirPetProfiler::MergeThread();
+  AirPetStackingAction::MergeThread();
+  AirPetLiveStream::MergeThread();
+  fScorer.EndRun();
+  if (!IsMaster()) {
+    if (fMasterRunAction) fScorer.MergeInto(fMasterRunAction->fScorer);
+    return;
+  }
+
+  // All threads have queued their last rows; the summaries below are
+  // written directly.
+  const G4bool asyncOutput = fOutputWriter.IsRunning();
+  fOutputWriter.Stop();
+  fLiveStream.EndRun();
+
+  const G4double seconds =
+      std::chrono::duration<G4double>(std::chrono::steady_clock::now() - fRunStartTime).count();
+  G4cout << "--> Run " << aRun->GetRunID() << " finished: " << aRun->GetNumberOfEvent()
+         << " events in " << seconds << " s" << G4endl;
   G4cout << "--> RunAction::EndOfRunAction: Writing and Closing..." << G4endl;
-  analysisManager->Write();
-  analysisManager->CloseFile();
+  WriteChannelMap();
+  WriteNameTable();
+  WriteProfile();
+  WriteStacking();
+  WriteShardManifest(aRun);
+  if (fDigitizer.IsEnabled()) fDigitizer.WriteSettings(fOutputFile);
+  if (asyncOutput) fOutputFile.WriteAttributes("output_writer", fOutputWriter.GetStatistics());
+  fScorer.Write(fOutputFile);
+  // Complete unless the run was aborted; a resume then continues it.
+  if (fCheckpoint.IsEnabled()) fCheckpoint.Save(fOutputFile, fCheckpointFileName);
+  fOutputFile.Close();
+  AirPetTrackFile::Instance()->Close();
+}
+
+void RunAction::WriteShardManifest(const G4Run *aRun) {
+  // Lets the merge step check that the shards of a run tile its events.
+  // A resumed run counts the events of the run it continues.
+  fOutputFile.WriteAttributes("shard", {{"shard_index", fShardIndex},
+                                        {"shard_count", fShardCount},
+                                        {"first_event", fRangeBegin},
+                                        {"end_event", fFirstEvent + aRun->GetNumberOfEventToBeProcessed()},
+                                        {"total_events", fTotalEvents},
+                                        {"events_processed", (fFirstEvent - fRangeBegin) + aRun->GetNumberOfEvent()},
+                                        {"run_id", fRunID},
+                                        {"seed", static_cast<G4long>(fRunSeed)}});
+}
+
+void RunAction::WriteProfile() {
+  // Workers have all merged their counters by the time the master ends the run.
+  AirPetNtupleBuffer buffer;
+  if (fProfileNtupleID >= 0) buffer.SetColumns(AirPetProfiler::GetProfileColumns());
+  AirPetProfiler::Report(buffer);
+  fOutputFile.AppendRows(fProfileNtupleID, buffer);
+}
+
+void RunAction::WriteStacking() {
+  AirPetNtupleBuffer buffer;
+  if (fStackingNtupleID >= 0) buffer.SetColumns(AirPetStackingAction::GetStackingColumns());
+  AirPetStackingAction::Report(buffer);
+  fOutputFile.AppendRows(fStackingNtupleID, buffer);
+}
+
+void RunAction::WriteChannelMap() {
+  if (fChannelsNtupleID < 0) return;
+  // The master's map has the same numbering as those of the workers.
+  auto channelMap = AirPetChannelMap::Instance();
+  AirPetNtupleBuffer buffer(kChannelsColumns);
+  for (size_t id = 0; id < channelMap->GetNumberOfChannels(); ++id) {
+    const auto &channel = channelMap->GetChannel(static_cast<G4int>(id));
+    buffer.FillI(0, static_cast<G4int>(id));
+    buffer.FillI(1, channel.copyNo);
+    buffer.FillI(2, channel.logicalVolumeID);
+    buffer.FillI(3, channel.physicalVolumeID);
+    buffer.FillS(4, channelMap->GetPath(static_cast<G4int>(id)));
+    buffer.AddRow();
+  }
+  fOutputFile.AppendRows(fChannelsNtupleID, buffer);
+}
+
+void RunAction::WriteNameTable() {
+  if (fNamesNtupleID < 0) return;
+  auto nameTable = AirPetNameTable::Instance();
+  AirPetNtupleBuffer buffer(kNamesColumns);
+  for (G4int table = 0; table < AirPetNameTable::kNumCategories; ++table) {
+    const auto names = nameTable->GetNames(static_cast<AirPetNameTable::Category>(table));
+    for (size_t id = 0; id < names.size(); ++id) {
+      buffer.FillI(0, table);
+      buffer.FillI(1, static_cast<G4int>(id));
+      buffer.FillS(2, names[id]);
+      buffer.AddRow();
+    }
+  }
+  fOutputFile.AppendRows(fNamesNtupleID, buffer);
 }
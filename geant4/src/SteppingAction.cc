@@ -1,12 +1,19 @@
 #include "SteppingAction.hh"
+#include "EventAction.hh"
+#include "AirPetProfiler.hh"
+#include "AirPetScorer.hh"
 #include "AirPetUserTrackInformation.hh"
 
+#include "G4LogicalVolume.hh"
+#include "G4OpticalPhoton.hh"
 #include "G4Step.hh"
 #include "G4Track.hh"
+#include "G4VPhysicalVolume.hh"
 #include "G4RunManager.hh"
 
-SteppingAction::SteppingAction()
- : G4UserSteppingAction()
+SteppingAction::SteppingAction(const EventAction* eventAction)
+ : G4UserSteppingAction(),
+   fEventAction(eventAction)
 {}
 
 SteppingAction::~SteppingAction()
@@ -14,6 +21,25 @@ SteppingAction::~SteppingAction()
 
 void SteppingAction::UserSteppingAction(const G4Step* step)
 {
+  AirPetProfileScope profile(AirPetProfiler::kStepping);
+
+  // Voxel scoring of every step in the selected volumes (/g4pet/score/)
+  AirPetScorer* scorer = AirPetScorer::GetActive();
+  if (scorer && !scorer->ScoresSensitiveDetectors() &&
+      scorer->ScoresVolume(step->GetPreStepPoint()->GetPhysicalVolume()->GetLogicalVolume())) {
+    scorer->AddStep(step);
+  }
+
+  // Parent momenta are only read into trajectories; skip the bookkeeping
+  // when this event records none or the feature is switched off.
+  if (!fEventAction->GetStoreParentMomentum()) return;
+
+  // On the optical fast path, photons and their secondaries (e.g. from
+  // wavelength shifting) carry no user information.
+  const G4ParticleDefinition* opticalPhoton = G4OpticalPhoton::Definition();
+  const G4bool opticalFastPath = fEventAction->GetOpticalFastPath();
+  if (opticalFastPath && step->GetTrack()->GetDefinition() == opticalPhoton) return;
+
   // Get the list of secondary particles created in this step
   const std::vector<const G4Track*>* secondaries = step->GetSecondaryInCurrentStep();
 
@@ -24,6 +50,8 @@ void SteppingAction::UserSteppingAction(const G4Step* step)
 
     // Loop over all newly created secondary tracks
     for (const auto& secondaryTrack : *secondaries) {
+      if (opticalFastPath && secondaryTrack->GetDefinition() == opticalPhoton) continue;
+
       // Create a new user information object
       auto* userInfo = new AirPetUserTrackInformation();
       userInfo->SetParentMomentum(parentMomentum);
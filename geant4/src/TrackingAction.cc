@@ -1,12 +1,16 @@
 #include "TrackingAction.hh"
+#include "EventAction.hh"
+#include "AirPetProfiler.hh"
 #include "AirPetTrajectory.hh"
 #include "AirPetUserTrackInformation.hh"
 
+#include "G4OpticalPhoton.hh"
 #include "G4TrackingManager.hh"
 #include "G4Track.hh"
 
-TrackingAction::TrackingAction()
- : G4UserTrackingAction()
+TrackingAction::TrackingAction(const EventAction* eventAction)
+ : G4UserTrackingAction(),
+   fEventAction(eventAction)
 {}
 
 TrackingAction::~TrackingAction()
@@ -14,10 +18,24 @@ TrackingAction::~TrackingAction()
 
 void TrackingAction::PreUserTrackingAction(const G4Track* aTrack)
 {
+  AirPetProfileScope profile(AirPetProfiler::kPreTracking);
+
+  // Nothing downstream consumes trajectories for this event: do not let the
+  // tracking manager build one either.
+  // Optical photons on the fast path are never recorded either.
+  TrajectoryMode mode = fEventAction->GetTrajectoryMode();
+  if (mode == TrajectoryMode::kNone ||
+      (aTrack->GetDefinition() == G4OpticalPhoton::Definition() &&
+       fEventAction->GetOpticalFastPath())) {
+    fpTrackingManager->SetStoreTrajectory(false);
+    return;
+  }
+
   // Tell the tracking manager to use our custom trajectory class.
-  // This is only done once per track.
+  // This is only done once per track. Summary trajectories skip the
+  // per-step point list.
   fpTrackingManager->SetStoreTrajectory(true);
-  fpTrackingManager->SetTrajectory(new AirPetTrajectory(aTrack));
+  fpTrackingManager->SetTrajectory(new AirPetTrajectory(aTrack, mode == TrajectoryMode::kFull));
 
   // Check if this track has custom user information attached.
   // This information (parent momentum) would have been attached by the SteppingAction
@@ -34,6 +52,8 @@ void TrackingAction::PreUserTrackingAction(const G4Track* aTrack)
 
 void TrackingAction::PostUserTrackingAction(const G4Track* aTrack)
 {
+  AirPetProfileScope profile(AirPetProfiler::kPostTracking);
+
   // This method is called after a track has been fully simulated.
   // We can now retrieve the completed trajectory and fill in the final details.
 
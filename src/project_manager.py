@@ -3277,6 +3277,9 @@ class ProjectManager:
         macro_content.append("\n# --- Random Seed ---")
         if seed1 > 0 and seed2 > 0:
             macro_content.append(f"/random/setSeeds {seed1} {seed2}")
+            # Per-event seeding: the same events come out for any number of
+            # threads or shards (airpet-sim --shard k/N).
+            macro_content.append(f"/g4pet/run/seed {(seed1 << 32) | (seed2 & 0xffffffff)}")
         else:
             macro_content.append("# Using default/random seeds")
 
@@ -3291,13 +3294,52 @@ class ProjectManager:
             for lv in sensitive_lvs:
                 sd_name = f"{lv.name}_SD" # Automatic naming
                 macro_content.append(f"/g4pet/detector/addSD {lv.name} {sd_name}")
+
+        # Photodetectors count optical photons instead of recording energy
+        for lv_name in sim_params.get('photon_detectors', []):
+            macro_content.append(f"/g4pet/detector/addPhotonSD {lv_name} {lv_name}_PhotonSD")
+
+        # Regions with their own production cuts and step limits, e.g.
+        # {'name': 'Phantom', 'volumes': ['Water'], 'cut_mm': 1.0, 'max_step_mm': 0}
+        for region in sim_params.get('regions', []):
+            for lv_name in region.get('volumes', []):
+                macro_content.append(f"/g4pet/detector/addRegion {region['name']} {lv_name}")
+            if region.get('cut_mm'):
+                macro_content.append(f"/g4pet/detector/setRegionCut {region['name']} {region['cut_mm']} mm")
+            for particle, cut_mm in region.get('cuts_mm', {}).items():
+                macro_content.append(f"/g4pet/detector/setRegionCut {region['name']} {cut_mm} mm {particle}")
+            if region.get('max_step_mm'):
+                macro_content.append(f"/g4pet/detector/setRegionStepLimit {region['name']} {region['max_step_mm']} mm")
+
+        # Optional local deposit of electrons in the SD crystals, e.g.
+        # {'max_energy_kev': 0, 'contained_only': True}; omit for full simulation
+        fast_sim = sim_params.get('fast_sim')
+        if fast_sim:
+            macro_content.append("/g4pet/detector/setFastSim true")
+            if fast_sim.get('max_energy_kev'):
+                macro_content.append(f"/g4pet/detector/setFastSimMaxEnergy {fast_sim['max_energy_kev']} keV")
+            if 'contained_only' in fast_sim:
+                macro_content.append(f"/g4pet/detector/setFastSimContainedOnly {str(bool(fast_sim['contained_only'])).lower()}")
         
         macro_content.append("")
 
         # --- Load Geometry ---
         macro_content.append(f"/g4pet/detector/readFile geometry.gdml")
+        # Overlap checks are off unless requested; a passed check is cached per
+        # GDML content hash for all runs of this version.
+        if sim_params.get('check_overlaps', False):
+            cache_dir = os.path.join(version_dir, "geometry_cache")
+            os.makedirs(cache_dir, exist_ok=True)
+            macro_content.append(f"/g4pet/detector/geometryCacheDir {cache_dir}")
+            macro_content.append("/g4pet/detector/checkOverlaps true")
         macro_content.append("")
 
+        # --- Threads (only honoured by the MT/tasking run managers) ---
+        num_threads = int(sim_params.get('threads', 1))
+        if num_threads > 1:
+            macro_content.append(f"/run/numberOfThreads {num_threads}")
+            macro_content.append("")
+
         # --- Initialize ---
         macro_content.append("/run/initialize")
         macro_content.append("")
@@ -3317,6 +3359,79 @@ class ProjectManager:
         # Default Hit Energy Threshold to reduce file size
         hit_threshold = sim_params.get('hit_energy_threshold', '400 keV')
         macro_content.append(f"/g4pet/run/hitEnergyThreshold {hit_threshold}")
+
+        # Optional compact output and event-level keep/drop policy
+        if sim_params.get('hits_format') in ('hits', 'summed'):
+            macro_content.append(f"/g4pet/run/hitsFormat {sim_params['hits_format']}")
+        event_filter = sim_params.get('event_filter')
+        if event_filter:
+            if event_filter.get('min_hits'):
+                macro_content.append(f"/g4pet/run/minHitsPerEvent {int(event_filter['min_hits'])}")
+            if event_filter.get('min_edep_kev'):
+                macro_content.append(f"/g4pet/run/minEventEdep {event_filter['min_edep_kev']} keV")
+            if event_filter.get('require_multiple_sds'):
+                macro_content.append("/g4pet/run/requireMultipleSDs true")
+
+        # Live hit/LOR summaries for the web UI (/api/simulation/live), on by default
+        if sim_params.get('live_stream', True):
+            macro_content.append(f"/g4pet/live/file {os.path.abspath(os.path.join(run_dir, 'live.bin'))}")
+
+        # Optional periodic checkpoints, for airpet-sim --resume
+        if sim_params.get('checkpoint_every'):
+            macro_content.append(f"/g4pet/run/checkpointEvery {int(sim_params['checkpoint_every'])}")
+
+        # Optional in-simulation coincidence sorting (writes the LORs ntuple)
+        digi = sim_params.get('digitize')
+        if digi:
+            pos_res = digi.get('position_resolution', {'x': 0.0, 'y': 0.0, 'z': 0.0})
+            macro_content.append("/g4pet/digi/enable true")
+            macro_content.append(f"/g4pet/digi/energyResolution {digi.get('energy_resolution', 0.0)}")
+            macro_content.append(f"/g4pet/digi/positionResolution {pos_res.get('x', 0.0)} {pos_res.get('y', 0.0)} {pos_res.get('z', 0.0)} mm")
+            macro_content.append(f"/g4pet/digi/energyCut {digi.get('energy_cut', 0.0)} MeV")
+            macro_content.append(f"/g4pet/digi/coincidenceWindow {digi.get('coincidence_window_ns', 4.0)} ns")
+
+        # Optional voxel scoring of the deposited energy (/scoring/Edep)
+        score = sim_params.get('scoring')
+        if score:
+            origin = score.get('origin', [0.0, 0.0, 0.0])
+            voxel = score.get('voxel_size', [1.0, 1.0, 1.0])
+            shape = score.get('shape', [1, 1, 1])
+            macro_content.append("/g4pet/score/enable true")
+            macro_content.append(f"/g4pet/score/origin {origin[0]} {origin[1]} {origin[2]} mm")
+            macro_content.append(f"/g4pet/score/voxelSize {voxel[0]} {voxel[1]} {voxel[2]} mm")
+            macro_content.append(f"/g4pet/score/shape {int(shape[0])} {int(shape[1])} {int(shape[2])}")
+            for lv_name in score.get('volumes', []):
+                macro_content.append(f"/g4pet/score/addVolume {lv_name}")
+
+        # Optional back-to-back 511 keV source at the GPS positions
+        pet_source = sim_params.get('pet_source')
+        if pet_source:
+            macro_content.append("/g4pet/source/type annihilation")
+            if pet_source.get('acolinearity_deg'):
+                macro_content.append(f"/g4pet/source/acolinearity {pet_source['acolinearity_deg']} deg")
+            if pet_source.get('acceptance_cos_theta'):
+                axis = pet_source.get('axis', [0.0, 0.0, 1.0])
+                macro_content.append(f"/g4pet/source/acceptanceCosTheta {pet_source['acceptance_cos_theta']}")
+                macro_content.append(f"/g4pet/source/acceptanceAxis {axis[0]} {axis[1]} {axis[2]}")
+
+        # Optional stacking rules, e.g. {'kill_particles': ['nu_e', 'anti_nu_e'],
+        # 'kill_below': [{'particle': 'e-', 'energy_keV': 100, 'volume': 'nonSD'}],
+        # 'kill_unreachable': True}
+        stacking = sim_params.get('stacking')
+        if stacking:
+            for particle in stacking.get('kill_particles', []):
+                macro_content.append(f"/g4pet/stack/killParticle {particle}")
+            for rule in stacking.get('kill_below', []):
+                macro_content.append(f"/g4pet/stack/killBelow {rule['particle']} {rule['energy_keV']} keV "
+                                     f"{rule.get('volume', 'nonSD')}")
+            if stacking.get('reach_margin_mm') is not None:
+                macro_content.append(f"/g4pet/stack/reachMargin {stacking['reach_margin_mm']} mm")
+            if stacking.get('kill_unreachable'):
+                macro_content.append("/g4pet/stack/killUnreachable true")
+            if stacking.get('defer_unreachable'):
+                macro_content.append("/g4pet/stack/deferUnreachable true")
+            if stacking.get('abort_without_hits'):
+                macro_content.append("/g4pet/stack/abortWithoutHits true")
         macro_content.append("")
 
         # --- ADD VERBOSITY FOR DEBUGGING ---
@@ -3461,7 +3576,8 @@ class ProjectManager:
         # --- Run Beam On ---
         num_events = sim_params.get('events', 1)
         macro_content.append("\n# --- Start Simulation ---")
-        macro_content.append(f"/run/beamOn {num_events}")
+        # The total over all shards; unsharded runs simulate all of it.
+        macro_content.append(f"/g4pet/run/beamOn {num_events}")
 
         # 3. Write the macro file
         with open(macro_path, 'w') as f: